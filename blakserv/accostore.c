@@ -0,0 +1,408 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * accostore.c
+ *
+
+ This module keeps the accounts in one binary file, the account store,
+ in the load/save directory.  The file is a short header followed by a
+ log of records, each an account_store_record followed by the account's
+ name and password.  A save appends a delete record for each account
+ deleted since the last save, a record for each account that changed
+ (account.c keeps track of both), and then a save record with the save's
+ time stamp.  Nothing already in the file is rewritten, so a save costs
+ only what changed.
+
+ Loading maps the file and replays it up to the save record with the
+ time stamp from the control file.  Anything after that record was
+ written by a save that didn't finish, so it's ignored, and the next
+ save rewrites the store.
+
+ Once the log holds more than [Save] AccountCompact records for each
+ live account, the next save compacts it: every account is written to a
+ new file with a single save record.  That file only replaces the store
+ in CommitAccountStore(), once the control file names the new save, so
+ until then the store still has the save the control file names, and a
+ save that fails partway or a crash leaves it alone.  Older save records
+ are gone after a compaction, so loading an older save falls back on
+ that save's text account file (saveacco.c, loadacco.c), which is
+ written unless [Save] AccountText is off.
+
+ */
+
+#include "blakserv.h"
+
+#define ACCOUNT_STORE_MAGIC "M59A"
+#define ACCOUNT_STORE_MAGIC_LEN 4
+#define ACCOUNT_STORE_HEADER_LEN (ACCOUNT_STORE_MAGIC_LEN + 4)
+
+/* longer than any name or password, for checking records as they're read */
+#define ACCOUNT_STORE_MAX_STRING 1024
+
+static int store_records;
+static int store_last_written;
+static int store_compactions;
+
+/* the file doesn't end with the last save, so write all of it next time */
+static Bool store_rewrite = True;
+
+/* a compacted store is waiting in the .new file for CommitAccountStore() */
+static Bool store_compact_pending;
+
+static FILE *storefile;
+static int store_written;
+static Bool store_write_ok;
+
+/* local function prototypes */
+void GetAccountStoreFilename(char *fname);
+void GetNewAccountStoreFilename(char *fname);
+char * GetAccountStoreRecord(char *ptr,char *end,account_store_record *r);
+Bool CompactAccountStore(INT64 save_time);
+void WriteAccountStoreHeader(void);
+void WriteAccountStoreRecord(account_store_record *r,const char *name,const char *password);
+void WriteAccountRecord(account_node *a);
+void WriteDirtyAccountRecord(account_node *a);
+void WriteDeleteAccountRecord(int account_id);
+void WriteSaveRecord(INT64 save_time);
+
+void GetAccountStoreFilename(char *fname)
+{
+   sprintf(fname,"%s%s",ConfigStr(PATH_LOADSAVE),ACCOUNT_STORE_FILE);
+}
+
+void GetNewAccountStoreFilename(char *fname)
+{
+   sprintf(fname,"%s%s.new",ConfigStr(PATH_LOADSAVE),ACCOUNT_STORE_FILE);
+}
+
+Bool AccountStoreExists(void)
+{
+   char fname[MAX_PATH+FILENAME_MAX];
+   struct stat st;
+
+   GetAccountStoreFilename(fname);
+   return stat(fname,&st) == 0;
+}
+
+/* GetAccountStoreRecord
+*
+* Copies out the record at ptr and returns where the next one starts, or
+* NULL if there isn't a whole, sensible record there.
+*/
+char * GetAccountStoreRecord(char *ptr,char *end,account_store_record *r)
+{
+   if (end - ptr < (int)sizeof(account_store_record))
+      return NULL;
+   memcpy(r,ptr,sizeof(account_store_record));
+
+   if (r->kind < ACCOUNT_RECORD_PUT || r->kind > ACCOUNT_RECORD_SAVE ||
+       r->len_name < 0 || r->len_name > ACCOUNT_STORE_MAX_STRING ||
+       r->len_password < 0 || r->len_password > ACCOUNT_STORE_MAX_STRING)
+      return NULL;
+
+   ptr += sizeof(account_store_record);
+   if (end - ptr < r->len_name + r->len_password)
+      return NULL;
+   return ptr + r->len_name + r->len_password;
+}
+
+/* LoadAccountStore
+*
+* Loads the accounts as they were at the save with time stamp save_time.
+* Returns False, having loaded nothing, if there's no store or it doesn't
+* have that save.
+*/
+Bool LoadAccountStore(INT64 save_time)
+{
+   char fname[MAX_PATH+FILENAME_MAX];
+   char name[ACCOUNT_STORE_MAX_STRING+1],password[ACCOUNT_STORE_MAX_STRING+1];
+   char *mem,*ptr,*next,*end,*replay_end;
+   int length,version,num_records,next_account_id;
+   account_store_record r;
+
+   GetAccountStoreFilename(fname);
+   if (!MapFile(fname,&mem,&length))
+      return False;
+
+   if (length < ACCOUNT_STORE_HEADER_LEN ||
+       memcmp(mem,ACCOUNT_STORE_MAGIC,ACCOUNT_STORE_MAGIC_LEN) != 0)
+   {
+      eprintf("LoadAccountStore %s is not an account store\n",fname);
+      UnmapFile(mem,length);
+      return False;
+   }
+   memcpy(&version,mem + ACCOUNT_STORE_MAGIC_LEN,4);
+   if (version != ACCOUNT_STORE_VERSION)
+   {
+      eprintf("LoadAccountStore %s is version %i, not %i\n",fname,version,
+	      ACCOUNT_STORE_VERSION);
+      UnmapFile(mem,length);
+      return False;
+   }
+
+   /* find the end of the last save record for this save */
+   end = mem + length;
+   replay_end = NULL;
+   for (ptr = mem + ACCOUNT_STORE_HEADER_LEN; ptr < end; ptr = next)
+   {
+      next = GetAccountStoreRecord(ptr,end,&r);
+      if (next == NULL)
+	 break;
+      if (r.kind == ACCOUNT_RECORD_SAVE && r.last_login_time == save_time)
+	 replay_end = next;
+   }
+
+   if (replay_end == NULL)
+   {
+      lprintf("LoadAccountStore %s has no save at time %lli\n",fname,(long long)save_time);
+      UnmapFile(mem,length);
+      return False;
+   }
+
+   num_records = 0;
+   next_account_id = -1;
+   for (ptr = mem + ACCOUNT_STORE_HEADER_LEN; ptr < replay_end; ptr = next)
+   {
+      next = GetAccountStoreRecord(ptr,end,&r);
+      switch (r.kind)
+      {
+      case ACCOUNT_RECORD_PUT :
+	 ptr += sizeof(account_store_record);
+	 memcpy(name,ptr,r.len_name);
+	 name[r.len_name] = 0;
+	 memcpy(password,ptr + r.len_name,r.len_password);
+	 password[r.len_password] = 0;
+	 LoadAccount(r.account_id,name,password,r.type,r.last_login_time,
+		     r.suspend_time,r.credits);
+	 num_records++;
+	 break;
+
+      case ACCOUNT_RECORD_DELETE :
+	 DeleteAccount(r.account_id);
+	 num_records++;
+	 break;
+
+      case ACCOUNT_RECORD_SAVE :
+	 next_account_id = r.account_id;
+	 break;
+      }
+   }
+
+   store_rewrite = (replay_end != end);
+   UnmapFile(mem,length);
+
+   /* the deletes we just replayed are already in the store */
+   ClearAccountChanges();
+
+   if (GetNextAccountID() > next_account_id)
+      next_account_id = GetNextAccountID();
+   SetNextAccountID(next_account_id);
+
+   store_records = num_records;
+   lprintf("LoadAccountStore loaded %i accounts from %i records in %s\n",
+	   GetNumAccounts(),num_records,fname);
+   if (store_rewrite)
+      lprintf("LoadAccountStore ignoring records after the save, will rewrite %s\n",fname);
+
+   return True;
+}
+
+/* SaveAccountStore
+*
+* Appends what changed since the last save, or compacts the store if the
+* log has grown too long or doesn't end with the last save.  Either way,
+* call CommitAccountStore() once the control file names save_time.
+*/
+Bool SaveAccountStore(INT64 save_time)
+{
+   char fname[MAX_PATH+FILENAME_MAX];
+
+   if (store_rewrite ||
+       store_records > ConfigInt(SAVE_ACCOUNT_COMPACT)*std::max(GetNumAccounts(),1))
+      return CompactAccountStore(save_time);
+
+   GetAccountStoreFilename(fname);
+   if ((storefile = fopen(fname,"ab")) == NULL)
+   {
+      eprintf("SaveAccountStore can't open %s to save accounts!\n",fname);
+      return False;
+   }
+
+   store_written = 0;
+   store_write_ok = True;
+
+   /* deletes first, in case an account number was deleted and reused */
+   ForEachDeletedAccount(WriteDeleteAccountRecord);
+   ForEachAccount(WriteDirtyAccountRecord);
+   WriteSaveRecord(save_time);
+
+   if (fclose(storefile) != 0)
+      store_write_ok = False;
+
+   if (!store_write_ok)
+   {
+      eprintf("SaveAccountStore error writing %s\n",fname);
+      store_rewrite = True;
+      return False;
+   }
+
+   store_records += store_written;
+   store_last_written = store_written;
+   ClearAccountChanges();
+
+   return True;
+}
+
+/* CompactAccountStore
+*
+* Writes every account and a save record for save_time to the .new file,
+* for CommitAccountStore() to put in place of the store.
+*/
+Bool CompactAccountStore(INT64 save_time)
+{
+   char new_fname[MAX_PATH+FILENAME_MAX];
+
+   GetNewAccountStoreFilename(new_fname);
+   if ((storefile = fopen(new_fname,"wb")) == NULL)
+   {
+      eprintf("CompactAccountStore can't open %s to save accounts!\n",new_fname);
+      return False;
+   }
+
+   store_written = 0;
+   store_write_ok = True;
+
+   WriteAccountStoreHeader();
+   ForEachAccount(WriteAccountRecord);
+   WriteSaveRecord(save_time);
+
+   if (fclose(storefile) != 0)
+      store_write_ok = False;
+
+   if (!store_write_ok)
+   {
+      eprintf("CompactAccountStore error writing %s\n",new_fname);
+      unlink(new_fname);
+      return False;
+   }
+
+   store_compact_pending = True;
+   return True;
+}
+
+/* CommitAccountStore
+*
+* Called once the save is over.  If it went through and the control file
+* names it, a compacted store replaces the old one; otherwise the old
+* store, which still has the save the control file names, is kept and
+* the compaction is tried again next save.
+*/
+void CommitAccountStore(Bool save_ok)
+{
+   char fname[MAX_PATH+FILENAME_MAX],new_fname[MAX_PATH+FILENAME_MAX];
+
+   if (!store_compact_pending)
+      return;
+   store_compact_pending = False;
+
+   GetAccountStoreFilename(fname);
+   GetNewAccountStoreFilename(new_fname);
+
+   if (!save_ok)
+   {
+      unlink(new_fname);
+      return;
+   }
+
+   if (!BlakMoveFile(new_fname,fname))
+   {
+      eprintf("CommitAccountStore can't replace %s with %s\n",fname,new_fname);
+      unlink(new_fname);
+      return;
+   }
+
+   lprintf("CommitAccountStore rewrote %s with %i accounts, was %i records\n",
+	   fname,store_written,store_records);
+
+   store_records = store_written;
+   store_last_written = store_written;
+   store_compactions++;
+   store_rewrite = False;
+   ClearAccountChanges();
+}
+
+void WriteAccountStoreHeader(void)
+{
+   int version;
+
+   version = ACCOUNT_STORE_VERSION;
+   if (fwrite(ACCOUNT_STORE_MAGIC,ACCOUNT_STORE_MAGIC_LEN,1,storefile) != 1 ||
+       fwrite(&version,4,1,storefile) != 1)
+      store_write_ok = False;
+}
+
+void WriteAccountStoreRecord(account_store_record *r,const char *name,const char *password)
+{
+   if (fwrite(r,sizeof(account_store_record),1,storefile) != 1 ||
+       (int)fwrite(name,1,r->len_name,storefile) != r->len_name ||
+       (int)fwrite(password,1,r->len_password,storefile) != r->len_password)
+      store_write_ok = False;
+}
+
+void WriteAccountRecord(account_node *a)
+{
+   account_store_record r;
+
+   memset(&r,0,sizeof(r));
+   r.kind = ACCOUNT_RECORD_PUT;
+   r.account_id = a->account_id;
+   r.type = a->type;
+   r.credits = a->credits;
+   r.last_login_time = a->last_login_time;
+   r.suspend_time = a->suspend_time;
+   r.len_name = std::min((int)strlen(a->name),ACCOUNT_STORE_MAX_STRING);
+   r.len_password = std::min((int)strlen(a->password),ACCOUNT_STORE_MAX_STRING);
+   WriteAccountStoreRecord(&r,a->name,a->password);
+   store_written++;
+}
+
+void WriteDirtyAccountRecord(account_node *a)
+{
+   if (a->dirty)
+      WriteAccountRecord(a);
+}
+
+void WriteDeleteAccountRecord(int account_id)
+{
+   account_store_record r;
+
+   memset(&r,0,sizeof(r));
+   r.kind = ACCOUNT_RECORD_DELETE;
+   r.account_id = account_id;
+   WriteAccountStoreRecord(&r,"","");
+   store_written++;
+}
+
+void WriteSaveRecord(INT64 save_time)
+{
+   account_store_record r;
+
+   memset(&r,0,sizeof(r));
+   r.kind = ACCOUNT_RECORD_SAVE;
+   r.account_id = GetNextAccountID();
+   r.last_login_time = save_time;
+   WriteAccountStoreRecord(&r,"","");
+}
+
+void GetAccountStoreStats(account_store_statistics *stat)
+{
+   stat->num_records = store_records;
+   stat->last_written = store_last_written;
+   stat->num_compactions = store_compactions;
+   stat->needs_rewrite = store_rewrite;
+}
@@ -0,0 +1,53 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * accostore.h
+ *
+ */
+
+#ifndef _ACCOSTORE_H
+#define _ACCOSTORE_H
+
+#define ACCOUNT_STORE_VERSION 1
+
+enum
+{
+   ACCOUNT_RECORD_PUT = 1,
+   ACCOUNT_RECORD_DELETE = 2,
+   ACCOUNT_RECORD_SAVE = 3,
+};
+
+/* followed in the file by len_name bytes of name and len_password bytes
+   of password, neither null terminated */
+typedef struct
+{
+   int kind;
+   int account_id;		/* next account number, for a save record */
+   int type;
+   int credits;
+   INT64 last_login_time;	/* save time stamp, for a save record */
+   INT64 suspend_time;
+   int len_name;
+   int len_password;
+} account_store_record;
+
+typedef struct
+{
+   int num_records;		/* account and delete records in the log */
+   int last_written;		/* records the last save appended */
+   int num_compactions;
+   Bool needs_rewrite;
+} account_store_statistics;
+
+Bool AccountStoreExists(void);
+Bool LoadAccountStore(INT64 save_time);
+Bool SaveAccountStore(INT64 save_time);
+void CommitAccountStore(Bool save_ok);
+void GetAccountStoreStats(account_store_statistics *stat);
+
+#endif
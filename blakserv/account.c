@@ -10,27 +10,65 @@
  *
  
  This module keeps a linked list of accounts in memory.  These are loaded in
- from a file (loadacco.c) when Blakserv starts (or initialized by builtin.c).
- The linked list is stored in account number, just so everytime it is
- loaded in and saved the file is in the same order.
+ from the account store (accostore.c) when Blakserv starts (or initialized
+ by builtin.c).  The linked list is stored in account number, just so
+ everytime it is loaded in and saved the file is in the same order.
+
+ The accounts are also hashed by number and by name, so looking one up
+ at login doesn't walk the list.  Each account remembers whether it has
+ changed since the account store last wrote it, and deleted account
+ numbers are kept until the next save, so a save only has to write what
+ changed.
  
  */
 
 #include "blakserv.h"
 
+#define ACCOUNT_HASH_INIT 1024
+
 account_node *accounts;
+account_node *last_account;	/* loading inserts in account number order */
 int next_account_id;
 
+/* both indexes have account_hash_size buckets, doubled as accounts are added */
+account_node **accounts_by_id;
+account_node **accounts_by_name;
+int account_hash_size;
+int num_accounts;
+
+/* accounts deleted since the account store last saved */
+int *deleted_account_ids;
+int num_deleted_accounts,max_deleted_accounts;
+
 account_node console_account_node,*console_account;
 
 /* local function prototypes */
 void InsertAccount(account_node *a);
+unsigned int GetAccountNameHash(const char *name);
+void IndexAccount(account_node *a);
+void UnindexAccount(account_node *a);
+void GrowAccountIndex(void);
+void SetAccountString(char **field,const char *str);
 
 void InitAccount(void)
 {
    accounts = NULL;
+   last_account = NULL;
    next_account_id = 1;
 
+   account_hash_size = ACCOUNT_HASH_INIT;
+   accounts_by_id = (account_node **)
+      AllocateMemory(MALLOC_ID_ACCOUNT,account_hash_size*sizeof(account_node *));
+   accounts_by_name = (account_node **)
+      AllocateMemory(MALLOC_ID_ACCOUNT,account_hash_size*sizeof(account_node *));
+   memset(accounts_by_id,0,account_hash_size*sizeof(account_node *));
+   memset(accounts_by_name,0,account_hash_size*sizeof(account_node *));
+   num_accounts = 0;
+
+   deleted_account_ids = NULL;
+   num_deleted_accounts = 0;
+   max_deleted_accounts = 0;
+
    console_account = &console_account_node;
    console_account->account_id = 0;
    console_account->name = ConfigStr(CONSOLE_ADMINISTRATOR);
@@ -57,7 +95,13 @@ void ResetAccount(void)
       a = temp;
    }
    accounts = NULL;
+   last_account = NULL;
    next_account_id = 1;
+
+   memset(accounts_by_id,0,account_hash_size*sizeof(account_node *));
+   memset(accounts_by_name,0,account_hash_size*sizeof(account_node *));
+   num_accounts = 0;
+   num_deleted_accounts = 0;
 }
 
 account_node * GetConsoleAccount()
@@ -96,10 +140,23 @@ void InsertAccount(account_node *a)
 {
    account_node *temp;
 
+   /* before a is on the list, since growing indexes everything on it */
+   if (num_accounts >= account_hash_size)
+      GrowAccountIndex();
+
    if (accounts == NULL || accounts->account_id > a->account_id)
    {
       a->next = accounts;
       accounts = a;
+      if (a->next == NULL)
+	 last_account = a;
+   }
+   else if (last_account->account_id < a->account_id)
+   {
+      /* new accounts and loaded ones go on the end */
+      a->next = NULL;
+      last_account->next = a;
+      last_account = a;
    }
    else
    {
@@ -109,6 +166,75 @@ void InsertAccount(account_node *a)
       a->next = temp->next;
       temp->next = a;
    }
+
+   IndexAccount(a);
+   num_accounts++;
+}
+
+/* GetAccountNameHash
+*
+* Names are looked up with stricmp, so they're hashed without case.
+*/
+unsigned int GetAccountNameHash(const char *name)
+{
+   unsigned int hash;
+
+   hash = 2166136261u;
+   while (*name != 0)
+   {
+      hash = (hash ^ (unsigned char)FoldChar(*name)) * 16777619u;
+      name++;
+   }
+   return hash;
+}
+
+void IndexAccount(account_node *a)
+{
+   unsigned int bucket;
+
+   bucket = (unsigned int)a->account_id & (account_hash_size - 1);
+   a->next_id_hash = accounts_by_id[bucket];
+   accounts_by_id[bucket] = a;
+
+   bucket = GetAccountNameHash(a->name) & (account_hash_size - 1);
+   a->next_name_hash = accounts_by_name[bucket];
+   accounts_by_name[bucket] = a;
+}
+
+void UnindexAccount(account_node *a)
+{
+   account_node **link;
+
+   link = &accounts_by_id[(unsigned int)a->account_id & (account_hash_size - 1)];
+   while (*link != NULL && *link != a)
+      link = &(*link)->next_id_hash;
+   if (*link != NULL)
+      *link = a->next_id_hash;
+
+   link = &accounts_by_name[GetAccountNameHash(a->name) & (account_hash_size - 1)];
+   while (*link != NULL && *link != a)
+      link = &(*link)->next_name_hash;
+   if (*link != NULL)
+      *link = a->next_name_hash;
+}
+
+void GrowAccountIndex(void)
+{
+   account_node *a;
+
+   FreeMemory(MALLOC_ID_ACCOUNT,accounts_by_id,account_hash_size*sizeof(account_node *));
+   FreeMemory(MALLOC_ID_ACCOUNT,accounts_by_name,account_hash_size*sizeof(account_node *));
+
+   account_hash_size *= 2;
+   accounts_by_id = (account_node **)
+      AllocateMemory(MALLOC_ID_ACCOUNT,account_hash_size*sizeof(account_node *));
+   accounts_by_name = (account_node **)
+      AllocateMemory(MALLOC_ID_ACCOUNT,account_hash_size*sizeof(account_node *));
+   memset(accounts_by_id,0,account_hash_size*sizeof(account_node *));
+   memset(accounts_by_name,0,account_hash_size*sizeof(account_node *));
+
+   for (a = accounts; a != NULL; a = a->next)
+      IndexAccount(a);
 }
 
 Bool CreateAccount(char *name,char *password,int type,int *account_id)
@@ -134,6 +260,7 @@ Bool CreateAccount(char *name,char *password,int type,int *account_id)
    a->last_login_time = 0;
    a->suspend_time = 0;
    a->credits = 100*ConfigInt(CREDIT_INIT);
+   a->dirty = True;
 
    InsertAccount(a);
 
@@ -170,6 +297,7 @@ int CreateAccountSecurePassword(const char *name,const char *password,int type)
    a->last_login_time = 0;
    a->suspend_time = 0;
    a->credits = 100*ConfigInt(CREDIT_INIT);
+   a->dirty = True;
 
    InsertAccount(a);
 
@@ -215,6 +343,7 @@ int RecreateAccountSecurePassword(int account_id,char *name,char *password,int t
    a->last_login_time = 0;
    a->suspend_time = 0;
    a->credits = 100*ConfigInt(CREDIT_INIT);
+   a->dirty = True;
 
    InsertAccount(a);
 
@@ -225,24 +354,44 @@ void LoadAccount(int account_id,char *name,char *password,int type,INT64 last_lo
 		 INT64 suspend_time, int credits)
 {
    account_node *a;
+   Bool is_new;
 
-   a = (account_node *)AllocateMemory(MALLOC_ID_ACCOUNT,sizeof(account_node));
+   /* the account store log can have several versions of an account; the
+      last one loaded wins */
+   a = GetAccountByID(account_id);
+   is_new = (a == NULL);
+   if (!is_new)
+   {
+      if (strcmp(a->name,name) != 0)
+      {
+	 UnindexAccount(a);
+	 SetAccountString(&a->name,name);
+	 IndexAccount(a);
+      }
+      SetAccountString(&a->password,password);
+   }
+   else
+   {
+      a = (account_node *)AllocateMemory(MALLOC_ID_ACCOUNT,sizeof(account_node));
 
-   a->account_id = account_id;
-   if (account_id >= next_account_id)
-      next_account_id = account_id + 1;
+      a->account_id = account_id;
+      if (account_id >= next_account_id)
+	 next_account_id = account_id + 1;
 
-   a->name = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(name)+1);
-   strcpy(a->name,name);
-   a->password = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(password)+1);
-   strcpy(a->password,password);
+      a->name = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(name)+1);
+      strcpy(a->name,name);
+      a->password = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(password)+1);
+      strcpy(a->password,password);
+   }
 
    a->type = type;
    a->last_login_time = last_login_time;
    a->suspend_time = suspend_time;
    a->credits = credits;
+   a->dirty = False;
 
-   InsertAccount(a);
+   if (is_new)
+      InsertAccount(a);
 }
 
 /* DeleteAccount
@@ -251,61 +400,83 @@ Bool DeleteAccount(int account_id)
 {
    account_node *a,*temp;
 
-   a = accounts;
+   a = GetAccountByID(account_id);
+   if (a == NULL)
+      return False;
 
-   /* delete from front of list */
-   if (a->account_id == account_id)
+   if (accounts == a)
    {
       accounts = a->next;
-      
-      FreeMemory(MALLOC_ID_ACCOUNT,a->name,strlen(a->name)+1);
-      FreeMemory(MALLOC_ID_ACCOUNT,a->password,strlen(a->password)+1);
-      FreeMemory(MALLOC_ID_ACCOUNT,a,sizeof(account_node));
-      return True;
+      if (last_account == a)
+	 last_account = NULL;
    }
-   
-   while (a != NULL)
+   else
    {
-      temp = a->next;
-      if (temp != NULL && temp->account_id == account_id)
-      {
-	 /* remove from list, then free memory */
-	 a->next = temp->next;
+      temp = accounts;
+      while (temp->next != a)
+	 temp = temp->next;
+      temp->next = a->next;
+      if (last_account == a)
+	 last_account = temp;
+   }
+
+   UnindexAccount(a);
+   num_accounts--;
 
-	 FreeMemory(MALLOC_ID_ACCOUNT,temp->name,strlen(temp->name)+1);
-	 FreeMemory(MALLOC_ID_ACCOUNT,temp->password,strlen(temp->password)+1);
-	 FreeMemory(MALLOC_ID_ACCOUNT,temp,sizeof(account_node));
-	 return True;
+   /* the account store needs to hear about it at the next save */
+   if (num_deleted_accounts == max_deleted_accounts)
+   {
+      if (deleted_account_ids == NULL)
+      {
+	 max_deleted_accounts = 64;
+	 deleted_account_ids = (int *)
+	    AllocateMemory(MALLOC_ID_ACCOUNT,max_deleted_accounts*sizeof(int));
+      }
+      else
+      {
+	 deleted_account_ids = (int *)
+	    ResizeMemory(MALLOC_ID_ACCOUNT,deleted_account_ids,max_deleted_accounts*sizeof(int),
+			 2*max_deleted_accounts*sizeof(int));
+	 max_deleted_accounts *= 2;
       }
-      a = a->next;
    }
+   deleted_account_ids[num_deleted_accounts++] = account_id;
 
-   return False;
+   FreeMemory(MALLOC_ID_ACCOUNT,a->name,strlen(a->name)+1);
+   FreeMemory(MALLOC_ID_ACCOUNT,a->password,strlen(a->password)+1);
+   FreeMemory(MALLOC_ID_ACCOUNT,a,sizeof(account_node));
+   return True;
+}
+
+void SetAccountString(char **field,const char *str)
+{
+   FreeMemory(MALLOC_ID_ACCOUNT,*field,strlen(*field)+1);
+   *field = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(str)+1);
+   strcpy(*field,str);
 }
 
 void SetAccountName(account_node *a,char *name)
 {
-   FreeMemory(MALLOC_ID_ACCOUNT,a->name,strlen(a->name)+1);
-   a->name = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(name)+1);
-   strcpy(a->name,name);
+   UnindexAccount(a);
+   SetAccountString(&a->name,name);
+   IndexAccount(a);
+   a->dirty = True;
 }
 
 void SetAccountPassword(account_node *a,char *password)
 {
    char buf[ENCRYPT_LEN+1];
 
-   FreeMemory(MALLOC_ID_ACCOUNT,a->password,strlen(a->password)+1);
    MDString(password,(unsigned char *) buf);
    buf[ENCRYPT_LEN] = 0;
-   a->password = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(buf)+1);
-   strcpy(a->password,buf);
+   SetAccountString(&a->password,buf);
+   a->dirty = True;
 }
 
 void SetAccountPasswordAlreadyEncrypted(account_node *a,char *password)
 {
-   FreeMemory(MALLOC_ID_ACCOUNT,a->password,strlen(a->password)+1);
-   a->password = (char *)AllocateMemory(MALLOC_ID_ACCOUNT,strlen(password)+1);
-   strcpy(a->password,password);
+   SetAccountString(&a->password,password);
+   a->dirty = True;
 }
 
 Bool SuspendAccountAbsolute(account_node *a, INT64 suspend_time)
@@ -340,13 +511,18 @@ Bool SuspendAccountAbsolute(account_node *a, INT64 suspend_time)
 	 lprintf("Suspension of account %i (%s) lifted\n",
 	         a->account_id, a->name);
       }
-      a->suspend_time = 0;
+      if (a->suspend_time != 0)
+      {
+	 a->suspend_time = 0;
+	 a->dirty = True;
+      }
       return True;
    }
 
    /* suspension going into effect or remaining in effect */
 
    a->suspend_time = suspend_time;
+   a->dirty = True;
 
    lprintf("Suspended account %i (%s) until %s\n",
            a->account_id, a->name, TimeStr(suspend_time));
@@ -399,12 +575,12 @@ account_node * GetAccountByID(int account_id)
 {
    account_node *a;
 
-   a = accounts;
+   a = accounts_by_id[(unsigned int)account_id & (account_hash_size - 1)];
    while (a != NULL)
    {
       if (a->account_id == account_id)
 	 return a;
-      a = a->next;
+      a = a->next_id_hash;
    }
    return NULL;
 }
@@ -413,12 +589,12 @@ account_node * GetAccountByName(const char *name)
 {
    account_node *a;
 
-   a = accounts;
+   a = accounts_by_name[GetAccountNameHash(name) & (account_hash_size - 1)];
    while (a != NULL)
    {
       if (!stricmp(a->name,name))
 	 return a;
-      a = a->next;
+      a = a->next_name_hash;
    }
    return NULL;
 }
@@ -452,20 +628,13 @@ account_node * AccountLoginByName(char *name)
    }
    else
    {
-      a = accounts;
-      while (a != NULL)
-      {
-	 if (!stricmp(a->name,name))
-	 {
-	    /* give administrators credits every time they login */
-	    /*
-	    if (a->type == ACCOUNT_ADMIN)
-	       a->credits = 100*ConfigInt(CREDIT_ADMIN);
-	       */
-	    return a;
-	 }
-	 a = a->next;
-      }
+      a = GetAccountByName(name);
+      /* give administrators credits every time they login */
+      /*
+      if (a != NULL && a->type == ACCOUNT_ADMIN)
+	 a->credits = 100*ConfigInt(CREDIT_ADMIN);
+	 */
+      return a;
    }
    return NULL;
 }
@@ -495,6 +664,42 @@ void ForEachAccount(void (*callback_func)(account_node *a))
    }
 }
 
+/* MarkAccountDirty
+*
+* For changes made to an account outside this module, so the next save
+* writes it to the account store.
+*/
+void MarkAccountDirty(account_node *a)
+{
+   a->dirty = True;
+}
+
+void ForEachDeletedAccount(void (*callback_func)(int account_id))
+{
+   int i;
+
+   for (i=0;i<num_deleted_accounts;i++)
+      callback_func(deleted_account_ids[i]);
+}
+
+/* ClearAccountChanges
+*
+* Called once the account store has every account as it is now.
+*/
+void ClearAccountChanges(void)
+{
+   account_node *a;
+
+   for (a = accounts; a != NULL; a = a->next)
+      a->dirty = False;
+   num_deleted_accounts = 0;
+}
+
+int GetNumAccounts(void)
+{
+   return num_accounts;
+}
+
 void DeleteAccountAndAssociatedUsersByID(int account_id)
 {
    account_node *a;
@@ -24,7 +24,10 @@ typedef struct account_node_struct
    int credits;			/* remember, stored as 1/100 of a credit */
    INT64 last_login_time;
    INT64 suspend_time;
+   Bool dirty;			/* changed since the account store last wrote it */
    struct account_node_struct *next;
+   struct account_node_struct *next_id_hash;
+   struct account_node_struct *next_name_hash;
 } account_node;
 
 void InitAccount(void);
@@ -48,6 +51,10 @@ account_node * AccountLoginByName(char *name);
 void AccountLogoff(account_node *a);
 void DoneLoadAccounts(void);
 void ForEachAccount(void (*callback_func)(account_node *a));
+void MarkAccountDirty(account_node *a);
+void ForEachDeletedAccount(void (*callback_func)(int account_id));
+void ClearAccountChanges(void);
+int GetNumAccounts(void);
 void DeleteAccountAndAssociatedUsersByID(int account_id);
 
 Bool SuspendAccountAbsolute(account_node *a, INT64 suspend_time);
@@ -38,7 +38,7 @@ void AdminProcessSessionBuffer(session_node *s)
 {
    char ch;
 
-   while (s->receive_list != NULL)
+   while (GetSessionReadBytes(s) > 0)
    {
       if (ReadSessionBytes(s,1,&ch) == False)
          return;
@@ -77,10 +77,23 @@ void AdminHelp(int session_id,int len_command_table,admin_table_type command_tab
 
 void AdminGarbage(int session_id,admin_parm_type parms[],
                   int num_blak_parm,parm_node blak_parm[]);
+void AdminReclaim(int session_id,admin_parm_type parms[],
+                  int num_blak_parm,parm_node blak_parm[]);
 void AdminSaveGame(int session_id,admin_parm_type parms[],
                    int num_blak_parm,parm_node blak_parm[]);
+INT64 AdminSaveGameNow(void);
+void AdminRecordStart(int session_id,admin_parm_type parms[],
+                      int num_blak_parm,parm_node blak_parm[]);
+void AdminRecordStop(int session_id,admin_parm_type parms[],
+                     int num_blak_parm,parm_node blak_parm[]);
+void AdminCensusStart(int session_id,admin_parm_type parms[],
+                      int num_blak_parm,parm_node blak_parm[]);
+void AdminCensusStop(int session_id,admin_parm_type parms[],
+                     int num_blak_parm,parm_node blak_parm[]);
 void AdminSaveConfiguration(int session_id,admin_parm_type parms[],
                             int num_blak_parm,parm_node blak_parm[]);
+void AdminSaveAccounts(int session_id,admin_parm_type parms[],
+                       int num_blak_parm,parm_node blak_parm[]);
 void AdminSaveOneConfigNode(config_node *c,const char *config_name,const char *default_str);
 void AdminWho(int session_id,admin_parm_type parms[],
               int num_blak_parm,parm_node blak_parm[]);
@@ -101,6 +114,17 @@ void AdminShowMemory(int session_id,admin_parm_type parms[],
 void AdminShowCalled(int session_id,admin_parm_type parms[],
                      int num_blak_parm,parm_node blak_parm[]);
 void AdminShowCalledClass(class_node *c);
+void AdminShowSendCache(int session_id,admin_parm_type parms[],
+                        int num_blak_parm,parm_node blak_parm[]);
+void AdminCollectSendCacheSite(send_cache_entry *e);
+int AdminCompareSendCacheSites(const void *a,const void *b);
+void AdminShowCensus(int session_id,admin_parm_type parms[],
+                     int num_blak_parm,parm_node blak_parm[]);
+void AdminCollectCensusSite(census_site *site);
+int AdminCompareCensusSites(const void *a,const void *b);
+void AdminCollectCensusClass(census_class *cc);
+int AdminCompareCensusClasses(const void *a,const void *b);
+void AdminShowCensusClass(int rank,const char *name,census_class *cc);
 
 void AdminShowObject(int session_id,admin_parm_type parms[],
                      int num_blak_parm,parm_node blak_parm[]);
@@ -306,6 +330,8 @@ admin_table_type admin_show_table[] =
 	{ AdminShowCalled,        {I,N}, F, A, NULL, 0, "called",
      "Show top (int) called messages" },
 	{ AdminShowCalls,         {I,N}, F, A, NULL, 0, "calls",         "Show top (int) C call counts" },
+	{ AdminShowCensus,        {I,N}, F, A, NULL, 0, "census",
+	"Count live nodes, show top (int) allocation sites and classes holding them" },
 	{ AdminShowClass,         {S,N}, F,A|M, NULL, 0, "class",          "Show info about class" },
 	{ AdminShowTime,          {N},   F, A|M, NULL, 0, "clock",        "Show current server time" },
 	{ AdminShowConfiguration, {N},   F, A|M, NULL, 0, "configuration", "Show configuration values" },
@@ -326,6 +352,8 @@ admin_table_type admin_show_table[] =
 	"Show what objects or lists reference a particular data value" },
 	{ AdminShowResource,      {S,N}, F, A|M, NULL, 0, "resource",
 	"Show a resource by resource name" },
+	{ AdminShowSendCache,     {I,N}, F, A, NULL, 0, "sendcache",
+	"Show top (int) Send call sites and their inline cache hits" },
 	{ AdminShowStatus,        {N},   F, A|M, NULL, 0, "status",        "Show system status" },
 	{ AdminShowString,        {I,N}, F, A|M, NULL, 0, "string",        "Show one string by string id" },
 	{ AdminShowSysTimers,     {N},   F, A, NULL, 0, "systimers",     "Show system timers" },
@@ -455,7 +483,7 @@ admin_table_type admin_hangup_table[] =
 {
 	{ AdminHangupAccount,  {R,N},  F, A|M, NULL, 0, "account", "Hangup one account" },
 	{ AdminHangupAll,      {N},    F, A|M, NULL, 0, "all", "Hangup all users" },
-	{ AdminBlockIP,        {R,N},  F, A|M, NULL, 0, "ip", "Block an IP address (temporarily)" },
+	{ AdminBlockIP,        {R,N},  F, A|M, NULL, 0, "ip", "Block an IP address or address/prefix range (temporarily)" },
 	{ AdminHangupSession,  {I,N},  F, A, NULL, 0, "session", "Hangup one session" },
 	{ AdminHangupUser,     {R,N},  F, A|M, NULL, 0, "user", "Hangup one user" },
 };
@@ -496,8 +524,24 @@ admin_table_type admin_terminate_table[] =
 };
 #define LEN_ADMIN_TERMINATE_TABLE (sizeof(admin_terminate_table)/sizeof(admin_table_type))
 
+admin_table_type admin_census_table[] =
+{
+	{ AdminCensusStart,   {N},   F, A, NULL, 0, "start",   "Record where objects, lists, strings and timers are made" },
+	{ AdminCensusStop,    {N},   F, A, NULL, 0, "stop",    "Stop recording allocation sites" },
+};
+#define LEN_ADMIN_CENSUS_TABLE (sizeof(admin_census_table)/sizeof(admin_table_type))
+
+admin_table_type admin_record_table[] =
+{
+	{ AdminRecordStart,   {S,N}, F, A, NULL, 0, "start",
+	"Save game, then record client traffic to a file for kodreplay" },
+	{ AdminRecordStop,    {N},   F, A, NULL, 0, "stop",    "Stop recording client traffic" },
+};
+#define LEN_ADMIN_RECORD_TABLE (sizeof(admin_record_table)/sizeof(admin_table_type))
+
 admin_table_type admin_save_table[] =
 {
+	{ AdminSaveAccounts,  {N},   F, A|M, NULL, 0, "accounts","Write the accounts to a text file" },
 	{ AdminSaveConfiguration,{N},F, A|M, NULL, 0, "configuration","Save blakserv.cfg" },
 	{ AdminSaveGame,      {N},   F, A|M, NULL, 0, "game",    "Save game (will garbage collect first)" },
 };
@@ -506,6 +550,7 @@ admin_table_type admin_save_table[] =
 admin_table_type admin_main_table[] =
 {
 	{ NULL, {N}, F, A, admin_add_table,    LEN_ADMIN_ADD_TABLE,    "add",    "Add subcommand" },
+	{ NULL, {N}, F, A, admin_census_table, LEN_ADMIN_CENSUS_TABLE, "census", "Census subcommand" },
 	{ NULL, {N}, F, A, admin_create_table, LEN_ADMIN_CREATE_TABLE, "create", "Create subcommand" },
 	{ NULL, {N}, F, A, admin_delete_table, LEN_ADMIN_DELETE_TABLE, "delete", "Delete subcommand" },
 	{ NULL, {N}, F, A, admin_disable_table,LEN_ADMIN_DISABLE_TABLE,"disable", "Disable subcommand" },
@@ -518,6 +563,8 @@ admin_table_type admin_main_table[] =
 	{ AdminMark,          {N},   F, A|M, NULL, 0, "mark",      "Mark all channel logs with a dashed line" },
 	{ AdminPage,          {N},   F, A, NULL, 0, "page",      "Page the console" },
 	{ AdminRead,          {S,N}, F, A|M, NULL, 0, "read",      "Read admin commands from a file, echoes everything" },
+	{ AdminReclaim,       {N},   F, A, NULL, 0, "reclaim",   "Free unreferenced objects and list nodes without renumbering" },
+	{ NULL, {N}, F, A, admin_record_table, LEN_ADMIN_RECORD_TABLE, "record", "Record subcommand" },
 	{ NULL, {N}, F, A, admin_recreate_table,LEN_ADMIN_RECREATE_TABLE, "recreate", "Recreate subcommand" },
 	{ NULL, {N}, F, A, admin_reload_table, LEN_ADMIN_RELOAD_TABLE, "reload", "Reload subcommand" },
 	{ NULL, {N}, F, A, admin_save_table,   LEN_ADMIN_SAVE_TABLE,   "save",   "Save subcommand" },
@@ -1048,8 +1095,37 @@ void AdminGarbage(int session_id,admin_parm_type parms[],
 	ResetBufferPool();
 }
 
+void AdminReclaim(int session_id,admin_parm_type parms[],
+                  int num_blak_parm,parm_node blak_parm[])
+{
+	int num_reclaimed;
+	list_node_statistics lstat;
+
+	lprintf("AdminReclaim reclaiming objects and list nodes\n");
+
+	PauseTimers();
+	SendBlakodBeginSystemEvent(SYSEVENT_GARBAGE);
+
+	num_reclaimed = ReclaimObjects();
+	aprintf("Reclaimed %i unreferenced objects, %i slots free for reuse.\n",
+		num_reclaimed,GetObjectsUsed() - GetObjectsLive());
+
+	num_reclaimed = ReclaimListNodes();
+	GetListNodeStats(&lstat);
+	aprintf("Reclaimed %i unreferenced list nodes, %i free for reuse.\n",
+		num_reclaimed,lstat.num_free);
+
+	SendBlakodEndSystemEvent(SYSEVENT_GARBAGE);
+	UnpauseTimers();
+}
+
 void AdminSaveGame(int session_id,admin_parm_type parms[],
                    int num_blak_parm,parm_node blak_parm[])
+{
+	AdminSaveGameNow();
+}
+
+INT64 AdminSaveGameNow(void)
 {
 	INT64 save_time;
 
@@ -1069,6 +1145,88 @@ void AdminSaveGame(int session_id,admin_parm_type parms[],
 
 	aprintf("done.  Save time is (%lli).\n", save_time);
 	UnpauseTimers();
+
+	return save_time;
+}
+
+void AdminRecordStart(int session_id,admin_parm_type parms[],
+                      int num_blak_parm,parm_node blak_parm[])
+{
+	char *filename;
+	INT64 save_time;
+
+	filename = (char *)parms[0];
+
+	if (IsRecording())
+	{
+		aprintf("Already recording to %s.\n",GetRecordingName());
+		return;
+	}
+
+	/* the replay starts from this save */
+	save_time = AdminSaveGameNow();
+
+	if (!StartRecording(filename,(int)save_time))
+	{
+		aprintf("Couldn't open %s to record to.\n",filename);
+		return;
+	}
+	aprintf("Recording client traffic to %s from save (%lli).\n",filename,(long long)save_time);
+}
+
+void AdminRecordStop(int session_id,admin_parm_type parms[],
+                     int num_blak_parm,parm_node blak_parm[])
+{
+	if (!IsRecording())
+	{
+		aprintf("Not recording.\n");
+		return;
+	}
+
+	aprintf("Recorded %lli events in %lli bytes to %s.\n",(long long)GetRecordingEvents(),
+		(long long)GetRecordingBytes(),GetRecordingName());
+	StopRecording();
+}
+
+void AdminCensusStart(int session_id,admin_parm_type parms[],
+                      int num_blak_parm,parm_node blak_parm[])
+{
+	if (census_recording)
+	{
+		aprintf("Already recording allocation sites.\n");
+		return;
+	}
+
+	StartCensusSites();
+	aprintf("Recording allocation sites; show census counts what's live from each.\n");
+}
+
+void AdminCensusStop(int session_id,admin_parm_type parms[],
+                     int num_blak_parm,parm_node blak_parm[])
+{
+	if (!census_recording)
+	{
+		aprintf("Not recording allocation sites.\n");
+		return;
+	}
+
+	StopCensusSites();
+	aprintf("Stopped recording allocation sites; what's already made keeps its site.\n");
+}
+
+void AdminSaveAccounts(int session_id,admin_parm_type parms[],
+                       int num_blak_parm,parm_node blak_parm[])
+{
+	char save_name[MAX_PATH+FILENAME_MAX];
+
+	sprintf(save_name,"%s%s%lli",ConfigStr(PATH_LOADSAVE),ACCOUNT_FILE_SAVE,
+		(long long)GetTime());
+	if (!SaveAccounts(save_name))
+	{
+		aprintf("Couldn't write %s.\n",save_name);
+		return;
+	}
+	aprintf("Wrote %i accounts to %s.\n",GetNumAccounts(),save_name);
 }
 
 /* data for ForEachConfigNode */
@@ -1311,6 +1469,14 @@ void AdminShowStatus(int session_id,admin_parm_type parms[],
 	object_node *o;
 	class_node *c;
 	const char *m;
+	channel_statistics cstat;
+	block_statistics bstat;
+	account_store_statistics astat;
+	send_cache_statistics send_stat;
+	post_queue_statistics post_stat;
+	garbage_statistics gstat;
+	timer_statistics tstat;
+	int i;
 	INT64 now = GetTime();
 
 	aprintf("System Status -----------------------------\n");
@@ -1332,6 +1498,14 @@ void AdminShowStatus(int session_id,admin_parm_type parms[],
 		kstat->interpreting_time/1000);
 	aprintf("Handled %i top level messages, total %i messages\n",
 		kstat->num_top_level_messages, kstat->num_messages);
+	GetSendCacheStats(&send_stat);
+	aprintf("Send inline caches at %i call sites, %lli hits and %lli misses\n",
+		send_stat.num_sites,send_stat.hits,send_stat.misses);
+	GetPostQueueStats(&post_stat);
+	aprintf("Post queue has %i waiting (most %i, room for %i), %lli posted, %lli coalesced, "
+		"%lli dropped, followups deferred %lli times\n",
+		post_stat.num_pending,post_stat.most_pending,post_stat.max_posts,post_stat.num_posted,
+		post_stat.num_coalesced,post_stat.num_dropped,post_stat.num_deferred);
 	aprintf("Deepest message call stack is %i calls from top level\n",kstat->message_depth_highest);
 	aprintf("Most instructions on one top level message is %i instructions\n",kstat->num_interpreted_highest);
 	aprintf("Number of top level messages over 1000 milliseconds is %i\n",kstat->interpreting_time_over_second);
@@ -1353,17 +1527,57 @@ void AdminShowStatus(int session_id,admin_parm_type parms[],
 	aprintf("----\n");
 	aprintf("Active accounts: %i\n",GetActiveAccountCount());
 	aprintf("Next account number is %i\n",GetNextAccountID());
+	GetAccountStoreStats(&astat);
+	aprintf("Account store has %i records for %i accounts, last save wrote %i, %i compactions%s\n",
+		astat.num_records,GetNumAccounts(),astat.last_written,astat.num_compactions,
+		astat.needs_rewrite ? " (rewrite pending)" : "");
 	aprintf("Clients on port %i, maintenance on port %i\n",
 		ConfigInt(SOCKET_PORT),
 		ConfigInt(SOCKET_MAINTENANCE_PORT));
 	aprintf("There are %i sessions (%i guests) logged on\n",
 		GetUsedSessions(),GetUsedGuestAccounts());
+	if (IsRecording())
+		aprintf("Recording client traffic to %s, %lli events in %lli bytes so far\n",
+			GetRecordingName(),(long long)GetRecordingEvents(),(long long)GetRecordingBytes());
+	GetBlockStats(&bstat);
+	aprintf("Blocking %i addresses and ranges (%i ranges), %lli expired\n",
+		bstat.num_blocks,bstat.num_ranges,(long long)bstat.num_expired);
+	aprintf("Refused %lli blocked, %lli rate limited and %lli maintenance connections\n",
+		(long long)bstat.num_blocked,(long long)bstat.num_rate_limited,
+		(long long)bstat.num_maintenance_refused);
+	aprintf("Accept limiter tracking %i addresses, %lli evicted\n",
+		bstat.num_limiter_entries,(long long)bstat.num_limiter_evictions);
 
 	aprintf("----\n");
 	aprintf("Used %i list nodes\n",GetListNodesUsed());
-	aprintf("Used %i object nodes\n",GetObjectsUsed());
+	aprintf("Used %i object nodes (%i live)\n",GetObjectsUsed(),GetObjectsLive());
 	aprintf("Used %i string nodes\n",GetStringsUsed());
-	aprintf("Watching %i active timers\n",GetNumActiveTimers());
+	GetTimerStats(&tstat);
+	aprintf("Watching %i active timers, %i fired\n",GetNumActiveTimers(),tstat.num_fired);
+	if (tstat.warping)
+	{
+		aprintf("Time warp covered %lli game seconds in %lli.%03lli real (%.1fx), "
+			"%i timers (%.0f/second), %.2f million instructions/second\n",
+			(long long)(tstat.warp_game_ms/1000),
+			(long long)(tstat.warp_real_ms/1000),(long long)(tstat.warp_real_ms%1000),
+			tstat.warp_real_ms ? (double)tstat.warp_game_ms/tstat.warp_real_ms : 0.0,
+			tstat.warp_timers_fired,
+			tstat.warp_real_ms ? 1000.0*tstat.warp_timers_fired/tstat.warp_real_ms : 0.0,
+			tstat.warp_real_ms ? tstat.warp_instructions/(1000.0*tstat.warp_real_ms) : 0.0);
+	}
+	GetGarbageStats(&gstat);
+	if (gstat.num_collections > 0)
+		aprintf("Last garbage collection took %i ms on %i threads (lists %i, objects %i, timers %i, strings %i), longest %i ms\n",
+			gstat.last_time,gstat.num_threads,gstat.last_list_time,gstat.last_object_time,
+			gstat.last_timer_time,gstat.last_string_time,gstat.longest_time);
+
+	aprintf("----\n");
+	for (i=0;i<NUM_CHANNELS;i++)
+	{
+		GetChannelStats(i,&cstat);
+		aprintf("Channel %s wrote %i lines, %i repeated, %i over the limit, %i dropped\n",
+			cstat.name,cstat.written,cstat.repeated,cstat.limited,cstat.dropped);
+	}
 
 	if (IsGameLocked())
 		aprintf("The game is LOCKED (%s)\n",GetGameLockedReason());
@@ -1376,6 +1590,12 @@ void AdminShowMemory(int session_id,admin_parm_type parms[],
 {
 	int i,total;
 	memory_statistics *mstat;
+	object_statistics ostat;
+	list_node_statistics lstat;
+	string_statistics sstat;
+	bof_statistics bstat;
+	buffer_pool_statistics pstat;
+	resource_statistics rstat;
 
 	aprintf("System Memory -----------------------------\n");
 
@@ -1391,6 +1611,60 @@ void AdminShowMemory(int session_id,admin_parm_type parms[],
 	}
 	aprintf("%-20s %4lu MB\n","-- Total",total/1024/1024);
 
+	GetObjectStats(&ostat);
+	aprintf("----\n");
+	aprintf("Object slots %i of %i allocated, %i live, %i dead\n",
+		ostat.num_slots,ostat.max_slots,ostat.num_live,ostat.num_slots - ostat.num_live);
+	aprintf("Free object slots %i (%i held until the next epoch), reused %i since last garbage collection\n",
+		ostat.num_free,ostat.num_held,ostat.num_reused);
+	aprintf("Property pools %i, arrays %i used %i free (%i bytes free)\n",
+		ostat.num_prop_pools,ostat.prop_arrays_used,ostat.prop_arrays_free,
+		ostat.prop_bytes_free);
+
+	GetListNodeStats(&lstat);
+	aprintf("List nodes %i of %i in %i chunks, %i live, %i free\n",
+		lstat.num_nodes,lstat.num_chunks*lstat.chunk_nodes,lstat.num_chunks,
+		lstat.num_live,lstat.num_free);
+	aprintf("List node conses %lli, %lli reused and %lli reclaimed since last garbage collection\n",
+		(long long)lstat.num_allocated,(long long)lstat.num_reused,(long long)lstat.num_freed);
+	aprintf("List node chunks %i allocated, %i freed\n",
+		lstat.num_chunks_allocated,lstat.num_chunks_freed);
+
+	GetStringStats(&sstat);
+	aprintf("Strings %i with %i distinct texts, %lli shared\n",
+		sstat.num_strings,sstat.num_bodies,(long long)sstat.num_shared);
+	aprintf("String text %lli bytes stored for %lli bytes in use (%lli saved)\n",
+		(long long)sstat.body_bytes,(long long)sstat.text_bytes,
+		(long long)(sstat.text_bytes - sstat.body_bytes));
+	aprintf("String arena %i blocks, %lli bytes free, %i large texts, %i hash buckets\n",
+		sstat.num_arena_blocks,(long long)sstat.arena_free_bytes,
+		sstat.num_large_bodies,sstat.num_buckets);
+
+	GetResourceStats(&rstat);
+	aprintf("Resources %i in a table of %i, %i dynamic in a table of %i\n",
+		rstat.num_resources,rstat.max_id,rstat.num_dynamic,rstat.max_dynamic_id);
+	aprintf("Resource text %lli bytes in %i distinct texts, arena %i blocks of %lli bytes\n",
+		(long long)rstat.text_bytes,rstat.num_texts,rstat.num_arena_blocks,
+		(long long)rstat.arena_bytes);
+
+	GetBofStats(&bstat);
+	if (bstat.resident_bytes < 0)
+		aprintf("Bof files %i mapped (%lli bytes), %i read (%lli bytes)\n",
+			bstat.num_mapped,(long long)bstat.mapped_bytes,
+			bstat.num_read,(long long)bstat.read_bytes);
+	else
+		aprintf("Bof files %i mapped (%lli bytes, %lli resident), %i read (%lli bytes)\n",
+			bstat.num_mapped,(long long)bstat.mapped_bytes,(long long)bstat.resident_bytes,
+			bstat.num_read,(long long)bstat.read_bytes);
+
+	GetBufferPoolStats(&pstat);
+	for (i=0;i<NUM_BUFFER_CLASSES;i++)
+		aprintf("Buffers of %5i bytes %i in use, %i pooled, %i trimmed, %i%% of %i gets from pool\n",
+			pstat.size[i],pstat.num_outstanding[i],pstat.num_pooled[i],pstat.num_trimmed[i],
+			pstat.num_gets[i] == 0 ? 100 :
+			(int)(100.0*(pstat.num_gets[i] - pstat.num_allocs[i])/pstat.num_gets[i]),
+			pstat.num_gets[i]);
+
 	aprintf("-------------------------------------------\n");
 }
 
@@ -1429,6 +1703,208 @@ void AdminShowCalled(int session_id,admin_parm_type parms[],
 
 }
 
+static send_cache_entry **admin_send_cache_sites;
+static int admin_send_cache_count;
+void AdminShowSendCache(int session_id,admin_parm_type parms[],
+                        int num_blak_parm,parm_node blak_parm[])
+{
+	send_cache_statistics stat;
+	send_cache_entry *e;
+	class_node *caller,*receiver;
+	char site[100];
+	int i,num_show,num_sites;
+
+	num_show = (int)parms[0];
+
+	num_show = std::max(1,num_show);
+	num_show = std::min(500,num_show);
+
+	GetSendCacheStats(&stat);
+	aprintf("Send inline caches at %i call sites, %lli hits and %lli misses\n",
+		stat.num_sites,stat.hits,stat.misses);
+	if (stat.num_sites == 0)
+		return;
+
+	num_sites = stat.num_sites;
+	admin_send_cache_sites = (send_cache_entry **)
+		AllocateMemory(MALLOC_ID_MESSAGE,num_sites*sizeof(send_cache_entry *));
+	admin_send_cache_count = 0;
+	ForEachSendCacheSite(AdminCollectSendCacheSite);
+	qsort(admin_send_cache_sites,admin_send_cache_count,sizeof(send_cache_entry *),
+		AdminCompareSendCacheSites);
+
+	aprintf("%4s %-30s %-22s %-22s %10s %6s\n","Rank","Call site","Message",
+		"Receiver class","Sends","Hits");
+	for (i=0;i<std::min(num_show,admin_send_cache_count);i++)
+	{
+		e = admin_send_cache_sites[i];
+		caller = GetClassByID(e->caller_class_id);
+		receiver = GetClassByID(e->class_id);
+		if (caller == NULL)
+			sprintf(site,"Unknown");
+		else
+			sprintf(site,"%.22s:%i",caller->class_name,GetSourceLine(caller,e->call_site));
+		aprintf("%3i. %-30s %-22s %-22s %10i %5i%%\n",i+1,site,
+			e->message_id == INVALID_ID ? "-" : GetNameByID(e->message_id),
+			receiver == NULL ? "-" : receiver->class_name,
+			e->hits + e->misses,
+			(int)(100.0*e->hits/std::max(1,e->hits + e->misses)));
+	}
+
+	FreeMemory(MALLOC_ID_MESSAGE,admin_send_cache_sites,num_sites*sizeof(send_cache_entry *));
+	admin_send_cache_sites = NULL;
+}
+
+void AdminCollectSendCacheSite(send_cache_entry *e)
+{
+	admin_send_cache_sites[admin_send_cache_count++] = e;
+}
+
+/* most sends first */
+int AdminCompareSendCacheSites(const void *a,const void *b)
+{
+	send_cache_entry *e1,*e2;
+
+	e1 = *(send_cache_entry **)a;
+	e2 = *(send_cache_entry **)b;
+	if (e1->hits + e1->misses != e2->hits + e2->misses)
+		return (e1->hits + e1->misses > e2->hits + e2->misses) ? -1 : 1;
+	return 0;
+}
+
+static census_site **admin_census_sites;
+static int admin_census_count;
+static census_class **admin_census_classes;
+static int admin_census_class_count;
+
+void AdminShowCensus(int session_id,admin_parm_type parms[],
+                     int num_blak_parm,parm_node blak_parm[])
+{
+	census_statistics stat;
+	census_site *s;
+	class_node *c;
+	char site[100];
+	int i,num_show,kind;
+
+	num_show = (int)parms[0];
+
+	num_show = std::max(1,num_show);
+	num_show = std::min(500,num_show);
+
+	TakeCensus(&stat);
+
+	aprintf("Census of live nodes, %s allocation sites (%i sites so far)\n",
+		stat.recording ? "recording" : "not recording",stat.num_sites);
+	for (kind=0;kind<NUM_CENSUS_KINDS;kind++)
+		aprintf("%-10s %9i live of %9i, %9i made while not recording\n",
+			GetCensusKindName(kind),stat.num_live[kind],stat.num_used[kind],
+			stat.num_unrecorded[kind]);
+
+	if (stat.num_sites > 0)
+	{
+		admin_census_sites = (census_site **)
+			AllocateMemory(MALLOC_ID_CENSUS,stat.num_sites*sizeof(census_site *));
+		admin_census_count = 0;
+		ForEachCensusSite(AdminCollectCensusSite);
+		qsort(admin_census_sites,admin_census_count,sizeof(census_site *),
+			AdminCompareCensusSites);
+
+		aprintf("%4s %-10s %-30s %-26s %9s %11s\n","Rank","Kind","Allocation site",
+			"Message","Live","Allocated");
+		for (i=0;i<std::min(num_show,admin_census_count);i++)
+		{
+			s = admin_census_sites[i];
+			c = GetClassByID(s->class_id);
+			if (c == NULL)
+				sprintf(site,"(server)");
+			else
+				sprintf(site,"%.22s:%i",c->class_name,GetSourceLine(c,s->bkod_ptr));
+			aprintf("%3i. %-10s %-30s %-26.26s %9i %11lli\n",i+1,GetCensusKindName(s->kind),site,
+				s->message_id == INVALID_ID ? "-" : GetNameByID(s->message_id),
+				s->num_live,(long long)s->num_allocated);
+		}
+
+		FreeMemory(MALLOC_ID_CENSUS,admin_census_sites,stat.num_sites*sizeof(census_site *));
+		admin_census_sites = NULL;
+	}
+
+	if (stat.num_classes > 0)
+	{
+		admin_census_classes = (census_class **)
+			AllocateMemory(MALLOC_ID_CENSUS,stat.num_classes*sizeof(census_class *));
+		admin_census_class_count = 0;
+		ForEachCensusClass(AdminCollectCensusClass);
+		qsort(admin_census_classes,admin_census_class_count,sizeof(census_class *),
+			AdminCompareCensusClasses);
+
+		aprintf("%4s %-26s %9s %10s %9s %7s\n","Rank","Holding class","Objects",
+			"List nodes","Strings","Timers");
+		for (i=0;i<std::min(num_show,admin_census_class_count);i++)
+		{
+			c = GetClassByID(admin_census_classes[i]->class_id);
+			AdminShowCensusClass(i+1,c == NULL ? "(unknown)" : c->class_name,
+				admin_census_classes[i]);
+		}
+
+		FreeMemory(MALLOC_ID_CENSUS,admin_census_classes,stat.num_classes*sizeof(census_class *));
+		admin_census_classes = NULL;
+	}
+	AdminShowCensusClass(0,"(tables and server)",&stat.unowned);
+}
+
+void AdminShowCensusClass(int rank,const char *name,census_class *cc)
+{
+	if (rank == 0)
+		aprintf("%4s ","");
+	else
+		aprintf("%3i. ",rank);
+	aprintf("%-26.26s %9i %10i %9i %7i\n",name,cc->num_live[CENSUS_OBJECT],
+		cc->num_live[CENSUS_LIST],cc->num_live[CENSUS_STRING],cc->num_live[CENSUS_TIMER]);
+}
+
+void AdminCollectCensusSite(census_site *site)
+{
+	admin_census_sites[admin_census_count++] = site;
+}
+
+/* most live first, then most made */
+int AdminCompareCensusSites(const void *a,const void *b)
+{
+	census_site *s1,*s2;
+
+	s1 = *(census_site **)a;
+	s2 = *(census_site **)b;
+	if (s1->num_live != s2->num_live)
+		return (s1->num_live > s2->num_live) ? -1 : 1;
+	if (s1->num_allocated != s2->num_allocated)
+		return (s1->num_allocated > s2->num_allocated) ? -1 : 1;
+	return 0;
+}
+
+void AdminCollectCensusClass(census_class *cc)
+{
+	admin_census_classes[admin_census_class_count++] = cc;
+}
+
+/* holding the most first */
+int AdminCompareCensusClasses(const void *a,const void *b)
+{
+	census_class *c1,*c2;
+	int total1,total2,kind;
+
+	c1 = *(census_class **)a;
+	c2 = *(census_class **)b;
+	total1 = total2 = 0;
+	for (kind=0;kind<NUM_CENSUS_KINDS;kind++)
+	{
+		total1 += c1->num_live[kind];
+		total2 += c2->num_live[kind];
+	}
+	if (total1 != total2)
+		return (total1 > total2) ? -1 : 1;
+	return 0;
+}
+
 void AdminShowCalledClass(class_node *c)
 {
 	int i;
@@ -1786,9 +2262,10 @@ void AdminShowOneAccount(account_node *a)
 		ch = types[a->type];
 
    // Check the suspend time.  We don't print a negative time.
-   if (a->suspend_time <= GetTime())
+   if (a->suspend_time != 0 && a->suspend_time <= GetTime())
    {
       a->suspend_time = 0;
+      MarkAccountDirty(a);
    }
 
    if (a->suspend_time > 0)
@@ -1894,7 +2371,7 @@ void AdminShowOneTimer(timer_node *t)
 		return;
 	}
 
-	expire_time = (int)(t->time - GetMilliCount());
+	expire_time = (int)(t->time - GetGameMilliCount());
 
 	aprintf("%5i  %-14u%-8i%-20s\n",t->timer_id,expire_time,
 		t->object_id,GetNameByID(t->message_id));
@@ -1906,6 +2383,12 @@ void AdminShowTime(int session_id,admin_parm_type parms[],
 	INT64 now = GetTime();
 
 	aprintf("Current server clock reads %lli (%s).\n", now, TimeStr(now));
+	if (GetGameTime() != now || IsGameClockStopped())
+	{
+		now = GetGameTime();
+		aprintf("Game clock reads %lli (%s)%s.\n", now, TimeStr(now),
+			IsGameClockStopped() ? ", in a time warp" : "");
+	}
 }
 
 void AdminShowConfiguration(int session_id,admin_parm_type parms[],
@@ -1996,7 +2479,9 @@ void AdminShowEachSysTimer(systimer_node *st)
 	case SYST_BLAKOD_HOUR : s = "New Blakod hour"; break;
 	case SYST_INTERFACE_UPDATE : s = "Update interface"; break;
 	case SYST_RESET_TRANSMITTED : s = "Reset transmit count"; break;
-	case SYST_RESET_POOL : s = "Reset buffer pool"; break;
+	case SYST_RESET_POOL : s = "Trim buffer pool"; break;
+	case SYST_REOPEN_CHANNELS : s = "Reopen channels"; break;
+	case SYST_RECLAIM : s = "Reclaim objects and lists"; break;
 	default : s = "Unknown"; break;
 	}
 	aprintf("%i %-18s %-15s ",st->systimer_type,s,RelativeTimeStr(st->period));
@@ -2112,7 +2597,6 @@ void AdminShowMessage(int session_id,admin_parm_type parms[],
 {
 	class_node *c,*found_class;
 	message_node *m;
-	char *bkod_ptr;
 	int i,num_parms;
 	int parm_id;
 	val_type parm_init_value;
@@ -2152,19 +2636,11 @@ void AdminShowMessage(int session_id,admin_parm_type parms[],
 	aprintf("\n");
 	aprintf("--------------------------------------------------------------\n");
 	aprintf("  Parameters:\n");
-	/* we need to read the first few bytes from the bkod to get the parms */
-	bkod_ptr = m->handler;
-	/* # of local vars at this byte */
-	bkod_ptr++;
-	num_parms = *bkod_ptr;
-	bkod_ptr++;
-
+	num_parms = m->num_parms;
 	for (i=0;i<num_parms;i++)
 	{
-		parm_id = *((int *)bkod_ptr);
-		bkod_ptr += 4;
-		parm_init_value.int_val = *((int *)bkod_ptr);
-		bkod_ptr += 4;
+		parm_id = m->parms[i].parm_id;
+		parm_init_value = m->parm_defaults[m->parms[i].slot];
 
 		aprintf("  %-20s %s %s\n",GetNameByID(parm_id),GetTagName(parm_init_value),
 			GetDataName(parm_init_value));
@@ -2221,6 +2697,9 @@ void AdminShowClass(int session_id,admin_parm_type parms[],
    for (i=0;i<c->num_messages;i++)
       aprintf(": MSG %s\n",GetNameByID(c->messages[i].message_id));
 
+	aprintf(": INSTANCES %i, %i with subclasses\n",GetClassInstanceCount(c,False),
+		GetClassInstanceCount(c,True));
+
 	aprintf(":>\n");
 
 }
@@ -2228,10 +2707,9 @@ void AdminShowClass(int session_id,admin_parm_type parms[],
 void AdminShowInstances(int session_id,admin_parm_type parms[],
                         int num_blak_parm,parm_node blak_parm[])
 {
-	int i, m;
+	int i, m, max_ids;
+	int *ids;
 	class_node *c;
-	extern object_node* objects;
-	extern int num_objects;
 
 	char *class_str;
 	class_str = (char *)parms[0];
@@ -2244,21 +2722,12 @@ void AdminShowInstances(int session_id,admin_parm_type parms[],
 	}
 
 	aprintf(":< instances of CLASS %s (%i)\n:",c->class_name,c->class_id);
-	m = 0;
-	for (i = 0; i < num_objects; i++)
-	{
-		class_node* wc = GetClassByID(objects[i].class_id);
-		while (wc)
-		{
-			if (wc == c)
-			{
-				aprintf(" OBJECT %i", i);
-				m++;
-				break;
-			}
-			wc = wc->super_ptr;
-		}
-	}
+	max_ids = GetClassInstanceCount(c,True);
+	ids = (int *)AllocateMemory(MALLOC_ID_OBJECT,std::max(max_ids,1)*sizeof(int));
+	m = CopyClassInstances(c,ids);
+	for (i = 0; i < m; i++)
+		aprintf(" OBJECT %i", ids[i]);
+	FreeMemory(MALLOC_ID_OBJECT,ids,std::max(max_ids,1)*sizeof(int));
 	aprintf("\n: %i total", m);
 	aprintf("\n:>\n");
 }
@@ -2266,7 +2735,8 @@ void AdminShowInstances(int session_id,admin_parm_type parms[],
 void AdminShowMatches(int session_id,admin_parm_type parms[],
                       int num_blak_parm,parm_node blak_parm[])
 {
-	int i, m;
+	int i, k, m, num_ids, max_ids;
+	int *ids;
 	class_node *c;
 	val_type match;
 	char* class_str;
@@ -2279,7 +2749,6 @@ void AdminShowMatches(int session_id,admin_parm_type parms[],
 	int data_int;
 	int property_id;
 	extern object_node* objects;
-	extern int num_objects;
 	enum { none=0,isequal=1,isgreater=2,isless=4,sametag=8,difftag=16 };
 	int matchtype;
 
@@ -2357,64 +2826,60 @@ void AdminShowMatches(int session_id,admin_parm_type parms[],
 		c->class_name,c->class_id, property_str, relation_str,
 		GetTagName(match), GetDataName(match));
 
+	max_ids = GetClassInstanceCount(c,True);
+	ids = (int *)AllocateMemory(MALLOC_ID_OBJECT,std::max(max_ids,1)*sizeof(int));
+	num_ids = CopyClassInstances(c,ids);
+
 	m = 0;
-	for (i = 0; i < num_objects; i++)
+	for (k = 0; k < num_ids; k++)
 	{
-		class_node* wc = GetClassByID(objects[i].class_id);
-		class_node* thisc = wc;
-		while (wc)
-		{
-			if (wc == c)
-			{
-				val_type thisv;
-				int thismatch;
+		i = ids[k];
+		class_node* thisc = GetClassByID(objects[i].class_id);
+		val_type thisv;
+		int thismatch;
 
 #if 0
-				property_id = GetPropertyIDByName(thisc,property_str);
-				if (property_id == INVALID_PROPERTY)
-				{
-					aprintf("Property %s doesn't exist (at least for CLASS %s (%i)).\n",
-						property_str,thisc->class_name,thisc->class_id);
-					break;
-				}
+		property_id = GetPropertyIDByName(thisc,property_str);
+		if (property_id == INVALID_PROPERTY)
+		{
+			aprintf("Property %s doesn't exist (at least for CLASS %s (%i)).\n",
+				property_str,thisc->class_name,thisc->class_id);
+			break;
+		}
 #endif
 
-				// This object's property's value.
-				thisv = objects[i].p[property_id].val;
-
-				// Compare it to the match value.
-				thismatch = 0;
-				if (thisv.v.tag == match.v.tag)
-					thismatch |= sametag;
-				else
-					thismatch |= difftag;
-				if (thisv.v.tag == TAG_INT)
-				{
-					if ((int)thisv.v.data > (int)match.v.data) thismatch |= isgreater;
-					if ((int)thisv.v.data < (int)match.v.data) thismatch |= isless;
-				}
-				else
-				{
-					if ((unsigned int)thisv.v.data > (unsigned int)match.v.data) thismatch |= isgreater;
-					if ((unsigned int)thisv.v.data < (unsigned int)match.v.data) thismatch |= isless;
-				}
-				if (thisv.v.data == match.v.data) thismatch |= isequal;
+		// This object's property's value.
+		thisv = objects[i].p[property_id].val;
 
-				// If it compares favorably according to the relationship requested, show it.
-				if ((thismatch &  (sametag|difftag)) == (matchtype &  (sametag|difftag)) &&
-					(thismatch & ~(sametag|difftag)) &  (matchtype & ~(sametag|difftag)))
-				{
-					aprintf(": OBJECT %i CLASS %s (%i) %s = %s %s\n",
-						i, thisc->class_name, thisc->class_id, property_str,
-						GetTagName(thisv), GetDataName(thisv));
-					m++;
-				}
+		// Compare it to the match value.
+		thismatch = 0;
+		if (thisv.v.tag == match.v.tag)
+			thismatch |= sametag;
+		else
+			thismatch |= difftag;
+		if (thisv.v.tag == TAG_INT)
+		{
+			if ((int)thisv.v.data > (int)match.v.data) thismatch |= isgreater;
+			if ((int)thisv.v.data < (int)match.v.data) thismatch |= isless;
+		}
+		else
+		{
+			if ((unsigned int)thisv.v.data > (unsigned int)match.v.data) thismatch |= isgreater;
+			if ((unsigned int)thisv.v.data < (unsigned int)match.v.data) thismatch |= isless;
+		}
+		if (thisv.v.data == match.v.data) thismatch |= isequal;
 
-				break;
-			}
-			wc = wc->super_ptr;
+		// If it compares favorably according to the relationship requested, show it.
+		if ((thismatch &  (sametag|difftag)) == (matchtype &  (sametag|difftag)) &&
+			(thismatch & ~(sametag|difftag)) &  (matchtype & ~(sametag|difftag)))
+		{
+			aprintf(": OBJECT %i CLASS %s (%i) %s = %s %s\n",
+				i, thisc->class_name, thisc->class_id, property_str,
+				GetTagName(thisv), GetDataName(thisv));
+			m++;
 		}
 	}
+	FreeMemory(MALLOC_ID_OBJECT,ids,std::max(max_ids,1)*sizeof(int));
 	aprintf(": %i total\n", m);
 	aprintf(":>\n");
 }
@@ -2879,6 +3344,7 @@ void AdminSetAccountCredits(int session_id,admin_parm_type parms[],
 	}
 	lprintf("AdminSetAccountCredits setting account %i to have %i credits\n",account_id,credits);
 	a->credits = 100*credits + 5;
+	MarkAccountDirty(a);
 }
 
 void AdminSetAccountObject(int session_id,admin_parm_type parms[],
@@ -3865,10 +4331,10 @@ void AdminSendObject(int session_id,admin_parm_type parms[],
 			int len;
 			if (rnod && rnod->resource_val && *rnod->resource_val)
 			{
-            len = std::min(strlen(rnod->resource_val), (size_t) 60);
+            len = std::min(rnod->len_val, 60);
 			  aprintf(":   == \"");
 			  AdminBufferSend(rnod->resource_val, len);
-			  if (len < (int)strlen(rnod->resource_val))
+			  if (len < rnod->len_val)
 			    aprintf("...");
 			  aprintf("\"\n");
 			}
@@ -4048,6 +4514,7 @@ void AdminAddCredits(int session_id,admin_parm_type parms[],
 	}
 	lprintf("AdminAddAccount adding %i credits to ACCOUNT %i (%s)\n",credits,account_id,a->name);
 	a->credits += 100*credits;
+	MarkAccountDirty(a);
 }
 
 void AdminKickoffAll(int session_id,admin_parm_type parms[],
@@ -4192,8 +4659,6 @@ void AdminHangupUser(int session_id,admin_parm_type parms[],
 	HangupSession(hangup_session);
 }
 
-extern block_node* FindBlock(struct in_addr* piaPeer);
-
 /*
  * AdminBlockIP - Block an IP address from accessing this server
  */
@@ -4202,17 +4667,18 @@ void AdminBlockIP(int session_id,admin_parm_type parms[],
                   int num_blak_parm,parm_node blak_parm[])
 {
 	struct in_addr blocktoAdd;
+	int prefix;
 	char *arg_str = (char *)parms[0];
 
 	aprintf("This command will only affect specified IPs until the server reboots\n");
 
-	if( ( blocktoAdd.s_addr = inet_addr( arg_str ) ) != -1 ) {
-		if(FindBlock( &blocktoAdd ) == NULL )  {
-			AddBlock(-1, &blocktoAdd);
-			aprintf("IP %s blocked\n",inet_ntoa( blocktoAdd ) );
+	if( ParseBlockAddress( arg_str, &blocktoAdd, &prefix ) ) {
+		if( !FindBlockRange( &blocktoAdd, prefix ) )  {
+			AddBlockRange(-1, &blocktoAdd, prefix);
+			aprintf("IP %s/%i blocked\n",inet_ntoa( blocktoAdd ), prefix );
 		} else {
-			DeleteBlock( &blocktoAdd );
-			aprintf("IP %s has been unblocked\n" ,inet_ntoa( blocktoAdd ) );
+			DeleteBlockRange( &blocktoAdd, prefix );
+			aprintf("IP %s/%i has been unblocked\n" ,inet_ntoa( blocktoAdd ), prefix );
 		}
 	}  else {
 		aprintf("Couldn`t build IP address bad format %s\n",arg_str );
@@ -4323,6 +4789,9 @@ void AdminReloadSystem(int session_id,admin_parm_type parms[],
 {
 	lprintf("AdminReloadSystem reloading system\n");
 
+	/* a replay couldn't follow the game through this */
+	StopRecording();
+
 	PauseTimers();
 	aprintf("Garbage collecting and saving game... ");
 
@@ -4354,6 +4823,7 @@ void AdminReloadSystem(int session_id,admin_parm_type parms[],
 	AdminSendBufferList();
 
 	LoadMotd();
+	StartPreload(False);
 	LoadBof();
 	LoadRsc();
 
@@ -4365,6 +4835,7 @@ void AdminReloadSystem(int session_id,admin_parm_type parms[],
 	/* can't reload accounts because sessions have pointers to accounts */
 	if (!LoadAllButAccount())
 		eprintf("AdminReload couldn't load game.  You are dead.\n");
+	EndPreload();
 
 	AddBuiltInDLlist();
 
@@ -4397,6 +4868,9 @@ void AdminReloadGame(int session_id,admin_parm_type parms[],
 		return;
 	}
 
+	/* a replay couldn't follow the game through this */
+	StopRecording();
+
 	aprintf("Unloading game... ");
 	AdminSendBufferList();
 	ResetRoomData();
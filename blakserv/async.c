@@ -29,12 +29,18 @@ void AsyncSocketWrite(SOCKET sock);
 void AsyncSocketRead(SOCKET sock);
 
 #define MAX_MAINTENANCE_MASKS 15
-char *maintenance_masks[MAX_MAINTENANCE_MASKS];
+/* parsed once at startup: a peer matches a mask if it has the same bytes
+   wherever the mask address has a non-zero byte */
+unsigned int maintenance_addrs[MAX_MAINTENANCE_MASKS];
+unsigned int maintenance_byte_masks[MAX_MAINTENANCE_MASKS];
 int num_maintenance_masks = 0;
-char *maintenance_buffer = NULL;
 
 void InitAsyncConnections(void)
 {
+	char *maintenance_buffer,*mask_str;
+	unsigned int mask_addr,byte_mask;
+	int shift;
+
 #ifdef BLAK_PLATFORM_WINDOWS
 	WSADATA WSAData;
 
@@ -49,24 +55,30 @@ void InitAsyncConnections(void)
 	strcpy(maintenance_buffer,ConfigStr(SOCKET_MAINTENANCE_MASK));
 
 	// now parse out each maintenance ip
-	maintenance_masks[num_maintenance_masks] = strtok(maintenance_buffer,";");
-	while (maintenance_masks[num_maintenance_masks] != NULL)
-	{
-		num_maintenance_masks++;
-		if (num_maintenance_masks == MAX_MAINTENANCE_MASKS)
-			break;
-		maintenance_masks[num_maintenance_masks] = strtok(NULL,";");
-	}
-
-	/*
+	num_maintenance_masks = 0;
+	mask_str = strtok(maintenance_buffer,";");
+	while (mask_str != NULL && num_maintenance_masks < MAX_MAINTENANCE_MASKS)
 	{
-		int i;
-		for (i=0;i<num_maintenance_masks;i++)
+		mask_addr = inet_addr(mask_str);
+		if (mask_addr == INADDR_NONE)
+		{
+			eprintf("InitAsyncConnections has invalid configured mask %s\n",mask_str);
+		}
+		else
 		{
-			dprintf("mask %i is [%s]\n",i,maintenance_masks[i]);
+			byte_mask = 0;
+			for (shift=0;shift<32;shift+=8)
+				if ((mask_addr >> shift) & 0xff)
+					byte_mask |= 0xffu << shift;
+
+			maintenance_addrs[num_maintenance_masks] = mask_addr;
+			maintenance_byte_masks[num_maintenance_masks] = byte_mask;
+			num_maintenance_masks++;
 		}
+		mask_str = strtok(NULL,";");
 	}
-	*/
+
+	free(maintenance_buffer);
 }
 
 void ExitAsyncConnections(void)
@@ -81,10 +93,15 @@ void AsyncSocketStart(void)
 {
 	AcceptSocketConnections(ConfigInt(SOCKET_PORT),SOCKET_PORT);
 	AcceptSocketConnections(ConfigInt(SOCKET_MAINTENANCE_PORT),SOCKET_MAINTENANCE_PORT);
+#ifdef BLAK_PLATFORM_LINUX
+	if (ConfigInt(SOCKET_METRICS_PORT) != 0)
+		AcceptSocketConnections(ConfigInt(SOCKET_METRICS_PORT),SOCKET_METRICS_PORT);
+#endif
 }
 
 /* connection_type is either SOCKET_PORT or SOCKET_MAINTENANCE_PORT, so we
-keep track of what state to send clients into. */
+keep track of what state to send clients into, or SOCKET_METRICS_PORT,
+which only listens on the loopback address. */
 void AcceptSocketConnections(int socket_port,int connection_type)
 {
 	SOCKET sock;
@@ -129,7 +146,10 @@ void AcceptSocketConnections(int socket_port,int connection_type)
 
 	memset(&sin,0,sizeof sin);
 	sin.sin_family = AF_INET;
-	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (connection_type == SOCKET_METRICS_PORT)
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	else
+		sin.sin_addr.s_addr = htonl(INADDR_ANY);
 	sin.sin_port = htons((short)socket_port);
 
 	if (bind(sock,(struct sockaddr *) &sin,sizeof(sin)) == SOCKET_ERROR)
@@ -192,6 +212,13 @@ void AsyncSocketAccept(SOCKET sock,int event,int error,int connection_type)
         eprintf("AcceptSocketConnections error setting non-blocking\n");
         return;
     }
+
+	/* a scrape, not a session */
+	if (connection_type == SOCKET_METRICS_PORT)
+	{
+		MetricsAccept(new_sock);
+		return;
+	}
 #endif
 
 	peer_len = sizeof peer_info;
@@ -211,6 +238,7 @@ void AsyncSocketAccept(SOCKET sock,int event,int error,int connection_type)
 		if (!CheckMaintenanceMask(&peer_info,peer_len))
 		{
 			lprintf("Blocked maintenance connection from %s.\n", conn.name);
+			CountMaintenanceRefused();
 			closesocket(new_sock);
 			return;
 		}
@@ -223,6 +251,14 @@ void AsyncSocketAccept(SOCKET sock,int event,int error,int connection_type)
 			closesocket(new_sock);
 			return;
 		}
+
+		/* CheckConnectRate logs when an address starts being limited, so a
+		   flood doesn't log every connection */
+		if (!CheckConnectRate(&peer_addr))
+		{
+			closesocket(new_sock);
+			return;
+		}
 	}
 
 	conn.type = CONN_SOCKET;
@@ -233,6 +269,7 @@ void AsyncSocketAccept(SOCKET sock,int event,int error,int connection_type)
 	s = CreateSession(conn);
 	if (s != NULL)
 	{
+		CountMetric(METRIC_CONNECTIONS,1);
 		StartAsyncSession(s);
 
 		switch (connection_type)
@@ -263,64 +300,16 @@ void AsyncSocketAccept(SOCKET sock,int event,int error,int connection_type)
 	LeaveServerLock();
 }
 
-#ifdef BLAK_PLATFORM_WINDOWS
-#define IN_ADDR_HELPER(x) x.S_un.S_addr
-#elif BLAK_PLATFORM_LINUX
-#define IN_ADDR_HELPER(x) x.s_addr
-#endif
-
 Bool CheckMaintenanceMask(SOCKADDR_IN *addr,int len_addr)
 {
-	IN_ADDR mask;
+	unsigned int peer;
 	int i;
 
+	peer = addr->sin_addr.s_addr;
 	for (i=0;i<num_maintenance_masks;i++)
 	{
-		IN_ADDR_HELPER(mask) = inet_addr(maintenance_masks[i]);
-		if (IN_ADDR_HELPER(mask) == INADDR_NONE)
-		{
-			eprintf("CheckMaintenanceMask has invalid configured mask %s\n",
-					  maintenance_masks[i]);
-			continue;
-		}
-
-		unsigned char b1 = (unsigned char)((IN_ADDR_HELPER(mask) & 0xff000000) >> 24);
-		unsigned char b2 = (unsigned char)((IN_ADDR_HELPER(mask) & 0x00ff0000) >> 16);
-		unsigned char b3 = (unsigned char)((IN_ADDR_HELPER(mask) & 0x0000ff00) >> 8);
-		unsigned char b4 = (unsigned char)(IN_ADDR_HELPER(mask) & 0xff);
-		/* for each byte of the mask, if it's non-zero, the client must match it */
-
-		unsigned char addr_b1 = (unsigned char)((IN_ADDR_HELPER(addr->sin_addr) & 0xff000000) >> 24);
-		unsigned char addr_b2 = (unsigned char)((IN_ADDR_HELPER(addr->sin_addr) & 0x00ff0000) >> 16);
-		unsigned char addr_b3 = (unsigned char)((IN_ADDR_HELPER(addr->sin_addr) & 0x0000ff00) >> 8);
-		unsigned char addr_b4 = (unsigned char)((IN_ADDR_HELPER(addr->sin_addr) & 0xff));
-
-		if ((b1 != 0) && (addr_b1 != b1))
-			continue;
-
-		if ((b2 != 0) && (addr_b2 != b2))
-			continue;
-
-		if ((b3 != 0) && (addr_b3 != b3))
-			continue;
-
-		if ((b4 != 0) && (addr_b4 != b4))
-			continue;
-
-		/*
-		dprintf("%u\n",addr_b1);
-		dprintf("%u\n",addr_b2);
-		dprintf("%u\n",addr_b3);
-		dprintf("%u\n",addr_b4);
-
-		  dprintf("----\n");
-
-			dprintf("%u\n",b1);
-			dprintf("%u\n",b2);
-			dprintf("%u\n",b3);
-			dprintf("%u\n",b4);
-	*/
-		return True;
+		if ((peer & maintenance_byte_masks[i]) == (maintenance_addrs[i] & maintenance_byte_masks[i]))
+			return True;
 	}
 	return False;
 }
@@ -417,9 +406,7 @@ void AsyncSocketClose(SOCKET sock)
 
 void AsyncSocketWrite(SOCKET sock)
 {
-	int bytes;
 	session_node *s;
-	buffer_node *bn;
 
 	s = GetSessionBySocket(sock);
 	if (s == NULL)
@@ -435,6 +422,22 @@ void AsyncSocketWrite(SOCKET sock)
 		return;
 	}
 
+	AsyncSessionWrite(s);
+
+	if (!MutexRelease(s->muxSend))
+		eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+}
+
+/* AsyncSessionWrite
+*
+* Sends as much of the session's send_list as the socket will take.  The
+* caller must hold s->muxSend.
+*/
+void AsyncSessionWrite(session_node *s)
+{
+	int bytes;
+	buffer_node *bn;
+
 	while (s->send_list != NULL)
 	{
 		bn = s->send_list;
@@ -445,8 +448,6 @@ void AsyncSocketWrite(SOCKET sock)
 			if (GetLastError() != WSAEWOULDBLOCK)
 			{
 				/* eprintf("AsyncSocketWrite got send error %i\n",GetLastError()); */
-				if (!MutexRelease(s->muxSend))
-					eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
 				HangupSession(s);
 				return;
 			}
@@ -454,26 +455,27 @@ void AsyncSocketWrite(SOCKET sock)
 			/* dprintf("got write event, but send would block\n"); */
 			break;
 		}
-		else
-		{
-			if (bytes != bn->len_buf)
-				dprintf("async write wrote %i/%i bytes\n",bytes,bn->len_buf);
 
-			transmitted_bytes += bn->len_buf;
+		InterlockedExchangeAdd((LONG *)&transmitted_bytes,bytes);
+		CountMetric(METRIC_BYTES_SENT,bytes);
 
-			s->send_list = bn->next;
-			DeleteBuffer(bn);
+		if (bytes < bn->len_buf)
+		{
+			/* socket's full; keep the rest at the front of the buffer for
+				the next write event */
+			memmove(bn->buf,bn->buf + bytes,bn->len_buf - bytes);
+			bn->len_buf -= bytes;
+			break;
 		}
+
+		s->send_list = bn->next;
+		DeleteBuffer(bn);
 	}
-	if (!MutexRelease(s->muxSend))
-		eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
 }
 
 void AsyncSocketRead(SOCKET sock)
 {
-	int bytes;
 	session_node *s;
-	buffer_node *bn;
 
 	s = GetSessionBySocket(sock);
 	if (s == NULL)
@@ -488,75 +490,68 @@ void AsyncSocketRead(SOCKET sock)
 		return;
 	}
 
-	if (s->receive_list == NULL)
-	{
-		s->receive_list = GetBuffer();
-		/* dprintf("Read0x%08x\n",s->receive_list); */
-	}
+	AsyncSessionRead(s);
+
+	if (!MutexRelease(s->muxReceive))
+		eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
 
-	// find the last buffer in the receive list
-	bn = s->receive_list;
-	while (bn->next != NULL)
-		bn = bn->next;
+	SignalSession(s->session_id);
+}
 
-	// if that buffer is filled to capacity already, get another and append it
-	if (bn->len_buf >= bn->size_buf)
-	{
-		bn->next = GetBuffer();
-		/* dprintf("ReadM0x%08x\n",bn->next); */
-		bn = bn->next;
-	}
+/* AsyncSessionRead
+*
+* Reads everything waiting on the session's socket into its receive
+* buffer.  The caller must hold s->muxReceive.
+*/
+void AsyncSessionRead(session_node *s)
+{
+	int bytes,len;
+	char *ptr;
 
-	// read from the socket, up to the remaining capacity of this buffer
-	bytes = recv(s->conn.socket,bn->buf + bn->len_buf,bn->size_buf - bn->len_buf,0);
-	if (bytes == SOCKET_ERROR)
+	/* read until the socket is empty, since with edge triggered epoll we
+		aren't told about the rest of the data again */
+	for (;;)
 	{
-		if (GetLastError() != WSAEWOULDBLOCK)
+		ptr = GetSessionReceiveSpace(s,&len);
+		if (ptr == NULL)
 		{
-			/* eprintf("AsyncSocketRead got read error %i\n",GetLastError()); */
-			if (!MutexRelease(s->muxReceive))
-				eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+			eprintf("AsyncSocketRead SESSION %i has %i bytes unprocessed, hanging up\n",
+					  s->session_id,GetSessionReadBytes(s));
 			HangupSession(s);
 			return;
 		}
-		if (!MutexRelease(s->muxReceive))
-			eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
-	}
-	if (bytes == 0)
-	{
-		// read of 0 bytes means it's been closed; on windows we're
-		// sent a specific close event instead
-      if (!MutexRelease(s->muxReceive))
-         eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
-		HangupSession(s);
-		return;
-	}
 
+		// recv straight into the free end of the session's buffer
+		bytes = recv(s->conn.socket,ptr,len,0);
+		if (bytes == SOCKET_ERROR)
+		{
+			if (GetLastError() != WSAEWOULDBLOCK)
+			{
+				/* eprintf("AsyncSocketRead got read error %i\n",GetLastError()); */
+				HangupSession(s);
+				return;
+			}
+			break;
+		}
+		if (bytes == 0)
+		{
+			// read of 0 bytes means it's been closed; on windows we're
+			// sent a specific close event instead
+			HangupSession(s);
+			return;
+		}
 
-	if (bytes < 0 || bytes > bn->size_buf - bn->len_buf)
-	{
-		eprintf("AsyncSocketRead got %i bytes from recv() when asked to stop at %i\n",bytes,bn->size_buf - bn->len_buf);
-		FlushDefaultChannels();
-		bytes = 0;
-	}
+		if (bytes < 0 || bytes > len)
+		{
+			eprintf("AsyncSocketRead got %i bytes from recv() when asked to stop at %i\n",bytes,len);
+			FlushDefaultChannels();
+			break;
+		}
 
-	bn->len_buf += bytes;
-
-	/*
-	dprintf("read %i bytes sess %i from %i\n",bytes,s->session_id,s->num_receiving,
-	   s->num_receiving-bytes);
-
-		 if (s->num_receiving > 0)
-		 {
-		 int i;
-		 dprintf("read got in %s\n",GetStateName(s));
-		 for (i=s->num_receiving-bytes;i<s->num_receiving;i++)
-		 dprintf("%5u",s->receiving_buf[i]);
-		 dprintf("\n");
-		 }
-	*/
-	if (!MutexRelease(s->muxReceive))
-		eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+		AddSessionReceivedBytes(s,bytes);
+		CountMetric(METRIC_BYTES_RECEIVED,bytes);
 
-	SignalSession(s->session_id);
+		if (bytes < len)
+			break;
+	}
 }
@@ -19,5 +19,7 @@ void AsyncSocketStart(void);
 void AsyncSocketAccept(SOCKET sock,int event,int error,int connection_type);
 void AsyncNameLookup(HANDLE hLookup,int error);
 void AsyncSocketSelect(SOCKET sock,int event,int error);
+void AsyncSessionRead(session_node *s);
+void AsyncSessionWrite(session_node *s);
 
 #endif
@@ -9,40 +9,99 @@
 * blakres.c
 *
 
-  This module keeps an open hash of resources in memory.  Each
-  resource has an id number, its text, and possibly its name
-  from the kodbase.  The resources are kept in sorted order by resource
-  number so that when changing a dynamic rsc it is clear which dynamic
-  rsc file will be rebuilt, and what resources go in it.
-  
+  This module keeps the resources in memory.  Each resource has an id
+  number, its text, and possibly its name from the kodbase.  The
+  compiler hands out resource ids one after another, so the resources
+  are kept in an array indexed by id rather than a hash table, and
+  dynamic resources in a second array indexed from MIN_DYNAMIC_RSC.
+  Walking either array goes in resource number order, so when changing
+  a dynamic rsc it is clear which dynamic rsc file will be rebuilt, and
+  what resources go in it.
+
+  The text of the resources from the .rsc files never changes, so it's
+  packed into large arena blocks along with the resource nodes, and the
+  same text used by many resources is stored only once.  Each resource
+  keeps the length of its text, so sending one to a client doesn't have
+  to measure it again.
+
 	Dynamic resources are loaded when a game is loaded, and contain
 	character names.  They can be created in admin mode.  They are all
 	resources with value MIN_DYNAMIC_RSC and higher.  They do not have names,
-	just values.
-	
+	just values.  Their text can change, so it is allocated separately.
+
 */
 
 #include "blakserv.h"
 
-static resource_node **resources;
-static int resources_table_size;
+#define RESOURCE_ARENA_BLOCK (64*1024)
+#define INIT_RESOURCE_IDS 4096
+#define INIT_RESOURCE_TEXTS 4096
+
+/* more dynamic resources than we'll ever see; guards against a bad id */
+#define MAX_DYNAMIC_RSC_IDS (16*1024*1024)
+
+typedef struct resource_arena_struct
+{
+	struct resource_arena_struct *next;
+	int size;
+	int used;
+} resource_arena_node;
+
+typedef struct
+{
+	unsigned int hash;
+	int len;
+	char *text;
+} resource_text_node;
+
+static resource_node **resources;			/* by id, below MIN_DYNAMIC_RSC */
+static int max_resources;
+static resource_node **dynamic_resources;	/* by id - MIN_DYNAMIC_RSC */
+static int max_dynamic_resources;
+
+static resource_arena_node *resource_arena;
+static int num_arena_blocks;
+static INT64 arena_bytes;
+
+/* open addressed table of the distinct texts in the arena */
+static resource_text_node *resource_texts;
+static int num_resource_texts,max_resource_texts;
+
+static int num_resources,num_dynamic_resources;
+static INT64 text_bytes;
 
 static int next_dynamic_rsc;
 static sihash_type resource_name_map;
 
 /* local function prototypes */
 void DynamicResourceChangeNotify(session_node *s);
+resource_node ** GetResourceSlot(int id);
+char * AllocateResourceArena(int size);
+void FreeResourceArena(void);
+char * InternResourceText(const char *str,int len);
+void GrowResourceTexts(void);
 
 
 void InitResource(void)
 {
-	int i;
+	resources = NULL;
+	max_resources = 0;
+	dynamic_resources = NULL;
+	max_dynamic_resources = 0;
 
-	resources_table_size = ConfigInt(MEMORY_SIZE_RESOURCE_HASH);
-	resources = (resource_node **)AllocateMemory(MALLOC_ID_RESOURCE,
-																resources_table_size*sizeof(resource_node *));
-	for (i=0;i<resources_table_size;i++)
-		resources[i] = NULL;
+	resource_arena = NULL;
+	num_arena_blocks = 0;
+	arena_bytes = 0;
+
+	max_resource_texts = INIT_RESOURCE_TEXTS;
+	resource_texts = (resource_text_node *)AllocateMemory(MALLOC_ID_RESOURCE,
+		max_resource_texts*sizeof(resource_text_node));
+	memset(resource_texts,0,max_resource_texts*sizeof(resource_text_node));
+	num_resource_texts = 0;
+
+	num_resources = 0;
+	num_dynamic_resources = 0;
+	text_bytes = 0;
 
 	next_dynamic_rsc = MIN_DYNAMIC_RSC;
 
@@ -51,41 +110,238 @@ void InitResource(void)
 
 void ResetResource(void)
 {
-	resource_node *r,*temp;
+	resource_node *r;
 	int i;
 
-	for (i=0;i<resources_table_size;i++)
+	for (i=0;i<max_resources;i++)
 	{
 		r = resources[i];
-		while (r != NULL)
-		{
-			temp = r->next;
-
-			FreeMemory(MALLOC_ID_RESOURCE,r,sizeof(resource_node));
-
-			r = temp;
-		}
+		if (r == NULL)
+			continue;
+		if (r->allocated)
+			FreeMemory(MALLOC_ID_RESOURCE,r->resource_val,r->len_val+1);
+		if (r->resource_name != NULL)
+			FreeMemory(MALLOC_ID_KODBASE,r->resource_name,strlen(r->resource_name)+1);
 		resources[i] = NULL;
 	}
 
+	for (i=0;i<max_dynamic_resources;i++)
+	{
+		r = dynamic_resources[i];
+		if (r == NULL)
+			continue;
+		if (r->allocated)
+			FreeMemory(MALLOC_ID_RESOURCE,r->resource_val,r->len_val+1);
+		dynamic_resources[i] = NULL;
+	}
+
+	/* the nodes and the .rsc text all go with the arena */
+	FreeResourceArena();
+	memset(resource_texts,0,max_resource_texts*sizeof(resource_text_node));
+	num_resource_texts = 0;
+
+	num_resources = 0;
+	num_dynamic_resources = 0;
+	text_bytes = 0;
+
 	FreeSIHash(resource_name_map);
 	resource_name_map = CreateSIHash(ConfigInt(MEMORY_SIZE_RESOURCE_NAME_HASH));
 }
 
+/* GetResourceSlot
+*
+* Returns where resource id goes, growing the arrays to hold it, or NULL
+* if the id can't be a resource.
+*/
+resource_node ** GetResourceSlot(int id)
+{
+	resource_node ***table;
+	int *max_table,index,new_max;
+
+	if (id < 0 || id - MIN_DYNAMIC_RSC >= MAX_DYNAMIC_RSC_IDS)
+		return NULL;
+
+	if (id < MIN_DYNAMIC_RSC)
+	{
+		table = &resources;
+		max_table = &max_resources;
+		index = id;
+	}
+	else
+	{
+		table = &dynamic_resources;
+		max_table = &max_dynamic_resources;
+		index = id - MIN_DYNAMIC_RSC;
+	}
+
+	if (index >= *max_table)
+	{
+		new_max = std::max(*max_table,INIT_RESOURCE_IDS);
+		while (new_max <= index)
+			new_max *= 2;
+		/* the first array can't reach the dynamic ids */
+		if (id < MIN_DYNAMIC_RSC)
+			new_max = std::min(new_max,MIN_DYNAMIC_RSC);
+
+		if (*table == NULL)
+			*table = (resource_node **)AllocateMemory(MALLOC_ID_RESOURCE,
+				new_max*sizeof(resource_node *));
+		else
+			*table = (resource_node **)ResizeMemory(MALLOC_ID_RESOURCE,*table,
+				*max_table*sizeof(resource_node *),new_max*sizeof(resource_node *));
+		memset(*table + *max_table,0,(new_max - *max_table)*sizeof(resource_node *));
+		*max_table = new_max;
+	}
+
+	return &(*table)[index];
+}
+
+/* AllocateResourceArena
+*
+* Memory that lasts until ResetResource, aligned for a resource_node.
+*/
+char * AllocateResourceArena(int size)
+{
+	resource_arena_node *block;
+	int block_size;
+	char *ptr;
+
+	size = (size + 7) & ~7;
+
+	if (resource_arena == NULL || resource_arena->used + size > resource_arena->size)
+	{
+		/* a long text gets a block to itself, so the current one stays open */
+		block_size = std::max(RESOURCE_ARENA_BLOCK,(int)sizeof(resource_arena_node) + size);
+		block = (resource_arena_node *)AllocateMemory(MALLOC_ID_RESOURCE,block_size);
+		block->size = block_size;
+		block->used = sizeof(resource_arena_node);
+		num_arena_blocks++;
+		arena_bytes += block_size;
+
+		if (resource_arena == NULL || block_size == RESOURCE_ARENA_BLOCK)
+		{
+			block->next = resource_arena;
+			resource_arena = block;
+		}
+		else
+		{
+			block->next = resource_arena->next;
+			resource_arena->next = block;
+		}
+	}
+	else
+		block = resource_arena;
+
+	ptr = (char *)block + block->used;
+	block->used += size;
+	return ptr;
+}
+
+void FreeResourceArena(void)
+{
+	resource_arena_node *block,*temp;
+
+	block = resource_arena;
+	while (block != NULL)
+	{
+		temp = block->next;
+		FreeMemory(MALLOC_ID_RESOURCE,block,block->size);
+		block = temp;
+	}
+	resource_arena = NULL;
+	num_arena_blocks = 0;
+	arena_bytes = 0;
+}
+
+/* InternResourceText
+*
+* Returns a null terminated copy of str in the arena, the same one for
+* every resource with this text.
+*/
+char * InternResourceText(const char *str,int len)
+{
+	resource_text_node *t;
+	unsigned int hash,i;
+	int j;
+
+	hash = 2166136261u;
+	for (j=0;j<len;j++)
+		hash = (hash ^ (unsigned char)str[j]) * 16777619u;
+
+	for (i = hash & (max_resource_texts - 1); resource_texts[i].text != NULL;
+		i = (i + 1) & (max_resource_texts - 1))
+	{
+		t = &resource_texts[i];
+		if (t->hash == hash && t->len == len && memcmp(t->text,str,len) == 0)
+			return t->text;
+	}
+
+	t = &resource_texts[i];
+	t->hash = hash;
+	t->len = len;
+	t->text = AllocateResourceArena(len+1);
+	memcpy(t->text,str,len);
+	t->text[len] = 0;
+
+	num_resource_texts++;
+	if (2*num_resource_texts > max_resource_texts)
+	{
+		GrowResourceTexts();
+		/* t moved, but the text didn't */
+		return InternResourceText(str,len);
+	}
+	return t->text;
+}
+
+void GrowResourceTexts(void)
+{
+	resource_text_node *old_texts;
+	int old_max,i;
+	unsigned int j;
+
+	old_texts = resource_texts;
+	old_max = max_resource_texts;
+
+	max_resource_texts *= 2;
+	resource_texts = (resource_text_node *)AllocateMemory(MALLOC_ID_RESOURCE,
+		max_resource_texts*sizeof(resource_text_node));
+	memset(resource_texts,0,max_resource_texts*sizeof(resource_text_node));
+
+	for (i=0;i<old_max;i++)
+	{
+		if (old_texts[i].text == NULL)
+			continue;
+		j = old_texts[i].hash & (max_resource_texts - 1);
+		while (resource_texts[j].text != NULL)
+			j = (j + 1) & (max_resource_texts - 1);
+		resource_texts[j] = old_texts[i];
+	}
+
+	FreeMemory(MALLOC_ID_RESOURCE,old_texts,old_max*sizeof(resource_text_node));
+}
+
 void AddResource(int id,const char *str_value)
 {
-	int hash_num;
+	resource_node **slot;
 	resource_node *new_node;
+	int len;
 
 	/* str_value is not permanent so need to make a copy here!
 		Comes fromloadrsc or adddynamicrsc */
-	
-	if (GetResourceByID(id) != NULL)
+
+	slot = GetResourceSlot(id);
+	if (slot == NULL)
+	{
+		eprintf("AddResource can't add resource num %i, it's out of range\n",id);
+		return;
+	}
+
+	if (*slot != NULL)
 	{
 		eprintf("AddResource can't add resource num %i because it already exists!\n",id);
 		return;
 	}
-	
+
 	/* Ok, also check for dynamic resources being loaded/created here, in that we have
 	to keep track of the next dynamic resource # to use. */
 	if (id >= MIN_DYNAMIC_RSC && id >= next_dynamic_rsc)
@@ -93,18 +349,29 @@ void AddResource(int id,const char *str_value)
 		next_dynamic_rsc = id + 1;
 		/* dprintf("setting next dyn rsc to %i\n",next_dynamic_rsc); */
 	}
-	
-	new_node = (resource_node *)AllocateMemory(MALLOC_ID_RESOURCE,sizeof(resource_node));
+
+	len = strlen(str_value);
+
+	new_node = (resource_node *)AllocateResourceArena(sizeof(resource_node));
 	new_node->resource_id = id;
-	new_node->resource_val = (char *)AllocateMemory(MALLOC_ID_RESOURCE,strlen(str_value)+1);
-	strcpy(new_node->resource_val,str_value);
-	
+	new_node->len_val = len;
+	if (id < MIN_DYNAMIC_RSC)
+	{
+		new_node->resource_val = InternResourceText(str_value,len);
+		new_node->allocated = False;
+		num_resources++;
+	}
+	else
+	{
+		new_node->resource_val = (char *)AllocateMemory(MALLOC_ID_RESOURCE,len+1);
+		memcpy(new_node->resource_val,str_value,len+1);
+		new_node->allocated = True;
+		num_dynamic_resources++;
+	}
 	new_node->resource_name = NULL;
-	
-	/* add to resources table */
-	hash_num = new_node->resource_id % resources_table_size;
-	new_node->next = resources[hash_num];
-	resources[hash_num] = new_node;
+	text_bytes += len + 1;
+
+	*slot = new_node;
 }
 
 void SetResourceName(int id,char *name)
@@ -130,10 +397,10 @@ int AddDynamicResource(const char *str_value)
 {
 	int new_rsc_id;
 	resource_node *r;
-	
+
 	new_rsc_id = next_dynamic_rsc;
 	AddResource(new_rsc_id,str_value);
-	
+
 	r = GetResourceByID(new_rsc_id);
 	if (r == NULL)
 		eprintf("AddDynamicResource created resource %i, now can't get\n",new_rsc_id);
@@ -143,7 +410,7 @@ int AddDynamicResource(const char *str_value)
 		notify_r = r;
 		ForEachSession(DynamicResourceChangeNotify);
 	}
-	
+
 	return new_rsc_id;
 }
 
@@ -159,12 +426,18 @@ void ChangeDynamicResource(resource_node *r,char *data,int len_data)
 		eprintf("ChangeDynamicResource got passed a null resource\n");
 		return;
 	}
-	
-	FreeMemory(MALLOC_ID_RESOURCE,r->resource_val,strlen(r->resource_val)+1);
+
+	/* text from a .rsc file stays in the arena, where others may share it */
+	if (r->allocated)
+		FreeMemory(MALLOC_ID_RESOURCE,r->resource_val,r->len_val+1);
+	text_bytes += len_data - r->len_val;
+
 	r->resource_val = (char *)AllocateMemory(MALLOC_ID_RESOURCE,len_data+1);
 	memcpy(r->resource_val,data,len_data);
 	r->resource_val[len_data] = 0; /* null terminate */
-	
+	r->len_val = len_data;
+	r->allocated = True;
+
 	/* now notify everyone in game */
 	notify_r = r;
 	ForEachSession(DynamicResourceChangeNotify);
@@ -176,22 +449,19 @@ void DynamicResourceChangeNotify(session_node *s)
 	{
 		AddByteToPacket(BP_CHANGE_RESOURCE);
 		AddIntToPacket(notify_r->resource_id);
-		AddStringToPacket(strlen(notify_r->resource_val),notify_r->resource_val);
+		AddStringToPacket(notify_r->len_val,notify_r->resource_val);
 		SendPacket(s->session_id);
 	}
 }
 
 resource_node * GetResourceByID(int id)
 {
-	resource_node *r;
+	if ((unsigned int)id < (unsigned int)max_resources)
+		return resources[id];
 
-	r = resources[id % resources_table_size];
-	while (r != NULL)
-	{
-		if (r->resource_id == id)
-			return r;
-		r = r->next;
-	}
+	id -= MIN_DYNAMIC_RSC;
+	if ((unsigned int)id < (unsigned int)max_dynamic_resources)
+		return dynamic_resources[id];
 
 	return NULL;
 }
@@ -218,37 +488,31 @@ resource_node * GetResourceByName(const char *resource_name)
 
 void ForEachResource(void (*callback_func)(resource_node *r))
 {
-	resource_node *r;
 	int i;
-	
-	for (i=0;i<resources_table_size;i++)
-	{
-		r = resources[i];
-		while (r != NULL)
-		{
-			if (r->resource_id < MIN_DYNAMIC_RSC)
-				callback_func(r);
-			r = r->next;
-		}
-	}
+
+	for (i=0;i<max_resources;i++)
+		if (resources[i] != NULL)
+			callback_func(resources[i]);
 }
 
 /* This is for saving dynamic resources */
 void ForEachDynamicRsc(void (*callback_func)(resource_node *r))
 {
-	resource_node *r;
 	int i;
-	
-	for (i=0;i<resources_table_size;i++)
-	{
-		r = resources[i];
-		while (r != NULL)
-		{
-			if (r->resource_id >= MIN_DYNAMIC_RSC)
-				callback_func(r);
-			r = r->next;
-		}
-	}
-}
 
+	for (i=0;i<max_dynamic_resources;i++)
+		if (dynamic_resources[i] != NULL)
+			callback_func(dynamic_resources[i]);
+}
 
+void GetResourceStats(resource_statistics *stats)
+{
+	stats->num_resources = num_resources;
+	stats->num_dynamic = num_dynamic_resources;
+	stats->max_id = max_resources;
+	stats->max_dynamic_id = max_dynamic_resources;
+	stats->num_texts = num_resource_texts;
+	stats->text_bytes = text_bytes;
+	stats->num_arena_blocks = num_arena_blocks;
+	stats->arena_bytes = arena_bytes;
+}
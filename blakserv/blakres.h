@@ -17,10 +17,23 @@ typedef struct resource_struct
 {
    int resource_id;
    char *resource_val;
+   int len_val;
+   Bool allocated;		/* resource_val is its own memory, not in the arena */
    char *resource_name;
-   struct resource_struct *next;
 } resource_node;
 
+typedef struct
+{
+   int num_resources;
+   int num_dynamic;
+   int max_id;			/* size of the id array */
+   int max_dynamic_id;
+   int num_texts;		/* distinct texts from .rsc files */
+   INT64 text_bytes;		/* over all resources, as if not shared */
+   int num_arena_blocks;
+   INT64 arena_bytes;
+} resource_statistics;
+
 void InitResource(void);
 void ResetResource(void);
 void AddResource(int id,const char *str_value);
@@ -35,5 +48,6 @@ Bool IsResourceByID(int id);
 resource_node * GetResourceByName(const char *resource_name);
 void ForEachResource(void (*callback_func)(resource_node *r));
 void ForEachDynamicRsc(void (*callback_func)(resource_node *r));
+void GetResourceStats(resource_statistics *stats);
 
 #endif
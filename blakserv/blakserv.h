@@ -101,6 +101,9 @@ enum
 #define STRING_FILE_SAVE "striings."
 #define DYNAMIC_RSC_FILE_SAVE "dynarscs."
 
+/* this one is appended to by each save, see accostore.c */
+#define ACCOUNT_STORE_FILE "accounts.dat"
+
 #define SAVE_CONTROL_FILE "lastsave.txt"
 
 #define MOTD_FILE "motd.txt"
@@ -134,6 +137,7 @@ typedef std::vector<std::string> StringVector;
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -141,9 +145,8 @@ typedef std::vector<std::string> StringVector;
 #include <math.h>
 #include <inttypes.h>
 
-#include "btime.h"
-
 #include "bool.h"
+#include "btime.h"
 #include "rscload.h"
 #include "roomtype.h"
 #include "bkod.h"
@@ -236,12 +239,14 @@ extern DWORD main_thread_id;
 #include "parsecli.h"
 #include "sprocket.h"
 #include "bstring.h"
+#include "strfold.h"
 #include "admin.h"
 #include "garbage.h"
 #include "savegame.h"
 
 #include "loadacco.h"
 #include "saveacco.h"
+#include "accostore.h"
 #include "savestr.h"
 #include "loadstr.h"
 #include "nameid.h"
@@ -262,6 +267,7 @@ extern DWORD main_thread_id;
 
 #include "saveall.h"
 #include "loadall.h"
+#include "preload.h"
 
 #include "saversc.h"
 
@@ -277,5 +283,9 @@ extern DWORD main_thread_id;
 #include "maintenance.h"
 #include "block.h"
 
+#include "record.h"
+#include "census.h"
+#include "metrics.h"
+
 #endif
 
@@ -7,6 +7,22 @@
 // Meridian is a registered trademark.
 // block.c : Implements the block list for BLAKSERV.
 //
+// Blocks are kept in a hash table keyed by network and prefix length, so
+// a single address is a /32 block and checking a connection costs one
+// lookup per prefix length in use (normally just /32).  Blocks that
+// expire are also linked into a wheel of slots by expiration time, and
+// each slot is swept once its time has passed, so expired blocks are
+// freed without ever walking the whole table.
+//
+// Connections are also rate limited per address, before a session is
+// made for them, with a token bucket: each address can connect
+// AcceptBurst times in a row, and earns back AcceptRate connections a
+// minute.  The buckets live in a fixed size table; when it's full, the
+// address seen least recently loses its bucket.
+//
+// Accepting happens on the interface thread on Windows, while the admin
+// commands run on the main thread, so everything here takes csBlock.
+//
 //////////
 //
 
@@ -14,17 +30,77 @@
 
 //////////
 
-static block_node* block_head = NULL;
+#define BLOCK_HASH_SIZE 4096	// must be a power of two
+
+#define BLOCK_WHEEL_SLOTS 64
+#define BLOCK_WHEEL_SECONDS 16	// each slot is this much time
+
+#define LIMITER_SIZE 4096	// must be a power of two
+#define LIMITER_PROBES 4	// slots an address can land in
+#define LIMITER_TOKEN 1000	// a token, in the fractions the buckets count
+
+typedef struct
+{
+	unsigned int addr;	// s_addr; 0 is an unused slot
+	int tokens;		// in 1/LIMITER_TOKEN of a connection
+	UINT64 last_ms;
+	bool limited;		// out of tokens; logged once until it refills
+} limiter_node;
+
+static block_node* block_table[BLOCK_HASH_SIZE];
+static int block_prefix_count[33];	// blocks of each prefix length
+
+static block_node* block_wheel[BLOCK_WHEEL_SLOTS];
+static INT64 block_wheel_tick;		// last tick swept
+
+static limiter_node limiter_table[LIMITER_SIZE];
+
+static block_statistics block_stats;
+
+static CRITICAL_SECTION csBlock;
+
+/* local function prototypes */
+static unsigned int PrefixMask(int iPrefix);
+static unsigned int BlockHash(unsigned int net, int iPrefix);
+static block_node* FindBlockNode(unsigned int net, int iPrefix);
+static void LinkBlockWheel(block_node* pBlock);
+static void UnlinkBlockWheel(block_node* pBlock);
+static void FreeBlockNode(block_node* pBlock);
+static void SweepBlockWheel(INT64 now);
 
 //////////
 
-block_node* FindBlock(struct in_addr* piaPeer)
+void InitBlock()
+{
+	InitializeCriticalSection(&csBlock);
+	memset(block_table, 0, sizeof(block_table));
+	memset(block_prefix_count, 0, sizeof(block_prefix_count));
+	memset(block_wheel, 0, sizeof(block_wheel));
+	block_wheel_tick = GetTime() / BLOCK_WHEEL_SECONDS;
+	memset(limiter_table, 0, sizeof(limiter_table));
+	memset(&block_stats, 0, sizeof(block_stats));
+}
+
+// A mask of the first iPrefix bits, in network order like s_addr.
+static unsigned int PrefixMask(int iPrefix)
 {
-	block_node* pBlock = block_head;
+	if (iPrefix <= 0)
+		return 0;
+	return htonl(0xFFFFFFFFu << (32 - iPrefix));
+}
+
+static unsigned int BlockHash(unsigned int net, int iPrefix)
+{
+	return ((net ^ (iPrefix << 24)) * 2654435761u) >> 20 & (BLOCK_HASH_SIZE - 1);
+}
+
+static block_node* FindBlockNode(unsigned int net, int iPrefix)
+{
+	block_node* pBlock = block_table[BlockHash(net, iPrefix)];
 
 	while (pBlock)
 	{
-		if (0 == memcmp(&pBlock->iaPeer, piaPeer, sizeof(struct in_addr)))
+		if (pBlock->iaPeer.s_addr == net && pBlock->iPrefix == iPrefix)
 			return pBlock;
 
 		pBlock = pBlock->next;
@@ -33,87 +109,377 @@ block_node* FindBlock(struct in_addr* piaPeer)
 	return NULL;
 }
 
+static void LinkBlockWheel(block_node* pBlock)
+{
+	int slot = (int)((pBlock->iExpires / BLOCK_WHEEL_SECONDS) % BLOCK_WHEEL_SLOTS);
+
+	pBlock->wheel_next = block_wheel[slot];
+	if (pBlock->wheel_next)
+		pBlock->wheel_next->wheel_prev = &pBlock->wheel_next;
+	pBlock->wheel_prev = &block_wheel[slot];
+	block_wheel[slot] = pBlock;
+}
+
+static void UnlinkBlockWheel(block_node* pBlock)
+{
+	if (!pBlock->wheel_prev)
+		return;
+
+	*pBlock->wheel_prev = pBlock->wheel_next;
+	if (pBlock->wheel_next)
+		pBlock->wheel_next->wheel_prev = pBlock->wheel_prev;
+	pBlock->wheel_next = NULL;
+	pBlock->wheel_prev = NULL;
+}
+
+// Takes a block out of the table and the wheel, and frees it.
+static void FreeBlockNode(block_node* pBlock)
+{
+	block_node** pHook = &block_table[BlockHash(pBlock->iaPeer.s_addr, pBlock->iPrefix)];
+
+	while (*pHook)
+	{
+		if (*pHook == pBlock)
+		{
+			*pHook = pBlock->next;
+			break;
+		}
+		pHook = &(*pHook)->next;
+	}
+
+	UnlinkBlockWheel(pBlock);
+	block_prefix_count[pBlock->iPrefix]--;
+	block_stats.num_blocks--;
+	FreeMemory(MALLOC_ID_BLOCK,pBlock,sizeof(block_node));
+}
+
+// Frees the expired blocks in every slot whose time has completely passed.
+// A slot also holds blocks for later laps of the wheel, which stay.
+static void SweepBlockWheel(INT64 now)
+{
+	INT64 now_tick = now / BLOCK_WHEEL_SECONDS;
+	int swept = 0;
+
+	while (block_wheel_tick < now_tick && swept < BLOCK_WHEEL_SLOTS)
+	{
+		block_node* pBlock = block_wheel[block_wheel_tick % BLOCK_WHEEL_SLOTS];
+
+		while (pBlock)
+		{
+			block_node* pNext = pBlock->wheel_next;
+			if (pBlock->iExpires <= now)
+			{
+				FreeBlockNode(pBlock);
+				block_stats.num_expired++;
+			}
+			pBlock = pNext;
+		}
+
+		block_wheel_tick++;
+		swept++;
+	}
+	block_wheel_tick = now_tick;
+}
+
+bool FindBlock(struct in_addr* piaPeer)
+{
+	return FindBlockRange(piaPeer, 32);
+}
+
+// Only says whether the block is there; the node itself can be swept as
+// soon as csBlock is let go, so it never leaves this file.
+bool FindBlockRange(struct in_addr* piaNet, int iPrefix)
+{
+	bool found;
+
+	if (iPrefix < 0 || iPrefix > 32)
+		return false;
+
+	EnterCriticalSection(&csBlock);
+	found = FindBlockNode(piaNet->s_addr & PrefixMask(iPrefix), iPrefix) != NULL;
+	LeaveCriticalSection(&csBlock);
+
+	return found;
+}
+
 void AddBlock(int iSeconds, struct in_addr* piaPeer)
 {
-	block_node* pBlock = FindBlock(piaPeer);
+	AddBlockRange(iSeconds, piaPeer, 32);
+}
+
+void AddBlockRange(int iSeconds, struct in_addr* piaNet, int iPrefix)
+{
+	block_node* pBlock;
+	unsigned int net;
 	INT64 iExpires = (iSeconds < 0)? -1 : GetTime() + iSeconds;
 
     // A block set to expire at -1 will stay in effect until all blocks are deleted.
 	// (Usually when server is shut down and later restarted.)
 
+	if (iPrefix < 0 || iPrefix > 32)
+	{
+		eprintf("AddBlockRange got bad prefix length %i\n", iPrefix);
+		return;
+	}
+	net = piaNet->s_addr & PrefixMask(iPrefix);
+
+	EnterCriticalSection(&csBlock);
+
+	pBlock = FindBlockNode(net, iPrefix);
 	if (pBlock)
 	{
 		if (pBlock->iExpires >= 0)
+		{
+			UnlinkBlockWheel(pBlock);
 			pBlock->iExpires = iExpires;
+			if (iExpires >= 0)
+				LinkBlockWheel(pBlock);
+		}
+		LeaveCriticalSection(&csBlock);
 		return;
 	}
 
 	pBlock = (block_node *) AllocateMemory(MALLOC_ID_BLOCK,sizeof(block_node));
 	if (pBlock)
 	{
+		unsigned int hash = BlockHash(net, iPrefix);
+
 		pBlock->iExpires = iExpires;
-		pBlock->iaPeer = *piaPeer;
-		pBlock->next = block_head;
-		block_head = pBlock;
+		pBlock->iaPeer.s_addr = net;
+		pBlock->iPrefix = iPrefix;
+		pBlock->next = block_table[hash];
+		block_table[hash] = pBlock;
+		pBlock->wheel_next = NULL;
+		pBlock->wheel_prev = NULL;
+		if (iExpires >= 0)
+			LinkBlockWheel(pBlock);
+
+		block_prefix_count[iPrefix]++;
+		block_stats.num_blocks++;
 	}
+
+	LeaveCriticalSection(&csBlock);
 }
 
 void DeleteBlock(struct in_addr* piaPeer)
 {
-	block_node** pHook = &block_head;
-	block_node* pBlock = block_head;
+	DeleteBlockRange(piaPeer, 32);
+}
 
-	while (pBlock)
-	{
-		if (0 == memcmp(&pBlock->iaPeer, piaPeer, sizeof(struct in_addr)))
-		{
-			*pHook = pBlock->next;
-			FreeMemory(MALLOC_ID_BLOCK,pBlock,sizeof(block_node));
-			return;
-		}
+void DeleteBlockRange(struct in_addr* piaNet, int iPrefix)
+{
+	block_node* pBlock;
 
-		pHook = &pBlock->next;
-		pBlock = pBlock->next;
-	}
+	if (iPrefix < 0 || iPrefix > 32)
+		return;
+
+	EnterCriticalSection(&csBlock);
+	pBlock = FindBlockNode(piaNet->s_addr & PrefixMask(iPrefix), iPrefix);
+	if (pBlock)
+		FreeBlockNode(pBlock);
+	LeaveCriticalSection(&csBlock);
 }
 
 void DeleteAllBlocks()
 {
-	while (block_head)
+	int i;
+
+	EnterCriticalSection(&csBlock);
+
+	for (i = 0; i < BLOCK_HASH_SIZE; i++)
 	{
-		block_node* pBlock = block_head;
-		block_head = pBlock->next;
+		while (block_table[i])
+		{
+			block_node* pBlock = block_table[i];
+			block_table[i] = pBlock->next;
 
-		FreeMemory(MALLOC_ID_BLOCK,pBlock,sizeof(block_node));
+			FreeMemory(MALLOC_ID_BLOCK,pBlock,sizeof(block_node));
+		}
 	}
+	memset(block_prefix_count, 0, sizeof(block_prefix_count));
+	memset(block_wheel, 0, sizeof(block_wheel));
+	block_stats.num_blocks = 0;
+
+	LeaveCriticalSection(&csBlock);
 }
 
 bool CheckBlockList(struct in_addr* piaPeer)
 {
-	block_node* pBlock = FindBlock(piaPeer);
+	block_node* pBlock = NULL;
+	INT64 now = GetTime();
+	int iPrefix;
 
 	// true means not blocked and can connect
 	// false means block still in effect
 
-	if (!pBlock)
-		return true;
+	EnterCriticalSection(&csBlock);
 
-	if (pBlock->iExpires < 0)
-		return false;
+	SweepBlockWheel(now);
+
+	// most specific first, though any match blocks
+	for (iPrefix = 32; iPrefix >= 0 && !pBlock; iPrefix--)
+	{
+		if (block_prefix_count[iPrefix])
+			pBlock = FindBlockNode(piaPeer->s_addr & PrefixMask(iPrefix), iPrefix);
+	}
 
-	if (pBlock->iExpires <= GetTime())
+	// a block expiring within the current wheel slot hasn't been swept yet
+	if (pBlock && pBlock->iExpires >= 0 && pBlock->iExpires <= now)
 	{
-		DeleteBlock(piaPeer);
+		FreeBlockNode(pBlock);
+		block_stats.num_expired++;
+		pBlock = NULL;
+	}
+
+	if (pBlock)
+		block_stats.num_blocked++;
+
+	LeaveCriticalSection(&csBlock);
+
+	return pBlock == NULL;
+}
+
+/*
+ * CheckConnectRate - Token bucket accept limiter
+ *
+ * Returns false if this address has connected too often lately.  Loopback
+ * connections are never limited.
+ */
+
+bool CheckConnectRate(struct in_addr* piaPeer)
+{
+	limiter_node* pSlot;
+	limiter_node* pOldest;
+	unsigned int addr = piaPeer->s_addr;
+	unsigned int hash;
+	int rate, burst, i;
+	UINT64 now_ms;
+	bool allowed;
+
+	rate = ConfigInt(SOCKET_ACCEPT_RATE);
+	burst = ConfigInt(SOCKET_ACCEPT_BURST);
+	if (rate <= 0 || burst <= 0)
+		return true;
+
+	if ((ntohl(addr) >> 24) == 127 || addr == 0)
 		return true;
+
+	now_ms = GetMilliCount();
+	hash = (addr * 2654435761u) >> 20 & (LIMITER_SIZE - 1);
+
+	EnterCriticalSection(&csBlock);
+
+	pSlot = NULL;
+	pOldest = NULL;
+	for (i = 0; i < LIMITER_PROBES; i++)
+	{
+		limiter_node* pEach = &limiter_table[(hash + i) & (LIMITER_SIZE - 1)];
+		if (pEach->addr == addr)
+		{
+			pSlot = pEach;
+			break;
+		}
+		if (!pOldest || pEach->addr == 0 ||
+			(pOldest->addr != 0 && pEach->last_ms < pOldest->last_ms))
+			pOldest = pEach;
+	}
+
+	if (!pSlot)
+	{
+		pSlot = pOldest;
+		if (pSlot->addr != 0)
+			block_stats.num_limiter_evictions++;
+		else
+			block_stats.num_limiter_entries++;
+		pSlot->addr = addr;
+		pSlot->tokens = burst * LIMITER_TOKEN;
+		pSlot->last_ms = now_ms;
+		pSlot->limited = false;
+	}
+	else
+	{
+		// rate is per minute, so each millisecond earns rate/60 thousandths
+		INT64 earned = (INT64)(now_ms - pSlot->last_ms) * rate / 60;
+		pSlot->tokens = (int)std::min((INT64)pSlot->tokens + earned, (INT64)burst * LIMITER_TOKEN);
+		pSlot->last_ms = now_ms;
+	}
+
+	allowed = pSlot->tokens >= LIMITER_TOKEN;
+	if (allowed)
+	{
+		pSlot->tokens -= LIMITER_TOKEN;
+		pSlot->limited = false;
 	}
+	else
+	{
+		block_stats.num_rate_limited++;
+		if (!pSlot->limited)
+		{
+			pSlot->limited = true;
+			lprintf("Rate limiting connections from %s.\n", inet_ntoa(*piaPeer));
+		}
+	}
+
+	LeaveCriticalSection(&csBlock);
 
-	return false;
+	return allowed;
+}
+
+void CountMaintenanceRefused()
+{
+	EnterCriticalSection(&csBlock);
+	block_stats.num_maintenance_refused++;
+	LeaveCriticalSection(&csBlock);
+}
+
+void GetBlockStats(block_statistics *stats)
+{
+	EnterCriticalSection(&csBlock);
+	*stats = block_stats;
+	stats->num_ranges = stats->num_blocks - block_prefix_count[32];
+	LeaveCriticalSection(&csBlock);
+}
+
+/*
+ * ParseBlockAddress - Read "a.b.c.d" or "a.b.c.d/n"
+ *
+ * Returns false if it isn't one.  A plain address is a /32.  The bits
+ * past the prefix are cleared.
+ */
+
+bool ParseBlockAddress(const char *str, struct in_addr* piaNet, int *piPrefix)
+{
+	char buffer[64];
+	char *slash;
+	int iPrefix = 32;
+
+	while (*str == ' ' || *str == '\t')
+		str++;
+	snprintf(buffer, sizeof(buffer), "%s", str);
+	buffer[strcspn(buffer, " \t\r\n")] = '\0';
+
+	slash = strchr(buffer, '/');
+	if (slash)
+	{
+		*slash++ = '\0';
+		if (sscanf(slash, "%i", &iPrefix) != 1 || iPrefix < 0 || iPrefix > 32)
+			return false;
+	}
+
+	piaNet->s_addr = inet_addr(buffer);
+	if (piaNet->s_addr == INADDR_NONE)
+		return false;
+
+	piaNet->s_addr &= PrefixMask(iPrefix);
+	*piPrefix = iPrefix;
+	return true;
 }
 
 /*
  * BuildBannedIPBlocks - Ban IPs from meridian
  *
- * Input : asciz string of filename of banned ips
+ * Input : asciz string of filename of banned ips, one address or
+ *         address/prefix range per line
  * Output :
  *
  * Author : Charlie
@@ -122,31 +488,32 @@ bool CheckBlockList(struct in_addr* piaPeer)
 
 void BuildBannedIPBlocks( const char *filename )
 {
-  
+
   FILE*fp;
   char buffer[1024];
   struct in_addr blocktoAdd ;
-  
+  int prefix;
+
   fp = fopen(filename,"rt");
   if( fp == NULL ) {
     eprintf("Cannot open banned log file %s\n",filename );
     return ;
   }
   dprintf("loading banned IP addresses\n");
-  
+
   do {
     if(fgets(buffer,1023,fp) != NULL ) {
       /* lets be cautious */
       if(strlen(buffer)>0) {
-	if( ( blocktoAdd.s_addr = inet_addr( buffer ) ) != -1 ) {
-	  AddBlock( -1, &blocktoAdd );
-	  dprintf("Banned IP address %s\n", inet_ntoa( blocktoAdd ) );
+	if( ParseBlockAddress( buffer, &blocktoAdd, &prefix ) ) {
+	  AddBlockRange( -1, &blocktoAdd, prefix );
+	  dprintf("Banned IP address %s/%i\n", inet_ntoa( blocktoAdd ), prefix );
 	} else {
 	  eprintf("Warning invalid entry in %s is [%s]\n",filename,buffer);
 	}
       }
     }
   } while( !feof( fp ) );
-  
+
   fclose( fp );
 }
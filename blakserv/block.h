@@ -16,16 +16,41 @@
 typedef struct block_node_struct
 {
    INT64 iExpires;  // Expiration time
-   struct in_addr iaPeer;
+   struct in_addr iaPeer;  // Network, with the bits past the prefix zeroed
+   int iPrefix;  // CIDR prefix length, 32 for a single address
    struct block_node_struct *next;
+   struct block_node_struct *wheel_next;  // Expiry wheel slot
+   struct block_node_struct **wheel_prev;
 } block_node;
 
+typedef struct
+{
+   int num_blocks;
+   int num_ranges;  // blocks wider than one address
+   INT64 num_expired;
+   INT64 num_blocked;  // connections refused by a block
+   INT64 num_rate_limited;  // connections refused by the accept limiter
+   INT64 num_maintenance_refused;  // maintenance connections outside the mask
+   int num_limiter_entries;
+   INT64 num_limiter_evictions;
+} block_statistics;
+
+void InitBlock(void);
+
+bool FindBlock(struct in_addr* piaPeer);
+bool FindBlockRange(struct in_addr* piaNet, int iPrefix);
 void AddBlock(int iSeconds, struct in_addr* piaPeer);
+void AddBlockRange(int iSeconds, struct in_addr* piaNet, int iPrefix);
 void DeleteBlock(struct in_addr* piaPeer);
+void DeleteBlockRange(struct in_addr* piaNet, int iPrefix);
 void DeleteAllBlocks(void);
 
 bool CheckBlockList(struct in_addr* piaPeer);
+bool CheckConnectRate(struct in_addr* piaPeer);
+void CountMaintenanceRefused(void);
+void GetBlockStats(block_statistics *stats);
 
+bool ParseBlockAddress(const char *str, struct in_addr* piaNet, int *piPrefix);
 void BuildBannedIPBlocks( const char *filename );
 
 
@@ -21,17 +21,36 @@ typedef struct
    char *data;
    int len_data;
    int garbage_ref;
+   int alloc_site; /* see census.c */
 } string_node;
 
+typedef struct
+{
+   int num_strings;
+   int num_bodies;         /* distinct texts */
+   INT64 num_shared;       /* times an existing body was reused */
+   INT64 text_bytes;       /* bytes of text over all string nodes */
+   INT64 body_bytes;       /* bytes of text actually stored */
+   int num_buckets;
+   int num_arena_blocks;
+   INT64 arena_free_bytes;
+   int num_large_bodies;
+} string_statistics;
+
 void InitString(void);
 void ResetString(void);
 int GetStringsUsed(void);
+void GetStringStats(string_statistics *stats);
 string_node * GetStringByID(int string_id);
 Bool IsStringByID(int string_id);
 int CreateString(const char *new_str);
 int CreateStringWithLen(const char *buf,int len);
-Bool LoadBlakodString(FILE *f,int len_str,int string_id);
+Bool LoadBlakodString(const char *data,int len_str,int string_id);
+Bool LoadSharedBlakodString(int string_id,int shared_id);
+void ClearStringSavedIDs(void);
+int GetSavedStringID(string_node *snod,int string_id);
 void ForEachString(void (*callback_func)(string_node *snod,int string_id));
+void ForEachStringInRange(int start,int end,void (*callback_func)(string_node *snod,int string_id));
 void FreeString(int string_id);
 void MoveStringNode(int dest_id,int source_id);
 void SetNumStrings(int new_num_strings);
@@ -20,6 +20,13 @@ const char * ShortTimeStr(time_t time);
 const char * FileTimeStr(time_t time);
 const char * RelativeTimeStr(time_t time);
 UINT64 GetMilliCount();
+UINT64 GetMicroCount(void);
+UINT64 GetGameMilliCount(void);
+time_t GetGameTime(void);
+void StopGameClock(UINT64 now,time_t now_time);
+void SetGameClock(UINT64 now);
+void StartGameClock(void);
+Bool IsGameClockStopped(void);
 
 #endif
 
@@ -13,104 +13,326 @@
  clients and sending data to them.
 
  The main thread typically calls GetBuffer() and the interface/socket thread
- calls DeleteBuffer(), so we need a cs.
+ calls DeleteBuffer(), so the pool has to work across threads (see below).
 
  */
 
 #include "blakserv.h"
 
-buffer_node *buffers;
-int next_buffer_id;
+/* Buffers come in a few sizes, so a short packet doesn't tie up a whole
+   BUFFER_SIZE buffer.  Each thread keeps a small cache of free buffers of
+   each size, so getting and deleting one normally takes no lock at all.
+   Behind the caches is one shared free list per size.  Buffers are only
+   ever pushed onto it one chain at a time, or taken off it all at once,
+   so a compare-and-swap push and an exchange to take it are all it needs
+   (no ABA problem, since nothing is popped off singly).  When a shared
+   list grows past the high water mark it's trimmed to the low one. */
 
+static const int buffer_class_size[NUM_BUFFER_CLASSES] =
+{
+   128, 512, 2048, BUFFER_SIZE,
+};
+
+#define BUFFER_CACHE_MAX 32  /* free buffers of each size a thread can keep */
+#define BUFFER_CACHE_KEEP 16 /* what it keeps when it hands the rest back */
+
+static buffer_node * volatile pool_head[NUM_BUFFER_CLASSES];
+static volatile LONG pool_count[NUM_BUFFER_CLASSES];
+
+static THREAD_LOCAL buffer_node *cache_head[NUM_BUFFER_CLASSES];
+static THREAD_LOCAL int cache_count[NUM_BUFFER_CLASSES];
+
+static volatile LONG stat_gets[NUM_BUFFER_CLASSES];
+static volatile LONG stat_allocs[NUM_BUFFER_CLASSES];
+static volatile LONG stat_outstanding[NUM_BUFFER_CLASSES];
+static volatile LONG stat_trimmed[NUM_BUFFER_CLASSES];
+
+static volatile LONG next_buffer_id;
 
-CRITICAL_SECTION csBuffers; /* protects our buffers list */
+/* local function prototypes */
+static buffer_node * AllocateBuffer(int size_class);
+static void FreeBuffer(buffer_node *bn);
+static void PoolPush(int size_class,buffer_node *first,buffer_node *last,int count);
+static buffer_node * PoolTakeAll(int size_class,int *count);
+static void PoolTrim(int size_class,int keep);
+static int PoolLowWater(int size_class);
+static int PoolHighWater(int size_class);
 
 void InitBufferPool(void)
 {
-   buffers = NULL;
-   next_buffer_id = 1;
-   InitializeCriticalSection(&csBuffers);
+   int i;
+
+   for (i=0;i<NUM_BUFFER_CLASSES;i++)
+   {
+      pool_head[i] = NULL;
+      pool_count[i] = 0;
+      stat_gets[i] = 0;
+      stat_allocs[i] = 0;
+      stat_outstanding[i] = 0;
+      stat_trimmed[i] = 0;
+   }
+   next_buffer_id = 0;
 }
 
 /* this frees buffers we have sitting around, but ones in action are still
-   out there */
+   out there, as are ones cached by other threads */
 void ResetBufferPool(void)
 {
-   buffer_node *bn,*temp;
-
-   EnterCriticalSection(&csBuffers);
-   /* dprintf("ResetBufferPool begin\n"); */
+   int i;
 
    /* test out debug junk: buffers->buf[BUFFER_SIZE] = 12; */
    DebugCheckHeap();
 
-   bn = buffers;
-   while (bn != NULL)
+   FlushBufferCache();
+   for (i=0;i<NUM_BUFFER_CLASSES;i++)
+      PoolTrim(i,0);
+}
+
+/* TrimBufferPool
+ *
+ * Frees free buffers down to the low water mark.  The shared lists are
+ * also trimmed whenever they pass the high water mark, so this is only
+ * for the periodic system timer.
+ */
+void TrimBufferPool(void)
+{
+   int i;
+
+   for (i=0;i<NUM_BUFFER_CLASSES;i++)
+      PoolTrim(i,PoolLowWater(i));
+}
+
+/* FlushBufferCache
+ *
+ * Hands this thread's cached buffers back to the shared lists.  Threads
+ * other than the main one call this before they exit.
+ */
+void FlushBufferCache(void)
+{
+   buffer_node *last;
+   int i;
+
+   for (i=0;i<NUM_BUFFER_CLASSES;i++)
    {
-      temp = bn->next;
-      if (bn->size_prebuf != BUFFER_SIZE + HEADERBYTES)
-      {
-	 eprintf("ResetBufferPool got overwrite of a buffer size!!!");
-	 bn->size_prebuf = BUFFER_SIZE + HEADERBYTES;
-      }
-      FreeMemory(MALLOC_ID_BUFFER,bn->prebuf,bn->size_prebuf);
-      FreeMemory(MALLOC_ID_BUFFER,bn,sizeof(buffer_node));
-      bn = temp;
+      if (cache_head[i] == NULL)
+         continue;
+
+      last = cache_head[i];
+      while (last->next != NULL)
+         last = last->next;
+
+      PoolPush(i,cache_head[i],last,cache_count[i]);
+      cache_head[i] = NULL;
+      cache_count[i] = 0;
    }
-   buffers = NULL;
-   /* dprintf("ResetBufferPool end\n"); */
-   LeaveCriticalSection(&csBuffers);
 }
 
 buffer_node * GetBuffer(void)
+{
+   return GetBufferSize(BUFFER_SIZE);
+}
+
+/* GetBufferSize
+ *
+ * Returns an empty buffer that can hold at least len_buf bytes, or a
+ * BUFFER_SIZE one if len_buf is more than that.
+ */
+buffer_node * GetBufferSize(int len_buf)
 {
    buffer_node *bn;
+   int size_class,count;
+
+   size_class = 0;
+   while (size_class < NUM_BUFFER_CLASSES-1 && buffer_class_size[size_class] < len_buf)
+      size_class++;
 
-   EnterCriticalSection(&csBuffers);
-   if (buffers == NULL)
+   InterlockedIncrement(&stat_gets[size_class]);
+   InterlockedIncrement(&stat_outstanding[size_class]);
+
+   if (cache_head[size_class] == NULL)
    {
-      bn = (buffer_node *) AllocateMemory(MALLOC_ID_BUFFER,sizeof(buffer_node));
-      bn->len_buf = 0;
-      bn->size_buf = BUFFER_SIZE; /* used for buffers in reading */
-      bn->size_prebuf = BUFFER_SIZE + HEADERBYTES;
-      bn->prebuf = (char *) AllocateMemory(MALLOC_ID_BUFFER,bn->size_prebuf);
-      bn->buf = bn->prebuf + HEADERBYTES;
-      bn->buffer_id = next_buffer_id++;
-      bn->next = NULL;
+      cache_head[size_class] = PoolTakeAll(size_class,&count);
+      cache_count[size_class] = count;
    }
-   else
+
+   bn = cache_head[size_class];
+   if (bn == NULL)
+      return AllocateBuffer(size_class);
+
+   cache_head[size_class] = bn->next;
+   cache_count[size_class]--;
+
+   bn->next = NULL;
+   bn->len_buf = 0;
+   bn->buf = bn->prebuf + HEADERBYTES;
+   if (bn->size_prebuf != bn->size_buf + HEADERBYTES)
    {
-      bn = buffers;
-      buffers = buffers->next;
-      bn->next = NULL;
-      bn->len_buf = 0;
-      bn->buf = bn->prebuf + HEADERBYTES;
-      if (bn->size_prebuf != BUFFER_SIZE + HEADERBYTES)
-      {
-	 eprintf("GetBuffer got overwrite of a buffer size!!!");
-	 bn->size_prebuf = BUFFER_SIZE + HEADERBYTES;
-      }
-      bn->buffer_id = next_buffer_id++;
-      /* dprintf("Reuse 0x%08x\n",bn); */
+      eprintf("GetBuffer got overwrite of a buffer size!!!");
+      bn->size_buf = buffer_class_size[bn->size_class];
+      bn->size_prebuf = bn->size_buf + HEADERBYTES;
    }
-   LeaveCriticalSection(&csBuffers);
+   /* dprintf("Reuse 0x%08x\n",bn); */
 
    return bn;
 }
 
 void DeleteBuffer(buffer_node *bn)
 {
+   buffer_node *keep_last,*last;
+   int size_class,i;
+
    /* dprintf("Del 0x%08x\n",bn); */
-   EnterCriticalSection(&csBuffers);
-   if (bn->size_prebuf != BUFFER_SIZE + HEADERBYTES)
+   size_class = bn->size_class;
+   if (size_class < 0 || size_class >= NUM_BUFFER_CLASSES ||
+       bn->size_buf != buffer_class_size[size_class] ||
+       bn->size_prebuf != bn->size_buf + HEADERBYTES)
    {
       eprintf("DeleteBuffer got overwrite of a buffer size!!!");
-      bn->size_prebuf = BUFFER_SIZE + HEADERBYTES;
+      return;
+   }
+
+   InterlockedDecrement(&stat_outstanding[size_class]);
+
+   bn->next = cache_head[size_class];
+   cache_head[size_class] = bn;
+   cache_count[size_class]++;
+
+   if (cache_count[size_class] <= BUFFER_CACHE_MAX)
+      return;
+
+   /* keep the first few, hand the rest to everyone else */
+   keep_last = cache_head[size_class];
+   for (i=1;i<BUFFER_CACHE_KEEP;i++)
+      keep_last = keep_last->next;
+
+   last = keep_last->next;
+   while (last->next != NULL)
+      last = last->next;
+
+   PoolPush(size_class,keep_last->next,last,cache_count[size_class] - BUFFER_CACHE_KEEP);
+   keep_last->next = NULL;
+   cache_count[size_class] = BUFFER_CACHE_KEEP;
+}
+
+void GetBufferPoolStats(buffer_pool_statistics *stats)
+{
+   int i;
+
+   for (i=0;i<NUM_BUFFER_CLASSES;i++)
+   {
+      stats->size[i] = buffer_class_size[i];
+      stats->num_gets[i] = stat_gets[i];
+      stats->num_allocs[i] = stat_allocs[i];
+      stats->num_outstanding[i] = stat_outstanding[i];
+      stats->num_pooled[i] = pool_count[i];
+      stats->num_trimmed[i] = stat_trimmed[i];
+   }
+}
+
+static buffer_node * AllocateBuffer(int size_class)
+{
+   buffer_node *bn;
+   int size;
+
+   InterlockedIncrement(&stat_allocs[size_class]);
+
+   /* the node and its memory are one block */
+   size = buffer_class_size[size_class];
+   bn = (buffer_node *) AllocateMemory(MALLOC_ID_BUFFER,sizeof(buffer_node) + HEADERBYTES + size);
+   bn->len_buf = 0;
+   bn->size_buf = size; /* used for buffers in reading */
+   bn->size_prebuf = size + HEADERBYTES;
+   bn->prebuf = (char *) (bn + 1);
+   bn->buf = bn->prebuf + HEADERBYTES;
+   bn->size_class = size_class;
+   bn->buffer_id = InterlockedIncrement(&next_buffer_id);
+   bn->next = NULL;
+
+   return bn;
+}
+
+static void FreeBuffer(buffer_node *bn)
+{
+   FreeMemory(MALLOC_ID_BUFFER,bn,sizeof(buffer_node) + HEADERBYTES + buffer_class_size[bn->size_class]);
+}
+
+/* add a chain of count buffers to the shared list */
+static void PoolPush(int size_class,buffer_node *first,buffer_node *last,int count)
+{
+   buffer_node *head;
+
+   do
+   {
+      head = pool_head[size_class];
+      last->next = head;
+   } while (InterlockedCompareExchangePointer((void * volatile *) &pool_head[size_class],
+                                              first,head) != head);
+
+   if (InterlockedExchangeAdd(&pool_count[size_class],count) + count > PoolHighWater(size_class))
+      PoolTrim(size_class,PoolLowWater(size_class));
+}
+
+static buffer_node * PoolTakeAll(int size_class,int *count)
+{
+   buffer_node *list,*bn;
+   int n;
+
+   list = (buffer_node *) InterlockedExchangePointer((void * volatile *) &pool_head[size_class],NULL);
+
+   n = 0;
+   for (bn=list;bn!=NULL;bn=bn->next)
+      n++;
+   InterlockedExchangeAdd(&pool_count[size_class],-n);
+
+   *count = n;
+   return list;
+}
+
+/* free all but keep buffers of the shared list */
+static void PoolTrim(int size_class,int keep)
+{
+   buffer_node *list,*bn,*last;
+   int count,freed;
+
+   list = PoolTakeAll(size_class,&count);
+
+   freed = 0;
+   while (list != NULL && count > keep)
+   {
+      bn = list;
+      list = list->next;
+      FreeBuffer(bn);
+      count--;
+      freed++;
    }
+   InterlockedExchangeAdd(&stat_trimmed[size_class],freed);
+
+   if (list == NULL)
+      return;
+
+   last = list;
+   while (last->next != NULL)
+      last = last->next;
 
-   bn->next = buffers;
-   buffers = bn;
-   LeaveCriticalSection(&csBuffers);
+   /* not PoolPush, which could trim again */
+   do
+   {
+      bn = pool_head[size_class];
+      last->next = bn;
+   } while (InterlockedCompareExchangePointer((void * volatile *) &pool_head[size_class],
+                                              list,bn) != bn);
+   InterlockedExchangeAdd(&pool_count[size_class],count);
+}
+
+static int PoolLowWater(int size_class)
+{
+   return ConfigInt(MEMORY_BUFFER_POOL_LOW)*1024/buffer_class_size[size_class];
+}
+
+static int PoolHighWater(int size_class)
+{
+   return std::max(ConfigInt(MEMORY_BUFFER_POOL_HIGH)*1024/buffer_class_size[size_class],
+                   PoolLowWater(size_class));
 }
 
 /* adds a block of bytes to a buffer list, potentially adding more buffers to
@@ -124,7 +346,7 @@ buffer_node * AddToBufferList(buffer_node *blist,void *buf,int len_buf)
       return blist;
 
    if (blist == NULL)
-      blist = GetBuffer();
+      blist = GetBufferSize(len_buf);
 
    bn = blist;
 
@@ -140,17 +362,19 @@ buffer_node * AddToBufferList(buffer_node *blist,void *buf,int len_buf)
       index += copy_bytes;
       bn->len_buf += copy_bytes;
 
-      if (bn->size_prebuf != BUFFER_SIZE + HEADERBYTES)
+      if (bn->size_prebuf != bn->size_buf + HEADERBYTES)
       {
 			eprintf("AddToBufferList overwrote a buffer size!!!");
-			bn->size_prebuf = BUFFER_SIZE + HEADERBYTES;
+			bn->size_prebuf = bn->size_buf + HEADERBYTES;
       }
 
       if (index == len_buf)
 			break;
 
 		//dprintf("AddToBufferList had to create a second buffer");
-      bn->next = GetBuffer();
+      /* packets are built up a few bytes at a time, so each new buffer on
+         the list is at least the next size up */
+      bn->next = GetBufferSize(std::max(len_buf - index,bn->size_buf + 1));
       bn = bn->next;
    }
 
@@ -171,22 +395,24 @@ buffer_node * CopyBufferList(buffer_node *blist)
    if (blist == NULL)
       return NULL;
 
-   new_list = GetBuffer();
+   /* each copy is the same size as what it copies, with the data at the
+      same place (it may start in the header bytes) */
+   new_list = GetBufferSize(blist->size_buf);
    bn = new_list;
    while (blist != NULL)
    {
-      memcpy(bn->buf,blist->buf,blist->len_buf);
-      bn->len_buf = blist->len_buf;
-      bn->size_prebuf = blist->size_prebuf;
-      if (bn->size_prebuf != BUFFER_SIZE + HEADERBYTES)
+      if (blist->size_prebuf != blist->size_buf + HEADERBYTES)
       {
 	 eprintf("CopyBufferList copying a bad buffer size!!!");
       }
+      bn->buf = bn->prebuf + (blist->buf - blist->prebuf);
+      memcpy(bn->buf,blist->buf,blist->len_buf);
+      bn->len_buf = blist->len_buf;
 
       blist = blist->next;
       if (blist != NULL)
       {
-	 bn->next = GetBuffer();
+	 bn->next = GetBufferSize(blist->size_buf);
 	 bn = bn->next;
       }
    }
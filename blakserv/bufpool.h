@@ -13,6 +13,8 @@
 #ifndef _BUFPOOL_H
 #define _BUFPOOL_H
 
+#define NUM_BUFFER_CLASSES 4 /* sizes of buffer, the biggest BUFFER_SIZE */
+
 typedef struct buffer_struct
 {
    int len_buf;  /* current amount of valid data in buf */
@@ -23,19 +25,34 @@ typedef struct buffer_struct
 
    char *prebuf;    /* this points to the real allocated memory.  */
    int size_prebuf; /* size of actually allocated memory */
+   int size_class;  /* which size of buffer, for the pool */
 
    int buffer_id;
    
    struct buffer_struct *next;
 } buffer_node;
 
+typedef struct
+{
+   int size[NUM_BUFFER_CLASSES];
+   int num_gets[NUM_BUFFER_CLASSES];
+   int num_allocs[NUM_BUFFER_CLASSES];      /* gets the pool couldn't fill */
+   int num_outstanding[NUM_BUFFER_CLASSES]; /* in use right now */
+   int num_pooled[NUM_BUFFER_CLASSES];      /* free on the shared list */
+   int num_trimmed[NUM_BUFFER_CLASSES];     /* freed past the watermarks */
+} buffer_pool_statistics;
+
 void InitBufferPool(void);
 void ResetBufferPool(void);
+void TrimBufferPool(void);
+void FlushBufferCache(void);
 buffer_node * GetBuffer(void);
+buffer_node * GetBufferSize(int len_buf);
 void DeleteBuffer(buffer_node *bn);
 buffer_node * AddToBufferList(buffer_node *blist,void *buf,int len_buf);
 buffer_node * AddByteToBufferList(buffer_node *blist,char ch);
 buffer_node * CopyBufferList(buffer_node *blist);
 void DeleteBufferList(buffer_node *blist);
+void GetBufferPoolStats(buffer_pool_statistics *stats);
 
 #endif
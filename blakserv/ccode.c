@@ -18,33 +18,6 @@
 
 #include "blakserv.h"
 
-#define iswhite(c) ((c)==' ' || (c)=='\t' || (c)=='\n' || (c)=='\r')
-
-// global buffers for zero-terminated string manipulation
-static char buf0[LEN_MAX_CLIENT_MSG+1];
-static char buf1[LEN_MAX_CLIENT_MSG+1];
-
-/* just like strstr, except any case-insensitive match will be returned */
-const char* stristr(const char* pSource, const char* pSearch)
-{
-   if (!pSource || !pSearch || !*pSearch)
-      return NULL;
-	
-   int nSearch = strlen(pSearch);
-   // Don't search past the end of pSource
-   const char *pEnd = pSource + strlen(pSource) - nSearch;
-   while (pSource <= pEnd)
-   {
-      if (0 == strnicmp(pSource, pSearch, nSearch))
-         return pSource;
-
-      pSource++;
-   }
-	
-   return NULL;
-}
-
-
 blak_int C_Invalid(int object_id,local_var_type *local_vars,
 			  int num_normal_parms,parm_node normal_parm_array[],
 			  int num_name_parms,parm_node name_parm_array[])
@@ -371,7 +344,7 @@ blak_int C_SendMessage(int object_id,local_var_type *local_vars,
 	if (object_val.v.tag == TAG_CLASS)
 		return SendBlakodClassMessage(object_val.v.data,message_val.v.data,num_name_parms,name_parm_array);
 	else
-		return SendBlakodMessage(object_val.v.data,message_val.v.data,num_name_parms,name_parm_array);
+		return SendBlakodMessageFromCall(object_val.v.data,message_val.v.data,num_name_parms,name_parm_array);
 }
 
 blak_int C_PostMessage(int object_id,local_var_type *local_vars,
@@ -533,11 +506,13 @@ bool LookupString(val_type val, const char *function_name, const char **str, int
 			return false;
 		}
 		*str = snod->data;
+		*len = snod->len_data;
 		break;
 		
 	case TAG_TEMP_STRING :
 		snod = GetTempString();
 		*str = snod->data;
+		*len = snod->len_data;
 		break;
 		
 	case TAG_RESOURCE :
@@ -549,6 +524,7 @@ bool LookupString(val_type val, const char *function_name, const char **str, int
 			return false;
 		}
 		*str = r->resource_val;
+		*len = r->len_val;
 		break;
 		
 	case TAG_DEBUGSTR :
@@ -566,6 +542,8 @@ bool LookupString(val_type val, const char *function_name, const char **str, int
          return false;
       }
       *str = GetClassDebugStr(c, val.v.data);
+      if (*str != NULL)
+         *len = strlen(*str);
       break;
    }
 
@@ -581,7 +559,6 @@ bool LookupString(val_type val, const char *function_name, const char **str, int
 
    if (*str == NULL)
       return false;
-   *len = strlen(*str);
    
    return true;
 }
@@ -627,58 +604,6 @@ blak_int C_StringEqual(int object_id,local_var_type *local_vars,
 	return ret_val.int_val;
 }
 
-void FuzzyCollapseString(char* pTarget, const char* pSource, int len)
-{
-	if (!pTarget || !pSource || len <= 0)
-	{
-		*pTarget = '\0';
-		return;
-	}
-	
-	// skip over leading and trailing whitespace
-	while (len && iswhite(*pSource)) { pSource++; len--; }
-	while (len && iswhite(pSource[len-1])) { len--; }
-	
-	// copy the core string in uppercase
-	while (len)
-	{
-		*pTarget++ = toupper(*pSource++);
-		len--;
-	}
-	
-	*pTarget = '\0';
-}
-
-bool FuzzyBufferEqual(const char *s1,int len1,const char *s2,int len2)
-{
-	if (!s1 || !s2 || len1 <= 0 || len2 <= 0)
-		return false;
-	
-	// skip over leading whitespace
-	while (len1 && iswhite(*s1)) { s1++; len1--; }
-	while (len2 && iswhite(*s2)) { s2++; len2--; }
-	
-	// cut off trailing whitespace
-	while (len1 && iswhite(s1[len1-1])) { len1--; }
-	while (len2 && iswhite(s2[len2-1])) { len2--; }
-	
-	// empty strings can't match anything
-	if (!len1 || !len2)
-		return false;
-	
-	// walk the strings until we find a mismatch or an end
-	while (len1 && len2 && toupper(*s1) == toupper(*s2))
-	{
-		s1++;
-		s2++;
-		len1--;
-		len2--;
-	}
-	
-	// we matched only if we finished both strings at the same time
-	return (len1 == 0 && len2 == 0);
-}
-
 //	Blakod parameters; string0, string1, string2
 //	Substitute first occurrence of string1 in string0 with string2
 //	Returns 1 if substituted, 0 if not found, NIL if error
@@ -688,15 +613,13 @@ blak_int C_StringSubstitute(int object_id,local_var_type *local_vars,
 {
 	val_type s0_val, s1_val, s2_val, r_val;
 	string_node *snod0, *snod1;
-	char buf0[LEN_MAX_CLIENT_MSG+1], buf1[LEN_MAX_CLIENT_MSG+1];
-	char *s0, *copyspot;
-   const char *s1, *s2, *subspot;
-	int len1, len2, new_len;
+	char new_buf[LEN_MAX_CLIENT_MSG+1];
+	char *copyspot;
+   const char *s0, *s1, *s2, *subspot;
+	int len0, len1, len2, new_len;
 	resource_node *r;
 	
-	s0 = buf0;
-	s1 = buf1;
-	s2 = subspot = copyspot = NULL;
+	s0 = s1 = s2 = subspot = copyspot = NULL;
 	
 	s0_val = RetrieveValue( object_id, local_vars, normal_parm_array[0].type,
 		normal_parm_array[0].value);
@@ -726,20 +649,14 @@ blak_int C_StringSubstitute(int object_id,local_var_type *local_vars,
 				s1_val.v.tag, s1_val.v.data );
 			return NIL;
 		}
-		
-		// make a zero-terminated scratch copy of string1
+		s1 = snod1->data;
 		len1 = snod1->len_data;
-		memcpy( buf1, snod1->data, len1 );
-		buf1[len1] = 0x0;
 		break;
 		
 	case TAG_TEMP_STRING :
 		snod1 = GetTempString();
-		
-		// make a zero-terminated scratch copy of string1
+		s1 = snod1->data;
 		len1 = snod1->len_data;
-		memcpy( buf1, snod1->data, len1 );
-		buf1[len1] = 0x0;
 		break;
 		
 	case TAG_RESOURCE :
@@ -750,7 +667,7 @@ blak_int C_StringSubstitute(int object_id,local_var_type *local_vars,
 			return NIL;
 		}
 		s1 = r->resource_val;
-		len1 = strlen( r->resource_val );
+		len1 = r->len_val;
 		break;
 		
 	case TAG_DEBUGSTR :
@@ -804,27 +721,20 @@ blak_int C_StringSubstitute(int object_id,local_var_type *local_vars,
 		return NIL;
 	}
 	
-	// now make a zero-terminated scratch copy of string0
-	memcpy( s0, snod0->data, snod0->len_data );
-	s0[snod0->len_data] = 0x0;
-	
-	// so we can use stristr to do the work
-	subspot = stristr( s0, s1 );
+	// search string0 in place, ignoring case
+	s0 = snod0->data;
+	len0 = snod0->len_data;
+	subspot = FoldedFind( s0, len0, s1, len1 );
 	
     r_val.v.tag = TAG_INT;
     r_val.v.data = 0;
 	
 	if( subspot != NULL )	// only substitute if string1 is found in string0
 	{
-		if (snod0 != GetTempString())
-		{
-			// free the old string0 and allocate a new (possibly longer) string0
-			FreeMemory(MALLOC_ID_STRING,snod0->data,snod0->len_data);
-			snod0->data = (char *) AllocateMemory( MALLOC_ID_STRING, new_len+1);
-		}
+		// string text is shared, so build the result aside and set it
 		
 		// copy the piece before string1
-		copyspot = snod0->data;
+		copyspot = new_buf;
 		memcpy( copyspot, s0, subspot - s0 );
 		
 		// copy string2
@@ -834,8 +744,7 @@ blak_int C_StringSubstitute(int object_id,local_var_type *local_vars,
 		// copy the piece after string1
 		copyspot += len2;
 		memcpy( copyspot, subspot + len1, new_len - (subspot - s0) - len2 );
-		snod0->len_data = new_len;
-		snod0->data[snod0->len_data] = '\0';
+		SetString(snod0,new_buf,new_len);
 		
 		r_val.v.data = 1;
 	}
@@ -883,25 +792,6 @@ blak_int C_StringContain(int object_id,local_var_type *local_vars,
 	return ret_val.int_val;
 }
 
-/*
-"   orc teeth" == "orc teeth"
-" orc  teeth" == "orc teeth"
-"orcteeth" == "orc teeth"
-*/
-
-// return true if s1 contains s2,
-//	first converting to uppercase and squashing tabs and spaces to a single space
-bool FuzzyBufferContain(const char *s1,int len_s1,const char *s2,int len_s2)
-{
-	if (!s1 || !s2 || len_s1 <= 0 || len_s2 <= 0)
-		return false;
-	
-	FuzzyCollapseString(buf0, s1, len_s1);
-	FuzzyCollapseString(buf1, s2, len_s2);
-	
-	return (NULL != strstr(buf0, buf1));
-}
-
 blak_int C_SetResource(int object_id,local_var_type *local_vars,
 				  int num_normal_parms,parm_node normal_parm_array[],
 				  int num_name_parms,parm_node name_parm_array[])
@@ -947,7 +837,7 @@ blak_int C_SetResource(int object_id,local_var_type *local_vars,
 					str_val.v.data);
 				return NIL;
 			}
-			new_len = strlen(r->resource_val);
+			new_len = r->len_val;
 			new_str = r->resource_val;
 			break;
 		}
@@ -1109,7 +999,7 @@ blak_int C_SetString(int object_id,local_var_type *local_vars,
 			return NIL;
 		}
 		//bprintf("SetString string%i<--resource%i\n",s1_val.v.data,s2_val.v.data);
-		SetString(snod,r->resource_val,strlen(r->resource_val));
+		SetString(snod,r->resource_val,r->len_val);
 		break;
 		
 	default :
@@ -1183,7 +1073,7 @@ blak_int C_AppendTempString(int object_id,local_var_type *local_vars,
 			bprintf("C_AppendTempString can't set from invalid resource %i\n",s_val.v.data);
 			return NIL;
 		}
-		AppendTempString(r->resource_val,strlen(r->resource_val));
+		AppendTempString(r->resource_val,r->len_val);
 		break;
 		
 	case TAG_DEBUGSTR :
@@ -1391,7 +1281,7 @@ blak_int C_GetTimeRemaining(int object_id,local_var_type *local_vars,
 	}
 	
 	ret_val.v.tag = TAG_INT;
-	ret_val.v.data = (int)(t->time - GetMilliCount());
+	ret_val.v.data = (int)(t->time - GetGameMilliCount());
 	if (ret_val.v.data < 0)
 		ret_val.v.data = 0;
 	
@@ -1746,7 +1636,6 @@ blak_int C_List(int object_id,local_var_type *local_vars,
 	ret_val.int_val = NIL;
 	for (i=num_normal_parms-1;i>=0;i--)
 	{
-		extern list_node *list_nodes;
 		temp = RetrieveValue(object_id,local_vars,normal_parm_array[i].type,
 			normal_parm_array[i].value);
 		ret_val.v.data = Cons(temp,ret_val);
@@ -1894,7 +1783,7 @@ blak_int C_GetTime(int object_id,local_var_type *local_vars,
 	   Removing it would be difficult, as some time values are stored in objects.
 	*/
 
-   ret_val.v.data = GetTime() - 1534000000L;    // Offset to sometime in mid-2018
+   ret_val.v.data = GetGameTime() - 1534000000L;    // Offset to sometime in mid-2018
 	
 	return ret_val.int_val;
 }
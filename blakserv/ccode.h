@@ -242,8 +242,4 @@ blak_int C_MinigameStringToNumber(int object_id,local_var_type *local_vars,
 		  int num_name_parms,parm_node name_parm_array[]);
 
 
-void FuzzyCollapseString(char* pTarget, const char* pSource, int len);
-bool FuzzyBufferEqual(const char *s1,int len1,const char *s2,int len2);
-bool FuzzyBufferContain(const char *s1,int len1,const char *s2,int len2);
-
 #endif
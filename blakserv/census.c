@@ -0,0 +1,433 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * census.c
+ *
+
+ This module finds out which Blakod made the objects, list nodes,
+ strings and timers that are taking up the server.  After "census
+ start", each Cons, CreateString, CreateObject and CreateTimer looks up
+ its allocation site, the bkod just past the call that made it, and
+ keeps the site's number in the node.  A site knows its class and
+ message, and through the class's line table, its source line.  Nodes
+ made while not recording, or loaded from the saved game, have site 0.
+
+ A census marks what's reachable the way ReclaimObjects() does, without
+ freeing anything, then counts the live nodes by site and by the class
+ of the object that holds them.  A list node or string held by more than
+ one object counts for the lowest numbered one; ones only held by kod
+ tables or the server count as unowned.  A timer counts for its object.
+
+ Sites point into the .bof code, like the Send() inline caches, so they
+ go away with it in ResetCensus(), which also puts every live node back
+ to site 0.
+
+ */
+
+#include "blakserv.h"
+
+#define CensusHash(p,kind) ((unsigned int)(((UINT64)(p) >> 2) * 2654435761U) ^ (unsigned int)(kind))
+
+Bool census_recording;
+
+static census_site *sites; /* by site number, from 1 */
+static int num_sites;
+static int *site_hash; /* site numbers, 0 for an empty slot */
+static int site_hash_size;
+
+/* while taking a census */
+static census_statistics *census_stats;
+static census_class *census_classes; /* by class id */
+static int num_census_classes;
+static census_class *census_owner; /* whose counts the nodes go to */
+static char *list_seen,*string_seen;
+static int num_list_seen,num_string_seen;
+static int *list_stack;
+static int num_list_stack,max_list_stack;
+
+/* local function prototypes */
+static void GrowCensusSites(void);
+static void CensusMaxClass(class_node *c);
+static void CountCensusNode(int kind,int site);
+static void CensusObject(object_node *o);
+static void CensusValue(val_type *val);
+static void CensusString(int string_id);
+static void CensusList(int list_id);
+static void PushCensusList(int list_id);
+static void CensusTimer(timer_node *t);
+static void CountCensusClass(census_class *cc);
+static void ClearObjectSite(object_node *o);
+static void ClearListSite(list_node *l,int list_id);
+static void ClearStringSite(string_node *snod,int string_id);
+static void ClearTimerSite(timer_node *t);
+
+void StartCensusSites(void)
+{
+   census_recording = True;
+}
+
+void StopCensusSites(void)
+{
+   census_recording = False;
+}
+
+void ResetCensus(void)
+{
+   if (sites != NULL)
+      FreeMemory(MALLOC_ID_CENSUS,sites,(site_hash_size/2 + 1)*sizeof(census_site));
+   if (site_hash != NULL)
+      FreeMemory(MALLOC_ID_CENSUS,site_hash,site_hash_size*sizeof(int));
+   sites = NULL;
+   site_hash = NULL;
+   site_hash_size = 0;
+   num_sites = 0;
+
+   if (census_classes != NULL)
+      FreeMemory(MALLOC_ID_CENSUS,census_classes,num_census_classes*sizeof(census_class));
+   census_classes = NULL;
+   num_census_classes = 0;
+
+   /* the live nodes' site numbers would name whatever sites come next */
+   ForEachObject(ClearObjectSite);
+   ForEachListNode(ClearListSite);
+   ForEachString(ClearStringSite);
+   ForEachTimer(ClearTimerSite);
+}
+
+static void ClearObjectSite(object_node *o)
+{
+   o->alloc_site = 0;
+}
+
+static void ClearListSite(list_node *l,int list_id)
+{
+   l->alloc_site = 0;
+}
+
+static void ClearStringSite(string_node *snod,int string_id)
+{
+   snod->alloc_site = 0;
+}
+
+static void ClearTimerSite(timer_node *t)
+{
+   t->alloc_site = 0;
+}
+
+/* GetCensusSite
+*
+* Returns the site number of whatever is being allocated now, adding
+* the site if it's new.  Use GetAllocSite(), which only calls this
+* while recording.
+*/
+int GetCensusSite(int kind)
+{
+   census_site *s;
+   char *bkod_ptr;
+   unsigned int i;
+   int site;
+
+   if (2*(num_sites + 1) > site_hash_size)
+      GrowCensusSites();
+
+   /* NULL outside the Blakod, so those share one site per kind */
+   bkod_ptr = GetBkodPtr();
+
+   i = CensusHash(bkod_ptr,kind) & (site_hash_size - 1);
+   for (;;)
+   {
+      site = site_hash[i];
+      if (site == 0)
+	 break;
+      s = &sites[site];
+      if (s->bkod_ptr == bkod_ptr && s->kind == kind)
+      {
+	 s->num_allocated++;
+	 return site;
+      }
+      i = (i + 1) & (site_hash_size - 1);
+   }
+
+   site = ++num_sites;
+   site_hash[i] = site;
+
+   s = &sites[site];
+   s->kind = kind;
+   s->bkod_ptr = bkod_ptr;
+   s->class_id = bkod_ptr == NULL ? INVALID_CLASS : GetKodStats()->interpreting_class;
+   s->message_id = bkod_ptr == NULL ? INVALID_ID : GetInterpretingMessage();
+   s->num_allocated = 1;
+   s->num_live = 0;
+
+   return site;
+}
+
+static void GrowCensusSites(void)
+{
+   int old_size,site;
+   unsigned int i;
+
+   old_size = site_hash_size;
+   site_hash_size = (old_size == 0) ? INIT_CENSUS_SITES : 2*old_size;
+
+   /* the hash stays at most half full, so that's all the sites there can be */
+   if (sites == NULL)
+      sites = (census_site *)
+	 AllocateMemory(MALLOC_ID_CENSUS,(site_hash_size/2 + 1)*sizeof(census_site));
+   else
+      sites = (census_site *)
+	 ResizeMemory(MALLOC_ID_CENSUS,sites,(old_size/2 + 1)*sizeof(census_site),
+		      (site_hash_size/2 + 1)*sizeof(census_site));
+
+   if (site_hash != NULL)
+      FreeMemory(MALLOC_ID_CENSUS,site_hash,old_size*sizeof(int));
+   site_hash = (int *)AllocateMemory(MALLOC_ID_CENSUS,site_hash_size*sizeof(int));
+   memset(site_hash,0,site_hash_size*sizeof(int));
+
+   for (site=1;site<=num_sites;site++)
+   {
+      i = CensusHash(sites[site].bkod_ptr,sites[site].kind) & (site_hash_size - 1);
+      while (site_hash[i] != 0)
+	 i = (i + 1) & (site_hash_size - 1);
+      site_hash[i] = site;
+   }
+}
+
+const char * GetCensusKindName(int kind)
+{
+   switch (kind)
+   {
+   case CENSUS_OBJECT : return "object";
+   case CENSUS_LIST : return "list node";
+   case CENSUS_STRING : return "string";
+   case CENSUS_TIMER : return "timer";
+   }
+   return "unknown";
+}
+
+/* TakeCensus
+*
+* Counts the live nodes by site and class; see ForEachCensusSite() and
+* ForEachCensusClass() for the counts.  Top level only, like
+* ReclaimObjects().
+*/
+void TakeCensus(census_statistics *stats)
+{
+   val_type cli_list;
+   list_node_statistics lstat;
+   int site;
+
+   memset(stats,0,sizeof(*stats));
+   stats->recording = census_recording;
+   stats->num_sites = num_sites;
+   stats->unowned.class_id = INVALID_CLASS;
+   census_stats = stats;
+
+   MarkLiveNodes();
+
+   for (site=1;site<=num_sites;site++)
+      sites[site].num_live = 0;
+
+   if (census_classes != NULL)
+      FreeMemory(MALLOC_ID_CENSUS,census_classes,num_census_classes*sizeof(census_class));
+   num_census_classes = 0;
+   ForEachClass(CensusMaxClass);
+   census_classes = (census_class *)
+      AllocateMemory(MALLOC_ID_CENSUS,num_census_classes*sizeof(census_class));
+   memset(census_classes,0,num_census_classes*sizeof(census_class));
+
+   num_list_seen = GetListNodesUsed();
+   list_seen = (char *)AllocateMemory(MALLOC_ID_CENSUS,num_list_seen + 1);
+   memset(list_seen,0,num_list_seen + 1);
+   num_string_seen = GetStringsUsed();
+   string_seen = (char *)AllocateMemory(MALLOC_ID_CENSUS,num_string_seen + 1);
+   memset(string_seen,0,num_string_seen + 1);
+
+   ForEachObject(CensusObject);
+
+   census_owner = &stats->unowned;
+   ForEachTableValue(CensusValue);
+   cli_list = GetParseClientListNodes();
+   CensusValue(&cli_list);
+
+   ForEachTimer(CensusTimer);
+
+   ForEachCensusClass(CountCensusClass);
+
+   GetListNodeStats(&lstat);
+   stats->num_used[CENSUS_OBJECT] = GetObjectsLive();
+   stats->num_used[CENSUS_LIST] = lstat.num_live;
+   stats->num_used[CENSUS_STRING] = GetStringsUsed();
+   stats->num_used[CENSUS_TIMER] = GetNumActiveTimers();
+
+   FreeMemory(MALLOC_ID_CENSUS,list_seen,num_list_seen + 1);
+   FreeMemory(MALLOC_ID_CENSUS,string_seen,num_string_seen + 1);
+   list_seen = NULL;
+   string_seen = NULL;
+   if (list_stack != NULL)
+      FreeMemory(MALLOC_ID_CENSUS,list_stack,max_list_stack*sizeof(int));
+   list_stack = NULL;
+   max_list_stack = 0;
+   census_stats = NULL;
+}
+
+static void CensusMaxClass(class_node *c)
+{
+   if (c->class_id >= num_census_classes)
+      num_census_classes = c->class_id + 1;
+}
+
+static void CountCensusNode(int kind,int site)
+{
+   census_stats->num_live[kind]++;
+   census_owner->num_live[kind]++;
+   if (site > 0 && site <= num_sites)
+      sites[site].num_live++;
+   else
+      census_stats->num_unrecorded[kind]++;
+}
+
+static void CensusObject(object_node *o)
+{
+   int i;
+
+   if (!IsMarkedObject(o))
+      return;
+
+   if (o->class_id >= 0 && o->class_id < num_census_classes)
+      census_owner = &census_classes[o->class_id];
+   else
+      census_owner = &census_stats->unowned;
+
+   CountCensusNode(CENSUS_OBJECT,o->alloc_site);
+   for (i=0;i<o->num_props;i++)
+      CensusValue(&o->p[i].val);
+}
+
+static void CensusValue(val_type *val)
+{
+   if (val->v.tag == TAG_STRING)
+      CensusString(val->v.data);
+   if (val->v.tag == TAG_LIST)
+      CensusList(val->v.data);
+}
+
+static void CensusString(int string_id)
+{
+   string_node *snod;
+
+   if (string_id < 0 || string_id >= num_string_seen || string_seen[string_id])
+      return;
+   string_seen[string_id] = True;
+
+   snod = GetStringByID(string_id);
+   if (snod != NULL)
+      CountCensusNode(CENSUS_STRING,snod->alloc_site);
+}
+
+static void CensusList(int list_id)
+{
+   list_node *l;
+
+   num_list_stack = 0;
+   PushCensusList(list_id);
+
+   while (num_list_stack > 0)
+   {
+      list_id = list_stack[--num_list_stack];
+      for (;;)
+      {
+	 /* a shared tail was already counted */
+	 if (list_id < 0 || list_id >= num_list_seen || list_seen[list_id])
+	    break;
+	 list_seen[list_id] = True;
+
+	 l = GetListNodeByID(list_id);
+	 if (l == NULL)
+	    break;
+	 CountCensusNode(CENSUS_LIST,l->alloc_site);
+
+	 if (l->first.v.tag == TAG_LIST)
+	    PushCensusList(l->first.v.data);
+	 if (l->first.v.tag == TAG_STRING)
+	    CensusString(l->first.v.data);
+	 if (l->rest.v.tag == TAG_STRING)
+	    CensusString(l->rest.v.data);
+
+	 if (l->rest.v.tag != TAG_LIST)
+	    break;
+	 list_id = l->rest.v.data;
+      }
+   }
+}
+
+static void PushCensusList(int list_id)
+{
+   if (num_list_stack == max_list_stack)
+   {
+      if (list_stack == NULL)
+	 list_stack = (int *)AllocateMemory(MALLOC_ID_CENSUS,256*sizeof(int));
+      else
+	 list_stack = (int *)ResizeMemory(MALLOC_ID_CENSUS,list_stack,max_list_stack*sizeof(int),
+					  2*max_list_stack*sizeof(int));
+      max_list_stack = (max_list_stack == 0) ? 256 : 2*max_list_stack;
+   }
+   list_stack[num_list_stack++] = list_id;
+}
+
+static void CensusTimer(timer_node *t)
+{
+   object_node *o;
+
+   o = GetObjectByIDQuietly(t->object_id);
+   if (o != NULL && IsMarkedObject(o) && o->class_id >= 0 && o->class_id < num_census_classes)
+      census_owner = &census_classes[o->class_id];
+   else
+      census_owner = &census_stats->unowned;
+
+   CountCensusNode(CENSUS_TIMER,t->alloc_site);
+}
+
+static void CountCensusClass(census_class *cc)
+{
+   census_stats->num_classes++;
+}
+
+/* ForEachCensusSite
+*
+* Every site since the .bof was loaded, with num_live from the last
+* census.
+*/
+void ForEachCensusSite(void (*callback_func)(census_site *site))
+{
+   int site;
+
+   for (site=1;site<=num_sites;site++)
+      callback_func(&sites[site]);
+}
+
+/* ForEachCensusClass
+*
+* The classes that held anything in the last census.
+*/
+void ForEachCensusClass(void (*callback_func)(census_class *cc))
+{
+   int i,kind;
+
+   for (i=0;i<num_census_classes;i++)
+   {
+      for (kind=0;kind<NUM_CENSUS_KINDS;kind++)
+	 if (census_classes[i].num_live[kind] != 0)
+	    break;
+      if (kind == NUM_CENSUS_KINDS)
+	 continue;
+
+      census_classes[i].class_id = i;
+      callback_func(&census_classes[i]);
+   }
+}
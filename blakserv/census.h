@@ -0,0 +1,65 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * census.h
+ *
+ */
+
+#ifndef _CENSUS_H
+#define _CENSUS_H
+
+#define INIT_CENSUS_SITES 1024
+
+enum
+{
+   CENSUS_OBJECT, CENSUS_LIST, CENSUS_STRING, CENSUS_TIMER,
+   NUM_CENSUS_KINDS
+};
+
+typedef struct
+{
+   int kind;
+   int class_id; /* INVALID_CLASS if made outside the Blakod */
+   int message_id;
+   char *bkod_ptr; /* just past the call that made it */
+   INT64 num_allocated; /* since "census start" */
+   int num_live; /* as of the last census */
+} census_site;
+
+typedef struct
+{
+   int class_id;
+   int num_live[NUM_CENSUS_KINDS]; /* its objects, and what they hold */
+} census_class;
+
+typedef struct
+{
+   Bool recording;
+   int num_sites;
+   int num_classes; /* that hold anything */
+   int num_live[NUM_CENSUS_KINDS];
+   int num_unrecorded[NUM_CENSUS_KINDS]; /* live, but made while not recording */
+   int num_used[NUM_CENSUS_KINDS]; /* reachable or not */
+   census_class unowned; /* held by tables and the server, not an object */
+} census_statistics;
+
+/* only look up where an allocation came from while recording */
+extern Bool census_recording;
+#define GetAllocSite(kind) (census_recording ? GetCensusSite(kind) : 0)
+
+void StartCensusSites(void);
+void StopCensusSites(void);
+void ResetCensus(void);
+int GetCensusSite(int kind);
+const char * GetCensusKindName(int kind);
+
+void TakeCensus(census_statistics *stats);
+void ForEachCensusSite(void (*callback_func)(census_site *site));
+void ForEachCensusClass(void (*callback_func)(census_class *cc));
+
+#endif
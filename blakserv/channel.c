@@ -13,10 +13,31 @@
  Based on the configuration, the channels may or not be written to
  files, but they are always shown on the interface (chanbuf.c).
 
+ If [Channel] Async is set, the lines for the files go into a ring
+ buffer, and a writer thread writes them out, so a flood of errors
+ doesn't hold up the main thread on disk writes.  Any thread can add
+ lines; a slot is claimed with a compare-exchange on the head and handed
+ to the writer by setting its ready flag.  If the ring is full the line
+ is dropped and counted.
+
+ The writer folds runs of identical lines into one "last message repeated"
+ line, and writes at most MaxLinesPerSecond lines a second to each
+ channel, counting the rest.
+
+ Network threads log too, so the files and whether the writer is running
+ are only looked at or changed with csChannels held.  ReopenDefaultChannels()
+ holds it across the whole close and reopen, so nobody writes to a file
+ that's being closed.  The writer thread itself never takes it; it's
+ stopped before any file it uses is closed.
+
  */
 
 #include "blakserv.h"
 
+#define CHANNEL_RING_SIZE 1024 /* must be a power of 2 */
+#define CHANNEL_LINE_LEN 2000
+#define CHANNEL_WRITER_SLEEP 10 /* ms */
+
 typedef struct
 {
    int channel_id;
@@ -33,13 +54,79 @@ channel_table_type channel_table[] =
 
 channel_node channel[NUM_CHANNELS];
 
+typedef struct
+{
+   volatile LONG ready;
+   int channel_id;
+   int body; /* offset of the text after the time stamp */
+   char s[CHANNEL_LINE_LEN];
+} channel_line;
+
+channel_line channel_ring[CHANNEL_RING_SIZE];
+volatile LONG channel_ring_head; /* next slot to claim */
+volatile LONG channel_ring_tail; /* next slot to write, only the writer moves it */
+
+Thread channel_writer;
+Bool channel_writer_running;
+volatile LONG channel_writer_stop;
+
+/* only the writer thread uses these */
+typedef struct
+{
+   char last[CHANNEL_LINE_LEN]; /* text of the last line written */
+   char last_time[80];          /* time stamp of the last repeat */
+   int repeats;
+   int lines;                   /* written this second */
+   int limited;                 /* not written this second */
+} channel_writer_node;
+
+channel_writer_node channel_writer_state[NUM_CHANNELS];
+time_t channel_writer_second;
+
+Bool channel_lock_ready;
+CRITICAL_SECTION csChannels;
+
 /* local function prototypes */
-void WriteStrChannel(int channel_id,char *s);
+const char * ChannelTimeStr(void);
+void WriteStrChannel(int channel_id,char *s,int body);
+void QueueStrChannel(int channel_id,const char *s,int body);
 FILE *CreateFileChannel(int channel_id);
+void StartChannelWriter(void);
+void StopChannelWriter(void);
+void ChannelWriterThread(void *arg);
+void ChannelWriterLine(int channel_id,const char *s,int body);
+int ChannelWriterSecond(Bool force);
+void LockChannels(void);
+void UnlockChannels(void);
+
+/* LockChannels
+*
+* Nothing can log to a file before the first OpenDefaultChannels(), which
+* makes the lock, so it's fine to skip it until then.
+*/
+void LockChannels(void)
+{
+   if (channel_lock_ready)
+      EnterCriticalSection(&csChannels);
+}
+
+void UnlockChannels(void)
+{
+   if (channel_lock_ready)
+      LeaveCriticalSection(&csChannels);
+}
 
 void OpenDefaultChannels()
 {
    int i;
+
+   if (!channel_lock_ready)
+   {
+      InitializeCriticalSection(&csChannels);
+      channel_lock_ready = True;
+   }
+
+   LockChannels();
    for (i=0;i<NUM_CHANNELS;i++)
    {
       if (ConfigBool(channel_table[i].disk_config_id))
@@ -52,12 +139,19 @@ void OpenDefaultChannels()
       else
          channel[i].file = NULL;
    }
+
+   if (ConfigBool(CHANNEL_ASYNC))
+      StartChannelWriter();
+   UnlockChannels();
 }
 
 void CloseDefaultChannels()
 {
    int i;
 
+   LockChannels();
+   StopChannelWriter();
+
    for (i=0;i<NUM_CHANNELS;i++)
    {
       if (channel[i].file != NULL)
@@ -66,23 +160,90 @@ void CloseDefaultChannels()
          channel[i].file = NULL;
       }
    }
+   UnlockChannels();
+}
+
+/* ReopenDefaultChannels
+*
+* Starts new files, say for a new day, without anyone logging in between.
+*/
+void ReopenDefaultChannels()
+{
+   LockChannels();
+   CloseDefaultChannels();
+   OpenDefaultChannels();
+   UnlockChannels();
 }
 
 void FlushDefaultChannels()
 {
    int i;
 
+   /* give the writer a second to catch up, we're usually about to crash */
+   if (channel_writer_running)
+      for (i=0;i<1000 && channel_ring_tail != channel_ring_head;i++)
+         Sleep(1);
+
+   /* no csChannels here, whoever's crashing might be holding it */
    for (i=0;i<NUM_CHANNELS;i++)
       if (channel[i].file != NULL)
          fflush(channel[i].file);
 }
 
+void GetChannelStats(int channel_id,channel_statistics *cstat)
+{
+   cstat->name = channel_table[channel_id].file_name;
+   cstat->written = channel[channel_id].num_written;
+   cstat->repeated = channel[channel_id].num_repeated;
+   cstat->limited = channel[channel_id].num_limited;
+   cstat->dropped = channel[channel_id].num_dropped;
+}
+
+/* ChannelTimeStr
+*
+* Same as TimeStr(GetTime()), but only formats once a second per thread,
+* and is safe to call from any thread.
+*/
+const char * ChannelTimeStr(void)
+{
+   static THREAD_LOCAL time_t cached_time;
+   static THREAD_LOCAL char cached_str[80];
+   struct tm tm_time;
+   const char *time_format;
+   time_t now;
+
+   now = GetTime();
+   if (now == cached_time)
+      return cached_str;
+
+#ifdef BLAK_PLATFORM_WINDOWS
+   if (localtime_s(&tm_time,&now) != 0)
+      return "Invalid Time";
+#else
+   if (localtime_r(&now,&tm_time) == NULL)
+      return "Invalid Time";
+#endif
+
+   if (tm_time.tm_mday < 10)
+      time_format = "%b  %#d %Y %H:%M:%S";
+   else
+      time_format = "%b %#d %Y %H:%M:%S";
+
+   if (strftime(cached_str,sizeof(cached_str),time_format,&tm_time) == 0)
+      return "Time string too long";
+
+   cached_time = now;
+   return cached_str;
+}
+
 void dprintf(const char *fmt,...)
 {
    char s[2000];
+   int body;
    va_list marker;
 
-   sprintf(s,"%s|",TimeStr(GetTime()));
+   sprintf(s,"%s|",ChannelTimeStr());
+   body = strlen(s);
 
    va_start(marker,fmt);
    vsprintf(s+strlen(s),fmt,marker);
@@ -92,15 +253,17 @@ void dprintf(const char *fmt,...)
    if (s[strlen(s)-1] != '\n')
       strcat(s,"\r\n");
 
-   WriteStrChannel(CHANNEL_D,s);
+   WriteStrChannel(CHANNEL_D,s,body);
 }
 
 void eprintf(const char *fmt,...)
 {
    char s[2000];
+   int body;
    va_list marker;
 
-   sprintf(s,"%s | ",TimeStr(GetTime()));
+   sprintf(s,"%s | ",ChannelTimeStr());
+   body = strlen(s);
 
    va_start(marker,fmt);
    vsprintf(s+strlen(s),fmt,marker);
@@ -108,15 +271,18 @@ void eprintf(const char *fmt,...)
 
    TermConvertBuffer(s,sizeof(s)); /* makes \n's into CR/LF pairs */
 
-   WriteStrChannel(CHANNEL_E,s);
+   WriteStrChannel(CHANNEL_E,s,body);
 }
 
 void bprintf(const char *fmt,...)
 {
    char s[1000];
+   int body;
    va_list marker;
 
-   sprintf(s,"%s | [%s] ",TimeStr(GetTime()),BlakodDebugInfo());
+   sprintf(s,"%s | ",ChannelTimeStr());
+   body = strlen(s);
+   sprintf(s+body,"[%s] ",BlakodDebugInfo());
 
    va_start(marker,fmt);
    vsprintf(s+strlen(s),fmt,marker);
@@ -126,15 +292,17 @@ void bprintf(const char *fmt,...)
    if (s[strlen(s)-1] != '\n')
       strcat(s,"\r\n");
 
-   WriteStrChannel(CHANNEL_E,s);
+   WriteStrChannel(CHANNEL_E,s,body);
 }
 
 void lprintf(const char *fmt,...)
 {
    char s[1000];
+   int body;
    va_list marker;
 
-   sprintf(s,"%s | ",TimeStr(GetTime()));
+   sprintf(s,"%s | ",ChannelTimeStr());
+   body = strlen(s);
 
    va_start(marker,fmt);
    vsprintf(s+strlen(s),fmt,marker);
@@ -144,21 +312,59 @@ void lprintf(const char *fmt,...)
    if (s[strlen(s)-1] != '\n')
       strcat(s,"\r\n");
 
-   WriteStrChannel(CHANNEL_L,s);
+   WriteStrChannel(CHANNEL_L,s,body);
 }
 
-void WriteStrChannel(int channel_id,char *s)
+void WriteStrChannel(int channel_id,char *s,int body)
 {
+   LockChannels();
    if (channel[channel_id].file != NULL)
    {
-      fwrite(s, 1, strlen(s), channel[channel_id].file);
-      if (ConfigBool(CHANNEL_FLUSH))
-         fflush(channel[channel_id].file);
+      if (channel_writer_running)
+         QueueStrChannel(channel_id,s,body);
+      else
+      {
+         fwrite(s, 1, strlen(s), channel[channel_id].file);
+         if (ConfigBool(CHANNEL_FLUSH))
+            fflush(channel[channel_id].file);
+         channel[channel_id].num_written++;
+      }
    }
+   UnlockChannels();
 
    WriteChannelBuffer(channel_id,s);
 }
 
+/* QueueStrChannel
+*
+* Hands a line to the writer thread; can be called from any thread.
+*/
+void QueueStrChannel(int channel_id,const char *s,int body)
+{
+   channel_line *line;
+   LONG head;
+   int len;
+
+   do
+   {
+      head = channel_ring_head;
+      if ((unsigned int)(head - channel_ring_tail) >= CHANNEL_RING_SIZE)
+      {
+         InterlockedIncrement(&channel[channel_id].num_dropped);
+         return;
+      }
+   } while (InterlockedCompareExchange(&channel_ring_head,head+1,head) != head);
+
+   line = &channel_ring[(unsigned int)head % CHANNEL_RING_SIZE];
+   len = std::min((int)strlen(s),CHANNEL_LINE_LEN-1);
+   memcpy(line->s,s,len);
+   line->s[len] = 0;
+   line->channel_id = channel_id;
+   line->body = std::min(body,len);
+
+   InterlockedIncrement(&line->ready);
+}
+
 FILE *CreateFileChannel(int channel_id)
 {
    char channel_file[MAX_PATH+FILENAME_MAX];
@@ -181,3 +387,159 @@ FILE *CreateFileChannel(int channel_id)
 
    return pFile;
 }
+
+void StartChannelWriter(void)
+{
+   if (channel_writer_running)
+      return;
+
+   memset(channel_writer_state,0,sizeof(channel_writer_state));
+   channel_writer_second = GetTime();
+   channel_writer_stop = 0;
+
+   if (!ThreadCreate(&channel_writer,ChannelWriterThread,NULL))
+   {
+      eprintf("StartChannelWriter couldn't start writer thread, writing channels directly\n");
+      return;
+   }
+   channel_writer_running = True;
+}
+
+void StopChannelWriter(void)
+{
+   if (!channel_writer_running)
+      return;
+
+   /* the writer empties the ring before it exits */
+   InterlockedIncrement(&channel_writer_stop);
+   ThreadJoin(channel_writer);
+   channel_writer_running = False;
+}
+
+void ChannelWriterThread(void *arg)
+{
+   channel_line *line;
+   int i,num_written;
+
+   for (;;)
+   {
+      num_written = 0;
+      for (;;)
+      {
+         line = &channel_ring[(unsigned int)channel_ring_tail % CHANNEL_RING_SIZE];
+         if (InterlockedExchangeAdd(&line->ready,0) == 0)
+            break;
+
+         ChannelWriterLine(line->channel_id,line->s,line->body);
+         num_written++;
+
+         /* free the slot before moving the tail past it */
+         InterlockedDecrement(&line->ready);
+         InterlockedIncrement(&channel_ring_tail);
+      }
+
+      num_written += ChannelWriterSecond(False);
+
+      if (num_written > 0)
+      {
+         if (ConfigBool(CHANNEL_FLUSH))
+            for (i=0;i<NUM_CHANNELS;i++)
+               if (channel[i].file != NULL)
+                  fflush(channel[i].file);
+         continue;
+      }
+
+      /* a line can be claimed but not ready yet, so wait for head too */
+      if (InterlockedExchangeAdd(&channel_writer_stop,0) != 0 &&
+          channel_ring_head == channel_ring_tail)
+         break;
+
+      Sleep(CHANNEL_WRITER_SLEEP);
+   }
+
+   ChannelWriterSecond(True);
+   for (i=0;i<NUM_CHANNELS;i++)
+      if (channel[i].file != NULL)
+         fflush(channel[i].file);
+}
+
+void ChannelWriterLine(int channel_id,const char *s,int body)
+{
+   channel_writer_node *cw;
+   int max_lines,len;
+
+   cw = &channel_writer_state[channel_id];
+
+   if (strcmp(s+body,cw->last) == 0)
+   {
+      len = std::min(body,(int)sizeof(cw->last_time)-1);
+      memcpy(cw->last_time,s,len);
+      cw->last_time[len] = 0;
+      cw->repeats++;
+      InterlockedIncrement(&channel[channel_id].num_repeated);
+      return;
+   }
+
+   if (cw->repeats > 0)
+   {
+      fprintf(channel[channel_id].file,"%slast message repeated %i times\r\n",
+              cw->last_time,cw->repeats);
+      cw->repeats = 0;
+   }
+
+   max_lines = ConfigInt(CHANNEL_MAX_LINES);
+   if (max_lines > 0 && cw->lines >= max_lines)
+   {
+      cw->limited++;
+      InterlockedIncrement(&channel[channel_id].num_limited);
+      return;
+   }
+   cw->lines++;
+
+   fwrite(s,1,strlen(s),channel[channel_id].file);
+   InterlockedIncrement(&channel[channel_id].num_written);
+   strcpy(cw->last,s+body);
+}
+
+/* ChannelWriterSecond
+*
+* Once a second (or when forced), writes out the pending repeat counts
+* and how many lines were over the limit, and starts counting again.
+* Returns the number of lines written.
+*/
+int ChannelWriterSecond(Bool force)
+{
+   channel_writer_node *cw;
+   time_t now;
+   int i,num_written;
+
+   now = GetTime();
+   if (!force && now == channel_writer_second)
+      return 0;
+   channel_writer_second = now;
+
+   num_written = 0;
+   for (i=0;i<NUM_CHANNELS;i++)
+   {
+      cw = &channel_writer_state[i];
+      if (channel[i].file == NULL)
+         continue;
+
+      if (cw->repeats > 0)
+      {
+         fprintf(channel[i].file,"%slast message repeated %i times\r\n",
+                 cw->last_time,cw->repeats);
+         cw->repeats = 0;
+         num_written++;
+      }
+      if (cw->limited > 0)
+      {
+         fprintf(channel[i].file,"%s | %i lines over the limit of %i a second were not written\r\n",
+                 ChannelTimeStr(),cw->limited,ConfigInt(CHANNEL_MAX_LINES));
+         cw->limited = 0;
+         num_written++;
+      }
+      cw->lines = 0;
+   }
+   return num_written;
+}
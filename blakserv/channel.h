@@ -16,8 +16,22 @@
 typedef struct
 {
    FILE *file;
+
+   volatile LONG num_written;
+   volatile LONG num_repeated; /* folded into "last message repeated" lines */
+   volatile LONG num_limited;  /* over MaxLinesPerSecond */
+   volatile LONG num_dropped;  /* writer thread too far behind */
 } channel_node;
 
+typedef struct
+{
+   const char *name;
+   int written;
+   int repeated;
+   int limited;
+   int dropped;
+} channel_statistics;
+
 enum
 {
    CHANNEL_D,		/* debug info */
@@ -28,7 +42,9 @@ enum
 
 void OpenDefaultChannels(void);
 void CloseDefaultChannels(void);
+void ReopenDefaultChannels(void);
 void FlushDefaultChannels(void);
+void GetChannelStats(int channel_id,channel_statistics *cstat);
 
 void dprintf(const char *fmt,...);
 void eprintf(const char *fmt,...);
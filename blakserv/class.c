@@ -93,6 +93,9 @@ void ResetClass(void)
 				cv = temp_cv;
 			}
 			
+			if (c->instances != NULL)
+				FreeMemory(MALLOC_ID_CLASS,c->instances,sizeof(int)*c->max_instances);
+
 			FreeMemory(MALLOC_ID_CLASS,c,sizeof(class_node));
 			c = temp;
 		}
@@ -196,8 +199,8 @@ void SetClassName(int id,char *name)
 /* SetClassesSuperPtr
 *
 * After calling addclass for all classes, call this to setup our class
-* hierarchy parent pointers 
-*
+* hierarchy parent pointers, and the lists of subclasses that go the
+* other way.
 */
 void SetClassesSuperPtr(void)
 {
@@ -205,6 +208,10 @@ void SetClassesSuperPtr(void)
 	int i;
 	int length; 
 
+	for (i=0;i<classes_table_size;i++)
+		for (c=classes[i];c!=NULL;c=c->next)
+			c->first_subclass = NULL;
+
 	for (i=0;i<classes_table_size;i++)
 	{
 		c = classes[i];
@@ -219,7 +226,11 @@ void SetClassesSuperPtr(void)
 					eprintf("SetClassesSuperPtr found class %i with invalid parent id %i! "
 					"[possibly obsolete bof]\n",c->class_id, c->super_id);
 				else
+				{
 					c->super_ptr = super_ptr;
+					c->next_subclass = super_ptr->first_subclass;
+					super_ptr->first_subclass = c;
+				}
 			}
 			c = c->next;
 		}
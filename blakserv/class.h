@@ -54,6 +54,14 @@ typedef struct class_struct
    bof_line_table *line_table;
 
    struct class_struct *super_ptr;
+   struct class_struct *first_subclass; /* direct subclasses, through next_subclass */
+   struct class_struct *next_subclass;
+
+   /* ids of the live objects of exactly this class, in no order; object.c
+      keeps them, and each object knows its place here in class_index */
+   int *instances;
+   int num_instances;
+   int max_instances;
 
    struct class_struct *next; /* for open hash table linked list */
 } class_node;
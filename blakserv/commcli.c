@@ -103,7 +103,7 @@ void AddBlakodToPacket(val_type obj_size,val_type obj_data)
 						  obj_data.v.data);
 				return;
 			}
-			AddStringToPacket(strlen(r->resource_val),r->resource_val);
+			AddStringToPacket(r->len_val,r->resource_val);
 			break;
       default :
 			bprintf("AddBlakodToPacket can't send %i bytes\n",num_bytes);
@@ -193,6 +193,7 @@ void SendPacket(int session_id)
 //   dprintf("SendPacket msg %u", (unsigned char)blist->buf[0]);
    SecurePacketBufferList(session_id,blist);
    SendClientBufferList(session_id,blist);
+   CountMetric(METRIC_MESSAGES_SENT,1);
    blist = NULL;
 }
 
@@ -202,6 +203,7 @@ void SendCopyPacket(int session_id)
 //   dprintf("SendCopyPacket msg %u", (unsigned char)bl->buf[0]);
    SecurePacketBufferList(session_id,bl);
    SendClientBufferList(session_id,bl);
+   CountMetric(METRIC_MESSAGES_SENT,1);
 }
 
 void ClearPacket()
@@ -234,6 +236,8 @@ void SendBlakodBeginSystemEvent(int type)
    val_type int_val;
    parm_node p[1];
 
+   RecordSystem(RECORD_BEGIN_EVENT,type);
+
    int_val.v.tag = TAG_INT;
    int_val.v.data = type;
 
@@ -249,6 +253,8 @@ void SendBlakodEndSystemEvent(int type)
    val_type int_val;
    parm_node p[1];
 
+   RecordSystem(RECORD_END_EVENT,type);
+
    int_val.v.tag = TAG_INT;
    int_val.v.data = type;
 
@@ -72,12 +72,18 @@ config_table_type config_table[] =
 { SOCKET_DNS_LOOKUP,      T, "DNSLookup",     CONFIG_BOOL,  "No" },
 { SOCKET_NAGLE,           F, "Nagle",         CONFIG_BOOL,  "Yes" },
 { SOCKET_BLOCK_TIME,      T, "BlockTime",     CONFIG_INT,   "300" }, /* seconds */
+{ SOCKET_NETWORK_THREADS, F, "NetworkThreads",CONFIG_INT,   "0" }, /* linux only */
+{ SOCKET_ACCEPT_RATE,     T, "AcceptRate",    CONFIG_INT,   "60" }, /* per ip per minute, 0 for no limit */
+{ SOCKET_ACCEPT_BURST,    T, "AcceptBurst",   CONFIG_INT,   "20" },
+{ SOCKET_METRICS_PORT,    F, "MetricsPort",   CONFIG_INT,   "0" }, /* linux only, on 127.0.0.1, 0 for none */
 
 { CHANNEL_GROUP,          F, "[Channel]",     CONFIG_GROUP, "" },
 { CHANNEL_DEBUG_DISK,     F, "DebugDisk",     CONFIG_BOOL,  "No" },
 { CHANNEL_ERROR_DISK,     F, "ErrorDisk",     CONFIG_BOOL,  "No" },
 { CHANNEL_LOG_DISK,       F, "LogDisk",       CONFIG_BOOL,  "No" },
 { CHANNEL_FLUSH,          T, "Flush",         CONFIG_BOOL,  "No" },
+{ CHANNEL_ASYNC,          F, "Async",         CONFIG_BOOL,  "Yes" },
+{ CHANNEL_MAX_LINES,      T, "MaxLinesPerSecond", CONFIG_INT, "1000" },
 
 { GUEST_GROUP,            F, "[Guest]",       CONFIG_GROUP, "" },
 { GUEST_ACCOUNT,          F, "Account",       CONFIG_STR,   "GUEST" },
@@ -136,9 +142,11 @@ config_table_type config_table[] =
 { MEMORY_GROUP,           F, "[Memory]",      CONFIG_GROUP, "" },
 { MEMORY_SIZE_CLASS_HASH, F, "SizeClassHash", CONFIG_INT,   "99971" },
 { MEMORY_SIZE_CLASS_NAME_HASH,F,"SizeClassNameHash", CONFIG_INT,   "99971" },
-{ MEMORY_SIZE_RESOURCE_HASH,F,"SizeResourceHash", CONFIG_INT,"99971" },
+{ MEMORY_SIZE_RESOURCE_HASH,F,"SizeResourceHash", CONFIG_INT,"99971" }, /* unused, resources are kept by id */
 { MEMORY_SIZE_RESOURCE_NAME_HASH,F,"SizeResourceNameHash", CONFIG_INT,"99971" },
 { MEMORY_SIZE_PROPERTIES_NAME_HASH,F,"SizePropertiesNameHash", CONFIG_INT,   "499" },
+{ MEMORY_BUFFER_POOL_LOW, T, "BufferPoolLow", CONFIG_INT,   "512" }, /* KB of each buffer size */
+{ MEMORY_BUFFER_POOL_HIGH,T, "BufferPoolHigh",CONFIG_INT,   "2048" },
 
 { AUTO_GROUP,             F, "[Auto]",        CONFIG_GROUP, "" },
 { AUTO_GARBAGE_TIME,      F, "GarbageTime",   CONFIG_INT,   "90", }, /* minutes */
@@ -154,6 +162,9 @@ config_table_type config_table[] =
 { AUTO_RESET_POOL_PERIOD, F, "ResetPoolPeriod",CONFIG_INT,  "60", },
 { AUTO_REOPEN_CHANNELS_TIME, F, "ReopenChannelsTime", CONFIG_INT,   "0", },
 { AUTO_REOPEN_CHANNELS_PERIOD, F, "ReopenChannelsPeriod",CONFIG_INT,  "86400", },
+{ AUTO_RECLAIM_TIME,      F, "ReclaimTime",   CONFIG_INT,   "45", }, /* minutes */
+{ AUTO_RECLAIM_PERIOD,    F, "ReclaimPeriod", CONFIG_INT,   "60", }, /* minutes */
+{ AUTO_GARBAGE_THREADS,   T, "GarbageThreads",CONFIG_INT,   "1", }, /* 0 for one per processor */
 
 { EMAIL_GROUP,            F, "[Email]",       CONFIG_GROUP, "" },
 { EMAIL_LISTEN,           F, "Listen",        CONFIG_BOOL,  "No" },
@@ -201,6 +212,7 @@ config_table_type config_table[] =
 { DEBUG_INITPROPERTIES,   T, "InitProperties",CONFIG_BOOL,  "No" },
 { DEBUG_INITLOCALS,       T, "InitLocals",    CONFIG_BOOL,  "No" },
 { DEBUG_UNINITIALIZED,    T, "Uninitialized", CONFIG_BOOL,  "No" },
+{ DEBUG_TIME_WARP,        T, "TimeWarp",      CONFIG_BOOL,  "No" },
 
 { SECURITY_GROUP,         F, "[Security]",    CONFIG_GROUP, "" },
 { SECURITY_LOG_SPOOFS,    T, "LogSpoofs",     CONFIG_BOOL,  "Yes" },
@@ -217,6 +229,16 @@ config_table_type config_table[] =
 
 { BLAKOD_GROUP,           F, "[Blakod]",      CONFIG_GROUP, "" },
 { BLAKOD_MAX_STATEMENTS,  T, "MaxStatements", CONFIG_INT,   "20000000" },
+{ BLAKOD_MAP_BOFS,        T, "MapBofs",       CONFIG_BOOL,  "Yes" },
+{ BLAKOD_SEND_CACHE,      T, "SendCache",     CONFIG_BOOL,  "Yes" },
+{ BLAKOD_POST_QUEUE_LIMIT, T, "PostQueueLimit", CONFIG_INT,  "100000" },
+{ BLAKOD_COALESCE_POSTS,  T, "CoalescePosts", CONFIG_STR,   "" },
+
+{ SAVE_GROUP,             F, "[Save]",        CONFIG_GROUP, "" },
+{ SAVE_VERSION,           T, "Version",       CONFIG_INT,   "2" },
+{ SAVE_COMPRESS,          T, "Compress",      CONFIG_BOOL,  "No" },
+{ SAVE_ACCOUNT_TEXT,      T, "AccountText",   CONFIG_BOOL,  "Yes" }, /* text accounts file too */
+{ SAVE_ACCOUNT_COMPACT,   T, "AccountCompact",CONFIG_INT,   "4" }, /* log records per account */
 
 };
 
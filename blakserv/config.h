@@ -23,11 +23,12 @@ enum
 
    SOCKET_GROUP,
    SOCKET_PORT, SOCKET_MAINTENANCE_PORT, SOCKET_MAINTENANCE_MASK,
-   SOCKET_DNS_LOOKUP, SOCKET_NAGLE, SOCKET_BLOCK_TIME,
+   SOCKET_DNS_LOOKUP, SOCKET_NAGLE, SOCKET_BLOCK_TIME, SOCKET_NETWORK_THREADS,
+   SOCKET_ACCEPT_RATE, SOCKET_ACCEPT_BURST, SOCKET_METRICS_PORT,
 
    CHANNEL_GROUP,
    CHANNEL_DEBUG_DISK, CHANNEL_ERROR_DISK, CHANNEL_LOG_DISK,
-   CHANNEL_FLUSH,
+   CHANNEL_FLUSH, CHANNEL_ASYNC, CHANNEL_MAX_LINES,
 
    GUEST_GROUP,
    GUEST_ACCOUNT, GUEST_CREDITS, GUEST_MAX, GUEST_TOO_MANY, GUEST_SERVER_MIN,
@@ -64,6 +65,7 @@ enum
    MEMORY_SIZE_RESOURCE_HASH,
    MEMORY_SIZE_RESOURCE_NAME_HASH,
    MEMORY_SIZE_PROPERTIES_NAME_HASH,
+   MEMORY_BUFFER_POOL_LOW, MEMORY_BUFFER_POOL_HIGH,
 
    AUTO_GROUP,
    AUTO_GARBAGE_TIME, AUTO_GARBAGE_PERIOD, AUTO_SAVE_TIME, AUTO_SAVE_PERIOD,
@@ -72,6 +74,8 @@ enum
    AUTO_TRANSMITTED_TIME, AUTO_TRANSMITTED_PERIOD,
    AUTO_RESET_POOL_TIME, AUTO_RESET_POOL_PERIOD,
    AUTO_REOPEN_CHANNELS_TIME, AUTO_REOPEN_CHANNELS_PERIOD,
+   AUTO_RECLAIM_TIME, AUTO_RECLAIM_PERIOD,
+   AUTO_GARBAGE_THREADS,
 
    EMAIL_GROUP,
    EMAIL_LISTEN, EMAIL_PORT, EMAIL_ACCOUNT_CREATE_NAME, EMAIL_ACCOUNT_DELETE_NAME,
@@ -96,7 +100,7 @@ enum
    DEBUG_GROUP,
    DEBUG_SMTP, DEBUG_CANMOVEINROOM, DEBUG_HEAP, DEBUG_TRANSMITTED_BYTES,
    DEBUG_HASH, DEBUG_INITPROPERTIES, DEBUG_INITLOCALS,
-   DEBUG_UNINITIALIZED,
+   DEBUG_UNINITIALIZED, DEBUG_TIME_WARP,
 
    SECURITY_GROUP,
    SECURITY_LOG_SPOOFS, SECURITY_HANGUP_SPOOFS, SECURITY_REDBOOK_RSC,
@@ -106,7 +110,11 @@ enum
    SERVICE_MACHINE, SERVICE_DIRECTORY, SERVICE_USERNAME, SERVICE_PASSWORD,
 
    BLAKOD_GROUP,
-   BLAKOD_MAX_STATEMENTS,
+   BLAKOD_MAX_STATEMENTS, BLAKOD_MAP_BOFS, BLAKOD_SEND_CACHE,
+   BLAKOD_POST_QUEUE_LIMIT, BLAKOD_COALESCE_POSTS,
+
+   SAVE_GROUP,
+   SAVE_VERSION, SAVE_COMPRESS, SAVE_ACCOUNT_TEXT, SAVE_ACCOUNT_COMPACT,
 
    NUM_CONFIG_VALUES
 };
@@ -35,3 +35,20 @@ void DeleteCriticalSection(CRITICAL_SECTION *m)
 {
    pthread_mutex_destroy(m);
 }
+
+void InitializeConditionVariable(CONDITION_VARIABLE *c)
+{
+   pthread_cond_init(c, NULL);
+}
+
+bool SleepConditionVariableCS(CONDITION_VARIABLE *c, CRITICAL_SECTION *m, int milliseconds)
+{
+   // The critical section must be entered just once, since waiting
+   // only releases one level of a recursive mutex.
+   return pthread_cond_wait(c, m) == 0;
+}
+
+void WakeAllConditionVariable(CONDITION_VARIABLE *c)
+{
+   pthread_cond_broadcast(c);
+}
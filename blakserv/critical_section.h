@@ -22,4 +22,15 @@ void EnterCriticalSection(CRITICAL_SECTION *m);
 void LeaveCriticalSection(CRITICAL_SECTION *m);
 void DeleteCriticalSection(CRITICAL_SECTION *m);
 
+// And of a Windows CONDITION_VARIABLE, using a pthread condition.  Only
+// INFINITE waits are supported.
+
+#define INFINITE -1
+
+typedef pthread_cond_t CONDITION_VARIABLE;
+
+void InitializeConditionVariable(CONDITION_VARIABLE *c);
+bool SleepConditionVariableCS(CONDITION_VARIABLE *c, CRITICAL_SECTION *m, int milliseconds);
+void WakeAllConditionVariable(CONDITION_VARIABLE *c);
+
 #endif
@@ -0,0 +1,347 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * framebench.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself,
+ though it links with the rest of the server.  It times how fast a
+ session's received bytes are cut up into client messages, the way the
+ game mode loop in game.c does it, two ways: with the session's one
+ receive buffer (GetSessionReceiveSpace, PeekSessionData and
+ ReadSessionBytes in session.c), and with the chain of pooled
+ buffer_nodes sessions used to receive into, copied here for
+ reference.  The messages are made up, 10 to 59 bytes of data each, and
+ arrive in segments of a TCP packet's size, as from a socket.  Both
+ ways have to find the same messages.  Build it with
+ "make -f makefile.linux framebench" and run bin/framebench [messages]
+ [segment size].
+
+ */
+
+#include "blakserv.h"
+
+#define BENCH_DEFAULT_MESSAGES 5000000
+#define BENCH_DEFAULT_SEGMENT 1460
+#define BENCH_PASSES 3
+
+static unsigned int seed;
+
+/* the received data as it was kept, for reference */
+static buffer_node *old_receive_list;
+static int old_receive_index;
+
+Bool InMainLoop(void)
+{
+   return False;
+}
+
+static double NowNanoseconds(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static int Random(int n)
+{
+   seed = seed*1103515245 + 12345;
+   return (seed >> 8) % n;
+}
+
+static int OldGetReadBytes(void)
+{
+   buffer_node *bn;
+   int bytes;
+
+   bytes = 0;
+   if (old_receive_list != NULL)
+   {
+      bytes += old_receive_list->len_buf - old_receive_index;
+      for (bn=old_receive_list->next;bn!=NULL;bn=bn->next)
+	 bytes += bn->len_buf;
+   }
+   return bytes;
+}
+
+static Bool OldReadBytes(int num_bytes,void *buf)
+{
+   buffer_node *bn,*blist;
+   int copied,copy_bytes;
+
+   if (OldGetReadBytes() < num_bytes)
+      return False;
+
+   blist = old_receive_list;
+   if (blist->len_buf - old_receive_index > num_bytes)
+   {
+      memcpy(buf,blist->buf + old_receive_index,num_bytes);
+      old_receive_index += num_bytes;
+      return True;
+   }
+
+   copy_bytes = blist->len_buf - old_receive_index;
+   memcpy(buf,blist->buf + old_receive_index,copy_bytes);
+   copied = copy_bytes;
+
+   bn = blist->next;
+   DeleteBuffer(blist);
+   old_receive_list = bn;
+   old_receive_index = 0;
+
+   copy_bytes = 0;
+   while (old_receive_list != NULL && copied < num_bytes)
+   {
+      copy_bytes = std::min(num_bytes-copied,old_receive_list->len_buf);
+      memcpy((char *)buf+copied,old_receive_list->buf,copy_bytes);
+
+      copied += copy_bytes;
+      if (copy_bytes == old_receive_list->len_buf)
+      {
+	 bn = old_receive_list->next;
+	 DeleteBuffer(old_receive_list);
+	 old_receive_list = bn;
+	 copy_bytes = 0;
+      }
+   }
+   old_receive_index = copy_bytes;
+   return True;
+}
+
+static Bool OldPeekBytes(int num_bytes,void *buf)
+{
+   buffer_node *bn,*blist;
+   int copied,copy_bytes;
+
+   if (OldGetReadBytes() < num_bytes)
+      return False;
+
+   blist = old_receive_list;
+   if (blist->len_buf - old_receive_index > num_bytes)
+   {
+      memcpy(buf,blist->buf + old_receive_index,num_bytes);
+      return True;
+   }
+
+   copy_bytes = blist->len_buf - old_receive_index;
+   memcpy(buf,blist->buf + old_receive_index,copy_bytes);
+
+   bn = blist->next;
+   copied = copy_bytes;
+   while (bn != NULL && copied < num_bytes)
+   {
+      copy_bytes = std::min(num_bytes-copied,bn->len_buf);
+      memcpy((char *)buf+copied,bn->buf,copy_bytes);
+
+      copied += copy_bytes;
+      if (copy_bytes == bn->len_buf)
+	 bn = bn->next;
+   }
+   return True;
+}
+
+/* OldReceive
+*
+* What AsyncSocketRead did with each recv(): fill the last buffer in the
+* chain, adding one when it's full.
+*/
+static void OldReceive(const char *data,int len)
+{
+   buffer_node *bn;
+   int num;
+
+   while (len > 0)
+   {
+      if (old_receive_list == NULL)
+	 old_receive_list = GetBuffer();
+
+      bn = old_receive_list;
+      while (bn->next != NULL)
+	 bn = bn->next;
+
+      if (bn->len_buf >= bn->size_buf)
+      {
+	 bn->next = GetBuffer();
+	 bn = bn->next;
+      }
+
+      num = std::min(len,bn->size_buf - bn->len_buf);
+      memcpy(bn->buf + bn->len_buf,data,num);
+      bn->len_buf += num;
+      data += num;
+      len -= num;
+   }
+}
+
+static void NewReceive(session_node *s,const char *data,int len)
+{
+   char *space;
+   int num;
+
+   while (len > 0)
+   {
+      space = GetSessionReceiveSpace(s,&num);
+      num = std::min(len,num);
+      memcpy(space,data,num);
+      AddSessionReceivedBytes(s,num);
+      data += num;
+      len -= num;
+   }
+}
+
+/* MakeStream
+*
+* The same messages every time, one after another as a client sends them.
+*/
+static char * MakeStream(int num_messages,int *len_stream)
+{
+   client_msg msg;
+   char *stream;
+   int i,len,max_len;
+
+   max_len = num_messages*(HEADERBYTES + 60);
+   stream = (char *)malloc(max_len);
+   *len_stream = 0;
+   seed = 1;
+
+   for (i=0;i<num_messages;i++)
+   {
+      len = 10 + Random(50);
+      msg.len = len;
+      msg.len_verify = len;
+      msg.crc16 = 0;
+      msg.seqno = 1;
+      memset(msg.data,i & 0xff,len);
+      memcpy(stream + *len_stream,&msg,HEADERBYTES + len);
+      *len_stream += HEADERBYTES + len;
+   }
+   return stream;
+}
+
+/* OldFrames
+*
+* Peeks at each header, then reads the whole message, as the game mode
+* loop did.
+*/
+static int OldFrames(const char *stream,int len_stream,int segment,INT64 *sum)
+{
+   client_msg msg;
+   int offset,num_messages;
+
+   num_messages = 0;
+   for (offset=0;offset<len_stream;offset+=segment)
+   {
+      OldReceive(stream + offset,std::min(segment,len_stream - offset));
+
+      while (OldGetReadBytes() > 0)
+      {
+	 if (!OldPeekBytes(HEADERBYTES,&msg))
+	    break;
+	 if (msg.len != msg.len_verify || msg.len > LEN_MAX_CLIENT_MSG)
+	    return -1;
+	 if (!OldReadBytes(msg.len+HEADERBYTES,&msg))
+	    break;
+
+	 *sum += (unsigned char)msg.data[0] + msg.len;
+	 num_messages++;
+      }
+   }
+   return num_messages;
+}
+
+/* NewFrames
+*
+* Looks at each header in place, then copies the message out, as
+* GameProcessSessionBuffer does.
+*/
+static int NewFrames(session_node *s,const char *stream,int len_stream,int segment,INT64 *sum)
+{
+   client_msg msg,*header;
+   int offset,num_messages;
+
+   num_messages = 0;
+   for (offset=0;offset<len_stream;offset+=segment)
+   {
+      NewReceive(s,stream + offset,std::min(segment,len_stream - offset));
+
+      while (GetSessionReadBytes(s) > 0)
+      {
+	 header = (client_msg *)PeekSessionData(s,HEADERBYTES);
+	 if (header == NULL)
+	    break;
+	 if (header->len != header->len_verify || header->len > LEN_MAX_CLIENT_MSG)
+	    return -1;
+	 if (!ReadSessionBytes(s,header->len+HEADERBYTES,&msg))
+	    break;
+
+	 *sum += (unsigned char)msg.data[0] + msg.len;
+	 num_messages++;
+      }
+   }
+   return num_messages;
+}
+
+int main(int argc,char **argv)
+{
+   session_node s;
+   char *stream;
+   int num_messages,segment,len_stream,pass,old_found,new_found,mismatches;
+   INT64 old_sum,new_sum;
+   double old_time,new_time;
+
+   num_messages = BENCH_DEFAULT_MESSAGES;
+   segment = BENCH_DEFAULT_SEGMENT;
+   if (argc > 1)
+      num_messages = atoi(argv[1]);
+   if (argc > 2)
+      segment = atoi(argv[2]);
+   if (num_messages <= 0 || segment <= 0)
+   {
+      fprintf(stderr,"usage: framebench [messages] [segment size]\n");
+      return 1;
+   }
+
+   InitMemory();
+   InitConfig();
+   InitBufferPool();
+
+   stream = MakeStream(num_messages,&len_stream);
+   printf("%i messages, %i bytes, in %i byte segments\n",num_messages,len_stream,segment);
+
+   mismatches = 0;
+   for (pass=0;pass<BENCH_PASSES;pass++)
+   {
+      old_sum = 0;
+      old_time = NowNanoseconds();
+      old_found = OldFrames(stream,len_stream,segment,&old_sum);
+      old_time = NowNanoseconds() - old_time;
+      DeleteBufferList(old_receive_list);
+      old_receive_list = NULL;
+      old_receive_index = 0;
+
+      memset(&s,0,sizeof(s));
+      new_sum = 0;
+      new_time = NowNanoseconds();
+      new_found = NewFrames(&s,stream,len_stream,segment,&new_sum);
+      new_time = NowNanoseconds() - new_time;
+      FreeMemory(MALLOC_ID_BUFFER,s.receive_buf,s.receive_size);
+
+      if (old_found != num_messages || new_found != num_messages || old_sum != new_sum)
+	 mismatches++;
+
+      printf("buffer chain:      %8.1f ms, %6.1f M messages/s\n",
+	     old_time/1e6,old_found/(old_time/1e9)/1e6);
+      printf("contiguous buffer: %8.1f ms, %6.1f M messages/s%s\n",
+	     new_time/1e6,new_found/(new_time/1e9)/1e6,
+	     old_found != new_found || old_sum != new_sum ? "  MESSAGES DIFFER" : "");
+   }
+
+   free(stream);
+   return mismatches ? 1 : 0;
+}
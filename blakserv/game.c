@@ -37,7 +37,6 @@ void GameSyncProcessSessionBuffer(session_node *s);
 void GameSyncInputChar(session_node *s,char ch);
 void GameWarnLowCredits(session_node *s);
 void GameProtocolParse(session_node *s,client_msg *msg);
-void GameStartUser(session_node *s,user_node *u);
 void GameTryGetUser(session_node *s);
 void GameSendEachUserChoice(user_node *u);
 void GameSendSystemEnter(session_node *s);
@@ -107,6 +106,7 @@ void GameProcessSessionTimer(session_node *s)
    SetSessionTimer(s,ConfigInt(CREDIT_DRAIN_TIME));
 
    s->account->credits -= ConfigInt(CREDIT_DRAIN_AMOUNT);
+   MarkAccountDirty(s->account);
 
    if (s->game->game_state != GAME_NORMAL)
       return;
@@ -130,7 +130,7 @@ void GameProcessSessionTimer(session_node *s)
 
 void GameProcessSessionBuffer(session_node *s)
 {
-   client_msg msg;
+   client_msg msg,*header;
    unsigned short security;
 
    s->game->game_last_message_time = GetTime();
@@ -142,12 +142,14 @@ void GameProcessSessionBuffer(session_node *s)
    }
 
    /* need to copy only as many bytes as we can hold */
-   while (s->receive_list != NULL)
+   while (GetSessionReadBytes(s) > 0)
    {
-      if (PeekSessionBytes(s,HEADERBYTES,&msg) == False)
+      /* look at the header where it sits in the receive buffer */
+      header = (client_msg *)PeekSessionData(s,HEADERBYTES);
+      if (header == NULL)
 	 return;
 
-      if (msg.len != msg.len_verify)
+      if (header->len != header->len_verify)
       {
 	 /* dprintf("GPSB found len != len_verify %i %i\n",msg_len,msg_len_verify); */
 	 GameSendResync(s);
@@ -156,17 +158,18 @@ void GameProcessSessionBuffer(session_node *s)
 	 return;
       }
 
-      if (msg.len > LEN_MAX_CLIENT_MSG)
+      if (header->len > LEN_MAX_CLIENT_MSG)
       {
-         eprintf("GameProcessSessionBuffer got message too long %i\n",msg.len);
+         eprintf("GameProcessSessionBuffer got message too long %i\n",header->len);
 	 GameSendResync(s);
 	 GameSyncInit(s);
 	 GameSyncProcessSessionBuffer(s);
 	 return;
       }
       
-      /* now read the header for real, plus the actual data */
-      if (ReadSessionBytes(s,msg.len+HEADERBYTES,&msg) == False)
+      /* copy the whole message out, since we give up the receive mutex
+	 while parsing it, and the buffer can move then */
+      if (ReadSessionBytes(s,header->len+HEADERBYTES,&msg) == False)
 	 return;
 
       /* dprintf("got crc %08x\n",msg.crc16); */
@@ -213,6 +216,7 @@ void GameProcessSessionBuffer(session_node *s)
       if (!MutexRelease(s->muxReceive))
 	 eprintf("GPSB released mutex it didn't own in session %i\n",s->session_id);
 	 
+      CountMetric(METRIC_MESSAGES_RECEIVED,1);
       GameProtocolParse(s,&msg);
       
       if (!MutexAcquireWithTimeout(s->muxReceive,10000))
@@ -273,7 +277,7 @@ void GameSyncProcessSessionBuffer(session_node *s)
 {
    char ch;
 
-   while (s->receive_list != NULL)
+   while (GetSessionReadBytes(s) > 0)
    {
       if (ReadSessionBytes(s,1,&ch) == False)
 	 return;
@@ -557,6 +561,7 @@ void GameStartUser(session_node *s,user_node *u)
    val_type session_id_const;
 
    s->game->object_id = u->object_id;
+   RecordEnterGame(s,u->object_id);
 
    session_id_const.v.tag = TAG_SESSION;
    session_id_const.v.data = s->session_id;
@@ -627,7 +632,7 @@ void GameSendEachUserChoice(user_node *u)
 		 name_val.v.data);
 	    return;
       }
-      AddStringToPacket(strlen(r->resource_val),r->resource_val);
+      AddStringToPacket(r->len_val,r->resource_val);
    }
 
    num_val.int_val = SendTopLevelBlakodMessage(u->object_id,IS_FIRST_TIME_MSG,0,NULL);
@@ -14,38 +14,142 @@
  everything else isn't too complicated.  See the GarbageCollect()
  function below for a full description of how things work.
 
+ ReclaimObjects() is a cheaper, non-moving pass that only marks objects
+ and deletes the unreferenced ones.  Nothing is renumbered, but the
+ deleted slots go on the object free list to be reused by new objects,
+ and clients keep object ids around (in their inventory, the room, and
+ so on), not just in messages on the way.  So, like GarbageCollect(), it
+ must be run between the Blakod's SYSEVENT_GARBAGE begin and end system
+ events, which have the users' clients wait and then throw away and
+ reacquire everything they know.  ReclaimListNodes() does the same for
+ list nodes, putting them on the list node free list; no client knows
+ about those.  Both delete the timers of the objects they delete.
+
+ Most passes are split among [Auto] GarbageThreads worker threads (one
+ per processor if it's 0), started for the pass and joined at its end.
+ It's 1 by default, which runs every pass on the main thread as before,
+ until the threaded passes have been timed and checked on more than one
+ processor.
+ A pass over the objects, list nodes or strings gives each worker an
+ equal range of ids.  Renumbering is done in two such passes: the first
+ counts the nodes each worker keeps, and after adding the counts up, the
+ second gives each kept node its new id, starting at the first id of its
+ worker's range.  Marking can't be split up ahead of time, since nobody
+ knows what's reachable from where, so each marker keeps a stack of the
+ objects and list nodes it has yet to look at, and hands some out to be
+ stolen when another marker runs dry.  A node is marked by swapping its
+ garbage_ref from UNREFERENCED to REFERENCED, so each is looked at once
+ however many markers find it.  Deleting objects and moving nodes into
+ their new spots stay on the main thread, in order.
+
  */
 
 #include "blakserv.h"
 
 #define SERVER_MERGE_BASE		(0)
 
-#define VISITED_LIST (1<<31)
-
 #define UNREFERENCED -1
 #define REFERENCED -2
 
+#define GARBAGE_MAX_THREADS 16
+#define GARBAGE_MIN_RANGE 16384 /* fewer ids than this aren't worth another thread */
+
+#define INIT_MARK_ITEMS 4096
+#define MAX_SHARED_MARKS 256 /* most a marker hands out at once */
+
+/* marking work is an object or list node id, with the low bit saying which */
+#define MARK_OBJECT_ITEM(id) ((id) << 1)
+#define MARK_LIST_ITEM(id) (((id) << 1) | 1)
+
+typedef struct
+{
+   int *items; /* only this marker uses these, from first up to num_items */
+   int first,num_items,max_items;
+   int shared[MAX_SHARED_MARKS]; /* up for stealing, under lock */
+   volatile int num_shared;
+   volatile LONG lock;
+} mark_worker;
+
+int next_renumber;
+
+static int num_reclaimed_list_nodes;
+
+static int gc_num_threads; /* for the collection going on */
+static Thread gc_threads[GARBAGE_MAX_THREADS];
+static void (*gc_worker_proc)(int worker);
+
+/* the pass that ForEach...InParallel is running */
+static void (*gc_object_callback)(object_node *o);
+static void (*gc_list_callback)(list_node *l,int list_id);
+static void (*gc_string_callback)(string_node *snod,int string_id);
+static int gc_range_count,gc_range_workers;
+static int gc_range_kept[GARBAGE_MAX_THREADS];
+static int gc_range_base[GARBAGE_MAX_THREADS];
+static THREAD_LOCAL int gc_worker_kept;
+static THREAD_LOCAL int gc_worker_next;
+
+static mark_worker mark_workers[GARBAGE_MAX_THREADS];
+static THREAD_LOCAL mark_worker *gc_marker;
+static volatile int num_markers;
+static volatile LONG num_idle_markers;
+static int num_mark_ranges;
+static Bool mark_objects; /* follow objects too, not just list nodes */
+static int *mark_roots;
+static int num_mark_roots,max_mark_roots;
+
+static garbage_statistics garbage_stats;
+
 /* local function prototypes */
 
 void GarbageKickoffGamePick(session_node *s);
 void GarbageWarnAdminSession(session_node *s);
 
+/* worker threads */
+int GetGarbageThreads(void);
+int StartGarbageWorkers(void (*worker_proc)(int worker),int num_workers);
+void JoinGarbageWorkers(int num_started);
+void GarbageWorkerThread(void *arg);
+void GarbageRangeWorker(int worker);
+void RunGarbageRanges(int count);
+void ForEachObjectInParallel(void (*callback_func)(object_node *o));
+void ForEachListNodeInParallel(void (*callback_func)(list_node *l,int list_id));
+void ForEachStringInParallel(void (*callback_func)(string_node *snod,int string_id));
+int AddUpGarbageRanges(int base);
+
+/* marking */
+void AddMarkRoot(int item);
+void MarkInParallel(Bool follow_objects);
+void MarkWorker(int worker);
+void PushMark(int item);
+void DrainMarks(mark_worker *w);
+void ShareMarks(mark_worker *w);
+Bool StealMarks(int worker);
+Bool AnySharedMarks(void);
+void LockMarks(mark_worker *w);
+void UnlockMarks(mark_worker *w);
+Bool ClaimGarbageRef(int *garbage_ref);
+
 /* list node garbage collection */
 void ClearListNodeGarbageRef(list_node *l,int list_id);
 void MarkObjectListNodes(object_node *o);
 void MarkListNode(int list_id);
+void CountListNode(list_node *l,int list_id);
 void RenumberListNode(list_node *l,int list_id);
 void RenumberObjectListNodeReferences(object_node *o);
-void RenumberListNodeReferences(val_type *vlist_ptr);
+void RenumberListNodeListReferences(list_node *l,int list_id);
+void ResetListNodeReference(val_type *vlist_ptr);
 void CompactListNode(list_node *l,int list_id);
+void MarkTableListNodes(val_type *val);
+void FreeUnreferencedListNode(list_node *l,int list_id);
 
 /* object garbage collection */
 void ClearObjectGarbageRef(object_node *o);
 void MarkUserObjectNodes(user_node *u);
 void MarkObject(int object_id);
-void MarkListNodeObject(int list_id);
 void DeleteUnreferencedObject(object_node *o);
+void MarkTableObjects(val_type *val);
 
+void CountObject(object_node *o);
 void RenumberObject(object_node *o);
 void RenumberObjectReferences(object_node *o);
 void RenumberUserObjectReferences(user_node *u);
@@ -67,6 +171,7 @@ void ClearStringGarbageRef(string_node *snod,int string_id);
 void MarkObjectStrings(object_node *o);
 void MarkListNodeStrings(list_node *l,int list_id);
 void MarkString(int string_id);
+void CountString(string_node *snod,int string_id);
 void RenumberString(string_node *snod,int string_id);
 void RenumberObjectStringReferences(object_node *o);
 void RenumberListNodeStringReferences(list_node *l,int list_id);
@@ -74,10 +179,14 @@ void ResetStringReference(val_type *vlist_ptr);
 void CompactString(string_node *snod,int string_id);
 
 
-int next_renumber;
-
 void GarbageCollect()
 {
+   UINT64 start_time,phase_time,now;
+
+   start_time = GetMilliCount();
+   gc_num_threads = GetGarbageThreads();
+   RecordSystem(RECORD_GARBAGE,0);
+
    /* anyone in game mode w/o a user can have stale data, so knock 'em out */
    ForEachSession(GarbageKickoffGamePick);
 
@@ -96,92 +205,232 @@ void GarbageCollect()
 
    /* first, garbage collect the list nodes */
 
-   /* 
+   /*
     * This is complicated, because there can be multiple references
     * to a list node out there.
     *
     * However, it's still O(number of list nodes + number of object nodes)
     *
     * first, mark all list nodes unreferenced.
-    *  then, mark used list nodes referenced.
+    *  then, mark used list nodes referenced, starting from the objects.
+    *  then, count the referenced list nodes in each worker's range of
+    *        ids, and add the counts up to get where each range starts.
     *  then, go through each list node in increasing numerical order and
     *        set the garbage_ref to what its new list node id will be.
-    *  then, go through each object & list node and change its
-    *        list id to that list node's new list id.
+    *  then, go through each object & referenced list node and change
+    *        its list ids to those list nodes' new list ids.
     *  then, go through each list node in increasing numerical order and
     *        move it to its new list id spot.
     */
 
-   ForEachListNode(ClearListNodeGarbageRef);
-   ForEachObject(MarkObjectListNodes);
-   
-   next_renumber = SERVER_MERGE_BASE;
-   
-   ForEachListNode(RenumberListNode);
-   ForEachObject(RenumberObjectListNodeReferences);
+   phase_time = GetMilliCount();
+
+   ForEachListNodeInParallel(ClearListNodeGarbageRef);
+   MarkInParallel(False);
+
+   ForEachListNodeInParallel(CountListNode);
+   next_renumber = AddUpGarbageRanges(SERVER_MERGE_BASE);
+   ForEachListNodeInParallel(RenumberListNode);
+   ForEachObjectInParallel(RenumberObjectListNodeReferences);
+   ForEachListNodeInParallel(RenumberListNodeListReferences);
    ForEachListNode(CompactListNode);
 
    SetNumListNodes(next_renumber);
-   
+
+   now = GetMilliCount();
+   garbage_stats.last_list_time = (int)(now - phase_time);
+   phase_time = now;
+
    /* now garbage collect the object nodes */
 
-   /* 
-    * This is complicated, because there are multiple references to 
+   /*
+    * This is complicated, because there are multiple references to
     * objects out there.
     *
     * However, it's still O(number of list nodes + number of object nodes)
     *
     * First, go through every user and system and mark referenced objects.
     *  then, delete the unreferenced ones.
+    *  then, count the objects in each worker's range, and add them up.
     *  then, go through each object in increasing numerical order and
     *        set the garbage_ref to what its new object id will be.
     *  then, go through each object, list node, user, session, and timer,
     *        and change its object id to that object's new object id.
     *  then, go through each object in increasing numerical order and
     *        move it to its new object id spot.
+    *
+    * The list nodes' garbage_refs are cleared too, so that marking
+    * goes through each list only once.
     */
 
-   ForEachObject(ClearObjectGarbageRef);
+   ForEachObjectInParallel(ClearObjectGarbageRef);
+   ForEachListNodeInParallel(ClearListNodeGarbageRef);
    ForEachUser(MarkUserObjectNodes);
-   MarkObject(GetSystemObjectID());
+   AddMarkRoot(MARK_OBJECT_ITEM(GetSystemObjectID()));
+   MarkInParallel(True);
    ForEachObject(DeleteUnreferencedObject);
+   DeleteTimersOfDeletedObjects();
 
-   next_renumber = SERVER_MERGE_BASE;
-
-   ForEachObject(RenumberObject);
-   ForEachObject(RenumberObjectReferences);
-   ForEachListNode(RenumberListNodeObjectReferences);
+   ForEachObjectInParallel(CountObject);
+   next_renumber = AddUpGarbageRanges(SERVER_MERGE_BASE);
+   ForEachObjectInParallel(RenumberObject);
+   ForEachObjectInParallel(RenumberObjectReferences);
+   ForEachListNodeInParallel(RenumberListNodeObjectReferences);
    ForEachUser(RenumberUserObjectReferences);
    ForEachSession(RenumberSessionObjectReferences);
    ForEachTimer(RenumberTimerObjectReferences);
    ForEachObject(CompactObject);
    SetNumObjects(next_renumber);
 
+   now = GetMilliCount();
+   garbage_stats.last_object_time = (int)(now - phase_time);
+   phase_time = now;
+
    /* now renumber timers, good for saving, and prevents rollover,
-    * since they are created and deleted all the time 
+    * since they are created and deleted all the time
     */
 
    next_renumber = SERVER_MERGE_BASE;
 
    ForEachTimer(RenumberTimer);
-   ForEachObject(RenumberObjectTimerReferences);
-   ForEachListNode(RenumberListNodeTimerReferences);
+   ForEachObjectInParallel(RenumberObjectTimerReferences);
+   ForEachListNodeInParallel(RenumberListNodeTimerReferences);
    ForEachTimer(CompactTimer);
    SetNumTimers(next_renumber);
 
-   /* now garbage collect the strings, just like list nodes */
+   now = GetMilliCount();
+   garbage_stats.last_timer_time = (int)(now - phase_time);
+   phase_time = now;
 
-   ForEachString(ClearStringGarbageRef);
-   ForEachObject(MarkObjectStrings);
-   ForEachListNode(MarkListNodeStrings);
+   /* now garbage collect the strings, just like list nodes */
 
-   next_renumber = SERVER_MERGE_BASE;
+   ForEachStringInParallel(ClearStringGarbageRef);
+   ForEachObjectInParallel(MarkObjectStrings);
+   ForEachListNodeInParallel(MarkListNodeStrings);
 
-   ForEachString(RenumberString);
-   ForEachObject(RenumberObjectStringReferences);
-   ForEachListNode(RenumberListNodeStringReferences);
+   ForEachStringInParallel(CountString);
+   next_renumber = AddUpGarbageRanges(SERVER_MERGE_BASE);
+   ForEachStringInParallel(RenumberString);
+   ForEachObjectInParallel(RenumberObjectStringReferences);
+   ForEachListNodeInParallel(RenumberListNodeStringReferences);
    ForEachString(CompactString);
    SetNumStrings(next_renumber);
+
+   now = GetMilliCount();
+   garbage_stats.last_string_time = (int)(now - phase_time);
+
+   garbage_stats.num_collections++;
+   garbage_stats.num_threads = gc_num_threads;
+   garbage_stats.last_time = (int)(now - start_time);
+   ObserveMetric(METRIC_GARBAGE_COLLECT,(INT64)garbage_stats.last_time*1000);
+   if (garbage_stats.last_time > garbage_stats.longest_time)
+      garbage_stats.longest_time = garbage_stats.last_time;
+
+   lprintf("GarbageCollect kept %i objects, %i list nodes and %i strings in %i ms with %i threads "
+	   "(lists %i ms, objects %i ms, timers %i ms, strings %i ms)\n",
+	   GetObjectsUsed(),GetListNodesUsed(),GetStringsUsed(),garbage_stats.last_time,
+	   gc_num_threads,garbage_stats.last_list_time,garbage_stats.last_object_time,
+	   garbage_stats.last_timer_time,garbage_stats.last_string_time);
+}
+
+int ReclaimObjects()
+{
+   int num_live;
+
+   /* Mark exactly like GarbageCollect does, except that kod tables survive
+    * this, so whatever they hold is kept alive too.  Must only be called
+    * at top level, with no messages on the stack, between the Blakod's
+    * SYSEVENT_GARBAGE system events, so clients drop the ids it frees.
+    */
+   gc_num_threads = GetGarbageThreads();
+   RecordSystem(RECORD_RECLAIM_OBJECTS,0);
+
+   ForEachObjectInParallel(ClearObjectGarbageRef);
+   ForEachListNodeInParallel(ClearListNodeGarbageRef);
+   ForEachUser(MarkUserObjectNodes);
+   AddMarkRoot(MARK_OBJECT_ITEM(GetSystemObjectID()));
+   ForEachTableValue(MarkTableObjects);
+   MarkInParallel(True);
+
+   num_live = GetObjectsLive();
+   ForEachObject(DeleteUnreferencedObject);
+   DeleteTimersOfDeletedObjects();
+
+   if (GetKodStats() && !IsObjectByID(GetKodStats()->interpreting_time_object_id))
+      GetKodStats()->interpreting_time_object_id = INVALID_ID;
+
+   /* these and any deleted by the Blakod since the last epoch can be
+      reused, since clients are told to reacquire their data at the end
+      of the system event, and messages sent before it are ignored */
+   if (GetHeldFreeObjects() > 0)
+   {
+      NewEpoch();
+      ReleaseFreeObjects();
+   }
+
+   return num_live - GetObjectsLive();
+}
+
+int ReclaimListNodes()
+{
+   val_type cli_list;
+
+   /* Mark from the objects like GarbageCollect does, and from the kod
+    * tables and the client parser's constant list too, since those aren't
+    * rebuilt afterwards here.  Top level only, like ReclaimObjects(); run
+    * that first so the lists of objects it deletes get reclaimed as well.
+    */
+   gc_num_threads = GetGarbageThreads();
+   RecordSystem(RECORD_RECLAIM_LIST_NODES,0);
+
+   ForEachListNodeInParallel(ClearListNodeGarbageRef);
+   ForEachTableValue(MarkTableListNodes);
+
+   cli_list = GetParseClientListNodes();
+   if (cli_list.v.tag == TAG_LIST)
+      AddMarkRoot(MARK_LIST_ITEM(cli_list.v.data));
+
+   MarkInParallel(False);
+
+   num_reclaimed_list_nodes = 0;
+   ForEachListNode(FreeUnreferencedListNode);
+
+   return num_reclaimed_list_nodes;
+}
+
+/* MarkLiveNodes
+*
+* Marks the objects and list nodes that ReclaimObjects() and
+* ReclaimListNodes() would keep, but frees nothing; it's for the census.
+* Top level only, like they are.
+*/
+void MarkLiveNodes()
+{
+   val_type cli_list;
+
+   gc_num_threads = GetGarbageThreads();
+
+   ForEachObjectInParallel(ClearObjectGarbageRef);
+   ForEachListNodeInParallel(ClearListNodeGarbageRef);
+   ForEachUser(MarkUserObjectNodes);
+   AddMarkRoot(MARK_OBJECT_ITEM(GetSystemObjectID()));
+   ForEachTableValue(MarkTableObjects);
+
+   cli_list = GetParseClientListNodes();
+   if (cli_list.v.tag == TAG_LIST)
+      AddMarkRoot(MARK_LIST_ITEM(cli_list.v.data));
+
+   MarkInParallel(True);
+}
+
+Bool IsMarkedObject(object_node *o)
+{
+   return o->garbage_ref == REFERENCED;
+}
+
+void GetGarbageStats(garbage_statistics *gstat)
+{
+   *gstat = garbage_stats;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -208,6 +457,381 @@ void GarbageWarnAdminSession(session_node *s)
 
 /////////////////////////////////////////////////////////////////////////////
 
+int GetGarbageThreads(void)
+{
+   int num_threads;
+
+   num_threads = ConfigInt(AUTO_GARBAGE_THREADS);
+   if (num_threads <= 0)
+      num_threads = ThreadNumProcessors();
+   return std::max(1,std::min(num_threads,GARBAGE_MAX_THREADS));
+}
+
+/* StartGarbageWorkers
+*
+* Starts worker_proc on threads for workers 1 through num_workers-1;
+* worker 0 is the caller's to run.  Returns how many workers there are
+* counting worker 0, which is fewer than asked for if a thread couldn't
+* be started.
+*/
+int StartGarbageWorkers(void (*worker_proc)(int worker),int num_workers)
+{
+   int i;
+
+   gc_worker_proc = worker_proc;
+   for (i=1;i<num_workers;i++)
+   {
+      if (!ThreadCreate(&gc_threads[i],GarbageWorkerThread,(void *)(intptr_t)i))
+      {
+	 eprintf("StartGarbageWorkers couldn't start worker thread %i\n",i);
+	 break;
+      }
+   }
+   return i;
+}
+
+void JoinGarbageWorkers(int num_started)
+{
+   int i;
+
+   for (i=1;i<num_started;i++)
+      ThreadJoin(gc_threads[i]);
+}
+
+void GarbageWorkerThread(void *arg)
+{
+   gc_worker_proc((int)(intptr_t)arg);
+}
+
+void GarbageRangeWorker(int worker)
+{
+   int start,end;
+
+   start = (int)((INT64)gc_range_count*worker/gc_range_workers);
+   end = (int)((INT64)gc_range_count*(worker+1)/gc_range_workers);
+
+   gc_worker_kept = 0;
+   gc_worker_next = gc_range_base[worker];
+
+   if (gc_object_callback != NULL)
+      ForEachObjectInRange(start,end,gc_object_callback);
+   if (gc_list_callback != NULL)
+      ForEachListNodeInRange(start,end,gc_list_callback);
+   if (gc_string_callback != NULL)
+      ForEachStringInRange(start,end,gc_string_callback);
+
+   gc_range_kept[worker] = gc_worker_kept;
+}
+
+/* RunGarbageRanges
+*
+* Splits the ids below count among the workers, by count alone, so two
+* passes over the same nodes get the same ranges.  Any range whose
+* thread couldn't be started is done here.
+*/
+void RunGarbageRanges(int count)
+{
+   int i,num_started;
+
+   gc_range_count = count;
+   gc_range_workers = std::max(1,std::min(gc_num_threads,count/GARBAGE_MIN_RANGE));
+
+   num_started = StartGarbageWorkers(GarbageRangeWorker,gc_range_workers);
+   GarbageRangeWorker(0);
+   for (i=num_started;i<gc_range_workers;i++)
+      GarbageRangeWorker(i);
+   JoinGarbageWorkers(num_started);
+
+   gc_object_callback = NULL;
+   gc_list_callback = NULL;
+   gc_string_callback = NULL;
+}
+
+void ForEachObjectInParallel(void (*callback_func)(object_node *o))
+{
+   gc_object_callback = callback_func;
+   RunGarbageRanges(GetObjectsUsed());
+}
+
+void ForEachListNodeInParallel(void (*callback_func)(list_node *l,int list_id))
+{
+   gc_list_callback = callback_func;
+   RunGarbageRanges(GetListNodesUsed());
+}
+
+void ForEachStringInParallel(void (*callback_func)(string_node *snod,int string_id))
+{
+   gc_string_callback = callback_func;
+   RunGarbageRanges(GetStringsUsed());
+}
+
+/* AddUpGarbageRanges
+*
+* After a counting pass, sets where each range's new ids start for the
+* renumbering pass, and returns the id after the last one.
+*/
+int AddUpGarbageRanges(int base)
+{
+   int i;
+
+   for (i=0;i<gc_range_workers;i++)
+   {
+      gc_range_base[i] = base;
+      base += gc_range_kept[i];
+   }
+   return base;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void AddMarkRoot(int item)
+{
+   int old_max;
+
+   if (num_mark_roots == max_mark_roots)
+   {
+      old_max = max_mark_roots;
+      max_mark_roots = std::max(2*max_mark_roots,INIT_MARK_ITEMS);
+      if (mark_roots == NULL)
+	 mark_roots = (int *)AllocateMemory(MALLOC_ID_GARBAGE,max_mark_roots*sizeof(int));
+      else
+	 mark_roots = (int *)ResizeMemory(MALLOC_ID_GARBAGE,mark_roots,old_max*sizeof(int),
+					  max_mark_roots*sizeof(int));
+   }
+   mark_roots[num_mark_roots++] = item;
+}
+
+/* MarkInParallel
+*
+* Marks everything reachable from the roots added with AddMarkRoot(),
+* following just list nodes unless follow_objects.  Without it, every
+* object's list properties are roots as well, each worker taking a
+* range of the objects to start with.
+*/
+void MarkInParallel(Bool follow_objects)
+{
+   int i,num_workers;
+   mark_worker *w;
+
+   num_workers = gc_num_threads;
+   if (GetObjectsUsed() + GetListNodesUsed() < GARBAGE_MIN_RANGE)
+      num_workers = 1;
+
+   for (i=0;i<num_workers;i++)
+   {
+      w = &mark_workers[i];
+      w->max_items = INIT_MARK_ITEMS;
+      w->items = (int *)AllocateMemory(MALLOC_ID_GARBAGE,w->max_items*sizeof(int));
+      w->first = 0;
+      w->num_items = 0;
+      w->num_shared = 0;
+      w->lock = 0;
+   }
+
+   mark_objects = follow_objects;
+   num_mark_ranges = follow_objects ? 0 : num_workers;
+   num_idle_markers = 0;
+   num_markers = num_workers;
+
+   num_markers = StartGarbageWorkers(MarkWorker,num_workers);
+   MarkWorker(0);
+   JoinGarbageWorkers(num_markers);
+
+   for (i=0;i<num_workers;i++)
+   {
+      w = &mark_workers[i];
+      FreeMemory(MALLOC_ID_GARBAGE,w->items,w->max_items*sizeof(int));
+      w->items = NULL;
+   }
+   num_mark_roots = 0;
+}
+
+void MarkWorker(int worker)
+{
+   int i,count,spins;
+   mark_worker *w;
+
+   w = &mark_workers[worker];
+   gc_marker = w;
+
+   if (worker == 0)
+      for (i=0;i<num_mark_roots;i++)
+	 PushMark(mark_roots[i]);
+
+   /* worker 0 also takes the object ranges of workers that didn't start */
+   count = GetObjectsUsed();
+   for (i=0;i<num_mark_ranges;i++)
+      if (i == worker || (worker == 0 && i >= num_markers))
+	 ForEachObjectInRange((int)((INT64)count*i/num_mark_ranges),
+			      (int)((INT64)count*(i+1)/num_mark_ranges),MarkObjectListNodes);
+
+   DrainMarks(w);
+
+   /* Everyone's done once all the markers are idle: a marker only goes
+    * idle when it has nothing left, nor can find anything to steal, and
+    * only busy markers share.
+    */
+   for (;;)
+   {
+      if (StealMarks(worker))
+      {
+	 DrainMarks(w);
+	 continue;
+      }
+
+      InterlockedIncrement(&num_idle_markers);
+      for (spins=1;;spins++)
+      {
+	 if (num_idle_markers == num_markers)
+	    return;
+	 if (AnySharedMarks())
+	    break;
+	 if (spins % 64 == 0)
+	    Sleep(0);
+      }
+      InterlockedDecrement(&num_idle_markers);
+   }
+}
+
+void PushMark(int item)
+{
+   mark_worker *w;
+   int old_max;
+
+   w = gc_marker;
+   if (w->num_items == w->max_items)
+   {
+      if (w->first > 0)
+      {
+	 memmove(w->items,w->items + w->first,(w->num_items - w->first)*sizeof(int));
+	 w->num_items -= w->first;
+	 w->first = 0;
+      }
+      else
+      {
+	 old_max = w->max_items;
+	 w->max_items *= 2;
+	 w->items = (int *)ResizeMemory(MALLOC_ID_GARBAGE,w->items,old_max*sizeof(int),
+					w->max_items*sizeof(int));
+      }
+   }
+   w->items[w->num_items++] = item;
+}
+
+void DrainMarks(mark_worker *w)
+{
+   int item;
+
+   while (w->num_items > w->first)
+   {
+      item = w->items[--w->num_items];
+      if (item & 1)
+	 MarkListNode(item >> 1);
+      else
+	 MarkObject(item >> 1);
+
+      if (num_idle_markers > 0 && w->num_shared == 0 && w->num_items - w->first > 1)
+	 ShareMarks(w);
+   }
+   w->first = 0;
+   w->num_items = 0;
+}
+
+/* ShareMarks
+*
+* Hands out the oldest half of what w has left, which are the nearest
+* the roots and so likely the most work.
+*/
+void ShareMarks(mark_worker *w)
+{
+   int num_share;
+
+   num_share = std::min((w->num_items - w->first)/2,MAX_SHARED_MARKS);
+
+   LockMarks(w);
+   memcpy(w->shared,w->items + w->first,num_share*sizeof(int));
+   w->num_shared = num_share;
+   UnlockMarks(w);
+
+   w->first += num_share;
+}
+
+/* StealMarks
+*
+* Takes back what this marker shared if nobody took it, or else what
+* another has shared.
+*/
+Bool StealMarks(int worker)
+{
+   int stolen[MAX_SHARED_MARKS];
+   int i,j,num_stolen,num;
+   mark_worker *victim;
+
+   num = num_markers;
+   for (i=0;i<num;i++)
+   {
+      victim = &mark_workers[(worker + i) % num];
+      if (victim->num_shared == 0)
+	 continue;
+
+      LockMarks(victim);
+      num_stolen = victim->num_shared;
+      memcpy(stolen,victim->shared,num_stolen*sizeof(int));
+      victim->num_shared = 0;
+      UnlockMarks(victim);
+
+      if (num_stolen > 0)
+      {
+	 for (j=0;j<num_stolen;j++)
+	    PushMark(stolen[j]);
+	 return True;
+      }
+   }
+   return False;
+}
+
+Bool AnySharedMarks(void)
+{
+   int i;
+
+   for (i=0;i<num_markers;i++)
+      if (mark_workers[i].num_shared > 0)
+	 return True;
+   return False;
+}
+
+void LockMarks(mark_worker *w)
+{
+   while (InterlockedCompareExchange(&w->lock,1,0) != 0)
+      ;
+}
+
+void UnlockMarks(mark_worker *w)
+{
+   InterlockedDecrement(&w->lock);
+}
+
+/* ClaimGarbageRef
+*
+* Marks a node referenced, returning True for just the one marker that
+* got to it first.
+*/
+Bool ClaimGarbageRef(int *garbage_ref)
+{
+   if (*(volatile int *)garbage_ref != UNREFERENCED)
+      return False;
+
+   if (num_markers == 1)
+   {
+      *garbage_ref = REFERENCED;
+      return True;
+   }
+   return InterlockedCompareExchange((volatile LONG *)garbage_ref,REFERENCED,UNREFERENCED) ==
+      UNREFERENCED;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 void ClearListNodeGarbageRef(list_node *l,int list_id)
 {
    l->garbage_ref = UNREFERENCED;
@@ -221,7 +845,8 @@ void MarkObjectListNodes(object_node *o)
    {
       if (o->p[i].val.v.tag == TAG_LIST)
       {
-	 MarkListNode(o->p[i].val.v.data);
+	 PushMark(MARK_LIST_ITEM(o->p[i].val.v.data));
+	 DrainMarks(gc_marker);
       }
    }
 }
@@ -238,11 +863,21 @@ void MarkListNode(int list_id)
 	 eprintf("MarkListNode death by garbage collection\n");
 	 return;
       }
-      
-      l->garbage_ref = REFERENCED;
-      
+
+      /* the rest of a shared tail is already marked, or being marked */
+      if (!ClaimGarbageRef(&l->garbage_ref))
+	 return;
+
       if (l->first.v.tag == TAG_LIST)
-	 MarkListNode(l->first.v.data);
+	 PushMark(MARK_LIST_ITEM(l->first.v.data));
+
+      if (mark_objects)
+      {
+	 if (l->first.v.tag == TAG_OBJECT)
+	    PushMark(MARK_OBJECT_ITEM(l->first.v.data));
+	 if (l->rest.v.tag == TAG_OBJECT)
+	    PushMark(MARK_OBJECT_ITEM(l->rest.v.data));
+      }
 
       if (l->rest.v.tag != TAG_LIST)
 	 break;
@@ -251,72 +886,89 @@ void MarkListNode(int list_id)
    }
 }
 
+void CountListNode(list_node *l,int list_id)
+{
+   if (l->garbage_ref == REFERENCED)
+      gc_worker_kept++;
+}
+
 void RenumberListNode(list_node *l,int list_id)
 {
    if (l->garbage_ref == REFERENCED)
    {
-      l->garbage_ref = next_renumber++;
+      l->garbage_ref = gc_worker_next++;
    }
 }
 
 void RenumberObjectListNodeReferences(object_node *o)
 {
    int i;
-   
+
    for (i=0;i<o->num_props;i++)
    {
       if (o->p[i].val.v.tag == TAG_LIST)
       {
-	 RenumberListNodeReferences(&(o->p[i].val));
+	 ResetListNodeReference(&(o->p[i].val));
       }
    }
 }
 
-void RenumberListNodeReferences(val_type *vlist_ptr)
+/* RenumberListNodeListReferences
+*
+* Each referenced node fixes up its own first and rest, so a list shared
+* by several others is only fixed up once.
+*/
+void RenumberListNodeListReferences(list_node *l,int list_id)
+{
+   if (l->garbage_ref < 0)
+      return;
+
+   if (l->first.v.tag == TAG_LIST)
+      ResetListNodeReference(&(l->first));
+   if (l->rest.v.tag == TAG_LIST)
+      ResetListNodeReference(&(l->rest));
+}
+
+void ResetListNodeReference(val_type *vlist_ptr)
 {
    list_node *l;
-   
-  begin:
+
    l = GetListNodeByID(vlist_ptr->v.data);
    if (l == NULL)
    {
-      eprintf("RenumberListNodeReferences death by garbage collection\n");
+      eprintf("ResetListNodeReference death by garbage collection\n");
       return;
    }
-   
+
    if (l->garbage_ref == REFERENCED || l->garbage_ref == UNREFERENCED)
    {
-      eprintf("RenumberListNodeReferences unrenumbered list node %i\n",
+      eprintf("ResetListNodeReference unrenumbered list node %i\n",
 	      vlist_ptr->v.data);
       return;
    }
-   
-   /* this VISITED_LIST bit is around because suppose there are two lists
-    * each containing a third list.  The first reference to list 3 will
-    * move its first and rest things, but the second should not.
-    */
-   
-   vlist_ptr->v.data = l->garbage_ref & ~VISITED_LIST; /* has the new list node id */
-   
-   if (!(l->garbage_ref & VISITED_LIST))
-   {
-      l->garbage_ref = l->garbage_ref | VISITED_LIST;
-      
-      if (l->first.v.tag == TAG_LIST)
-	 RenumberListNodeReferences(&(l->first));
-      if (l->rest.v.tag == TAG_LIST)
-      {
-	 vlist_ptr = &(l->rest);
-	 goto begin;
-      }
-   }
 
+   vlist_ptr->v.data = l->garbage_ref; /* has the new list node id */
 }
 
 void CompactListNode(list_node *l,int list_id)
 {
    if (l->garbage_ref != UNREFERENCED)
-      MoveListNode(l->garbage_ref & ~VISITED_LIST,list_id);
+      MoveListNode(l->garbage_ref,list_id);
+}
+
+void MarkTableListNodes(val_type *val)
+{
+   if (val->v.tag == TAG_LIST)
+      AddMarkRoot(MARK_LIST_ITEM(val->v.data));
+}
+
+void FreeUnreferencedListNode(list_node *l,int list_id)
+{
+   if (l->garbage_ref == UNREFERENCED && IsListNodeByID(list_id))
+   {
+      FreeListNode(list_id);
+      num_reclaimed_list_nodes++;
+   }
 }
 
 void ClearObjectGarbageRef(object_node *o)
@@ -326,7 +978,7 @@ void ClearObjectGarbageRef(object_node *o)
 
 void MarkUserObjectNodes(user_node *u)
 {
-   MarkObject(u->object_id);
+   AddMarkRoot(MARK_OBJECT_ITEM(u->object_id));
 }
 
 void MarkObject(int object_id)
@@ -342,44 +994,24 @@ void MarkObject(int object_id)
       return;
    }
 
-   if (o->garbage_ref == REFERENCED)
+   if (!ClaimGarbageRef(&o->garbage_ref))
       return;
 
-   o->garbage_ref = REFERENCED;
-
    for (i=0;i<o->num_props;i++)
    {
       if (o->p[i].val.v.tag == TAG_OBJECT)
-	 MarkObject(o->p[i].val.v.data);
+	 PushMark(MARK_OBJECT_ITEM(o->p[i].val.v.data));
       if (o->p[i].val.v.tag == TAG_LIST)
-	 MarkListNodeObject(o->p[i].val.v.data);
+	 PushMark(MARK_LIST_ITEM(o->p[i].val.v.data));
    }
 }
 
-void MarkListNodeObject(int list_id)
+void MarkTableObjects(val_type *val)
 {
-   list_node *l;
-
-   while (1)
-   {
-      l = GetListNodeByID(list_id);
-      if (l == NULL)
-      {
-	 eprintf("MarkListNodeObject death by garbage collection\n");
-	 return;
-      }
-      
-      if (l->first.v.tag == TAG_OBJECT)
-	 MarkObject(l->first.v.data);
-      if (l->rest.v.tag == TAG_OBJECT)
-	 MarkObject(l->rest.v.data);
-      
-      if (l->first.v.tag == TAG_LIST)
-	 MarkListNodeObject(l->first.v.data);
-      if (l->rest.v.tag != TAG_LIST)
-	 break;
-      list_id = l->rest.v.data;
-   }
+   if (val->v.tag == TAG_OBJECT)
+      AddMarkRoot(MARK_OBJECT_ITEM(val->v.data));
+   if (val->v.tag == TAG_LIST)
+      AddMarkRoot(MARK_LIST_ITEM(val->v.data));
 }
 
 void DeleteUnreferencedObject(object_node *o)
@@ -388,9 +1020,14 @@ void DeleteUnreferencedObject(object_node *o)
       DeleteBlakodObject(o->object_id);
 }
 
+void CountObject(object_node *o)
+{
+   gc_worker_kept++;
+}
+
 void RenumberObject(object_node *o)
 {
-   o->garbage_ref = next_renumber++;
+   o->garbage_ref = gc_worker_next++;
 }
 
 void RenumberObjectReferences(object_node *o)
@@ -417,9 +1054,9 @@ void RenumberListNodeObjectReferences(list_node *l,int list_id)
       if (ResetObjectReference(&(l->first)) == False)
 	 eprintf("RenumberListNodesReferences got object death in list node %i first\n",
 		 list_id);
-      
+
    }
-   
+
    if (l->rest.v.tag == TAG_OBJECT)
    {
       if (ResetObjectReference(&(l->rest)) == False)
@@ -577,11 +1214,17 @@ void MarkString(int string_id)
    snod->garbage_ref = REFERENCED;
 }
 
+void CountString(string_node *snod,int string_id)
+{
+   if (snod->garbage_ref == REFERENCED)
+      gc_worker_kept++;
+}
+
 void RenumberString(string_node *snod,int string_id)
 {
    if (snod->garbage_ref == REFERENCED)
    {
-      snod->garbage_ref = next_renumber++;
+      snod->garbage_ref = gc_worker_next++;
    }
 }
 
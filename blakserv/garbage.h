@@ -13,6 +13,20 @@
 #ifndef _GARBAGE_H
 #define _GARBAGE_H
 
+typedef struct
+{
+   int num_collections;
+   int num_threads; /* used by the last collection */
+   int last_time; /* milliseconds the last collection took */
+   int last_list_time,last_object_time,last_timer_time,last_string_time;
+   int longest_time;
+} garbage_statistics;
+
 void GarbageCollect(void);
+void GetGarbageStats(garbage_statistics *gstat);
+int ReclaimObjects(void);
+int ReclaimListNodes(void);
+void MarkLiveNodes(void);
+Bool IsMarkedObject(object_node *o);
 
 #endif
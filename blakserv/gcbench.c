@@ -0,0 +1,454 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * gcbench.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself,
+ though it links with the rest of the server.  It builds a made-up game
+ in memory, a system object holding lists of rooms full of objects,
+ each with lists of numbers, strings, objects and other lists, some of
+ them sharing tails, plus a quarter of the objects that nothing keeps,
+ and times GarbageCollect() on it with different [Auto] GarbageThreads.
+ The same game is built for each run, and the reachable part of it is
+ walked before and after collecting to check that the collector kept
+ everything that was reachable, the same way, and that each class's
+ index of its instances still matches the objects.  Build it with
+ "make -f makefile.linux gcbench" and run bin/gcbench [objects] [list length] [threads], where
+ threads is the most to try, one per processor by default.
+
+ Then it saves the collected game with each [Save] Version, compressed
+ and not, loads it back in, and times both, checking that what loads
+ is what was saved.  The file is written to the current directory and
+ removed afterwards.
+
+ */
+
+#include "blakserv.h"
+
+#define BENCH_DEFAULT_OBJECTS 500000
+#define BENCH_DEFAULT_LIST_LENGTH 8
+#define BENCH_ROOM_OBJECTS 1000
+#define BENCH_CLASS 100
+#define BENCH_PROPERTIES 4
+#define BENCH_SAVE_FILE "gcbench.save"
+
+static unsigned int seed;
+
+Bool InMainLoop(void)
+{
+   return False;
+}
+
+static double NowNanoseconds(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static int Random(int n)
+{
+   seed = seed*1103515245 + 12345;
+   return (seed >> 8) % n;
+}
+
+static val_type MakeVal(int tag,int data)
+{
+   val_type val;
+
+   val.int_val = NIL;
+   val.v.tag = tag;
+   val.v.data = data;
+   return val;
+}
+
+static void AddBenchClass(int class_id,const char *class_name,int num_properties)
+{
+   bof_class_header *header;
+   bof_class_props *props;
+   class_node *c;
+   char name[20];
+   int i;
+
+   header = (bof_class_header *)AllocateMemory(MALLOC_ID_CLASS,sizeof(bof_class_header));
+   memset(header,0,sizeof(bof_class_header));
+   props = (bof_class_props *)AllocateMemory(MALLOC_ID_CLASS,sizeof(bof_class_props));
+   memset(props,0,sizeof(bof_class_props));
+   props->num_properties = num_properties;
+   AddClass(class_id,header,(char *)"gcbench",NULL,NULL,NULL,props);
+   SetClassName(class_id,(char *)class_name);
+
+   /* so SaveGame() and LoadGame() can match them up, and objects
+      LoadGame() makes have their property ids set */
+   c = GetClassByID(class_id);
+   c->num_prop_defaults = num_properties;
+   c->prop_default = (prop_default_type *)
+      AllocateMemory(MALLOC_ID_CLASS,num_properties*sizeof(prop_default_type));
+   for (i=1;i<=num_properties;i++)
+   {
+      sprintf(name,"p%i",i);
+      AddClassPropertyName(c,name,i);
+      c->prop_default[i-1].id = i;
+      c->prop_default[i-1].val.int_val = NIL;
+   }
+}
+
+/* NewBenchObject
+*
+* Made the way loading a saved game makes them, so no kod has to run.
+*/
+static object_node * NewBenchObject(const char *class_name)
+{
+   object_node *o;
+   int i;
+
+   LoadObject(GetObjectsUsed(),(char *)class_name);
+   o = GetObjectByID(GetObjectsUsed() - 1);
+   o->p[0].id = 0;
+   o->p[0].val = MakeVal(TAG_OBJECT,o->object_id);
+   for (i=1;i<o->num_props;i++)
+   {
+      o->p[i].id = i;
+      o->p[i].val.int_val = NIL;
+   }
+   return o;
+}
+
+/* BuildHeap
+*
+* Makes the same game every time for the same arguments.
+*/
+static void BuildHeap(int num_objects,int list_length)
+{
+   object_node *o,*other,*sys;
+   val_type list,room,rooms,elem;
+   char buf[40];
+   int i,k,num_kept;
+
+   ResetObject();
+   ResetList();
+   ResetString();
+   seed = 1;
+
+   sys = NewBenchObject("System");
+   SetSystemObjectID(sys->object_id);
+
+   rooms.int_val = NIL;
+   room.int_val = NIL;
+   num_kept = 0;
+   for (i=1;i<num_objects;i++)
+   {
+      o = NewBenchObject("Bench");
+
+      list.int_val = NIL;
+      for (k=0;k<list_length;k++)
+      {
+	 switch (Random(8))
+	 {
+	 case 0 :
+	    sprintf(buf,"item %i of %i",k,i);
+	    elem = MakeVal(TAG_STRING,CreateString(buf));
+	    break;
+	 case 1 :
+	 case 2 :
+	    elem = MakeVal(TAG_OBJECT,1 + Random(i));
+	    break;
+	 case 3 :
+	    elem.int_val = NIL;
+	    elem = MakeVal(TAG_LIST,Cons(MakeVal(TAG_INT,k),elem));
+	    elem = MakeVal(TAG_LIST,Cons(MakeVal(TAG_INT,i),elem));
+	    break;
+	 default :
+	    elem = MakeVal(TAG_INT,Random(1000));
+	    break;
+	 }
+	 list = MakeVal(TAG_LIST,Cons(elem,list));
+      }
+      o->p[1].val = list;
+
+      /* a couple of nodes in front of some earlier object's list */
+      other = GetObjectByID(1 + Random(i));
+      if (other->p[1].val.v.tag == TAG_LIST)
+      {
+	 list = MakeVal(TAG_LIST,Cons(MakeVal(TAG_INT,i),other->p[1].val));
+	 o->p[2].val = MakeVal(TAG_LIST,Cons(MakeVal(TAG_OBJECT,i),list));
+      }
+
+      o->p[3].val = MakeVal(TAG_OBJECT,1 + Random(i));
+      if (i % 4 == 1)
+      {
+	 sprintf(buf,"object %i",i);
+	 o->p[4].val = MakeVal(TAG_STRING,CreateString(buf));
+      }
+
+      /* a scratch list nothing keeps */
+      Cons(MakeVal(TAG_INT,i),MakeVal(TAG_OBJECT,i));
+
+      if (i % 4 == 0)
+	 continue;
+
+      room = MakeVal(TAG_LIST,Cons(MakeVal(TAG_OBJECT,i),room));
+      if (++num_kept % BENCH_ROOM_OBJECTS == 0)
+      {
+	 rooms = MakeVal(TAG_LIST,Cons(room,rooms));
+	 room.int_val = NIL;
+      }
+   }
+   rooms = MakeVal(TAG_LIST,Cons(room,rooms));
+   GetObjectByID(GetSystemObjectID())->p[1].val = rooms;
+}
+
+/* the walk of what's reachable, numbering objects and list nodes in the
+   order they're found, so the result doesn't depend on their ids */
+
+static int *walk_objects,*walk_lists,*walk_stack;
+static int num_walk_stack;
+static int walk_num_objects,walk_num_lists;
+static UINT64 walk_hash;
+
+static void WalkHash(UINT64 value)
+{
+   walk_hash = (walk_hash ^ value) * 1099511628211ULL;
+}
+
+static void WalkVal(val_type val)
+{
+   string_node *snod;
+   int i;
+
+   WalkHash(val.v.tag);
+   switch (val.v.tag)
+   {
+   case TAG_OBJECT :
+      if (walk_objects[val.v.data] < 0)
+      {
+	 walk_objects[val.v.data] = walk_num_objects++;
+	 walk_stack[num_walk_stack++] = val.v.data << 1;
+      }
+      WalkHash(walk_objects[val.v.data]);
+      break;
+
+   case TAG_LIST :
+      if (walk_lists[val.v.data] < 0)
+      {
+	 walk_lists[val.v.data] = walk_num_lists++;
+	 walk_stack[num_walk_stack++] = (val.v.data << 1) | 1;
+      }
+      WalkHash(walk_lists[val.v.data]);
+      break;
+
+   case TAG_STRING :
+      snod = GetStringByID(val.v.data);
+      for (i=0;i<snod->len_data;i++)
+	 WalkHash((unsigned char)snod->data[i]);
+      break;
+
+   default :
+      WalkHash(val.v.data);
+      break;
+   }
+}
+
+static UINT64 WalkHeap(void)
+{
+   object_node *o;
+   list_node *l;
+   int i,item;
+
+   walk_objects = (int *)malloc(GetObjectsUsed()*sizeof(int));
+   walk_lists = (int *)malloc(GetListNodesUsed()*sizeof(int));
+   walk_stack = (int *)malloc((GetObjectsUsed() + GetListNodesUsed())*sizeof(int));
+   memset(walk_objects,0xff,GetObjectsUsed()*sizeof(int));
+   memset(walk_lists,0xff,GetListNodesUsed()*sizeof(int));
+   num_walk_stack = 0;
+   walk_num_objects = 0;
+   walk_num_lists = 0;
+   walk_hash = 14695981039346656037ULL;
+
+   WalkVal(MakeVal(TAG_OBJECT,GetSystemObjectID()));
+   while (num_walk_stack > 0)
+   {
+      item = walk_stack[--num_walk_stack];
+      if (item & 1)
+      {
+	 l = GetListNodeByID(item >> 1);
+	 WalkVal(l->first);
+	 WalkVal(l->rest);
+      }
+      else
+      {
+	 o = GetObjectByID(item >> 1);
+	 for (i=1;i<o->num_props;i++)
+	    WalkVal(o->p[i].val);
+      }
+   }
+
+   free(walk_objects);
+   free(walk_lists);
+   free(walk_stack);
+   return walk_hash;
+}
+
+/* CheckClassIndex
+*
+* Every live object has to be in its class's instances where its
+* class_index says, and the classes can't have any more than that.
+*/
+static Bool CheckClassIndex(void)
+{
+   object_node *o;
+   class_node *c;
+   int i,num_indexed;
+
+   for (i=0;i<GetObjectsUsed();i++)
+   {
+      o = GetObjectByIDQuietly(i);
+      if (o == NULL)
+	 continue;
+      c = GetClassByID(o->class_id);
+      if (o->class_index < 0 || o->class_index >= c->num_instances ||
+	  c->instances[o->class_index] != i)
+	 return False;
+   }
+
+   num_indexed = GetClassInstanceCount(GetClassByID(SYSTEM_CLASS),False) +
+      GetClassInstanceCount(GetClassByID(BENCH_CLASS),False);
+   return num_indexed == GetObjectsLive();
+}
+
+/* BenchSaveGame
+*
+* Saves the game in the given format, loads it back in, and says whether
+* the same heap came back.
+*/
+static Bool BenchSaveGame(int version,Bool compress,UINT64 heap)
+{
+   struct stat st;
+   double save_time,load_time;
+   Bool saved,loaded;
+   UINT64 after;
+
+   SetConfigInt(SAVE_VERSION,version);
+   SetConfigBool(SAVE_COMPRESS,compress);
+
+   save_time = NowNanoseconds();
+   saved = SaveGame((char *)BENCH_SAVE_FILE);
+   save_time = NowNanoseconds() - save_time;
+   if (stat(BENCH_SAVE_FILE,&st) != 0)
+      st.st_size = 0;
+
+   /* strings are saved in their own file, so they stay */
+   ResetObject();
+   ResetList();
+
+   load_time = NowNanoseconds();
+   loaded = LoadGame((char *)BENCH_SAVE_FILE);
+   load_time = NowNanoseconds() - load_time;
+   after = loaded ? WalkHeap() : 0;
+
+   printf("version %i %-12s: save %8.1f ms, load %8.1f ms, %10lli bytes%s\n",
+	  version,version < 2 ? "" : compress ? "compressed" : "uncompressed",
+	  save_time/1e6,load_time/1e6,(long long)st.st_size,
+	  !saved ? "  SAVE FAILED" : !loaded ? "  LOAD FAILED" :
+	  after != heap ? "  HEAP DIFFERS" : "");
+
+   unlink(BENCH_SAVE_FILE);
+   return saved && loaded && after == heap;
+}
+
+int main(int argc,char **argv)
+{
+   int num_objects,list_length,num_threads,max_threads,reachable,mismatches;
+   Bool indexed;
+   int kept_objects,kept_lists,kept_strings;
+   UINT64 before,after;
+   double start;
+   garbage_statistics gstat;
+
+   num_objects = BENCH_DEFAULT_OBJECTS;
+   list_length = BENCH_DEFAULT_LIST_LENGTH;
+   if (argc > 1)
+      num_objects = atoi(argv[1]);
+   if (argc > 2)
+      list_length = atoi(argv[2]);
+   max_threads = std::min(ThreadNumProcessors(),16);
+   if (argc > 3)
+      max_threads = atoi(argv[3]);
+   if (num_objects <= 1 || list_length <= 0 || max_threads <= 0 || max_threads > 16)
+   {
+      fprintf(stderr,"usage: gcbench [objects] [list length] [threads up to 16]\n");
+      return 1;
+   }
+
+   InitMemory();
+   InitConfig();
+   LoadConfig();
+   InitClass();
+   InitObject();
+   InitList();
+   InitTimer();
+   InitSession();
+   InitResource();
+   InitString();
+   InitUser();
+   InitTable();
+
+   AddBenchClass(SYSTEM_CLASS,"System",BENCH_PROPERTIES);
+   AddBenchClass(BENCH_CLASS,"Bench",BENCH_PROPERTIES);
+   SetClassPropertyNames();
+
+   mismatches = 0;
+   kept_objects = kept_lists = kept_strings = -1;
+   for (num_threads=1;num_threads<=max_threads;num_threads *= 2)
+   {
+      BuildHeap(num_objects,list_length);
+      if (num_threads == 1)
+	 printf("%i objects, %i list nodes, %i strings\n",
+		GetObjectsUsed(),GetListNodesUsed(),GetStringsUsed());
+
+      before = WalkHeap();
+      reachable = walk_num_objects;
+
+      SetConfigInt(AUTO_GARBAGE_THREADS,num_threads);
+      start = NowNanoseconds();
+      GarbageCollect();
+      start = NowNanoseconds() - start;
+      GetGarbageStats(&gstat);
+
+      after = WalkHeap();
+      indexed = CheckClassIndex();
+      if (before != after || reachable != GetObjectsUsed() || !indexed ||
+	  (kept_objects >= 0 && (kept_objects != GetObjectsUsed() ||
+				 kept_lists != GetListNodesUsed() ||
+				 kept_strings != GetStringsUsed())))
+	 mismatches++;
+      kept_objects = GetObjectsUsed();
+      kept_lists = GetListNodesUsed();
+      kept_strings = GetStringsUsed();
+
+      printf("%2i threads: %8.1f ms (lists %i, objects %i, timers %i, strings %i ms), "
+	     "kept %i objects, %i list nodes, %i strings%s%s\n",
+	     num_threads,start/1e6,gstat.last_list_time,gstat.last_object_time,
+	     gstat.last_timer_time,gstat.last_string_time,
+	     kept_objects,kept_lists,kept_strings,
+	     before != after || reachable != kept_objects ? "  HEAP DIFFERS" : "",
+	     indexed ? "" : "  CLASS INDEX WRONG");
+   }
+
+   after = WalkHeap();
+   if (!BenchSaveGame(1,False,after))
+      mismatches++;
+   if (!BenchSaveGame(2,False,after))
+      mismatches++;
+   if (!BenchSaveGame(2,True,after))
+      mismatches++;
+
+   return mismatches ? 1 : 0;
+}
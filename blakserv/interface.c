@@ -989,6 +989,9 @@ void InterfaceReloadSystem()
 	EnterServerLock();
 	
 	lprintf("InterfaceReloadSystem reloading system\n");
+
+	/* a replay couldn't follow the game through this */
+	StopRecording();
 	
 	PauseTimers();
 	
@@ -1013,6 +1016,7 @@ void InterfaceReloadSystem()
 	ResetClass();
 	
 	LoadMotd();
+	StartPreload(False);
 	LoadBof();
 	LoadRsc();
 	
@@ -1024,6 +1028,7 @@ void InterfaceReloadSystem()
 	/* can't reload accounts because sessions have pointers to accounts */
 	if (!LoadAllButAccount()) 
 		eprintf("InterfaceReloadSystem couldn't load game.  You are dead.\n");
+	EndPreload();
 	
 	AllocateParseClientListNodes(); /* it needs a list to send to users */
 	AddBuiltInDLlist();
@@ -74,5 +74,7 @@ void SignalSession(int session_id)
 	// the main loop every session is checked anyway
 #ifdef BLAK_PLATFORM_WINDOWS
 	PostThreadMessage(main_thread_id,WM_BLAK_MAIN_READ,0,session_id);
+#else
+	NetworkThreadSignal(session_id);
 #endif
 }
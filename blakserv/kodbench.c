@@ -0,0 +1,651 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * kodbench.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself,
+ though it links with the rest of the server.  It starts the server
+ the way main.c does, from the blakserv.cfg in the current directory,
+ loading the kod, resources and last saved game (or making a new game
+ if there isn't one), but without any sockets, sessions or interface.
+ Then it runs a script of top level messages and reports, for each
+ scenario in it, the wall time, Blakod instructions interpreted,
+ messages sent, timers fired and what was allocated.  Nothing is ever
+ saved.
+
+ The game runs on a clock that only moves when the script says to
+ (see StopGameClock() in time.c), starting from the same moment each
+ run, and the kod's Random() is seeded the same way each run, so the
+ same script on the same save does the same work every time.
+
+ Build it with "make -f makefile.linux kodbench" and run it from a
+ server directory with bin/kodbench script [seed].  kodbench.txt has
+ some scenarios for the standard kod.  Each line of a script is one of
+
+   scenario <name>               starts a scenario, ending the one before
+   send <target> <message> [<parm> <tag> <data>]...
+   create <class> [<parm> <tag> <data>]...
+   save <name>                   names the last object, for later lines
+   advance <milliseconds>        moves the clock, firing timers as they come due
+   garbage                       garbage collects
+   repeat <count>                runs the lines up to the matching "end" count times
+   end
+
+ where a target is an object number, "system", "last" (the object last
+ created, or returned by a send), a saved name, or a class name, which
+ sends to each of its instances.  Object data can be given the same
+ ways, and other data the way the admin commands take it.  Lines
+ starting with # are comments.
+
+ */
+
+#include "blakserv.h"
+
+#define BENCH_MAX_LINE 1000
+#define BENCH_MAX_TOKENS 64
+#define BENCH_MAX_REPEAT 16
+#define BENCH_MAX_NAMES 256
+#define BENCH_START_TIME 1000000
+#define BENCH_START_GAME_TIME 1577836800 /* 2020-01-01, for the kod's GetTime() */
+#define BENCH_DEFAULT_SEED 1
+
+typedef struct
+{
+   char name[64];
+   int object_id;
+} bench_name;
+
+typedef struct
+{
+   int line;  /* of the first line inside the repeat */
+   int count; /* times left to go after this one */
+} bench_repeat;
+
+typedef struct
+{
+   double wall;
+   INT64 instructions;
+   int top_level_messages;
+   int messages;
+   int timers;
+   INT64 posts;
+   INT64 objects;
+   INT64 list_nodes;
+   int live_objects;
+   int live_list_nodes;
+   int strings;
+   int memory;
+} bench_counts;
+
+static char **lines;
+static int num_lines;
+
+static bench_name names[BENCH_MAX_NAMES];
+static int num_names;
+static int last_object = INVALID_OBJECT;
+
+static UINT64 bench_time = BENCH_START_TIME;
+static int timers_fired;
+
+static char scenario[BENCH_MAX_LINE];
+static bench_counts scenario_start;
+static int num_scenarios;
+
+Bool InMainLoop(void)
+{
+   return False;
+}
+
+static double NowNanoseconds(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static void GetBenchCounts(bench_counts *counts)
+{
+   kod_statistics *kstat;
+   post_queue_statistics pstat;
+   object_statistics ostat;
+   list_node_statistics lstat;
+
+   kstat = GetKodStats();
+   GetPostQueueStats(&pstat);
+   GetObjectStats(&ostat);
+   GetListNodeStats(&lstat);
+
+   counts->wall = NowNanoseconds();
+   counts->instructions = (INT64)kstat->billions_interpreted*1000000000 + kstat->num_interpreted;
+   counts->top_level_messages = kstat->num_top_level_messages;
+   counts->messages = kstat->num_messages;
+   counts->timers = timers_fired;
+   counts->posts = pstat.num_posted;
+   counts->objects = ostat.num_allocated;
+   counts->list_nodes = lstat.num_allocated;
+   counts->live_objects = ostat.num_live;
+   counts->live_list_nodes = lstat.num_live;
+   counts->strings = GetStringsUsed();
+   counts->memory = GetMemoryTotal();
+}
+
+static void ReportScenario(void)
+{
+   bench_counts now;
+   double ms;
+   INT64 instructions;
+
+   if (scenario[0] == 0)
+      return;
+
+   GetBenchCounts(&now);
+   ms = (now.wall - scenario_start.wall)/1e6;
+   instructions = now.instructions - scenario_start.instructions;
+
+   printf("%s\n",scenario);
+   printf("  %.1f ms, %lli instructions (%.1f million a second)\n",ms,(long long)instructions,
+	  ms > 0 ? instructions/ms/1000 : 0.0);
+   printf("  %i top level messages, %i messages, %i timers fired, %lli posts\n",
+	  now.top_level_messages - scenario_start.top_level_messages,
+	  now.messages - scenario_start.messages,now.timers - scenario_start.timers,
+	  (long long)(now.posts - scenario_start.posts));
+   printf("  made %lli objects and %lli list nodes; live objects %+i, list nodes %+i, "
+	  "strings %+i, memory %+i bytes\n",
+	  (long long)(now.objects - scenario_start.objects),
+	  (long long)(now.list_nodes - scenario_start.list_nodes),
+	  now.live_objects - scenario_start.live_objects,
+	  now.live_list_nodes - scenario_start.live_list_nodes,
+	  now.strings - scenario_start.strings,now.memory - scenario_start.memory);
+   fflush(stdout);
+
+   num_scenarios++;
+   scenario[0] = 0;
+}
+
+static void StartScenario(int argc,char **argv)
+{
+   int i;
+
+   ReportScenario();
+
+   scenario[0] = 0;
+   for (i=1;i<argc;i++)
+   {
+      if (i > 1)
+	 strcat(scenario," ");
+      strncat(scenario,argv[i],sizeof(scenario) - strlen(scenario) - 2);
+   }
+   if (scenario[0] == 0)
+      strcpy(scenario,"(unnamed)");
+
+   GetBenchCounts(&scenario_start);
+}
+
+/* StartServer
+*
+* Everything MainServer() does up to the main loop, but the sockets.
+*/
+static void StartServer(void)
+{
+   InitMemory();
+   InitConfig();
+   LoadConfig();
+   InitDebug();
+   InitChannelBuffer();
+   OpenDefaultChannels();
+
+   lprintf("Starting %s in kodbench\n",BlakServLongVersionString());
+
+   InitClass();
+   InitMessage();
+   InitObject();
+   InitList();
+   InitTimer();
+   InitSession();
+   InitResource();
+   InitRoomData();
+   InitString();
+   InitUser();
+   InitAccount();
+   InitNameID();
+   InitDLlist();
+   InitSysTimer();
+   InitMotd();
+   InitLoadBof();
+   InitTime();
+   InitGameLock();
+   InitBkodInterpret();
+   InitBufferPool();
+   InitTable();
+   InitBlock();
+   AddBuiltInDLlist();
+
+   StopGameClock(bench_time,BENCH_START_GAME_TIME);
+
+   StartPreload(True);
+   LoadBof();
+   LoadRsc();
+   LoadKodbase();
+   LoadAdminConstants();
+
+   /* the timers aren't paused around the load, since the clock doesn't move */
+   if (LoadAll() == True)
+   {
+      SendTopLevelBlakodMessage(GetSystemObjectID(),LOADED_GAME_MSG,0,NULL);
+      DoneLoadAccounts();
+      printf("Loaded the saved game: ");
+   }
+   else
+      printf("No saved game, made a new one: ");
+   EndPreload();
+
+   InitCommCli();
+   InitParseClient();
+   InitProfiling();
+
+   printf("%i objects, %i list nodes, %i strings, %i timers\n",GetObjectsLive(),
+	  GetListNodesUsed(),GetStringsUsed(),GetNumActiveTimers());
+}
+
+static Bool LoadScript(const char *filename)
+{
+   FILE *f;
+   char line[BENCH_MAX_LINE];
+   int max_lines;
+
+   f = fopen(filename,"rt");
+   if (f == NULL)
+      return False;
+
+   max_lines = 0;
+   while (fgets(line,sizeof(line),f) != NULL)
+   {
+      if (num_lines == max_lines)
+      {
+	 max_lines = max_lines ? 2*max_lines : 256;
+	 lines = (char **)realloc(lines,max_lines*sizeof(char *));
+      }
+      lines[num_lines++] = strdup(line);
+   }
+   fclose(f);
+   return True;
+}
+
+static int SplitLine(char *line,char **argv)
+{
+   char *token;
+   int argc;
+
+   argc = 0;
+   for (token = strtok(line," \t\r\n");token != NULL && argc < BENCH_MAX_TOKENS;
+	token = strtok(NULL," \t\r\n"))
+   {
+      if (argc == 0 && token[0] == '#')
+	 break;
+      argv[argc++] = token;
+   }
+   return argc;
+}
+
+static bench_name * FindName(const char *name)
+{
+   int i;
+
+   for (i=0;i<num_names;i++)
+      if (stricmp(names[i].name,name) == 0)
+	 return &names[i];
+   return NULL;
+}
+
+/* LookupObject
+*
+* An object by number or by one of the names a script can use for it.
+*/
+static Bool LookupObject(const char *str,int *object_id)
+{
+   bench_name *n;
+   char *end;
+   long id;
+
+   if (stricmp(str,"system") == 0)
+      *object_id = GetSystemObjectID();
+   else if (stricmp(str,"last") == 0)
+      *object_id = last_object;
+   else if ((n = FindName(str)) != NULL)
+      *object_id = n->object_id;
+   else
+   {
+      id = strtol(str,&end,10);
+      if (*str == 0 || *end != 0)
+	 return False;
+      *object_id = (int)id;
+   }
+   return IsObjectByID(*object_id);
+}
+
+static Bool ParseParms(int argc,char **argv,parm_node parms[],int *num_parms)
+{
+   val_type val;
+   int i,tag,data,name_id;
+
+   if (argc % 3 != 0 || argc/3 > MAX_NAME_PARMS)
+   {
+      fprintf(stderr,"parms go in threes, name tag data\n");
+      return False;
+   }
+
+   *num_parms = 0;
+   for (i=0;i<argc;i+=3)
+   {
+      name_id = GetIDByName(argv[i]);
+      if (name_id == INVALID_ID)
+      {
+	 fprintf(stderr,"no parm named %s\n",argv[i]);
+	 return False;
+      }
+
+      tag = GetTagNum(argv[i+1]);
+      if (tag == INVALID_TAG)
+      {
+	 fprintf(stderr,"'%s' is not a tag\n",argv[i+1]);
+	 return False;
+      }
+
+      if (tag == TAG_OBJECT && LookupObject(argv[i+2],&data))
+	 ;
+      else if (LookupAdminConstant(argv[i+2],&data) == False)
+      {
+	 data = GetDataNum(tag,argv[i+2]);
+	 if (data == INVALID_DATA)
+	 {
+	    fprintf(stderr,"'%s' is not valid data\n",argv[i+2]);
+	    return False;
+	 }
+      }
+
+      val.v.tag = tag;
+      val.v.data = data;
+      parms[*num_parms].type = CONSTANT;
+      parms[*num_parms].value = val.int_val;
+      parms[*num_parms].name_id = name_id;
+      (*num_parms)++;
+   }
+   return True;
+}
+
+static void SendToObject(int object_id,int message_id,int num_parms,parm_node parms[])
+{
+   parm_node copy[MAX_NAME_PARMS];
+   val_type ret_val;
+
+   /* the interpreter sorts the parms it's given */
+   memcpy(copy,parms,num_parms*sizeof(parm_node));
+   ret_val.int_val = SendTopLevelBlakodMessage(object_id,message_id,num_parms,copy);
+   if (ret_val.v.tag == TAG_OBJECT && IsObjectByID(ret_val.v.data))
+      last_object = ret_val.v.data;
+}
+
+static Bool BenchSend(int argc,char **argv)
+{
+   parm_node parms[MAX_NAME_PARMS];
+   class_node *c;
+   int object_id,message_id,num_parms,i,num_ids;
+   int *ids;
+
+   if (argc < 3)
+   {
+      fprintf(stderr,"send needs a target and a message\n");
+      return False;
+   }
+
+   message_id = GetIDByName(argv[2]);
+   if (message_id == INVALID_ID)
+   {
+      fprintf(stderr,"no message named %s\n",argv[2]);
+      return False;
+   }
+
+   if (!ParseParms(argc-3,argv+3,parms,&num_parms))
+      return False;
+
+   if (LookupObject(argv[1],&object_id))
+   {
+      SendToObject(object_id,message_id,num_parms,parms);
+      return True;
+   }
+
+   c = GetClassByName(argv[1]);
+   if (c == NULL)
+   {
+      fprintf(stderr,"%s isn't an object or a class\n",argv[1]);
+      return False;
+   }
+
+   ids = (int *)malloc(std::max(GetClassInstanceCount(c,True),1)*sizeof(int));
+   num_ids = CopyClassInstances(c,ids);
+   for (i=0;i<num_ids;i++)
+      if (IsObjectByID(ids[i]))
+	 SendToObject(ids[i],message_id,num_parms,parms);
+   free(ids);
+   return True;
+}
+
+static Bool BenchCreate(int argc,char **argv)
+{
+   parm_node parms[MAX_NAME_PARMS];
+   class_node *c;
+   int num_parms,object_id;
+
+   if (argc < 2 || (c = GetClassByName(argv[1])) == NULL)
+   {
+      fprintf(stderr,"create needs a class\n");
+      return False;
+   }
+
+   if (!ParseParms(argc-2,argv+2,parms,&num_parms))
+      return False;
+
+   object_id = CreateObject(c->class_id,num_parms,parms);
+   if (object_id == INVALID_OBJECT)
+      return False;
+   last_object = object_id;
+   return True;
+}
+
+static Bool BenchSave(int argc,char **argv)
+{
+   bench_name *n;
+
+   if (argc != 2 || last_object == INVALID_OBJECT)
+   {
+      fprintf(stderr,"save needs a name, and an object to give it to\n");
+      return False;
+   }
+
+   n = FindName(argv[1]);
+   if (n == NULL)
+   {
+      if (num_names == BENCH_MAX_NAMES)
+      {
+	 fprintf(stderr,"too many names\n");
+	 return False;
+      }
+      n = &names[num_names++];
+      snprintf(n->name,sizeof(n->name),"%s",argv[1]);
+   }
+   n->object_id = last_object;
+   return True;
+}
+
+/* Advance
+*
+* Moves the clock ms ahead, stopping just after each timer that comes
+* due on the way to fire it, the way the main loop would if it were
+* never late.
+*/
+static void Advance(UINT64 ms)
+{
+   UINT64 target,next;
+
+   target = bench_time + ms;
+   while (GetNextTimerTime(&next) && next < target)
+   {
+      if (next + 1 > bench_time)
+	 bench_time = next + 1;
+      SetGameClock(bench_time);
+      TimerActivate();
+      timers_fired++;
+   }
+
+   bench_time = target;
+   SetGameClock(bench_time);
+}
+
+/* SkipRepeat
+*
+* The line after the "end" matching the repeat on line.
+*/
+static int SkipRepeat(int line)
+{
+   char buf[BENCH_MAX_LINE];
+   char *argv[BENCH_MAX_TOKENS];
+   int argc,depth;
+
+   depth = 0;
+   for (line++;line<num_lines;line++)
+   {
+      strcpy(buf,lines[line]);
+      argc = SplitLine(buf,argv);
+      if (argc == 0)
+	 continue;
+      if (stricmp(argv[0],"repeat") == 0)
+	 depth++;
+      else if (stricmp(argv[0],"end") == 0 && depth-- == 0)
+	 return line + 1;
+   }
+   return num_lines;
+}
+
+static Bool RunScript(void)
+{
+   char buf[BENCH_MAX_LINE];
+   char *argv[BENCH_MAX_TOKENS];
+   bench_repeat repeats[BENCH_MAX_REPEAT];
+   int num_repeats,argc,line,count;
+   Bool ok;
+
+   num_repeats = 0;
+   line = 0;
+   while (line < num_lines)
+   {
+      strcpy(buf,lines[line]);
+      argc = SplitLine(buf,argv);
+      if (argc == 0)
+      {
+	 line++;
+	 continue;
+      }
+
+      ok = True;
+      if (stricmp(argv[0],"repeat") == 0)
+      {
+	 count = argc == 2 ? atoi(argv[1]) : -1;
+	 if (count < 0 || num_repeats == BENCH_MAX_REPEAT)
+	    ok = False;
+	 else if (count == 0)
+	 {
+	    line = SkipRepeat(line);
+	    continue;
+	 }
+	 else
+	 {
+	    repeats[num_repeats].line = line + 1;
+	    repeats[num_repeats].count = count - 1;
+	    num_repeats++;
+	 }
+      }
+      else if (stricmp(argv[0],"end") == 0)
+      {
+	 if (num_repeats == 0)
+	    ok = False;
+	 else if (repeats[num_repeats-1].count > 0)
+	 {
+	    repeats[num_repeats-1].count--;
+	    line = repeats[num_repeats-1].line;
+	    continue;
+	 }
+	 else
+	    num_repeats--;
+      }
+      else if (stricmp(argv[0],"scenario") == 0)
+	 StartScenario(argc,argv);
+      else if (stricmp(argv[0],"send") == 0)
+	 ok = BenchSend(argc,argv);
+      else if (stricmp(argv[0],"create") == 0)
+	 ok = BenchCreate(argc,argv);
+      else if (stricmp(argv[0],"save") == 0)
+	 ok = BenchSave(argc,argv);
+      else if (stricmp(argv[0],"advance") == 0 && argc == 2 && atoi(argv[1]) >= 0)
+	 Advance(atoi(argv[1]));
+      else if (stricmp(argv[0],"garbage") == 0)
+      {
+	 GarbageCollect();
+	 AllocateParseClientListNodes();
+	 last_object = INVALID_OBJECT;
+	 num_names = 0;
+      }
+      else
+	 ok = False;
+
+      if (!ok)
+      {
+	 fprintf(stderr,"kodbench: can't do line %i: %s",line+1,lines[line]);
+	 return False;
+      }
+      line++;
+   }
+
+   if (num_repeats > 0)
+   {
+      fprintf(stderr,"kodbench: repeat without an end\n");
+      return False;
+   }
+
+   ReportScenario();
+   return True;
+}
+
+int main(int argc,char **argv)
+{
+   int seed;
+
+   if (argc < 2 || argc > 3)
+   {
+      fprintf(stderr,"usage: kodbench script [seed]\n");
+      return 1;
+   }
+   seed = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_SEED;
+
+   if (!LoadScript(argv[1]))
+   {
+      fprintf(stderr,"kodbench: can't read %s\n",argv[1]);
+      return 1;
+   }
+
+   srand(seed);
+   StartServer();
+
+   if (!RunScript())
+      return 1;
+
+   printf("%i scenarios, %i timers left, clock at %llu ms\n",num_scenarios,
+	  GetNumActiveTimers(),(unsigned long long)(bench_time - BENCH_START_TIME));
+   return 0;
+}
@@ -0,0 +1,595 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * kodreplay.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself,
+ though it links with the rest of the server.  It replays a recording
+ made with the "record start" admin command (see record.c): it starts
+ the server the way main.c does, from the blakserv.cfg in the current
+ directory, but loads the game saved just before the recording started
+ instead of the last one, and without any sockets.  Then it goes
+ through the recording, making a session with no connection for each
+ one that went into the game, and giving the Blakod each client
+ message, user entering the game and session leaving it, as fast as
+ it can.  The garbage collections, reclaims, system events and new
+ hours in the recording are done again where they happened, so object,
+ list and string numbers in the client messages still name the same
+ things; no timer goes off while the timers were paused, and then they
+ are moved as far as they were.  Nothing is sent anywhere and nothing
+ is ever saved.
+
+ The game runs on a clock that moves to the recorded time of each
+ event (see StopGameClock() in time.c), starting at the time of the
+ save, so timers go off between the client messages the way they did
+ when it was recorded.  How long each client message and timer takes
+ is reported at the end, by client message type, along with the
+ slowest ones and when in the recording they were.
+
+ The replay does the same Blakod work as the recording only as far as
+ the Blakod does the same thing given the same messages.  Random() is
+ seeded the same way each run but not the way the server was,
+ characters made while recording don't exist in the save, so they
+ can't come into the game, and messages admins send the Blakod aren't
+ recorded.
+ The number of timers that went off is compared with the recording as
+ a sign of how far it strayed.
+
+ Build it with "make -f makefile.linux kodreplay" and run it from the
+ server directory the recording was made in with
+ bin/kodreplay recording [seed].
+
+ */
+
+#include "blakserv.h"
+
+#define REPLAY_START_TIME 1000000
+#define REPLAY_DEFAULT_SEED 1
+#define REPLAY_SLOWEST 10
+#define REPLAY_TOP_TYPES 20
+
+enum { REPLAY_CLIENT, REPLAY_TIMER, REPLAY_ENTER, REPLAY_EXIT, REPLAY_SYSTEM, NUM_REPLAY_KINDS };
+
+static const char *replay_kind_names[NUM_REPLAY_KINDS] =
+{
+   "client messages", "timers", "users entering", "users leaving", "system events"
+};
+
+typedef struct
+{
+   double *times; /* microseconds */
+   int num_times;
+   int max_times;
+} replay_times;
+
+typedef struct
+{
+   int count;
+   double total;
+   double most;
+} replay_type_times;
+
+typedef struct
+{
+   double us;
+   UINT64 time; /* in the recording */
+   int kind;
+   int detail; /* client message type or timer's message */
+   int object_id;
+} replay_slow;
+
+static session_node **replay_sessions; /* by recorded session id */
+static int max_replay_sessions;
+
+static UINT64 replay_time = REPLAY_START_TIME;
+static Bool replay_paused; /* between a RECORD_PAUSE and its RECORD_UNPAUSE */
+
+static replay_times kind_times[NUM_REPLAY_KINDS];
+static replay_type_times type_times[256];
+static replay_slow slowest[REPLAY_SLOWEST];
+static int num_slowest;
+
+static int recorded_timers,missing_sessions,missing_users;
+
+Bool InMainLoop(void)
+{
+   return False;
+}
+
+static double NowNanoseconds(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static int CompareTimes(const void *a,const void *b)
+{
+   double d1,d2;
+
+   d1 = *(const double *)a;
+   d2 = *(const double *)b;
+   return d1 < d2 ? -1 : d1 > d2;
+}
+
+/* AddTime
+*
+* Notes how long something took, keeping the slowest few.
+*/
+static void AddTime(int kind,double start,int detail,int object_id)
+{
+   replay_times *t;
+   double us;
+   int i;
+
+   us = (NowNanoseconds() - start)/1000;
+
+   t = &kind_times[kind];
+   if (t->num_times == t->max_times)
+   {
+      t->max_times = t->max_times ? 2*t->max_times : 1024;
+      t->times = (double *)realloc(t->times,t->max_times*sizeof(double));
+      if (t->times == NULL)
+      {
+	 fprintf(stderr,"kodreplay: out of memory for %i timings\n",t->max_times);
+	 exit(1);
+      }
+   }
+   t->times[t->num_times++] = us;
+
+   if (kind == REPLAY_CLIENT)
+   {
+      type_times[detail].count++;
+      type_times[detail].total += us;
+      type_times[detail].most = std::max(type_times[detail].most,us);
+   }
+
+   if (num_slowest < REPLAY_SLOWEST)
+      num_slowest++;
+   else if (us <= slowest[num_slowest-1].us)
+      return;
+
+   for (i=num_slowest-1;i>0 && slowest[i-1].us < us;i--)
+      slowest[i] = slowest[i-1];
+   slowest[i].us = us;
+   slowest[i].time = replay_time - REPLAY_START_TIME;
+   slowest[i].kind = kind;
+   slowest[i].detail = detail;
+   slowest[i].object_id = object_id;
+}
+
+/* StartServer
+*
+* Everything MainServer() does up to the main loop, but the sockets, and
+* loading the game saved at save_time.
+*/
+static Bool StartServer(int save_time)
+{
+   Bool loaded;
+
+   InitMemory();
+   InitConfig();
+   LoadConfig();
+   InitDebug();
+   InitChannelBuffer();
+   OpenDefaultChannels();
+
+   lprintf("Starting %s in kodreplay\n",BlakServLongVersionString());
+
+   InitClass();
+   InitMessage();
+   InitObject();
+   InitList();
+   InitTimer();
+   InitSession();
+   InitResource();
+   InitRoomData();
+   InitString();
+   InitUser();
+   InitAccount();
+   InitNameID();
+   InitDLlist();
+   InitSysTimer();
+   InitMotd();
+   InitLoadBof();
+   InitTime();
+   InitGameLock();
+   InitBkodInterpret();
+   InitBufferPool();
+   InitTable();
+   InitBlock();
+   AddBuiltInDLlist();
+
+   StopGameClock(replay_time,save_time);
+
+   StartPreload(True);
+   LoadBof();
+   LoadRsc();
+   LoadKodbase();
+   LoadAdminConstants();
+
+   loaded = LoadAllAtTime(save_time);
+   if (loaded)
+   {
+      SendTopLevelBlakodMessage(GetSystemObjectID(),LOADED_GAME_MSG,0,NULL);
+      DoneLoadAccounts();
+   }
+   EndPreload();
+
+   InitCommCli();
+   InitParseClient();
+   InitProfiling();
+
+   return loaded;
+}
+
+static session_node * GetReplaySession(int recorded_id)
+{
+   if (recorded_id < 0 || recorded_id >= max_replay_sessions)
+      return NULL;
+   return replay_sessions[recorded_id];
+}
+
+static session_node * NewReplaySession(int recorded_id)
+{
+   connection_node conn;
+   session_node *s;
+   int old_max;
+
+   if (recorded_id < 0)
+      return NULL;
+
+   if (recorded_id >= max_replay_sessions)
+   {
+      old_max = max_replay_sessions;
+      max_replay_sessions = std::max(2*max_replay_sessions,recorded_id + 1);
+      if (replay_sessions == NULL)
+	 replay_sessions = (session_node **)
+	    AllocateMemory(MALLOC_ID_SESSION_MODES,max_replay_sessions*sizeof(session_node *));
+      else
+	 replay_sessions = (session_node **)
+	    ResizeMemory(MALLOC_ID_SESSION_MODES,replay_sessions,old_max*sizeof(session_node *),
+			 max_replay_sessions*sizeof(session_node *));
+      memset(replay_sessions + old_max,0,(max_replay_sessions - old_max)*sizeof(session_node *));
+   }
+
+   /* a console connection, so nothing it's sent goes anywhere */
+   memset(&conn,0,sizeof(conn));
+   conn.type = CONN_CONSOLE;
+   snprintf(conn.name,sizeof(conn.name),"replay of session %i",recorded_id);
+
+   s = CreateSession(conn);
+   if (s != NULL)
+      s->state = -1; /* not in the game */
+   replay_sessions[recorded_id] = s;
+   return s;
+}
+
+static void ReplaySessionState(record_event *e)
+{
+   session_node *s;
+   double start;
+
+   s = GetReplaySession(e->session_id);
+   if (s != NULL && s->state == STATE_GAME)
+   {
+      start = NowNanoseconds();
+      ExitSessionState(s);
+      AddTime(REPLAY_EXIT,start,0,s->game->object_id);
+      s->state = -1;
+   }
+
+   if (e->value != STATE_GAME)
+      return;
+
+   if (s == NULL)
+      s = NewReplaySession(e->session_id);
+   if (s == NULL)
+   {
+      missing_sessions++;
+      return;
+   }
+
+   s->account = GetAccountByID(e->value2);
+   InitSessionState(s,STATE_GAME);
+}
+
+static void ReplayClose(record_event *e)
+{
+   session_node *s;
+   double start;
+   int object_id;
+
+   s = GetReplaySession(e->session_id);
+   if (s == NULL)
+      return;
+
+   start = NowNanoseconds();
+   object_id = s->state == STATE_GAME ? s->game->object_id : INVALID_OBJECT;
+   CloseSession(s->session_id);
+   if (object_id != INVALID_OBJECT)
+      AddTime(REPLAY_EXIT,start,0,object_id);
+
+   replay_sessions[e->session_id] = NULL;
+}
+
+static void ReplayEnterGame(record_event *e)
+{
+   session_node *s;
+   user_node *u;
+   double start;
+
+   s = GetReplaySession(e->session_id);
+   if (s == NULL || s->state != STATE_GAME)
+   {
+      missing_sessions++;
+      return;
+   }
+
+   u = GetUserByObjectID(e->value);
+   if (u == NULL)
+   {
+      missing_users++;
+      return;
+   }
+
+   start = NowNanoseconds();
+   GameStartUser(s,u);
+   AddTime(REPLAY_ENTER,start,0,u->object_id);
+}
+
+static void ReplayClientMessage(record_event *e)
+{
+   session_node *s;
+   double start;
+
+   s = GetReplaySession(e->session_id);
+   if (s == NULL || s->state != STATE_GAME || s->game->object_id == INVALID_OBJECT ||
+       e->len_data == 0)
+   {
+      missing_sessions++;
+      return;
+   }
+
+   start = NowNanoseconds();
+   ClientToBlakodUser(s,e->len_data,(char *)e->data);
+   AddTime(REPLAY_CLIENT,start,e->data[0],s->game->object_id);
+}
+
+/* ReplaySystem
+*
+* Does what the server did to the whole game; see record.h.
+*/
+static void ReplaySystem(record_event *e)
+{
+   double start;
+
+   start = NowNanoseconds();
+   switch (e->session_id)
+   {
+   case RECORD_PAUSE :
+      replay_paused = True;
+      return;
+   case RECORD_UNPAUSE :
+      return; /* done in main() */
+   case RECORD_BEGIN_EVENT :
+      SendBlakodBeginSystemEvent(e->value);
+      break;
+   case RECORD_END_EVENT :
+      SendBlakodEndSystemEvent(e->value);
+      break;
+   case RECORD_GARBAGE :
+      GarbageCollect();
+      break;
+   case RECORD_RECLAIM_OBJECTS :
+      ReclaimObjects();
+      break;
+   case RECORD_RECLAIM_LIST_NODES :
+      ReclaimListNodes();
+      break;
+   case RECORD_CLIENT_LISTS :
+      AllocateParseClientListNodes();
+      break;
+   case RECORD_NEW_HOUR :
+      SendTopLevelBlakodMessage(GetSystemObjectID(),NEW_HOUR_MSG,0,NULL);
+      break;
+   default :
+      return;
+   }
+   AddTime(REPLAY_SYSTEM,start,e->session_id,INVALID_OBJECT);
+}
+
+/* AdvanceTo
+*
+* Moves the clock up to the time of an event, firing the timers that
+* come due on the way, each just after its time.
+*/
+static void AdvanceTo(UINT64 target)
+{
+   timer_node *t;
+   double start;
+   int object_id,message_id;
+
+   while ((t = GetNextTimer()) != NULL && t->time < target)
+   {
+      if (t->time + 1 > replay_time)
+	 replay_time = t->time + 1;
+      SetGameClock(replay_time);
+
+      object_id = t->object_id;
+      message_id = t->message_id;
+
+      start = NowNanoseconds();
+      TimerActivate();
+      AddTime(REPLAY_TIMER,start,message_id,object_id);
+   }
+
+   replay_time = std::max(replay_time,target);
+   SetGameClock(replay_time);
+}
+
+static void ReportTimes(void)
+{
+   replay_times *t;
+   int i,k,order[256],num_types,swap;
+   double total;
+
+   printf("%-16s %8s %10s %10s %10s %10s %10s\n","","count","total ms",
+	  "median us","99% us","most us","mean us");
+   for (k=0;k<NUM_REPLAY_KINDS;k++)
+   {
+      t = &kind_times[k];
+      if (t->num_times == 0)
+	 continue;
+
+      qsort(t->times,t->num_times,sizeof(double),CompareTimes);
+      total = 0;
+      for (i=0;i<t->num_times;i++)
+	 total += t->times[i];
+
+      printf("%-16s %8i %10.1f %10.1f %10.1f %10.1f %10.1f\n",replay_kind_names[k],
+	     t->num_times,total/1000,t->times[t->num_times/2],
+	     t->times[(int)(t->num_times*0.99)],t->times[t->num_times-1],total/t->num_times);
+   }
+
+   num_types = 0;
+   for (i=0;i<256;i++)
+      if (type_times[i].count > 0)
+	 order[num_types++] = i;
+   for (i=1;i<num_types;i++)
+      for (k=i;k>0 && type_times[order[k]].total > type_times[order[k-1]].total;k--)
+      {
+	 swap = order[k];
+	 order[k] = order[k-1];
+	 order[k-1] = swap;
+      }
+
+   printf("\nclient message types by total time\n");
+   printf("%-16s %8s %10s %10s %10s\n","type","count","total ms","mean us","most us");
+   for (i=0;i<num_types && i<REPLAY_TOP_TYPES;i++)
+      printf("%-16i %8i %10.1f %10.1f %10.1f\n",order[i],type_times[order[i]].count,
+	     type_times[order[i]].total/1000,type_times[order[i]].total/type_times[order[i]].count,
+	     type_times[order[i]].most);
+
+   printf("\nslowest\n");
+   for (i=0;i<num_slowest;i++)
+   {
+      if (slowest[i].kind == REPLAY_TIMER)
+	 printf("%10.1f us at %8.3f s: timer MESSAGE %s to OBJECT %i\n",slowest[i].us,
+		slowest[i].time/1000.0,GetNameByID(slowest[i].detail),slowest[i].object_id);
+      else if (slowest[i].kind == REPLAY_CLIENT)
+	 printf("%10.1f us at %8.3f s: client message type %i to OBJECT %i\n",slowest[i].us,
+		slowest[i].time/1000.0,slowest[i].detail,slowest[i].object_id);
+      else if (slowest[i].kind == REPLAY_SYSTEM)
+	 printf("%10.1f us at %8.3f s: system event %i (see record.h)\n",slowest[i].us,
+		slowest[i].time/1000.0,slowest[i].detail);
+      else
+	 printf("%10.1f us at %8.3f s: %s, OBJECT %i\n",slowest[i].us,slowest[i].time/1000.0,
+		replay_kind_names[slowest[i].kind],slowest[i].object_id);
+   }
+}
+
+int main(int argc,char **argv)
+{
+   FILE *f;
+   record_header header;
+   record_event *e;
+   kod_statistics *kstat;
+   INT64 instructions;
+   int num_events,seed;
+   double start;
+
+   if (argc < 2 || argc > 3)
+   {
+      fprintf(stderr,"usage: kodreplay recording [seed]\n");
+      return 1;
+   }
+   seed = argc > 2 ? atoi(argv[2]) : REPLAY_DEFAULT_SEED;
+
+   f = OpenRecording(argv[1],&header);
+   if (f == NULL)
+   {
+      fprintf(stderr,"kodreplay: %s isn't a recording\n",argv[1]);
+      return 1;
+   }
+
+   srand(seed);
+   if (!StartServer(header.save_time))
+   {
+      fprintf(stderr,"kodreplay: can't load the game saved at (%i)\n",header.save_time);
+      return 1;
+   }
+   printf("Loaded the game saved at (%i): %i objects, %i list nodes, %i strings, %i timers\n",
+	  header.save_time,GetObjectsLive(),GetListNodesUsed(),GetStringsUsed(),
+	  GetNumActiveTimers());
+
+   e = (record_event *)malloc(sizeof(record_event));
+   num_events = 0;
+   start = NowNanoseconds();
+   while (ReadRecordEvent(f,e))
+   {
+      num_events++;
+
+      /* no timers went off while they were paused, and then they all
+	 moved later */
+      if (e->type == RECORD_SYSTEM && e->session_id == RECORD_UNPAUSE)
+      {
+	 ShiftTimers(e->value);
+	 replay_paused = False;
+      }
+
+      if (replay_paused)
+      {
+	 replay_time = std::max(replay_time,REPLAY_START_TIME + e->time);
+	 SetGameClock(replay_time);
+      }
+      else
+	 AdvanceTo(REPLAY_START_TIME + e->time);
+
+      switch (e->type)
+      {
+      case RECORD_CLIENT_MSG :
+	 ReplayClientMessage(e);
+	 break;
+      case RECORD_SESSION_STATE :
+	 ReplaySessionState(e);
+	 break;
+      case RECORD_SESSION_CLOSE :
+	 ReplayClose(e);
+	 break;
+      case RECORD_ENTER_GAME :
+	 ReplayEnterGame(e);
+	 break;
+      case RECORD_TIMER :
+	 recorded_timers++;
+	 break;
+      case RECORD_SYSTEM :
+	 ReplaySystem(e);
+	 break;
+      }
+   }
+   start = NowNanoseconds() - start;
+   if (e->type != 0)
+      printf("The recording is cut off or garbled after %i events\n",num_events);
+   fclose(f);
+   free(e);
+
+   kstat = GetKodStats();
+   instructions = (INT64)kstat->billions_interpreted*1000000000 + kstat->num_interpreted;
+   printf("Replayed %i events, %.1f s of recorded time, in %.1f ms: %lli instructions, "
+	  "%i top level messages\n",num_events,(replay_time - REPLAY_START_TIME)/1000.0,
+	  start/1e6,(long long)instructions,kstat->num_top_level_messages);
+   printf("%i timers went off, %i in the recording; %i events had no session in the game, "
+	  "%i users weren't in the save\n\n",kind_times[REPLAY_TIMER].num_times,
+	  recorded_timers,missing_sessions,missing_users);
+
+   ReportTimes();
+   return 0;
+}
@@ -9,25 +9,52 @@
 * list.c
 *
 
-  This module maintains a dynamically sized array with the list nodes
-  used by the Blakod.  They are like LISP list nodes, keeping values in
-  two fields, first and rest.
+  This module maintains the list nodes used by the Blakod.  They are
+  like LISP list nodes, keeping values in two fields, first and rest.
+
+  Nodes live in fixed size chunks, addressed by splitting the list id
+  into a chunk number and an index within the chunk, so growing never
+  copies the nodes that are already there.  Nodes that ReclaimListNodes()
+  in garbage.c proves unreferenced go on a free list, chained through
+  their first field, and are handed out again by Cons before the high
+  water mark grows.  Only GarbageCollect() renumbers and compacts them.
   
 */
 
 #include "blakserv.h"
 
-list_node *list_nodes;
-int num_nodes,max_nodes;
+#define LIST_CHUNK_SHIFT 16
+#define LIST_CHUNK_NODES (1 << LIST_CHUNK_SHIFT)
+#define LIST_CHUNK_MASK (LIST_CHUNK_NODES - 1)
+
+#define ListNodeAt(list_id) \
+	(&list_chunks[(list_id) >> LIST_CHUNK_SHIFT][(list_id) & LIST_CHUNK_MASK])
+
+/* a free node has this tag in first, and the next free id in first's data */
+#define IsFreeListNode(l) ((l)->first.v.tag == TAG_INVALID)
+
+static list_node **list_chunks;
+static int num_chunks,max_chunks;
+int num_nodes;
+
+static int free_list_head;
+static int num_free_nodes;
+
+static list_node_statistics list_stats;
 
 /* local function prototypes */
 int AllocateListNode(void);
+void FreeListChunks(int keep_chunks);
+void ClearFreeListNodes(void);
 
 void InitList(void)
 {
 	num_nodes = 0;
-	max_nodes = INIT_LIST_NODES;
-	list_nodes = (list_node *)AllocateMemory(MALLOC_ID_LIST,max_nodes*sizeof(list_node));
+	num_chunks = 0;
+	max_chunks = INIT_LIST_NODES/LIST_CHUNK_NODES + 1;
+	list_chunks = (list_node **)AllocateMemory(MALLOC_ID_LIST,max_chunks*sizeof(list_node *));
+	ClearFreeListNodes();
+	memset(&list_stats,0,sizeof(list_stats));
 }
 
 void ResetList(void)
@@ -43,15 +70,29 @@ void ResetList(void)
 */
 void ClearList(void)
 {
-	int old_nodes;
-	
-	old_nodes = max_nodes;
-	
 	num_nodes = 0;
-	max_nodes = INIT_LIST_NODES;
-	list_nodes = (list_node *)
-		ResizeMemory(MALLOC_ID_LIST,list_nodes,old_nodes*sizeof(list_node),
-		max_nodes*sizeof(list_node));
+	ClearFreeListNodes();
+	FreeListChunks(0);
+}
+
+/* FreeListChunks
+*
+* Gives back every chunk past the first keep_chunks.
+*/
+void FreeListChunks(int keep_chunks)
+{
+	while (num_chunks > keep_chunks)
+	{
+		num_chunks--;
+		FreeMemory(MALLOC_ID_LIST,list_chunks[num_chunks],LIST_CHUNK_NODES*sizeof(list_node));
+		list_stats.num_chunks_freed++;
+	}
+}
+
+void ClearFreeListNodes(void)
+{
+	free_list_head = -1;
+	num_free_nodes = 0;
 }
 
 int GetListNodesUsed(void)
@@ -59,45 +100,114 @@ int GetListNodesUsed(void)
 	return num_nodes;
 }
 
+void GetListNodeStats(list_node_statistics *lstat)
+{
+	*lstat = list_stats;
+	lstat->num_nodes = num_nodes;
+	lstat->num_live = num_nodes - num_free_nodes;
+	lstat->num_free = num_free_nodes;
+	lstat->num_chunks = num_chunks;
+	lstat->chunk_nodes = LIST_CHUNK_NODES;
+}
+
 int AllocateListNode(void)
 {
-	int old_nodes;
+	int list_id;
+	list_node *l;
 	
-	if (num_nodes == max_nodes)
+	list_stats.num_allocated++;
+
+	if (free_list_head >= 0)
+	{
+		list_id = free_list_head;
+		l = ListNodeAt(list_id);
+		free_list_head = (int)l->first.v.data;
+		num_free_nodes--;
+		list_stats.num_reused++;
+		return list_id;
+	}
+
+	if ((num_nodes >> LIST_CHUNK_SHIFT) == num_chunks)
 	{
-		old_nodes = max_nodes;
-		max_nodes = max_nodes + ( INIT_LIST_NODES/2) ;
-		
-		list_nodes = (list_node *)
-			ResizeMemory(MALLOC_ID_LIST,list_nodes,old_nodes*sizeof(list_node),
-			max_nodes*sizeof(list_node));      
-		lprintf("AllocateListNode resized to %i list nodes\n",max_nodes);
+		if (num_chunks == max_chunks)
+		{
+			/* only the small array of chunk pointers moves */
+			list_chunks = (list_node **)
+				ResizeMemory(MALLOC_ID_LIST,list_chunks,max_chunks*sizeof(list_node *),
+				2*max_chunks*sizeof(list_node *));
+			max_chunks *= 2;
+		}
+		list_chunks[num_chunks++] = (list_node *)
+			AllocateMemory(MALLOC_ID_LIST,LIST_CHUNK_NODES*sizeof(list_node));
+		list_stats.num_chunks_allocated++;
+		if (num_chunks > 1)
+			lprintf("AllocateListNode added chunk %i, room for %i list nodes\n",
+				num_chunks,num_chunks*LIST_CHUNK_NODES);
 	}
 	return num_nodes++;
 }
 
+/* FreeListNode
+*
+* Only for nodes that nothing can refer to anymore; see ReclaimListNodes().
+* The id will be handed out by the next Cons.
+*/
+void FreeListNode(int list_id)
+{
+	list_node *l;
+
+	if (list_id < 0 || list_id >= num_nodes)
+	{
+		eprintf("FreeListNode can't free invalid list node %i\n",list_id);
+		return;
+	}
+
+	l = ListNodeAt(list_id);
+	if (IsFreeListNode(l))
+		return;
+
+	l->first.v.tag = TAG_INVALID;
+	l->first.v.data = free_list_head;
+	l->rest.int_val = NIL;
+	free_list_head = list_id;
+	num_free_nodes++;
+	list_stats.num_freed++;
+}
+
 Bool LoadList(int list_id,val_type first,val_type rest)
 {
+	list_node *l;
+
 	if (AllocateListNode() != list_id)
 	{
 		eprintf("LoadList didn't make list id %i\n",list_id);
 		return False;
 	}
 	
-	list_nodes[list_id].first = first;
-	list_nodes[list_id].rest = rest;
+	l = ListNodeAt(list_id);
+	l->first = first;
+	l->rest = rest;
+	l->alloc_site = 0;
 	
 	return True;
 }
 
 list_node *GetListNodeByID(int list_id)
 {
+	list_node *l;
+
 	if (list_id < 0 || list_id >= num_nodes)
 	{
 		eprintf("GetListNodeByID can't retrieve invalid list node %i\n",list_id);
 		return NULL;
 	}
-	return &list_nodes[list_id];
+	l = ListNodeAt(list_id);
+	if (IsFreeListNode(l))
+	{
+		eprintf("GetListNodeByID can't retrieve freed list node %i\n",list_id);
+		return NULL;
+	}
+	return l;
 }
 
 Bool IsListNodeByID(int list_id)
@@ -105,7 +215,7 @@ Bool IsListNodeByID(int list_id)
 	if (list_id < 0 || list_id >= num_nodes)
 		return False;
 	
-	return True;
+	return !IsFreeListNode(ListNodeAt(list_id));
 }
 
 blak_int First(int list_id)
@@ -132,12 +242,11 @@ int Cons(val_type source,val_type dest)
 	/*   bprintf("Allocing list node #%i\n",num_nodes); */
 	
 	list_id = AllocateListNode();
-	new_node = GetListNodeByID(list_id);
-	if (!new_node)
-		return NIL;
+	new_node = ListNodeAt(list_id);
 	
 	new_node->first.int_val = source.int_val;
 	new_node->rest.int_val = dest.int_val;
+	new_node->alloc_site = GetAllocSite(CENSUS_LIST);
 	return list_id;
 }
 
@@ -283,12 +392,36 @@ blak_int DelListElem(val_type list_id,val_type list_elem)
 	return list_id.int_val;
 }
 
+/* ForEachListNode
+*
+* Visits every id below the high water mark, free nodes included, so that
+* saving them keeps the ids the same when they're loaded back in.
+*/
 void ForEachListNode(void (*callback_func)(list_node *l,int list_id))
 {
-	int i;
+	ForEachListNodeInRange(0,num_nodes,callback_func);
+}
+
+/* ForEachListNodeInRange
+*
+* ForEachListNode() for just the ids start <= id < end; the range may
+* cross chunks.
+*/
+void ForEachListNodeInRange(int start,int end,void (*callback_func)(list_node *l,int list_id))
+{
+	int i,chunk,count;
+	list_node *l;
 	
-	for (i=0;i<num_nodes;i++)
-		callback_func(&list_nodes[i],i);
+	if (end > num_nodes)
+		end = num_nodes;
+	while (start < end)
+	{
+		chunk = start >> LIST_CHUNK_SHIFT;
+		l = list_chunks[chunk];
+		count = std::min(end - start,LIST_CHUNK_NODES - (start & LIST_CHUNK_MASK));
+		for (i=start & LIST_CHUNK_MASK;count>0;i++,count--)
+			callback_func(&l[i],start++);
+	}
 }
 
 /* these functions are for garbage collecting */
@@ -305,19 +438,31 @@ void MoveListNode(int dest_id,int source_id)
 		return;
 	}
 	
-	dest = GetListNodeByID(dest_id);
-	if (dest == NULL)
+	/* the destination may well be a free node, which is fine here */
+	if (dest_id < 0 || dest_id >= num_nodes)
 	{
 		eprintf("MoveListNode can't find dest %i, total death end game\n",
 			dest_id);
 		return;
 	}
+	dest = ListNodeAt(dest_id);
 	dest->first = source->first;
 	dest->rest = source->rest;
 	dest->garbage_ref = source->garbage_ref;
+	dest->alloc_site = source->alloc_site;
 }
 
+/* SetNumListNodes
+*
+* Called when GarbageCollect() has compacted the live nodes below
+* new_num_nodes, which leaves nothing on the free list, and the chunks
+* past the new high water mark empty.
+*/
 void SetNumListNodes(int new_num_nodes)
 {
 	num_nodes = new_num_nodes;
+	ClearFreeListNodes();
+	FreeListChunks((num_nodes + LIST_CHUNK_NODES - 1) >> LIST_CHUNK_SHIFT);
+	list_stats.num_reused = 0;
+	list_stats.num_freed = 0;
 }
@@ -20,12 +20,29 @@ typedef struct
    val_type first;
    val_type rest;
    int garbage_ref;
+   int alloc_site; /* see census.c */
 } list_node;
 
+typedef struct
+{
+   int num_nodes; /* high water mark of list ids */
+   int num_live;
+   int num_free; /* reclaimed nodes waiting to be reused */
+   int num_chunks;
+   int chunk_nodes;
+   INT64 num_allocated; /* every Cons, ever */
+   INT64 num_reused; /* Cons calls served from the free list since the last compaction */
+   INT64 num_freed; /* nodes reclaimed since the last compaction */
+   int num_chunks_allocated;
+   int num_chunks_freed;
+} list_node_statistics;
+
 void InitList(void);
 void ResetList(void);
 void ClearList(void);
 int GetListNodesUsed(void);
+void GetListNodeStats(list_node_statistics *lstat);
+void FreeListNode(int list_id);
 Bool LoadList(int list_id,val_type first,val_type rest);
 list_node * GetListNodeByID(int list_id);
 Bool IsListNodeByID(int list_id);
@@ -40,6 +57,7 @@ int FindListElem(val_type list_id,val_type list_elem);
 blak_int DelListElem(val_type list_id,val_type list_elem);
 
 void ForEachListNode(void (*callback_func)(list_node *l,int list_id));
+void ForEachListNodeInRange(int start,int end,void (*callback_func)(list_node *l,int list_id));
 void MoveListNode(int dest_id,int source_id);
 void SetNumListNodes(int new_num_nodes);
 
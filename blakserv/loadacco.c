@@ -25,6 +25,9 @@
  Sample:
  ACCOUNT 2:Andrew Kirmse:97,105,70:1:0:1200:0
 
+ Accounts are normally loaded from the account store (accostore.c); this
+ file is only read for a save the store doesn't have.
+
  */
 
 #include "blakserv.h"
@@ -41,12 +44,13 @@ Bool LoadLineAccount(char *account_str,char *name_str,char *password_str,
 
 Bool LoadAccounts(char *filename)
 {
-   FILE *accofile;
+   char *mem,*ptr,*line_end;
+   int length,len_line;
    char line[MAX_ACCOUNT_LINE+1];
    char *type_str,*t1,*t2,*t3,*t4,*t5,*t6,*t7;
    int nextAccountID = -1;
 
-   if ((accofile = fopen(filename,"rt")) == NULL)
+   if (!PreloadFile(filename,MALLOC_ID_ACCOUNT,&mem,&length))
    {
       eprintf("LoadAccounts can't open %s to load the accounts!\n",
 	      filename);
@@ -55,10 +59,22 @@ Bool LoadAccounts(char *filename)
 
    highestAccount = -1;
    lineno = 0;
-   while (fgets(line,MAX_ACCOUNT_LINE,accofile))
+   for (ptr = mem; ptr < mem + length; ptr = line_end + 1)
    {
       lineno++;
 
+      /* PreloadFile null terminates, so strchr stops at the end */
+      line_end = strchr(ptr,'\n');
+      if (line_end == NULL)
+	 line_end = mem + length;
+
+      /* we read it as binary, so drop the \r that text mode used to */
+      len_line = std::min((int)(line_end - ptr),MAX_ACCOUNT_LINE);
+      if (len_line > 0 && ptr[len_line-1] == '\r')
+	 len_line--;
+      memcpy(line,ptr,len_line);
+      line[len_line] = 0;
+
       type_str = strtok(line,": \t\n");
 
       if (type_str == NULL)	/* ignore blank lines */
@@ -80,7 +96,7 @@ Bool LoadAccounts(char *filename)
       {
 	 if (!LoadLineAccount(t1,t2,t3,t4,t5,t7,t6))
 	 {
-	    fclose(accofile);
+	    FreeFileMemory(MALLOC_ID_ACCOUNT,mem,length);
 	    return False;
 	 }
 	 else
@@ -93,10 +109,11 @@ Bool LoadAccounts(char *filename)
       }
 
       eprintf("LoadAccounts can't handle account file line type %s\n",type_str);
+      FreeFileMemory(MALLOC_ID_ACCOUNT,mem,length);
       return False;     
    }
 
-   fclose(accofile);
+   FreeFileMemory(MALLOC_ID_ACCOUNT,mem,length);
    if (GetNextAccountID() > nextAccountID)
       nextAccountID = GetNextAccountID();
    SetNextAccountID(nextAccountID);
@@ -9,8 +9,8 @@
  * loadall.c
  *
 
-  This module uses the three load modules loadacco.c, loadgame.c, and
-  loadstr.c to load the entire system.  It reads the last save time
+  This module uses the load modules accostore.c (or loadacco.c), loadgame.c,
+  and loadstr.c to load the entire system.  It reads the last save time
   from the save control file to determine the filenames of the saved
   game.  The file is a text file, with comment lines started with a
   pound sign (#).  The important line starts with "LOADSAVE", followed
@@ -24,7 +24,6 @@
 
 /* local function prototypes */
 Bool LoadAllButAccountAtTime(char *time_str);
-Bool LoadControlFile(int *last_save_time);
 
 /* LoadAll
 Can't do this if any sessions are logged in because sessions have
@@ -32,10 +31,7 @@ pointers to accounts
 */
 Bool LoadAll(void)
 {
-	char load_name[MAX_PATH+FILENAME_MAX];
-	char time_str[100];
 	int last_save_time;
-	
 
 	/* ban all the naughty children */
 	BuildBannedIPBlocks("banned.txt");
@@ -47,17 +43,32 @@ Bool LoadAll(void)
 		CreateBuiltIn();
 		return False;
 	}
-	
+
+	return LoadAllAtTime(last_save_time);
+}
+
+/* LoadAllAtTime
+Loads the game saved at last_save_time, whether or not it's the last
+one saved.
+*/
+Bool LoadAllAtTime(int last_save_time)
+{
+	char load_name[MAX_PATH+FILENAME_MAX];
+	char time_str[100];
+
 	sprintf(time_str,"%i",last_save_time);
 	
+	/* saves from before the account store, or older than its last
+	   compaction, only have the text file */
 	sprintf(load_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),ACCOUNT_FILE_SAVE,time_str);
-	if (LoadAccounts(load_name) == False)
+	if (LoadAccountStore(last_save_time) == False && LoadAccounts(load_name) == False)
 	{
 		lprintf("LoadAll error loading accounts, initializing a new game\n");
 		SetSystemObjectID(CreateObject(SYSTEM_CLASS,0,NULL));
 		CreateBuiltIn();
 		return False;
 	}
+	LoadPhaseDone("accounts");
 	
 	if (LoadAllButAccountAtTime(time_str) == False)
 		return False;
@@ -96,6 +107,7 @@ Bool LoadAllButAccountAtTime(char *time_str)
 	sprintf(load_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),STRING_FILE_SAVE,time_str);
 	if (LoadBlakodStrings(load_name) == False)
 		load_ok = False;
+	LoadPhaseDone("strings");
 	
 	sprintf(load_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),GAME_FILE_SAVE,time_str);
 	if (!LoadGame(load_name)) 
@@ -110,9 +122,11 @@ Bool LoadAllButAccountAtTime(char *time_str)
 		ClearUser();
 		SetSystemObjectID(CreateObject(SYSTEM_CLASS,0,NULL));
 	}
+	LoadPhaseDone("game");
 	
 	sprintf(load_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),DYNAMIC_RSC_FILE_SAVE,time_str);
 	LoadDynamicRsc(load_name);
+	LoadPhaseDone("dynarscs");
 	
 	return load_ok;
 }
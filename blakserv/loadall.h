@@ -14,6 +14,8 @@
 #define _LOADALL_H
 
 Bool LoadAll(void);
+Bool LoadAllAtTime(int last_save_time);
 Bool LoadAllButAccount(void);
+Bool LoadControlFile(int *last_save_time);
 
 #endif
@@ -14,10 +14,20 @@
   Data lines start with a tag name, either "SYSTEM", "OBJECT", "PROP", "LIST",
   "TIMER", or "USER" which indicates what type of data is being stored on that
   line.
+
+  Version 2 files are split into sections (see savegame.h).  We read one
+  section at a time into memory, check its CRC, and parse the records out
+  of the buffer, so a truncated or damaged file is refused instead of
+  half loaded.  The file is streamed that way rather than preloaded
+  whole (see preload.c), so loading never needs more than a section.
+
+  Classes, properties and resources are matched up by name once, when the
+  saved names are read, so setting each object property is just an index.
   
 */
 
 #include <assert.h>
+#include <zlib.h>
 
 #include "blakserv.h"
 
@@ -36,10 +46,25 @@ typedef struct load_game_class_struct
 	
 	int num_props;
 	load_game_prop_node *props; /* array of property names */
+
+	Bool resolved;
+	class_node *c; /* the class now, or NULL if it's gone */
+	int *prop_ids; /* current property id of each saved property */
 	
 	struct load_game_class_struct *next;
 } load_game_class_node;
 
+typedef struct
+{
+	Bool active;
+	char *buf;
+	int max_len;
+	char *zbuf;
+	int max_zlen;
+	int len;
+	int pos;
+} load_section_type;
+
 typedef struct loaded_file_struct
 {
    char fname[MAX_PATH+FILENAME_MAX];
@@ -55,11 +80,18 @@ int load_game_classes_table_size;
 load_game_class_node **load_game_classes;
 
 ishash_type load_game_resources;
+ishash_type load_game_messages;
+
+/* current resource id of each saved resource id, or INVALID_ID */
+int *load_game_resource_ids;
+int max_load_game_resource_ids;
+
+load_section_type load_section;
 
 
 #define LoadGameRead(buf,len) \
 { \
-   if (fread(buf, 1, len, loadfile.file) != len) \
+   if (!LoadGameReadBytes(buf,len)) \
    { \
 	   eprintf("File %s Line %i not enough bytes to read\n",__FILE__,__LINE__); \
       return False; \
@@ -73,7 +105,7 @@ ishash_type load_game_resources;
 #define LoadGameReadString(buf,max_len) \
 { \
 	unsigned short len; \
-   if (fread(&len, 1, 2, loadfile.file) != 2) \
+   if (!LoadGameReadBytes(&len,2)) \
    { \
       eprintf("File %s Line %i not enough bytes to read\n",__FILE__,__LINE__); \
       return False; \
@@ -85,7 +117,7 @@ ishash_type load_game_resources;
       return False; \
    } \
 \
-   if (fread(buf, 1, len, loadfile.file) != len) \
+   if (!LoadGameReadBytes(buf,len)) \
    { \
       eprintf("File %s Line %i not enough bytes to read\n",__FILE__,__LINE__); \
       return False; \
@@ -97,12 +129,19 @@ ishash_type load_game_resources;
 
 Bool LoadGameOpen(char *fname);
 Bool LoadGameParse(char *filename);
+Bool LoadGameParseSections(char *filename);
+Bool LoadGameReadSection(save_section_header *h);
+Bool LoadGameReadBytes(void *buf,size_t len);
+void LoadGameGrowBuffer(char **buf,int *max_len,int len);
 void LoadGameClose(void);
 
+Bool LoadGameRecord(int cmd,int file_version);
 Bool LoadGameSystem(void);
 Bool LoadGameObject(int file_version);
 Bool LoadGameListNodes(int file_version);
+Bool LoadGameListNode(int file_version);
 Bool LoadGameTimer(int file_version);
+Bool LoadGameMessage(void);
 Bool LoadGameUser(void);
 Bool LoadGameClass(void);
 void LoadAddPropertyName(load_game_class_node *lgc,int prop_old_id,char *prop_name);
@@ -113,6 +152,7 @@ load_game_class_node * CreateLoadGameClass(int class_old_id,char *class_name,int
 void CreateLoadGameResource(int resource_old_id,char *resource_name);
 
 load_game_class_node * GetLoadGameClassByID(int class_old_id);
+void LoadGameResolveClass(load_game_class_node *lgc);
 char * GetLoadGamePropertyNameByID(load_game_class_node *lgc,int prop_old_id);
 const char * GetLoadGameResourceByID(int resource_old_id);
 
@@ -136,6 +176,10 @@ Bool LoadGame(char *filename)
 		load_game_classes[i] = NULL;
 
 	load_game_resources = CreateISHash(ConfigInt(MEMORY_SIZE_RESOURCE_NAME_HASH));
+	load_game_messages = CreateISHash(ConfigInt(MEMORY_SIZE_RESOURCE_NAME_HASH));
+	load_game_resource_ids = NULL;
+	max_load_game_resource_ids = 0;
+	memset(&load_section,0,sizeof(load_section));
 	current_object_id = INVALID_OBJECT;
 	current_object_class_id = INVALID_OBJECT;
 	
@@ -166,6 +210,8 @@ Bool LoadGame(char *filename)
 			}
 			if (lgc->num_props > 0)
 				FreeMemory(MALLOC_ID_LOAD_GAME,lgc->props,lgc->num_props*sizeof(load_game_prop_node));
+			if (lgc->prop_ids != NULL)
+				FreeMemory(MALLOC_ID_LOAD_GAME,lgc->prop_ids,lgc->num_props*sizeof(int));
 			FreeMemory(MALLOC_ID_LOAD_GAME,lgc->class_name,strlen(lgc->class_name)+1);
 		
 			tempc = lgc->next;
@@ -179,9 +225,23 @@ Bool LoadGame(char *filename)
 
 	FreeISHash(load_game_resources);
 	load_game_resources = NULL;
+	FreeISHash(load_game_messages);
+	load_game_messages = NULL;
+
+	if (load_game_resource_ids != NULL)
+		FreeMemory(MALLOC_ID_LOAD_GAME,load_game_resource_ids,
+					  max_load_game_resource_ids*sizeof(int));
+	load_game_resource_ids = NULL;
+
+	if (load_section.buf != NULL)
+		FreeMemory(MALLOC_ID_LOAD_GAME,load_section.buf,load_section.max_len);
+	if (load_section.zbuf != NULL)
+		FreeMemory(MALLOC_ID_LOAD_GAME,load_section.zbuf,load_section.max_zlen);
+	memset(&load_section,0,sizeof(load_section));
 
 	end_time = GetMilliCount();
-	dprintf("LoadGame exiting LoadGame %u seconds\n",(unsigned int)(end_time-start_time)/1000);
+	dprintf("LoadGame exiting LoadGame %u.%03u seconds\n",(unsigned int)(end_time-start_time)/1000,
+		(unsigned int)(end_time-start_time)%1000);
 	
 	return ret_val;
 }
@@ -204,13 +264,14 @@ Bool LoadGameParse(char *filename)
   // File versions:
   // 0 - original save game, everything is 32 bits
   // 1 - object properties are 64 bits
+  // 2 - sectioned, checksummed, optionally compressed
   int file_version = 0;
 
   char sentinel;
   LoadGameReadChar(&sentinel);
   if (sentinel == 'V') {
     LoadGameReadInt(&file_version);
-    if (file_version < 0 || file_version > 1) {
+    if (file_version < 0 || file_version > 2) {
       eprintf("LoadGameParse got unknown save game version %i\n", file_version);
       return False;
     }
@@ -218,6 +279,9 @@ Bool LoadGameParse(char *filename)
     rewind(loadfile.file);
   }
 
+  if (file_version >= 2)
+    return LoadGameParseSections(filename);
+
 	while (true)
 	{
       if (fread(&cmd, 1, 1, loadfile.file) != 1)
@@ -231,46 +295,189 @@ Bool LoadGameParse(char *filename)
       }
 
       //      dprintf("load game %i\n",cmd);
-		switch (cmd)
+		if (!LoadGameRecord(cmd,file_version))
 		{
-		case SAVE_GAME_CLASS :
-			if (!LoadGameClass())
-				return False;
-			break;
-		case SAVE_GAME_RESOURCE :
-			if (!LoadGameResource())
-				return False;
-			break;
-		case SAVE_GAME_SYSTEM :
-			if (!LoadGameSystem())
-				return False;
-			break;
-		case SAVE_GAME_OBJECT :
-			if (!LoadGameObject(file_version))
-				return False;
-			break;
-		case SAVE_GAME_LIST_NODES :
-			if (!LoadGameListNodes(file_version))
-				return False;
-			break;
-		case SAVE_GAME_TIMER :
-			if (!LoadGameTimer(file_version))
-				return False;
+			eprintf("LoadGameParse failed on record type %u at offset %li in %s\n",
+					  cmd,ftell(loadfile.file),filename);
+			return False;
+		}
+	}
+	
+	return True;
+}
+
+Bool LoadGameParseSections(char *filename)
+{
+	save_section_header header;
+	int i,num_sections;
+	INT64 file_len;
+
+	num_sections = 0;
+	file_len = 0;
+	load_section.active = True;
+
+	while (true)
+	{
+		if (fread(&header,sizeof(header),1,loadfile.file) != 1)
+		{
+			eprintf("LoadGameParseSections %s is truncated after %i sections\n",
+					  filename,num_sections);
+			return False;
+		}
+		num_sections++;
+
+		if (header.type == SAVE_GAME_END)
 			break;
-		case SAVE_GAME_USER :
-			if (!LoadGameUser())
+
+		if (!LoadGameReadSection(&header))
+		{
+			eprintf("LoadGameParseSections can't read section %i of %s\n",
+					  num_sections,filename);
+			return False;
+		}
+		file_len += header.len;
+
+		for (i=0;i<header.count;i++)
+		{
+			if (!LoadGameRecord(header.type,2))
+			{
+				eprintf("LoadGameParseSections failed on record %i of section %i (type %i) in %s\n",
+						  i,num_sections,header.type,filename);
 				return False;
-			break;
-		default :
-			eprintf("LoadGameFile found invalid command byte %u at offset %i in %s\n",
-                 cmd,ftell(loadfile.file),filename);
+			}
+		}
+
+		if (load_section.pos != load_section.len)
+		{
+			eprintf("LoadGameParseSections section %i of %s has %i extra bytes\n",
+					  num_sections,filename,load_section.len - load_section.pos);
 			return False;
 		}
 	}
-	
+
+	load_section.active = False;
+
+	dprintf("LoadGameParseSections read %i sections, %lli bytes\n",num_sections,
+			  (long long)file_len);
 	return True;
 }
 
+/* LoadGameReadSection
+*
+* Reads the payload of a version 2 section into load_section, inflating and
+* checking it.  The header was just read.
+*/
+Bool LoadGameReadSection(save_section_header *h)
+{
+	uLongf len;
+
+	if (h->count < 0 || h->len < 0 || h->len > SAVE_SECTION_MAX_LEN ||
+		 h->stored_len < 0 || h->stored_len > SAVE_SECTION_MAX_LEN ||
+		 (!(h->flags & SAVE_SECTION_COMPRESSED) && h->stored_len != h->len))
+	{
+		eprintf("LoadGameReadSection found bad header for section type %i\n",h->type);
+		return False;
+	}
+
+	LoadGameGrowBuffer(&load_section.buf,&load_section.max_len,h->len);
+
+	if (h->flags & SAVE_SECTION_COMPRESSED)
+	{
+		LoadGameGrowBuffer(&load_section.zbuf,&load_section.max_zlen,h->stored_len);
+		if (fread(load_section.zbuf,1,h->stored_len,loadfile.file) != (size_t)h->stored_len)
+		{
+			eprintf("LoadGameReadSection section type %i is truncated\n",h->type);
+			return False;
+		}
+
+		len = h->len;
+		if (uncompress((Bytef *)load_section.buf,&len,(const Bytef *)load_section.zbuf,
+							h->stored_len) != Z_OK || len != (uLongf)h->len)
+		{
+			eprintf("LoadGameReadSection can't uncompress section type %i\n",h->type);
+			return False;
+		}
+	}
+	else
+	{
+		if (fread(load_section.buf,1,h->len,loadfile.file) != (size_t)h->len)
+		{
+			eprintf("LoadGameReadSection section type %i is truncated\n",h->type);
+			return False;
+		}
+	}
+
+	if (CRC32(load_section.buf,h->len) != h->crc)
+	{
+		eprintf("LoadGameReadSection section type %i fails its CRC check\n",h->type);
+		return False;
+	}
+
+	load_section.len = h->len;
+	load_section.pos = 0;
+	return True;
+}
+
+/* LoadGameReadBytes
+*
+* Version 2 records come from the current section, older ones straight
+* from the file.
+*/
+Bool LoadGameReadBytes(void *buf,size_t len)
+{
+	if (!load_section.active)
+		return fread(buf,1,len,loadfile.file) == len;
+
+	if (len > (size_t)(load_section.len - load_section.pos))
+		return False;
+
+	memcpy(buf,load_section.buf + load_section.pos,len);
+	load_section.pos += len;
+	return True;
+}
+
+void LoadGameGrowBuffer(char **buf,int *max_len,int len)
+{
+	if (len <= *max_len)
+		return;
+
+	if (*buf != NULL)
+		FreeMemory(MALLOC_ID_LOAD_GAME,*buf,*max_len);
+	*max_len = len;
+	*buf = (char *)AllocateMemory(MALLOC_ID_LOAD_GAME,*max_len);
+}
+
+Bool LoadGameRecord(int cmd,int file_version)
+{
+	switch (cmd)
+	{
+	case SAVE_GAME_CLASS :
+		return LoadGameClass();
+	case SAVE_GAME_RESOURCE :
+		return LoadGameResource();
+	case SAVE_GAME_SYSTEM :
+		return LoadGameSystem();
+	case SAVE_GAME_OBJECT :
+		return LoadGameObject(file_version);
+	case SAVE_GAME_LIST_NODES :
+		/* version 2 has a record per node, older ones a count and all nodes */
+		if (file_version >= 2)
+			return LoadGameListNode(file_version);
+		return LoadGameListNodes(file_version);
+	case SAVE_GAME_TIMER :
+		return LoadGameTimer(file_version);
+	case SAVE_GAME_USER :
+		return LoadGameUser();
+	case SAVE_GAME_MESSAGE :
+		if (file_version >= 2)
+			return LoadGameMessage();
+		break;
+	}
+
+	eprintf("LoadGameRecord found invalid record type %i\n",cmd);
+	return False;
+}
+
 Bool LoadGameSystem(void)
 {
 	int system_id;
@@ -283,9 +490,9 @@ Bool LoadGameSystem(void)
 
 Bool LoadGameObject(int file_version)
 {
-	int object_id,class_old_id,num_props,i;
+	int object_id,class_old_id,num_props,i,property_id;
 	val_type prop_val;
-	char *property_str;
+	object_node *o;
 	load_game_class_node *lgc;
 	
 	LoadGameReadInt(&object_id);
@@ -307,6 +514,9 @@ Bool LoadGameObject(int file_version)
 	}
 	current_object_id = object_id;
 
+	o = GetObjectByID(object_id);
+	LoadGameResolveClass(lgc);
+
 	for (i=1;i<=num_props;i++)
 	{
     if (file_version == 0) {
@@ -318,22 +528,27 @@ Bool LoadGameObject(int file_version)
     }
 		// eprintf("loading object %i\n",object_id);
 
-		LoadGameTranslateVal(&prop_val);
-		property_str = GetLoadGamePropertyNameByID(lgc,i);
-		if (property_str == NULL)
+		if (i > lgc->num_props)
 		{
 			eprintf("LoadGameObject found object %i class %s property %i without name\n",
 				object_id,lgc->class_name,i);
 			return False;
 		}
 
-		if (!SetObjectPropertyByName(current_object_id,property_str,prop_val))
+		/* property just eliminated in new kod; LoadGameResolveClass said so */
+		property_id = lgc->prop_ids[i-1];
+		if (property_id == INVALID_PROPERTY)
+			continue;
+
+		if (property_id >= o->num_props || o->p[property_id].id != property_id)
 		{
 			eprintf("LoadGameObject object %i class %s property %s can't set object property\n",
-				object_id,lgc->class_name,property_str);
-			// it's usually ok, property just eliminated in new kod
+				object_id,lgc->class_name,lgc->props[i-1].prop_name);
+			continue;
 		}
 
+		LoadGameTranslateVal(&prop_val);
+		o->p[property_id].val = prop_val;
 	}
 	
 	return True;
@@ -342,30 +557,39 @@ Bool LoadGameObject(int file_version)
 Bool LoadGameListNodes(int file_version)
 {
 	int num_list_nodes,i;
-	val_type first_val,rest_val;
 	
 	LoadGameReadInt(&num_list_nodes);
 	
 	for (i=0;i<num_list_nodes;i++)
-	{
-		if (file_version == 0) {
-		  if (!LoadGameReadInt32To64(&first_val) ||
-		      !LoadGameReadInt32To64(&rest_val)) {
-		    return False;
-		  }
-		} else {
-		  LoadGameReadInt64(&first_val);
-		  LoadGameReadInt64(&rest_val);
-		}
-		
-		LoadGameTranslateVal(&first_val);
-		LoadGameTranslateVal(&rest_val);
-		
-		if (!LoadList(i,first_val,rest_val))
-		{
-			eprintf("LoadGameList can't set list node %i\n",i);
+		if (!LoadGameListNode(file_version))
 			return False;
-		}
+	
+	return True;
+}
+
+Bool LoadGameListNode(int file_version)
+{
+	int list_id;
+	val_type first_val,rest_val;
+
+	if (file_version == 0) {
+	  if (!LoadGameReadInt32To64(&first_val) ||
+	      !LoadGameReadInt32To64(&rest_val)) {
+	    return False;
+	  }
+	} else {
+	  LoadGameReadInt64(&first_val);
+	  LoadGameReadInt64(&rest_val);
+	}
+	
+	LoadGameTranslateVal(&first_val);
+	LoadGameTranslateVal(&rest_val);
+	
+	list_id = GetListNodesUsed();
+	if (!LoadList(list_id,first_val,rest_val))
+	{
+		eprintf("LoadGameList can't set list node %i\n",list_id);
+		return False;
 	}
 	
 	return True;
@@ -373,12 +597,28 @@ Bool LoadGameListNodes(int file_version)
 
 Bool LoadGameTimer(int file_version)
 {
-	int timer_id,object_id,milliseconds32,milliseconds64;
+	int timer_id,object_id,milliseconds32,message_old_id;
+	INT64 milliseconds64;
 	char buf[100];
+	const char *message_name;
 	
 	LoadGameReadInt(&timer_id);
 	LoadGameReadInt(&object_id);
-	LoadGameReadString(buf,sizeof(buf));
+	if (file_version >= 2)
+	{
+		LoadGameReadInt(&message_old_id);
+		message_name = ISHashFind(load_game_messages,message_old_id);
+		if (message_name == NULL)
+		{
+			eprintf("LoadGameTimer found timer %i with unknown message %i\n",timer_id,
+					  message_old_id);
+			return False;
+		}
+		strncpy(buf,message_name,sizeof(buf));
+		buf[sizeof(buf)-1] = 0;
+	}
+	else
+		LoadGameReadString(buf,sizeof(buf));
 	if (file_version == 0) {
 	  LoadGameReadInt(&milliseconds32);
 	  milliseconds64 = milliseconds32;
@@ -394,6 +634,18 @@ Bool LoadGameTimer(int file_version)
 	return True;
 }
 
+Bool LoadGameMessage(void)
+{
+	int message_old_id;
+	char buf[100];
+
+	LoadGameReadInt(&message_old_id);
+	LoadGameReadString(buf,sizeof(buf));
+
+	ISHashInsert(load_game_messages,message_old_id,buf);
+	return True;
+}
+
 Bool LoadGameUser(void)
 {   
 	int object_id,account_id;
@@ -468,6 +720,9 @@ load_game_class_node * CreateLoadGameClass(int class_old_id,char *class_name,int
 	strcpy(lgc->class_name,class_name);
 	lgc->num_props = num_props;
 	lgc->props = NULL;
+	lgc->resolved = False;
+	lgc->c = NULL;
+	lgc->prop_ids = NULL;
 	if (num_props > 0)
 		lgc->props = (load_game_prop_node *)AllocateMemory(MALLOC_ID_LOAD_GAME,
 																			num_props*sizeof(load_game_prop_node));    
@@ -481,7 +736,32 @@ load_game_class_node * CreateLoadGameClass(int class_old_id,char *class_name,int
 
 void CreateLoadGameResource(int resource_old_id,char *resource_name)
 {
+	resource_node *r;
+	int i,old_max;
+
 	ISHashInsert(load_game_resources,resource_old_id,resource_name);
+
+	if (resource_old_id < 0 || resource_old_id >= MIN_DYNAMIC_RSC)
+		return;
+
+	if (resource_old_id >= max_load_game_resource_ids)
+	{
+		old_max = max_load_game_resource_ids;
+		max_load_game_resource_ids = std::max(2*old_max,resource_old_id + 1024);
+		if (load_game_resource_ids == NULL)
+			load_game_resource_ids = (int *)AllocateMemory(MALLOC_ID_LOAD_GAME,
+				max_load_game_resource_ids*sizeof(int));
+		else
+			load_game_resource_ids = (int *)ResizeMemory(MALLOC_ID_LOAD_GAME,
+				load_game_resource_ids,old_max*sizeof(int),max_load_game_resource_ids*sizeof(int));
+		for (i=old_max;i<max_load_game_resource_ids;i++)
+			load_game_resource_ids[i] = INVALID_ID;
+	}
+
+	/* rsc files are loaded before the game, so we can match it up now */
+	r = GetResourceByName(resource_name);
+	if (r != NULL)
+		load_game_resource_ids[resource_old_id] = r->resource_id;
 }
 
 load_game_class_node * GetLoadGameClassByID(int class_old_id)
@@ -500,6 +780,36 @@ load_game_class_node * GetLoadGameClassByID(int class_old_id)
 	return NULL;
 }
 
+/* LoadGameResolveClass
+*
+* Matches a saved class and its property names up with the loaded kod, once
+* per class rather than once per object.
+*/
+void LoadGameResolveClass(load_game_class_node *lgc)
+{
+	int i;
+
+	if (lgc->resolved)
+		return;
+	lgc->resolved = True;
+
+	lgc->c = GetClassByName(lgc->class_name);
+	if (lgc->num_props > 0)
+		lgc->prop_ids = (int *)AllocateMemory(MALLOC_ID_LOAD_GAME,lgc->num_props*sizeof(int));
+
+	for (i=0;i<lgc->num_props;i++)
+	{
+		lgc->prop_ids[i] = INVALID_PROPERTY;
+		if (lgc->c == NULL || lgc->props[i].prop_name == NULL)
+			continue;
+
+		lgc->prop_ids[i] = GetPropertyIDByName(lgc->c,lgc->props[i].prop_name);
+		if (lgc->prop_ids[i] == INVALID_PROPERTY)
+			eprintf("LoadGameResolveClass can't find property %s in class %s (%i), not loading it\n",
+					  lgc->props[i].prop_name,lgc->class_name,lgc->c->class_id);
+	}
+}
+
 char * GetLoadGamePropertyNameByID(load_game_class_node *lgc,int prop_old_id)
 {
 	if (prop_old_id < 1 || prop_old_id > lgc->num_props)
@@ -517,7 +827,6 @@ const char * GetLoadGameResourceByID(int resource_old_id)
 void LoadGameTranslateVal(val_type *pval)
 {
 	load_game_class_node *lgc;
-	class_node *c;
 	const char *resource_name;
 	resource_node *r;
 	
@@ -540,14 +849,14 @@ void LoadGameTranslateVal(val_type *pval)
 			eprintf("LoadGameTranslateVal unable to get class %i\n",pval->v.data);
 			break;
 		}
-		c = GetClassByName(lgc->class_name);
-		if (c == NULL)
+		LoadGameResolveClass(lgc);
+		if (lgc->c == NULL)
 		{
 			eprintf("LoadGameTranslateVal unable to lookup loaded class %s\n",
 				lgc->class_name);
 			break;
 		}
-		pval->v.data = c->class_id;
+		pval->v.data = lgc->c->class_id;
 		
 		break;
 		
@@ -555,6 +864,13 @@ void LoadGameTranslateVal(val_type *pval)
 		if (pval->v.data >= MIN_DYNAMIC_RSC)
 			break;
 
+		if (pval->v.data < (unsigned int)max_load_game_resource_ids &&
+			 load_game_resource_ids[pval->v.data] != INVALID_ID)
+		{
+			pval->v.data = load_game_resource_ids[pval->v.data];
+			break;
+		}
+
 		resource_name = GetLoadGameResourceByID(pval->v.data);
 		if (resource_name == NULL)
 		{
@@ -0,0 +1,1145 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * loadgen.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself.  It
+ opens many client connections to a server and drives each one as a
+ scripted bot, so that load resembling a full game can be generated on
+ a development machine.  Build it with "make -f makefile.linux loadgen".
+
+ Each bot speaks the same protocol as the Windows client: it logs in
+ from STATE_SYNCHED with an MD5'd password, asks for the game, picks its
+ first character, and then loops over its script (walk, say, attack,
+ turn).  Game mode messages carry the CRC security value from the
+ random streams seeded by AP_GETCHOICE (see GameRandomStreamsStep) and
+ the epoch from the last server message, and the first byte of server
+ messages is unmangled with the token and redbook from BP_ECHO_PING.
+ If the server asks for a resync, the bot sends the beacon and answers
+ the trysync string with the detect string like the client does.
+
+ After every scripted action the bot sends a BP_PING.  The server
+ handles a session's messages in order, so the time until BP_ECHO_PING
+ comes back covers the action as well.  Accounts without characters
+ stay at the main menu and time AP_REQ_MENU round trips instead.
+
+ The accounts must exist already; "loadgen -A" prints the admin
+ commands that create them.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "bool.h"
+#include "proto.h"
+#include "crc.h"
+#include "md5.h"
+#include "rscload.h"
+
+#define HEADERBYTES 7
+#define SEED_COUNT 5
+#define LENGTH_SYNC 9
+
+#define LOADGEN_MAX_MSG 65536
+#define LOADGEN_OUT_SIZE 8192
+#define LOADGEN_PINGS 16
+#define LOADGEN_MAX_ACTIONS 32
+#define LOADGEN_TICK_MS 10
+
+/* Same version the client sends; below 4 the server doesn't secure packets */
+#define LOADGEN_MAJOR_REV 7
+#define LOADGEN_MINOR_REV 22
+
+#define LOADGEN_DEFAULT_REDBOOK "BLAKSTON: Greenwich Q Zjiria"
+
+/* strings from resync.c and trysync.c */
+static unsigned char beacon_str[] = { 1, 255, 66, 76, 65, 75, 10, 13, 2 };
+static unsigned char tell_cli_str[] = { 3, 251, 98, 108, 97, 107, 10, 13, 1 };
+static unsigned char detect_str[] = { 7, 230, 98, 108, 97, 107, 10, 13, 8 };
+
+enum
+{
+   BOT_IDLE,       /* not connected yet */
+   BOT_CONNECTING,
+   BOT_LOGIN,      /* waiting for AP_LOGINOK */
+   BOT_MENU,       /* at main menu, no characters */
+   BOT_ENTERING,   /* in game mode, choosing a character */
+   BOT_GAME,
+   BOT_RESYNC,     /* sent beacon, waiting for tell_cli_str */
+   BOT_DEAD,
+};
+
+enum
+{
+   ACTION_WALK,
+   ACTION_SAY,
+   ACTION_ATTACK,
+   ACTION_TURN,
+   NUM_ACTIONS,
+};
+
+static const char *action_names[NUM_ACTIONS] = { "walk", "say", "attack", "turn" };
+
+typedef struct
+{
+   int *us;
+   int count;
+   int size;
+} latency_list;
+
+typedef struct
+{
+   int index;
+   int fd;
+   int state;
+   int resync_state; /* state to go back to after a resync */
+   int sync_index;
+   int connect_tries;
+
+   char in[LOADGEN_MAX_MSG + HEADERBYTES];
+   int len_in;
+   char out[LOADGEN_OUT_SIZE];
+   int len_out;
+
+   unsigned int seeds[SEED_COUNT];
+   unsigned char epoch;
+   unsigned int secure_token;
+   const char *redbook;
+   const char *sliding_token;
+   Bool asked_characters;
+   Bool watching_out;
+
+   int player_id;
+   int room_id;
+   int row,col;
+   Bool have_position;
+
+   double connect_time;
+   double request_time;
+   double ping_times[LOADGEN_PINGS];
+   int ping_head,ping_count;
+   double next_action;
+   int script_index;
+} bot_node;
+
+typedef struct
+{
+   long msgs_in;
+   long bytes_in;
+   long msgs_out;
+   long bytes_out;
+   long actions;
+   long resyncs;
+   long login_failures;
+   long disconnects;
+} loadgen_counts;
+
+typedef struct
+{
+   int id;
+   char *str;
+} rsc_entry;
+
+/* options */
+static const char *host = "127.0.0.1";
+static int port = 5959;
+static int num_bots = 100;
+static int duration = 60;
+static const char *name_prefix = "bot";
+static const char *password = "bot";
+static int interval_ms = 1000;
+static int max_pending = 4;
+static int report_secs = 5;
+static int script[LOADGEN_MAX_ACTIONS];
+static int script_len;
+
+static bot_node *bots;
+static int fd_epoll;
+static struct sockaddr_in server_addr;
+static unsigned char encrypted_password[ENCRYPT_LEN+1];
+
+static loadgen_counts counts,last_counts;
+static latency_list login_latency,enter_latency,action_latency,interval_latency;
+static long action_counts[NUM_ACTIONS];
+
+static rsc_entry *rscs;
+static int num_rscs,size_rscs;
+static Bool warned_redbook;
+
+/* local function prototypes */
+static double Now(void);
+static void Fail(const char *fmt,...);
+static void Usage(void);
+static Bool ParseScript(const char *str);
+static void AddLatency(latency_list *l,double seconds);
+static int CompareInt(const void *a,const void *b);
+static int Percentile(latency_list *l,int permille);
+static void PrintLatency(const char *label,latency_list *l);
+static bool LoadRscCallback(char *filename,int resource_num,char *string);
+static void LoadRscDirectory(const char *dir);
+static int CompareRsc(const void *a,const void *b);
+static const char * LookupRsc(int id);
+static void StartConnect(bot_node *b);
+static void CloseBot(bot_node *b,const char *reason);
+static void FlushBot(bot_node *b);
+static void WriteBot(bot_node *b,const void *data,int len);
+static void SendMessage(bot_node *b,const char *data,int len);
+static void RandomStreamsStep(bot_node *b,unsigned int *value);
+static void SendPing(bot_node *b);
+static void SendLogin(bot_node *b);
+static void SendReqGame(bot_node *b);
+static void SendCharacters(bot_node *b);
+static void StartResync(bot_node *b);
+static void DoAction(bot_node *b,double now);
+static void ReadBot(bot_node *b);
+static void ScanResync(bot_node *b);
+static void HandleSynched(bot_node *b,unsigned char *msg,int len);
+static void HandleGame(bot_node *b,unsigned char *msg,int len);
+static void PopPing(bot_node *b,double now);
+static void Report(double elapsed,double since);
+
+/* helpers to build messages */
+#define PUT_BYTE(p,x) (*(p)++ = (char)(x))
+#define PUT_SHORT(p,x) do { short _s = (short)(x); memcpy(p,&_s,2); (p) += 2; } while (0)
+#define PUT_INT(p,x) do { int _i = (int)(x); memcpy(p,&_i,4); (p) += 4; } while (0)
+#define PUT_STRING(p,s,l) do { PUT_SHORT(p,l); memcpy(p,s,l); (p) += (l); } while (0)
+
+static double Now(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static void Fail(const char *fmt,...)
+{
+   va_list marker;
+
+   va_start(marker,fmt);
+   vfprintf(stderr,fmt,marker);
+   va_end(marker);
+   exit(1);
+}
+
+static void Usage(void)
+{
+   fprintf(stderr,
+           "usage: loadgen [options]\n"
+           "  -h host       server address (127.0.0.1)\n"
+           "  -p port       server port (5959)\n"
+           "  -n bots       number of bots (100)\n"
+           "  -t seconds    length of run (60)\n"
+           "  -u prefix     account names are prefix0, prefix1, ... (bot)\n"
+           "  -w password   password of every account (bot)\n"
+           "  -s script     actions, comma separated: walk,say,attack,turn (walk,walk,say,attack)\n"
+           "  -i ms         time between actions of one bot (1000)\n"
+           "  -c count      connections opened at once (4)\n"
+           "  -r dir        rsc directory, to follow the security redbook\n"
+           "  -R seconds    progress report interval, 0 for none (5)\n"
+           "  -A            print admin commands to create the accounts, and exit\n");
+   exit(1);
+}
+
+static Bool ParseScript(const char *str)
+{
+   char buf[500],*tok;
+   int i;
+
+   script_len = 0;
+   snprintf(buf,sizeof(buf),"%s",str);
+   for (tok = strtok(buf,", "); tok != NULL; tok = strtok(NULL,", "))
+   {
+      for (i=0;i<NUM_ACTIONS;i++)
+         if (strcmp(tok,action_names[i]) == 0)
+            break;
+      if (i == NUM_ACTIONS || script_len == LOADGEN_MAX_ACTIONS)
+         return False;
+      script[script_len++] = i;
+   }
+   return script_len > 0;
+}
+
+static void AddLatency(latency_list *l,double seconds)
+{
+   if (l->count == l->size)
+   {
+      l->size = l->size ? l->size*2 : 4096;
+      l->us = (int *)realloc(l->us,l->size*sizeof(int));
+      if (l->us == NULL)
+         Fail("loadgen out of memory\n");
+   }
+   l->us[l->count++] = (int)(seconds*1000000.0);
+}
+
+static int CompareInt(const void *a,const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+/* Percentile
+*
+* Returns the latency below which the given fraction (in tenths of a
+* percent) of the list falls, in microseconds.  The list must be sorted.
+*/
+static int Percentile(latency_list *l,int permille)
+{
+   int i;
+
+   if (l->count == 0)
+      return 0;
+   i = (int)((long)l->count*permille/1000);
+   if (i >= l->count)
+      i = l->count - 1;
+   return l->us[i];
+}
+
+static void PrintLatency(const char *label,latency_list *l)
+{
+   qsort(l->us,l->count,sizeof(int),CompareInt);
+   printf("%-8s %8i  p50 %8.2f  p90 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f ms\n",
+          label,l->count,Percentile(l,500)/1000.0,Percentile(l,900)/1000.0,
+          Percentile(l,990)/1000.0,Percentile(l,999)/1000.0,
+          l->count ? l->us[l->count-1]/1000.0 : 0.0);
+}
+
+static bool LoadRscCallback(char *filename,int resource_num,char *string)
+{
+   if (num_rscs == size_rscs)
+   {
+      size_rscs = size_rscs ? size_rscs*2 : 1024;
+      rscs = (rsc_entry *)realloc(rscs,size_rscs*sizeof(rsc_entry));
+      if (rscs == NULL)
+         Fail("loadgen out of memory\n");
+   }
+   rscs[num_rscs].id = resource_num;
+   rscs[num_rscs].str = strdup(string);
+   num_rscs++;
+   return true;
+}
+
+/* LoadRscDirectory
+*
+* The redbook the server slides the security token along is a resource
+* string.  The server only sends its id, so load the rsc files the
+* client would have to look it up.
+*/
+static void LoadRscDirectory(const char *dir)
+{
+   DIR *d;
+   struct dirent *entry;
+   char file[1024];
+   int len;
+
+   d = opendir(dir);
+   if (d == NULL)
+      Fail("loadgen can't open rsc directory %s\n",dir);
+   while ((entry = readdir(d)) != NULL)
+   {
+      len = strlen(entry->d_name);
+      if (len < 4 || strcasecmp(entry->d_name+len-4,".rsc") != 0)
+         continue;
+      snprintf(file,sizeof(file),"%s/%s",dir,entry->d_name);
+      if (!RscFileLoad(file,LoadRscCallback))
+         fprintf(stderr,"loadgen couldn't load %s\n",file);
+   }
+   closedir(d);
+   qsort(rscs,num_rscs,sizeof(rsc_entry),CompareRsc);
+   printf("Loaded %i resources from %s\n",num_rscs,dir);
+}
+
+static int CompareRsc(const void *a,const void *b)
+{
+   return ((const rsc_entry *)a)->id - ((const rsc_entry *)b)->id;
+}
+
+static const char * LookupRsc(int id)
+{
+   rsc_entry key,*r;
+
+   key.id = id;
+   r = (rsc_entry *)bsearch(&key,rscs,num_rscs,sizeof(rsc_entry),CompareRsc);
+   return r ? r->str : NULL;
+}
+
+static void StartConnect(bot_node *b)
+{
+   struct epoll_event ev;
+   int one = 1;
+
+   b->fd = socket(AF_INET,SOCK_STREAM,0);
+   if (b->fd < 0)
+      Fail("loadgen can't create socket, %s\n",strerror(errno));
+   fcntl(b->fd,F_SETFL,O_NONBLOCK);
+   setsockopt(b->fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+   b->state = BOT_CONNECTING;
+   b->len_in = 0;
+   b->len_out = 0;
+   b->epoch = 0;
+   b->secure_token = 0;
+   b->redbook = NULL;
+   b->sliding_token = NULL;
+   b->asked_characters = False;
+   b->watching_out = True;
+   b->ping_count = 0;
+   b->player_id = 0;
+   b->have_position = False;
+   b->connect_time = Now();
+
+   if (connect(b->fd,(struct sockaddr *)&server_addr,sizeof(server_addr)) < 0 &&
+       errno != EINPROGRESS)
+   {
+      CloseBot(b,NULL);
+      return;
+   }
+
+   ev.events = EPOLLIN | EPOLLOUT;
+   ev.data.u32 = b->index;
+   epoll_ctl(fd_epoll,EPOLL_CTL_ADD,b->fd,&ev);
+}
+
+/* CloseBot
+*
+* A bot that was refused while connecting goes back to idle to be tried
+* again; the server's listen backlog is small.  Any other close is final.
+*/
+static void CloseBot(bot_node *b,const char *reason)
+{
+   if (b->fd >= 0)
+      close(b->fd);
+   b->fd = -1;
+
+   if (b->state == BOT_CONNECTING && b->connect_tries++ < 50)
+   {
+      b->state = BOT_IDLE;
+      return;
+   }
+
+   if (reason != NULL)
+      fprintf(stderr,"%s%i: %s\n",name_prefix,b->index,reason);
+   if (b->state != BOT_DEAD)
+      counts.disconnects++;
+   b->state = BOT_DEAD;
+}
+
+static void FlushBot(bot_node *b)
+{
+   struct epoll_event ev;
+   int len;
+
+   if (b->len_out > 0)
+   {
+      len = send(b->fd,b->out,b->len_out,MSG_NOSIGNAL);
+      if (len < 0)
+      {
+         if (errno != EAGAIN)
+         {
+            CloseBot(b,"write failed");
+            return;
+         }
+         len = 0;
+      }
+      memmove(b->out,b->out+len,b->len_out-len);
+      b->len_out -= len;
+   }
+
+   /* only watch for writability while there's something left to write */
+   if (b->watching_out != (b->len_out > 0))
+   {
+      b->watching_out = (b->len_out > 0);
+      ev.events = EPOLLIN | (b->watching_out ? (uint32_t)EPOLLOUT : 0);
+      ev.data.u32 = b->index;
+      epoll_ctl(fd_epoll,EPOLL_CTL_MOD,b->fd,&ev);
+   }
+}
+
+static void WriteBot(bot_node *b,const void *data,int len)
+{
+   if (b->fd < 0)
+      return;
+   if (b->len_out + len > LOADGEN_OUT_SIZE)
+   {
+      CloseBot(b,"server stopped reading");
+      return;
+   }
+   memcpy(b->out+b->len_out,data,len);
+   b->len_out += len;
+   counts.bytes_out += len;
+}
+
+static void RandomStreamsStep(bot_node *b,unsigned int *value)
+{
+   int i,stream;
+
+   for (i=0;i<SEED_COUNT;i++)
+      b->seeds[i] = (b->seeds[i] * 9301 + 49297) % 233280;
+
+   stream = b->seeds[SEED_COUNT - 1] % (SEED_COUNT - 1);
+   *value = b->seeds[stream];
+}
+
+/* SendMessage
+*
+* Writes a message with the header the server's synched and game modes
+* read: length, security value, length again, then epoch.  In game mode
+* the security value is the next random stream step mixed with the
+* length, type and CRC, and the epoch is the last one the server sent.
+*/
+static void SendMessage(bot_node *b,const char *data,int len)
+{
+   char header[HEADERBYTES],*p;
+   unsigned int security;
+   Bool game;
+
+   game = (b->state == BOT_ENTERING || b->state == BOT_GAME);
+
+   security = 0xffff & CRC32(data,len);
+   if (game)
+   {
+      RandomStreamsStep(b,&security);
+      security ^= len;
+      security ^= ((unsigned int)(unsigned char)data[0] << 4);
+      security ^= 0xffff & CRC32(data,len);
+   }
+
+   p = header;
+   PUT_SHORT(p,len);
+   PUT_SHORT(p,security);
+   PUT_SHORT(p,len);
+   PUT_BYTE(p,game ? b->epoch : 0);
+
+   WriteBot(b,header,HEADERBYTES);
+   WriteBot(b,data,len);
+   counts.msgs_out++;
+}
+
+static void SendPing(bot_node *b)
+{
+   char msg[1];
+
+   if (b->ping_count == LOADGEN_PINGS)
+      return;
+   msg[0] = BP_PING;
+   SendMessage(b,msg,1);
+   b->ping_times[(b->ping_head + b->ping_count) % LOADGEN_PINGS] = Now();
+   b->ping_count++;
+}
+
+static void PopPing(bot_node *b,double now)
+{
+   if (b->ping_count == 0)
+      return;
+   AddLatency(&action_latency,now - b->ping_times[b->ping_head]);
+   AddLatency(&interval_latency,now - b->ping_times[b->ping_head]);
+   b->ping_head = (b->ping_head + 1) % LOADGEN_PINGS;
+   b->ping_count--;
+}
+
+static void SendLogin(bot_node *b)
+{
+   char msg[200],name[100],*p;
+   int len;
+
+   len = snprintf(name,sizeof(name),"%s%i",name_prefix,b->index);
+
+   p = msg;
+   PUT_BYTE(p,AP_LOGIN);
+   PUT_BYTE(p,LOADGEN_MAJOR_REV);
+   PUT_BYTE(p,LOADGEN_MINOR_REV);
+   PUT_INT(p,0);            /* os type */
+   PUT_INT(p,0);            /* os major */
+   PUT_INT(p,0);            /* os minor */
+   PUT_INT(p,64*1024*1024); /* ram */
+   PUT_INT(p,0);            /* cpu */
+   PUT_SHORT(p,640);        /* screen x */
+   PUT_SHORT(p,480);        /* screen y */
+   PUT_INT(p,0);            /* displays */
+   PUT_INT(p,0);            /* bandwidth */
+   PUT_INT(p,8);            /* color depth, partner */
+   PUT_STRING(p,name,len);
+   PUT_STRING(p,(char *)encrypted_password,ENCRYPT_LEN);
+
+   b->state = BOT_LOGIN;
+   b->request_time = Now();
+   SendMessage(b,msg,p - msg);
+}
+
+static void SendReqGame(bot_node *b)
+{
+   char msg[20],*p;
+
+   p = msg;
+   PUT_BYTE(p,AP_REQ_GAME);
+   PUT_INT(p,time(NULL));   /* last download time: we want no files */
+   PUT_INT(p,0);            /* catch */
+   PUT_STRING(p,"",0);
+
+   b->request_time = Now();
+   SendMessage(b,msg,p - msg);
+}
+
+static void SendCharacters(bot_node *b)
+{
+   char msg[1];
+
+   if (b->epoch == 0)
+      b->epoch = 1;
+   msg[0] = BP_SEND_CHARACTERS;
+   SendMessage(b,msg,1);
+   b->asked_characters = True;
+}
+
+static void StartResync(bot_node *b)
+{
+   counts.resyncs++;
+   if (b->state != BOT_RESYNC)
+      b->resync_state = b->state;
+   b->state = BOT_RESYNC;
+   b->sync_index = 0;
+   b->len_in = 0;
+   b->ping_count = 0;
+   WriteBot(b,beacon_str,LENGTH_SYNC);
+}
+
+static void DoAction(bot_node *b,double now)
+{
+   char msg[100],*p,text[60];
+   int action,len,target;
+
+   b->next_action = now + interval_ms/1000.0;
+
+   if (b->state == BOT_MENU)
+   {
+      /* no character to play, so time main menu round trips */
+      if (b->ping_count == LOADGEN_PINGS)
+         return;
+      msg[0] = AP_REQ_MENU;
+      SendMessage(b,msg,1);
+      b->ping_times[(b->ping_head + b->ping_count) % LOADGEN_PINGS] = now;
+      b->ping_count++;
+      counts.actions++;
+      return;
+   }
+
+   action = script[b->script_index];
+   b->script_index = (b->script_index + 1) % script_len;
+
+   p = msg;
+   switch (action)
+   {
+   case ACTION_WALK :
+      if (!b->have_position)
+      {
+         /* the server answers a wild move with our real position */
+         b->row = b->col = 10*64 + 64;
+         b->have_position = True;
+      }
+      b->row += (rand() % 3 - 1)*16;
+      b->col += (rand() % 3 - 1)*16;
+      PUT_BYTE(p,BP_REQ_MOVE);
+      PUT_SHORT(p,b->row);
+      PUT_SHORT(p,b->col);
+      PUT_BYTE(p,18);
+      PUT_INT(p,b->room_id);
+      break;
+
+   case ACTION_SAY :
+      len = snprintf(text,sizeof(text),"load test %i",rand());
+      PUT_BYTE(p,BP_SAY_TO);
+      PUT_BYTE(p,SAY_NORMAL);
+      PUT_STRING(p,text,len);
+      break;
+
+   case ACTION_ATTACK :
+      /* swing at some other bot that's in the game */
+      target = bots[rand() % num_bots].player_id;
+      if (target == 0)
+         target = b->player_id;
+      PUT_BYTE(p,BP_REQ_ATTACK);
+      PUT_BYTE(p,ATTACK_NORMAL);
+      PUT_INT(p,target);
+      break;
+
+   case ACTION_TURN :
+      PUT_BYTE(p,BP_REQ_TURN);
+      PUT_INT(p,b->player_id);
+      PUT_SHORT(p,rand() % 4096);
+      break;
+   }
+
+   SendMessage(b,msg,p - msg);
+   SendPing(b);
+   counts.actions++;
+   action_counts[action]++;
+}
+
+static void ReadBot(bot_node *b)
+{
+   int len,msg_len;
+   unsigned char *msg;
+
+   for (;;)
+   {
+      len = recv(b->fd,b->in+b->len_in,sizeof(b->in)-b->len_in,0);
+      if (len == 0)
+      {
+         CloseBot(b,"server closed connection");
+         return;
+      }
+      if (len < 0)
+      {
+         if (errno != EAGAIN)
+            CloseBot(b,"read failed");
+         return;
+      }
+      counts.bytes_in += len;
+      b->len_in += len;
+
+      if (b->state == BOT_RESYNC)
+      {
+         ScanResync(b);
+         if (b->state == BOT_RESYNC)
+            continue;
+      }
+
+      while (b->len_in >= HEADERBYTES && b->state != BOT_DEAD && b->state != BOT_RESYNC)
+      {
+         msg_len = *(unsigned short *)b->in;
+         if (msg_len != *(unsigned short *)(b->in+4))
+         {
+            StartResync(b);
+            break;
+         }
+         if (b->len_in < HEADERBYTES + msg_len)
+            break;
+
+         msg = (unsigned char *)b->in + HEADERBYTES;
+         counts.msgs_in++;
+         if (msg_len > 0)
+         {
+            if (b->state == BOT_ENTERING || b->state == BOT_GAME)
+            {
+               b->epoch = (unsigned char)b->in[6];
+               HandleGame(b,msg,msg_len);
+            }
+            else
+               HandleSynched(b,msg,msg_len);
+         }
+
+         if (b->state == BOT_RESYNC || b->state == BOT_DEAD)
+            break;
+         memmove(b->in,b->in+HEADERBYTES+msg_len,b->len_in-HEADERBYTES-msg_len);
+         b->len_in -= HEADERBYTES + msg_len;
+      }
+   }
+}
+
+/* ScanResync
+*
+* While resyncing, the server sends raw bytes with no header.  When the
+* trysync string has gone by, answer with the detect string and go back
+* to reading messages.
+*/
+static void ScanResync(bot_node *b)
+{
+   int i;
+
+   for (i=0;i<b->len_in;i++)
+   {
+      if ((unsigned char)b->in[i] == tell_cli_str[b->sync_index])
+         b->sync_index++;
+      else
+         b->sync_index = ((unsigned char)b->in[i] == tell_cli_str[0]) ? 1 : 0;
+
+      if (b->sync_index == LENGTH_SYNC)
+      {
+         WriteBot(b,detect_str,LENGTH_SYNC);
+         b->state = b->resync_state;
+         memmove(b->in,b->in+i+1,b->len_in-i-1);
+         b->len_in -= i+1;
+         return;
+      }
+   }
+   b->len_in = 0;
+}
+
+static void HandleSynched(bot_node *b,unsigned char *msg,int len)
+{
+   double now = Now();
+   int i;
+
+   switch (msg[0])
+   {
+   case AP_GETLOGIN :
+      SendLogin(b);
+      break;
+
+   case AP_LOGINOK :
+      AddLatency(&login_latency,now - b->request_time);
+      break;
+
+   case AP_LOGINFAILED :
+      counts.login_failures++;
+      CloseBot(b,"login failed");
+      break;
+
+   case AP_GETCHOICE :
+      if (len < 1 + 4*SEED_COUNT)
+         break;
+      for (i=0;i<SEED_COUNT;i++)
+         memcpy(&b->seeds[i],msg+1+4*i,4);
+      if (b->state == BOT_LOGIN)
+      {
+         b->state = BOT_MENU;
+         SendReqGame(b);
+      }
+      else
+         PopPing(b,now);
+      break;
+
+   case AP_NOCHARACTERS :
+      /* stay at the menu; DoAction times menu requests instead */
+      b->next_action = now + (rand() % interval_ms)/1000.0;
+      break;
+
+   case AP_GAME :
+      /* wait for the first game message to learn the epoch, see main */
+      b->state = BOT_ENTERING;
+      b->request_time = now;
+      b->ping_count = 0;
+      b->ping_head = 0;
+      break;
+
+   case AP_RESYNC :
+      StartResync(b);
+      break;
+
+   case AP_ACCOUNTUSED :
+      CloseBot(b,"account already logged in");
+      break;
+
+   case AP_TOOMANYLOGINS :
+   case AP_TIMEOUT :
+   case AP_DOWNLOAD :
+   case AP_MESSAGE :
+      CloseBot(b,"server refused login");
+      break;
+
+   default :
+      break;
+   }
+}
+
+/* HandleGame
+*
+* Undoes the server's SecurePacketBufferList on the type byte, and keeps
+* the token sliding along the redbook just like the server does.
+*/
+static void HandleGame(bot_node *b,unsigned char *msg,int len)
+{
+   double now = Now();
+   unsigned char type;
+   char reply[10],*p;
+   int id;
+   short count;
+   const char *redbook;
+
+   type = msg[0] ^ (unsigned char)(b->secure_token & 0xFF);
+   if (b->sliding_token)
+   {
+      b->secure_token += (*b->sliding_token) & 0x7F;
+      b->sliding_token++;
+      if (*b->sliding_token == '\0')
+         b->sliding_token = b->redbook;
+   }
+
+   if (b->state == BOT_ENTERING && !b->asked_characters)
+      SendCharacters(b);
+
+   switch (type)
+   {
+   case BP_ECHO_PING :
+      if (len < 6)
+         break;
+      b->secure_token = (unsigned int)(msg[1] ^ 0xED);
+      memcpy(&id,msg+2,4);
+      redbook = LookupRsc(id);
+      if (redbook == NULL)
+      {
+         if (id != 0 && !warned_redbook)
+         {
+            fprintf(stderr,"loadgen doesn't have redbook resource %i, use -r\n",id);
+            warned_redbook = True;
+         }
+         redbook = LOADGEN_DEFAULT_REDBOOK;
+      }
+      b->redbook = redbook;
+      b->sliding_token = redbook;
+      PopPing(b,now);
+      break;
+
+   case BP_RESYNC :
+      StartResync(b);
+      break;
+
+   case BP_CHARACTERS :
+      if (b->state != BOT_ENTERING || len < 7)
+         break;
+      memcpy(&count,msg+1,2);
+      if (count <= 0)
+      {
+         CloseBot(b,"no characters");
+         break;
+      }
+      memcpy(&id,msg+3,4);
+      p = reply;
+      PUT_BYTE(p,BP_USE_CHARACTER);
+      PUT_INT(p,id);
+      SendMessage(b,reply,p - reply);
+      break;
+
+   case BP_PLAYER :
+      if (len < 1 + 4*4)
+         break;
+      memcpy(&b->player_id,msg+1,4);
+      memcpy(&b->room_id,msg+1+3*4,4);
+      if (b->state == BOT_ENTERING)
+      {
+         AddLatency(&enter_latency,now - b->request_time);
+         b->state = BOT_GAME;
+         b->next_action = now + (rand() % interval_ms)/1000.0;
+      }
+      break;
+
+   case BP_MOVE :
+      if (len < 1 + 4 + 2*2)
+         break;
+      memcpy(&id,msg+1,4);
+      if (id == b->player_id)
+      {
+         b->row = *(unsigned short *)(msg+5);
+         b->col = *(unsigned short *)(msg+7);
+         b->have_position = True;
+      }
+      break;
+
+   case BP_QUIT :
+      CloseBot(b,"server sent us back to the menu");
+      break;
+
+   default :
+      break;
+   }
+}
+
+static void Report(double elapsed,double since)
+{
+   int in_game,at_menu,i;
+
+   in_game = at_menu = 0;
+   for (i=0;i<num_bots;i++)
+   {
+      if (bots[i].state == BOT_GAME)
+         in_game++;
+      if (bots[i].state == BOT_MENU)
+         at_menu++;
+   }
+
+   qsort(interval_latency.us,interval_latency.count,sizeof(int),CompareInt);
+   printf("%5.0fs  game %5i  menu %5i  actions/s %7.0f  msgs in/s %8.0f  KB in/s %8.1f"
+          "  p50 %7.2f  p99 %7.2f ms\n",
+          elapsed,in_game,at_menu,
+          (counts.actions - last_counts.actions)/since,
+          (counts.msgs_in - last_counts.msgs_in)/since,
+          (counts.bytes_in - last_counts.bytes_in)/since/1024.0,
+          Percentile(&interval_latency,500)/1000.0,Percentile(&interval_latency,990)/1000.0);
+   fflush(stdout);
+
+   interval_latency.count = 0;
+   last_counts = counts;
+}
+
+int main(int argc,char **argv)
+{
+   struct epoll_event events[1024];
+   struct hostent *h;
+   const char *rsc_dir = NULL;
+   Bool print_accounts = False;
+   double start,now,last_report;
+   int opt,i,n,pending,in_game;
+   bot_node *b;
+
+   ParseScript("walk,walk,say,attack");
+
+   while ((opt = getopt(argc,argv,"h:p:n:t:u:w:s:i:c:r:R:A")) != -1)
+   {
+      switch (opt)
+      {
+      case 'h' : host = optarg; break;
+      case 'p' : port = atoi(optarg); break;
+      case 'n' : num_bots = atoi(optarg); break;
+      case 't' : duration = atoi(optarg); break;
+      case 'u' : name_prefix = optarg; break;
+      case 'w' : password = optarg; break;
+      case 's' :
+         if (!ParseScript(optarg))
+            Usage();
+         break;
+      case 'i' : interval_ms = atoi(optarg); break;
+      case 'c' : max_pending = atoi(optarg); break;
+      case 'r' : rsc_dir = optarg; break;
+      case 'R' : report_secs = atoi(optarg); break;
+      case 'A' : print_accounts = True; break;
+      default : Usage();
+      }
+   }
+   if (num_bots <= 0 || interval_ms <= 0 || max_pending <= 0)
+      Usage();
+
+   if (print_accounts)
+   {
+      for (i=0;i<num_bots;i++)
+         printf("create automated %s%i %s\n",name_prefix,i,password);
+      return 0;
+   }
+
+   memset(&server_addr,0,sizeof(server_addr));
+   server_addr.sin_family = AF_INET;
+   server_addr.sin_port = htons(port);
+   h = gethostbyname(host);
+   if (h == NULL)
+      Fail("loadgen can't resolve %s\n",host);
+   memcpy(&server_addr.sin_addr,h->h_addr,h->h_length);
+
+   /* same as LoginSendInfo in the client */
+   MDString((char *)password,encrypted_password);
+   encrypted_password[ENCRYPT_LEN] = 0;
+
+   if (rsc_dir != NULL)
+      LoadRscDirectory(rsc_dir);
+
+   fd_epoll = epoll_create(1);
+   bots = (bot_node *)calloc(num_bots,sizeof(bot_node));
+   if (bots == NULL)
+      Fail("loadgen out of memory\n");
+   for (i=0;i<num_bots;i++)
+   {
+      bots[i].index = i;
+      bots[i].fd = -1;
+      bots[i].state = BOT_IDLE;
+      bots[i].script_index = i % script_len;
+   }
+
+   printf("%i bots against %s:%i for %i seconds\n",num_bots,host,port,duration);
+
+   start = last_report = Now();
+   for (;;)
+   {
+      now = Now();
+      if (now - start >= duration)
+         break;
+
+      /* open connections a few at a time; the listen backlog is short */
+      pending = 0;
+      for (i=0;i<num_bots;i++)
+         if (bots[i].state == BOT_CONNECTING || bots[i].state == BOT_LOGIN)
+            pending++;
+      for (i=0;i<num_bots && pending < max_pending;i++)
+         if (bots[i].state == BOT_IDLE)
+         {
+            StartConnect(&bots[i]);
+            pending++;
+         }
+
+      n = epoll_wait(fd_epoll,events,1024,LOADGEN_TICK_MS);
+      for (i=0;i<n;i++)
+      {
+         b = &bots[events[i].data.u32];
+         if (b->fd < 0)
+            continue;
+         if (events[i].events & (EPOLLERR | EPOLLHUP))
+         {
+            CloseBot(b,"connection error");
+            continue;
+         }
+         if (b->state == BOT_CONNECTING)
+            b->state = BOT_LOGIN; /* connected, AP_GETLOGIN is on its way */
+         if (events[i].events & EPOLLIN)
+            ReadBot(b);
+         if (b->fd >= 0)
+            FlushBot(b);
+      }
+
+      now = Now();
+      for (i=0;i<num_bots;i++)
+      {
+         b = &bots[i];
+         if (b->state == BOT_ENTERING && !b->asked_characters && now - b->request_time > 1.0)
+         {
+            SendCharacters(b);
+            FlushBot(b);
+         }
+         if ((b->state == BOT_GAME || (b->state == BOT_MENU && b->next_action > 0)) &&
+             now >= b->next_action)
+         {
+            DoAction(b,now);
+            FlushBot(b);
+         }
+      }
+
+      if (report_secs > 0 && now - last_report >= report_secs)
+      {
+         Report(now - start,now - last_report);
+         last_report = now;
+      }
+   }
+
+   now = Now() - start;
+
+   in_game = 0;
+   for (i=0;i<num_bots;i++)
+      if (bots[i].state == BOT_GAME || bots[i].state == BOT_MENU)
+         in_game++;
+
+   printf("\n%i of %i bots active after %.1f seconds\n",in_game,num_bots,now);
+   printf("actions   %8li (%.0f/s)",counts.actions,counts.actions/now);
+   for (i=0;i<NUM_ACTIONS;i++)
+      printf("  %s %li",action_names[i],action_counts[i]);
+   printf("\n");
+   printf("sent      %8li msgs (%.0f/s) %li bytes (%.1f KB/s)\n",counts.msgs_out,
+          counts.msgs_out/now,counts.bytes_out,counts.bytes_out/now/1024.0);
+   printf("received  %8li msgs (%.0f/s) %li bytes (%.1f KB/s)\n",counts.msgs_in,
+          counts.msgs_in/now,counts.bytes_in,counts.bytes_in/now/1024.0);
+   printf("resyncs %li  login failures %li  disconnects %li\n",
+          counts.resyncs,counts.login_failures,counts.disconnects);
+   PrintLatency("login",&login_latency);
+   PrintLatency("enter",&enter_latency);
+   PrintLatency("action",&action_latency);
+
+   for (i=0;i<num_bots;i++)
+      if (bots[i].fd >= 0)
+         close(bots[i].fd);
+   return 0;
+}
@@ -14,6 +14,11 @@
   file is maintained.  When each .bof file is loaded, the classes and
   message handlers are created by class.c and message.c.  The format of
   the .bof files is in bof.txt.
+
+  The classes and message handlers point straight into the mapping, which
+  is read only, so the code pages are shared between server processes and
+  only read in when they're first run.  If MapBofs is off, or a file can't
+  be mapped, it's read into memory instead.
   
 */
 
@@ -30,7 +35,8 @@ loaded_bof_node *mem_files;
 
 /* local function prototypes */
 Bool LoadBofName(char *fname);
-void AddFileMem(char *fname,char *ptr,int size);
+void FreeBofMem(char *ptr,int size,Bool mapped);
+void AddFileMem(char *fname,char *ptr,int size,Bool mapped);
 void FindClasses(char *fmem,char *fname);
 void FindMessages(char *fmem,int class_id,bof_dispatch *dispatch);
 
@@ -39,7 +45,12 @@ void InitLoadBof(void)
 	mem_files = NULL;
 }
 
-void LoadBof(void)
+/* MoveNewBofFiles
+*
+* Newly compiled .bof files are dropped in PATH_BOF, and we move them over
+* the ones in PATH_MEMMAP, which is where we load them from.
+*/
+void MoveNewBofFiles(void)
 {
 	char file_load_path[MAX_PATH+FILENAME_MAX];
 	char file_copy_path[MAX_PATH+FILENAME_MAX];
@@ -62,9 +73,20 @@ void LoadBof(void)
 	if (!files.empty())
 	dprintf("LoadBof moved in %i of %i found new .bof files\n",files_loaded,files.size());
 	*/
+}
+
+void LoadBof(void)
+{
+	char file_load_path[MAX_PATH+FILENAME_MAX];
+	
+	int files_loaded = 0;
+	
+	StringVector files;
+
+	/* StartPreload has usually done this already */
+	MoveNewBofFiles();
 
 	//dprintf("starting to load bof files\n");
-	files_loaded = 0;
 	
 	if (FindMatchingFiles(ConfigStr(PATH_MEMMAP), BOF_EXTENSION, &files))
 	{
@@ -86,6 +108,40 @@ void LoadBof(void)
 	//dprintf("LoadBof loaded %i of %i found .bof files\n",files_loaded,files.size());
 }
 
+/* GetBofStats
+*
+* Counts the loaded .bof files, and how much of the mapped ones is
+* actually in memory.
+*/
+void GetBofStats(bof_statistics *bstat)
+{
+	loaded_bof_node *lf;
+	INT64 resident;
+
+	memset(bstat,0,sizeof(bof_statistics));
+
+	for (lf = mem_files; lf != NULL; lf = lf->next)
+	{
+		if (!lf->mapped)
+		{
+			bstat->num_read++;
+			bstat->read_bytes += lf->length;
+			continue;
+		}
+
+		bstat->num_mapped++;
+		bstat->mapped_bytes += lf->length;
+		if (bstat->resident_bytes >= 0)
+		{
+			resident = MappedResidentBytes(lf->mem,lf->length);
+			if (resident < 0)
+				bstat->resident_bytes = -1;
+			else
+				bstat->resident_bytes += resident;
+		}
+	}
+}
+
 void ResetLoadBof(void)
 { 
 	loaded_bof_node *lf,*temp;
@@ -95,7 +151,7 @@ void ResetLoadBof(void)
 	{
 		temp = lf->next;
 		
-		FreeMemory(MALLOC_ID_LOADBOF,lf->mem,lf->length);
+		FreeBofMem(lf->mem,lf->length,lf->mapped);
 		
 		FreeMemory(MALLOC_ID_LOADBOF,lf,sizeof(loaded_bof_node));
 		lf = temp;
@@ -105,55 +161,50 @@ void ResetLoadBof(void)
 
 Bool LoadBofName(char *fname)
 {
-   FILE *f = fopen(fname, "rb");
-	if (f == NULL)
+   char *ptr;
+   int file_size;
+   Bool mapped;
+
+   mapped = ConfigBool(BLAKOD_MAP_BOFS) && MapFile(fname, &ptr, &file_size);
+
+   // Otherwise a preload thread has usually read the whole file in already.
+   if (!mapped && !PreloadFile(fname, MALLOC_ID_LOADBOF, &ptr, &file_size))
    {
       eprintf("LoadBofName can't open %s\n", fname);
 		return False;
    }
 
-   for (int i = 0; i < BOF_MAGIC_LEN; ++i)
+   if (file_size < (int) BOF_MAGIC_LEN + 4 ||
+       memcmp(ptr, magic_num, BOF_MAGIC_LEN) != 0)
    {
-      unsigned char c;
-      if (fread(&c, 1, 1, f) != 1 || c != magic_num[i])
-      {
-         eprintf("LoadBofName %s is not in BOF format\n", fname);
-         fclose(f);
-         return False;
-      }
+      eprintf("LoadBofName %s is not in BOF format\n", fname);
+      FreeBofMem(ptr, file_size, mapped);
+      return False;
    }
    
-   int version;
-   if (fread(&version, 1, 4, f) != 4 || version != 5)
+   int version = *(int *) (ptr + BOF_MAGIC_LEN);
+   if (version != 5)
 	{
 		eprintf("LoadBofName %s can't understand bof version != 5\n",fname);
-      fclose(f);
+      FreeBofMem(ptr, file_size, mapped);
 		return False;
 	}
-   
-   // Go back to start of file and read the whole thing into memory.
-   fseek(f, 0, SEEK_SET);
-   
-   struct stat st;
-   stat(fname, &st);
-   int file_size = st.st_size;
-
-	char *ptr = (char *)AllocateMemory(MALLOC_ID_LOADBOF,file_size);
-   if (fread(ptr, 1, file_size, f) != file_size)
-   {
-      fclose(f);
-      return False;
-   }
 
-   fclose(f);
-
-	AddFileMem(fname,ptr,file_size);
+	AddFileMem(fname,ptr,file_size,mapped);
 	
 	return True;
 }
 
+void FreeBofMem(char *ptr,int size,Bool mapped)
+{
+	if (mapped)
+		UnmapFile(ptr,size);
+	else
+		FreeFileMemory(MALLOC_ID_LOADBOF,ptr,size);
+}
+
 /* add a filename and mapped ptr to the list of loaded files */
-void AddFileMem(char *fname,char *ptr,int size)
+void AddFileMem(char *fname,char *ptr,int size,Bool mapped)
 {
 	loaded_bof_node *lf;
 	
@@ -162,6 +213,7 @@ void AddFileMem(char *fname,char *ptr,int size)
 	strcpy(lf->fname,fname);
 	lf->mem = ptr;
 	lf->length = size;
+	lf->mapped = mapped;
 	
 	/* we store the fname so the class structures can point to it, but kill the path */
 	
@@ -18,12 +18,24 @@ typedef struct loaded_bof_struct
    char fname[MAX_PATH+FILENAME_MAX];
    char *mem;
    int length;
+   Bool mapped; /* mem is a read only mapping of the file, not a copy */
    struct loaded_bof_struct *next;
 } loaded_bof_node;
 
+typedef struct
+{
+   int num_mapped;
+   INT64 mapped_bytes;
+   INT64 resident_bytes; /* of the mapped bytes; -1 if unknown */
+   int num_read;
+   INT64 read_bytes;
+} bof_statistics;
+
 void InitLoadBof(void);
 void ResetLoadBof(void);
 void LoadBof(void);
+void MoveNewBofFiles(void);
+void GetBofStats(bof_statistics *bstat);
 void CloseAllFiles(void);
 
 #endif
@@ -26,6 +26,8 @@ Bool LoadDynamicRscName(char *filename);
 void LoadRsc(void)
 {
 	char file_load_path[MAX_PATH+FILENAME_MAX];
+	char *mem;
+	int length;
 	
 	int files_loaded = 0;
 	StringVector files;
@@ -35,10 +37,18 @@ void LoadRsc(void)
 		{
 			sprintf(file_load_path,"%s%s",ConfigStr(PATH_RSC), it->c_str());
 			
-			if (RscFileLoad(file_load_path,EachLoadRsc))
+			if (!PreloadFile(file_load_path,MALLOC_ID_RESOURCE,&mem,&length))
+			{
+				eprintf("LoadRsc error reading %s\n", it->c_str());
+				continue;
+			}
+
+			if (RscMemoryLoad(file_load_path,mem,length,EachLoadRsc))
 				files_loaded++;
 			else
 				eprintf("LoadRsc error loading %s\n", it->c_str());
+
+			FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 		}
 	}
 	
@@ -62,27 +72,33 @@ void LoadDynamicRsc(char *filename)
 
 Bool LoadDynamicRscName(char *filename)
 {
-	FILE *fh = fopen(filename,"rb");
+	char *mem,*ptr,*end;
+	int length;
    int magic_num;
    int version;
    unsigned int num_resources;
 	unsigned int i;
 	
-	if (fh == NULL)
+	if (!PreloadFile(filename,MALLOC_ID_RESOURCE,&mem,&length))
 		return False;
 
-	fread(&magic_num,4,1,fh);
-	fread(&version,4,1,fh);
-	fread(&num_resources,4,1,fh);
-	if (ferror(fh) || feof(fh))
+	ptr = mem;
+	end = mem + length;
+
+	if (length < 12)
 	{
-		fclose(fh);
+		FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 		return False;
 	}
+	memcpy(&magic_num,ptr,4);
+	memcpy(&version,ptr+4,4);
+	memcpy(&num_resources,ptr+8,4);
+	ptr += 12;
 
 	if (version != 1)
 	{
 		eprintf("LoadDynamicRscName can't understand rsc version != 1\n");
+		FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 		return False;
 	}
 
@@ -93,36 +109,38 @@ Bool LoadDynamicRscName(char *filename)
 		unsigned int len_data;
 		char resource_value[500];
 
-		fread(&resource_id,4,1,fh);
-		fread(&resource_type,4,1,fh);
-		fread(&len_data,4,1,fh);
-
-		if (ferror(fh) || feof(fh))
+		if (end - ptr < 12)
 		{
-			fclose(fh);
+			FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 			return False;
 		}
+		memcpy(&resource_id,ptr,4);
+		memcpy(&resource_type,ptr+4,4);
+		memcpy(&len_data,ptr+8,4);
+		ptr += 12;
 
 		if (len_data > sizeof(resource_value)-1)
 		{
 			eprintf("LoadDynamicRscName got invalid long dynamic resource %u\n",
 					  len_data);
+			FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 			return False;
 		}
 
-		fread(&resource_value,len_data,1,fh);
-
-		if (ferror(fh) || feof(fh))
+		if ((unsigned int)(end - ptr) < len_data)
 		{
-			fclose(fh);
+			FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 			return False;
 		}
+		memcpy(resource_value,ptr,len_data);
+		ptr += len_data;
+
 		resource_value[len_data] = '\0'; // null-terminate string
 		//dprintf("got %u %s\n",resource_id,resource_value);
 		AddResource(resource_id,resource_value);
 	}
 
-	fclose(fh);
+	FreeFileMemory(MALLOC_ID_RESOURCE,mem,length);
 	return True;
 }
 
@@ -11,7 +11,7 @@
 
  This module loads in the string database file and tells string.c each
  string it finds.  The format of the strings.sav file, which is a
- binary file, is not documented?
+ binary file, is described in savestr.c.
 
  */
 
@@ -19,43 +19,80 @@
 
 Bool LoadBlakodStrings(char *filename)
 {
-   FILE *f;
+   char *mem,*ptr,*end;
+   int length;
+   string_statistics stats;
    
-   int i,version,num_strs,len_str,str_id;
+   int i,version,num_strs,len_str,str_id,num_shared;
 
-   f = fopen(filename, "rb");
-   if (f == NULL)
+   if (!PreloadFile(filename, MALLOC_ID_STRING, &mem, &length))
    {
       eprintf("LoadBlakodStrings can't open %s to load the strings, none loaded\n",
               filename);
       return False;
    }
+
+   ptr = mem;
+   end = mem + length;
    
-   if (fread(&version, 1, LEN_STR_VERSION, f) != LEN_STR_VERSION ||
-       fread(&num_strs, 1, LEN_NUM_STRS, f) != LEN_NUM_STRS)
+   if (end - ptr < LEN_STR_VERSION + LEN_NUM_STRS)
    {
-      fclose(f);
+      FreeFileMemory(MALLOC_ID_STRING, mem, length);
       return False;
    }
-   
+   memcpy(&version, ptr, LEN_STR_VERSION);
+   ptr += LEN_STR_VERSION;
+   memcpy(&num_strs, ptr, LEN_NUM_STRS);
+   ptr += LEN_NUM_STRS;
+
+   if (version < 1 || version > STR_SAVE_VERSION)
+   {
+      eprintf("LoadBlakodStrings can't load version %i strings from %s\n",
+              version,filename);
+      FreeFileMemory(MALLOC_ID_STRING, mem, length);
+      return False;
+   }
+
+   num_shared = 0;
    for (i=0;i<num_strs;i++)
    {
-      if (fread(&str_id, 1, LEN_STR_ID, f) != LEN_STR_ID ||
-          fread(&len_str, 1, LEN_STR_LEN, f) != LEN_STR_LEN)
+      if (end - ptr < LEN_STR_ID + LEN_STR_LEN)
       {
-         fclose(f);
+         FreeFileMemory(MALLOC_ID_STRING, mem, length);
          return False;
       }
-      
-      if (!LoadBlakodString(f,len_str,str_id))
+      memcpy(&str_id, ptr, LEN_STR_ID);
+      ptr += LEN_STR_ID;
+      memcpy(&len_str, ptr, LEN_STR_LEN);
+      ptr += LEN_STR_LEN;
+
+      /* a negative length means the same text as an earlier string */
+      if (len_str < 0)
+      {
+         if (!LoadSharedBlakodString(str_id,-1 - len_str))
+         {
+            FreeFileMemory(MALLOC_ID_STRING, mem, length);
+            return False;
+         }
+         num_shared++;
+         continue;
+      }
+
+      if (end - ptr < len_str ||
+          !LoadBlakodString(ptr,len_str,str_id))
       {
-         fclose(f);
+         FreeFileMemory(MALLOC_ID_STRING, mem, length);
          return False;
       }
+      ptr += len_str;
    }
 
-   fclose(f);
+   FreeFileMemory(MALLOC_ID_STRING, mem, length);
+
+   GetStringStats(&stats);
+   lprintf("LoadBlakodStrings loaded %i strings (%i saved shared), %i distinct, %lli of %lli bytes stored\n",
+           num_strs,num_shared,stats.num_bodies,(long long)stats.body_bytes,
+           (long long)stats.text_bytes);
 
    return True;
 }
-
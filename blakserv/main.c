@@ -97,14 +97,21 @@ void MainServer()
 	InitBkodInterpret();
 	InitBufferPool();
 	InitTable();
+	InitBlock();
 	AddBuiltInDLlist();
 	
 	LoadMotd();
+
+	/* worker threads read the files while we link them */
+	StartPreload(True);
 	LoadBof();
+	LoadPhaseDone("bof");
 	LoadRsc();
+	LoadPhaseDone("rsc");
 	LoadKodbase();
 	
 	LoadAdminConstants();
+	LoadPhaseDone("kodbase");
 	
 	PauseTimers();
 	
@@ -116,6 +123,7 @@ void MainServer()
 		SendTopLevelBlakodMessage(GetSystemObjectID(),LOADED_GAME_MSG,0,NULL);
 		DoneLoadAccounts();
 	}
+	EndPreload();
 	
 	/* these must be after LoadAll and ClearList */
 	InitCommCli(); 
@@ -155,6 +163,7 @@ void MainExitServer()
 	ExitAsyncConnections();
 	
 	CloseAllSessions(); /* gotta do this before anything, cause it uses kod, accounts */
+	StopRecording();
 	
 	CloseDefaultChannels();
 	
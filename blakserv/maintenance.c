@@ -47,7 +47,7 @@ void MaintenanceProcessSessionBuffer(session_node *s)
 
    SetSessionTimer(s,ConfigInt(INACTIVE_MAINTENANCE));
 
-   while (s->receive_list != NULL)
+   while (GetSessionReadBytes(s) > 0)
    {
       if (ReadSessionBytes(s,1,&ch) == False)
           return;
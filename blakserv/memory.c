@@ -196,7 +196,8 @@ const char *memory_stat_names[] =
 		"List", "Object properties",
 		"Configuration", "Rooms",
 		"Admin constants", "Buffers", "Game loading",
-		"Tables", "Socket blocks",
+		"Tables", "Socket blocks", "Game saving",
+		"Garbage collection", "Census",
 		
 		NULL
 };
@@ -260,7 +261,8 @@ void * AllocateMemoryDebug(int malloc_id,int size,const char *filename,int linen
 	if (malloc_id < 0 || malloc_id >= MALLOC_ID_NUM)
 		eprintf("AllocateMemory allocating memory of unknown type %i\n",malloc_id);
 	else
-		memory_stat.allocated[malloc_id] += size;
+		/* preload threads allocate too */
+		InterlockedExchangeAdd((LONG *)&memory_stat.allocated[malloc_id],size);
 #ifndef NMEMDEBUG
 
 
@@ -300,7 +302,7 @@ void FreeMemoryX(int malloc_id,void **ptr,int size)
 	if (malloc_id < 0 || malloc_id >= MALLOC_ID_NUM)
 		eprintf("FreeMemory freeing memory of unknown type %i\n",malloc_id);
 	else
-		memory_stat.allocated[malloc_id] -= size;
+		InterlockedExchangeAdd((LONG *)&memory_stat.allocated[malloc_id],-size);
 	
 #ifndef NMEMDEBUG
 	FreeCHK(*ptr);
@@ -322,7 +324,7 @@ void * ResizeMemory(int malloc_id,void *ptr,int old_size,int new_size)
 	if (malloc_id < 0 || malloc_id >= MALLOC_ID_NUM)
 		eprintf("ResizeMemory resizing memory of unknown type %i\n",malloc_id);
 	else
-		memory_stat.allocated[malloc_id] += new_size-old_size;
+		InterlockedExchangeAdd((LONG *)&memory_stat.allocated[malloc_id],new_size-old_size);
 
 #ifndef NMEMDEBUG
 	return ReallocCHK(malloc_id,ptr,new_size,old_size);
@@ -23,7 +23,8 @@ enum
    MALLOC_ID_LIST, MALLOC_ID_OBJECT_PROPERTIES,
    MALLOC_ID_CONFIG, MALLOC_ID_ROOM,
    MALLOC_ID_ADMIN_CONSTANTS, MALLOC_ID_BUFFER, MALLOC_ID_LOAD_GAME,
-   MALLOC_ID_TABLE, MALLOC_ID_BLOCK,
+   MALLOC_ID_TABLE, MALLOC_ID_BLOCK, MALLOC_ID_SAVE_GAME,
+   MALLOC_ID_GARBAGE, MALLOC_ID_CENSUS,
    
    MALLOC_ID_NUM
 };
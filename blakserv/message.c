@@ -15,6 +15,13 @@
  The table is in the same order as the table in the .bof file.  Linear
  searches are performed to find messages.
 
+ Each handler's bkod starts with a table of its parameters and their
+ default values.  AddMessage reads it once, so the interpreter can bind
+ parameters without decoding it on every call: the defaults are already
+ expanded to in-memory values, and the parameters are sorted by id
+ (blakcomp sorts them, but an old .bof might not) so they can be merged
+ with the sorted parameters of a send.
+
  */
 
 #include "blakserv.h"
@@ -22,6 +29,8 @@
 /* local function prototypes */
 void ResetMessageClass(class_node *c);
 void SetEachClassMessagesPropagate(class_node *c);
+void SetMessageParms(message_node *m);
+void FreeMessageParms(message_node *m);
 
 void InitMessage()
 {
@@ -30,14 +39,23 @@ void InitMessage()
 
 void ResetMessage()
 {
+   /* the inline caches point at the messages, and allocation sites
+      into the .bof */
+   ResetSendCache();
+   ResetCensus();
+   ResetPostCoalescing();
    ForEachClass(ResetMessageClass);
 }
 
 void ResetMessageClass(class_node *c)
 {
+   int i;
+
    if (c->num_messages == 0)
       return;
 
+   for (i=0;i<c->num_messages;i++)
+      FreeMessageParms(&c->messages[i]);
    FreeMemory(MALLOC_ID_MESSAGE,c->messages,c->num_messages*sizeof(message_node));
    c->messages = NULL;
    c->num_messages = 0;
@@ -66,6 +84,11 @@ void SetClassNumMessages(int class_id,int num_messages)
    {
       c->messages[i].message_id = 0;
       c->messages[i].handler = 0;
+      c->messages[i].code = 0;
+      c->messages[i].num_locals = 0;
+      c->messages[i].num_parms = 0;
+      c->messages[i].parms = NULL;
+      c->messages[i].parm_defaults = NULL;
       c->messages[i].dstr_id = INVALID_DSTR;
       c->messages[i].trace_session_id = INVALID_ID;
       c->messages[i].called_count = 0;
@@ -92,6 +115,64 @@ void AddMessage(int class_id,int count,int message_id,char *offset,int dstr_id)
    c->messages[count].dstr_id = dstr_id;
    c->messages[count].trace_session_id = INVALID_ID;
    c->messages[count].called_count = 0;
+   SetMessageParms(&c->messages[count]);
+}
+
+/* SetMessageParms
+*
+* Reads the handler's header: a byte with the number of locals, a byte
+* with the number of parameters, then an id and a 32 bit default value
+* for each parameter.
+*/
+void SetMessageParms(message_node *m)
+{
+   char *ptr;
+   int i,j,parm_default;
+   message_parm_type parm;
+
+   ptr = m->handler;
+   m->num_locals = (unsigned char)*ptr++;
+   m->num_parms = (unsigned char)*ptr++;
+   if (m->num_parms == 0)
+   {
+      m->code = ptr;
+      return;
+   }
+
+   m->parms = (message_parm_type *)
+      AllocateMemory(MALLOC_ID_MESSAGE,m->num_parms*sizeof(message_parm_type));
+   m->parm_defaults = (val_type *)
+      AllocateMemory(MALLOC_ID_MESSAGE,m->num_parms*sizeof(val_type));
+
+   for (i=0;i<m->num_parms;i++)
+   {
+      memcpy(&parm.parm_id,ptr,4);
+      memcpy(&parm_default,ptr+4,4);
+      ptr += 8;
+
+      parm.slot = i;
+      m->parm_defaults[i].int_val = val32to64(parm_default);
+
+      /* insertion sort, which only compares once per parameter when the
+	 compiler already sorted them */
+      for (j=i;j>0 && m->parms[j-1].parm_id > parm.parm_id;j--)
+	 m->parms[j] = m->parms[j-1];
+      m->parms[j] = parm;
+   }
+
+   m->code = ptr;
+}
+
+void FreeMessageParms(message_node *m)
+{
+   if (m->num_parms == 0)
+      return;
+
+   FreeMemory(MALLOC_ID_MESSAGE,m->parms,m->num_parms*sizeof(message_parm_type));
+   FreeMemory(MALLOC_ID_MESSAGE,m->parm_defaults,m->num_parms*sizeof(val_type));
+   m->parms = NULL;
+   m->parm_defaults = NULL;
+   m->num_parms = 0;
 }
 
 /* SetMessagesPropagate
@@ -13,10 +13,22 @@
 #ifndef _MESSAGE_H
 #define _MESSAGE_H
 
+/* one of a handler's parameters, from the table at the start of its bkod */
+typedef struct
+{
+   int parm_id;
+   int slot;			/* local variable the parameter is bound to */
+} message_parm_type;
+
 typedef struct message_struct
 {
    int message_id;
    char *handler;
+   char *code;			/* bkod past the handler's parameter table */
+   int num_locals;
+   int num_parms;
+   message_parm_type *parms;	/* sorted by parm_id */
+   val_type *parm_defaults;	/* by slot */
    int dstr_id;
    int trace_session_id;
    int called_count;
@@ -0,0 +1,225 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * metrics.c
+ *
+
+ This module keeps counters and histograms of how the server is doing,
+ and writes them out in the Prometheus text format for a scraper to
+ read from the MetricsPort.  The counters and histograms are added to
+ with interlocked adds, so the network threads can count what they
+ send and receive without taking a lock.  They only ever go up; the
+ scraper works out packets and bytes per second from the difference
+ between two scrapes.  The rest (sessions, objects, queue depths and
+ so on) are read from the other modules when the response is built,
+ which must be done holding the server lock.
+
+ A histogram's buckets are in microseconds here, and written out in
+ seconds.
+
+ */
+
+#include "blakserv.h"
+
+#define NUM_METRIC_BUCKETS 14
+
+static const INT64 metric_bucket_bounds[NUM_METRIC_BUCKETS] =
+{
+   100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+   100000, 250000, 500000, 1000000, 5000000
+};
+
+typedef struct
+{
+   volatile INT64 sum; /* microseconds */
+   volatile INT64 buckets[NUM_METRIC_BUCKETS+1]; /* the last is for anything longer */
+} metric_histogram;
+
+typedef struct
+{
+   const char *name;
+   const char *help;
+} metric_name;
+
+static volatile INT64 metric_counts[NUM_METRIC_COUNTERS];
+static metric_histogram metric_histograms[NUM_METRIC_HISTOGRAMS];
+
+static const metric_name metric_counter_names[NUM_METRIC_COUNTERS] =
+{
+   { "blakserv_received_bytes_total", "Bytes read from sessions' sockets." },
+   { "blakserv_sent_bytes_total", "Bytes written to sessions' sockets." },
+   { "blakserv_received_messages_total", "Messages from clients in the game." },
+   { "blakserv_sent_messages_total", "Messages sent to clients in the game." },
+   { "blakserv_connections_total", "Connections accepted on the game and maintenance ports." },
+   { "blakserv_scrapes_total", "Requests answered on the metrics port." },
+};
+
+static const metric_name metric_histogram_names[NUM_METRIC_HISTOGRAMS] =
+{
+   { "blakserv_main_loop_seconds", "Time the main loop spent on each pass, not counting the wait." },
+   { "blakserv_top_level_message_seconds", "Time each top level Blakod message took, with its posts." },
+   { "blakserv_garbage_collect_seconds", "Time the game was stopped for each garbage collection." },
+   { "blakserv_save_seconds", "Time the game was stopped for each save." },
+};
+
+static char metrics_body[METRICS_RESPONSE_SIZE];
+static char metrics_response[METRICS_RESPONSE_SIZE+200];
+static int len_metrics_body;
+
+/* local function prototypes */
+static void MetricsPrintf(const char *fmt,...);
+static void MetricsGauge(const char *name,const char *help,INT64 value);
+static void MetricsCounter(const char *name,const char *help,INT64 value);
+static void MetricsHistogram(const metric_name *m,metric_histogram *h);
+
+void CountMetric(int counter,INT64 n)
+{
+   if (counter < 0 || counter >= NUM_METRIC_COUNTERS)
+      return;
+
+   InterlockedExchangeAdd64(&metric_counts[counter],n);
+}
+
+void ObserveMetric(int histogram,INT64 microseconds)
+{
+   metric_histogram *h;
+   int i;
+
+   if (histogram < 0 || histogram >= NUM_METRIC_HISTOGRAMS)
+      return;
+
+   h = &metric_histograms[histogram];
+   for (i=0;i<NUM_METRIC_BUCKETS;i++)
+      if (microseconds <= metric_bucket_bounds[i])
+	 break;
+
+   InterlockedExchangeAdd64(&h->buckets[i],1);
+   InterlockedExchangeAdd64(&h->sum,microseconds);
+}
+
+INT64 GetMetricCount(int counter)
+{
+   if (counter < 0 || counter >= NUM_METRIC_COUNTERS)
+      return 0;
+
+   return metric_counts[counter];
+}
+
+static void MetricsPrintf(const char *fmt,...)
+{
+   va_list marker;
+   int len;
+
+   if (len_metrics_body >= METRICS_RESPONSE_SIZE - 1)
+      return;
+
+   va_start(marker,fmt);
+   len = vsnprintf(metrics_body + len_metrics_body,METRICS_RESPONSE_SIZE - len_metrics_body,fmt,marker);
+   va_end(marker);
+
+   if (len < 0)
+      return;
+
+   len_metrics_body += len;
+   if (len_metrics_body > METRICS_RESPONSE_SIZE - 1)
+      len_metrics_body = METRICS_RESPONSE_SIZE - 1; /* cut off */
+}
+
+static void MetricsGauge(const char *name,const char *help,INT64 value)
+{
+   MetricsPrintf("# HELP %s %s\n# TYPE %s gauge\n%s %lli\n",name,help,name,name,(long long)value);
+}
+
+static void MetricsCounter(const char *name,const char *help,INT64 value)
+{
+   MetricsPrintf("# HELP %s %s\n# TYPE %s counter\n%s %lli\n",name,help,name,name,(long long)value);
+}
+
+/* MetricsHistogram
+*
+* The buckets are each read once, so the +Inf bucket and the count agree
+* even if another thread adds to them while we're here.
+*/
+static void MetricsHistogram(const metric_name *m,metric_histogram *h)
+{
+   INT64 count;
+   int i;
+
+   MetricsPrintf("# HELP %s %s\n# TYPE %s histogram\n",m->name,m->help,m->name);
+
+   count = 0;
+   for (i=0;i<NUM_METRIC_BUCKETS;i++)
+   {
+      count += h->buckets[i];
+      MetricsPrintf("%s_bucket{le=\"%g\"} %lli\n",m->name,
+		    metric_bucket_bounds[i]/1000000.0,(long long)count);
+   }
+   count += h->buckets[NUM_METRIC_BUCKETS];
+   MetricsPrintf("%s_bucket{le=\"+Inf\"} %lli\n",m->name,(long long)count);
+   MetricsPrintf("%s_sum %.6f\n",m->name,h->sum/1000000.0);
+   MetricsPrintf("%s_count %lli\n",m->name,(long long)count);
+}
+
+/* BuildMetricsResponse
+*
+* Call holding the server lock.  Sets *response to a whole HTTP response
+* for a scrape, good until the next call, and returns its length.
+*/
+int BuildMetricsResponse(char **response)
+{
+   kod_statistics *kstat;
+   timer_statistics tstat;
+   garbage_statistics gstat;
+   post_queue_statistics pstat;
+   int i,len;
+
+   CountMetric(METRIC_SCRAPES,1);
+
+   kstat = GetKodStats();
+   GetTimerStats(&tstat);
+   GetGarbageStats(&gstat);
+   GetPostQueueStats(&pstat);
+
+   len_metrics_body = 0;
+
+   for (i=0;i<NUM_METRIC_COUNTERS;i++)
+      MetricsCounter(metric_counter_names[i].name,metric_counter_names[i].help,metric_counts[i]);
+
+   for (i=0;i<NUM_METRIC_HISTOGRAMS;i++)
+      MetricsHistogram(&metric_histogram_names[i],&metric_histograms[i]);
+
+   MetricsCounter("blakserv_instructions_total","Blakod instructions interpreted.",
+		  (INT64)kstat->billions_interpreted*1000000000 + kstat->num_interpreted);
+   MetricsCounter("blakserv_top_level_messages_total","Top level Blakod messages sent.",
+		  kstat->num_top_level_messages);
+   MetricsCounter("blakserv_timers_fired_total","Blakod timers that have gone off.",
+		  tstat.num_fired);
+   MetricsCounter("blakserv_garbage_collections_total","Garbage collections done.",
+		  gstat.num_collections);
+
+   MetricsGauge("blakserv_uptime_seconds","Seconds since the server started.",
+		GetTime() - kstat->system_start_time);
+   MetricsGauge("blakserv_sessions","Sessions logged on.",GetUsedSessions());
+   MetricsGauge("blakserv_objects","Objects in use.",GetObjectsUsed());
+   MetricsGauge("blakserv_list_nodes","List nodes in use.",GetListNodesUsed());
+   MetricsGauge("blakserv_strings","Strings in use.",GetStringsUsed());
+   MetricsGauge("blakserv_timers","Blakod timers waiting to go off.",GetNumActiveTimers());
+   MetricsGauge("blakserv_post_queue_depth","Posted messages waiting to be sent.",pstat.num_pending);
+   MetricsGauge("blakserv_memory_bytes","Bytes allocated through the memory module.",GetMemoryTotal());
+
+   len = snprintf(metrics_response,sizeof(metrics_response),
+		  "HTTP/1.0 200 OK\r\n"
+		  "Content-Type: text/plain; version=0.0.4\r\n"
+		  "Content-Length: %i\r\n"
+		  "Connection: close\r\n"
+		  "\r\n",len_metrics_body);
+   memcpy(metrics_response + len,metrics_body,len_metrics_body);
+
+   *response = metrics_response;
+   return len + len_metrics_body;
+}
@@ -0,0 +1,40 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * metrics.h
+ *
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#define MAX_METRICS_SOCKETS 16
+#define METRICS_SOCKET_TIMEOUT 5000 /* ms to wait for a scraper's request */
+#define METRICS_RESPONSE_SIZE 16384
+
+enum
+{
+   METRIC_BYTES_RECEIVED, METRIC_BYTES_SENT,
+   METRIC_MESSAGES_RECEIVED, METRIC_MESSAGES_SENT,
+   METRIC_CONNECTIONS, METRIC_SCRAPES,
+   NUM_METRIC_COUNTERS
+};
+
+enum
+{
+   METRIC_MAIN_LOOP, METRIC_TOP_LEVEL_MESSAGE, METRIC_GARBAGE_COLLECT, METRIC_SAVE,
+   NUM_METRIC_HISTOGRAMS
+};
+
+void CountMetric(int counter,INT64 n);
+void ObserveMetric(int histogram,INT64 microseconds);
+INT64 GetMetricCount(int counter);
+
+int BuildMetricsResponse(char **response);
+
+#endif
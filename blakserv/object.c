@@ -12,45 +12,109 @@
  This module maintains a dynamically sized array with the Blakod
  objects. 
 
+ Slots of deleted objects are kept on a free list and handed out again
+ by AllocateObject, so the array doesn't have to wait for a full
+ renumbering garbage collection to stop growing.  A client may still
+ send us the id of an object that was just deleted, so its slot is held
+ back until ReleaseFreeObjects() is called by ReclaimObjects(), which
+ runs inside a garbage collection system event that has clients
+ reacquire the ids they know, right after a NewEpoch() that makes the
+ server ignore messages sent before it.  Every allocation
+ stamps the slot with a new generation number, which things that hold
+ on to an object id outside of Blakod (like timers) can remember and
+ check, to catch references to an object that has since been replaced.
+
+ Property arrays come out of pools, one per property count, carved out
+ of larger blocks.  Freed arrays go back on their pool's free list, and
+ the blocks themselves are only released by ResetObject/ClearObject.
+
+ Each class also keeps the ids of its live instances (see class.h), so
+ sending a message to every object of a class, or counting them for
+ the administrator, only touches those objects instead of the whole
+ array.  The sets are changed when an object is allocated, deleted or
+ moved by the garbage collector, and emptied along with the array.
+
  */
 
 #include "blakserv.h"
 
+/* bytes of property arrays to carve out of the heap at once for a pool */
+#define PROP_POOL_BLOCK_SIZE 16384
+
+typedef struct prop_block_struct
+{
+   int size;
+   struct prop_block_struct *next;
+} prop_block;
+
+typedef struct
+{
+   prop_type *free_list; /* linked through the first bytes of each free array */
+   int num_free;
+   int num_used;
+   prop_block *blocks;
+} prop_pool;
+
 object_node *objects;
 int num_objects,max_objects;
 
+static int num_live_objects;
+static unsigned int next_generation;
+
+/* slots of deleted objects; the first num_reusable_objects of them were
+   deleted before the last epoch and can be handed out again */
+static int *free_objects;
+static int num_free_objects,max_free_objects;
+static int num_reusable_objects;
+static int num_reused_objects;
+static INT64 num_allocated_objects;
+
+static prop_pool *prop_pools;
+static int num_prop_pools;
+
 /* local function prototypes */
 void SetObjectProperties(int object_id,class_node *c);
+prop_type * AllocateProperties(int num_props);
+void FreeProperties(prop_type *p,int num_props);
+void FreePropertyPools(void);
+void ClearFreeObjects(void);
+void AddFreeObject(int object_id);
+void AddClassInstance(class_node *c,int object_id);
+void RemoveClassInstance(class_node *c,int object_id);
+void ClearClassInstances(class_node *c);
+void CopyClassInstancesUnsorted(class_node *c,int *ids,int *num_ids);
+int CompareObjectIDs(const void *a,const void *b);
 
 void InitObject()
 {
    num_objects = 0;
    max_objects = INIT_OBJECTS;
    objects = (object_node *)AllocateMemory(MALLOC_ID_OBJECT,max_objects*sizeof(object_node));
+
+   num_live_objects = 0;
+   next_generation = 1;
+
+   num_free_objects = 0;
+   max_free_objects = INIT_FREE_OBJECTS;
+   free_objects = (int *)AllocateMemory(MALLOC_ID_OBJECT,max_free_objects*sizeof(int));
+   num_reused_objects = 0;
+
+   num_prop_pools = 0;
+   prop_pools = NULL;
 }
 
 void ResetObject()
 {
-   int i,old_objects;
-   class_node *c;
+   int old_objects;
+
+   /* every property array lives in a pool block, so just drop the blocks */
+   FreePropertyPools();
+   ClearFreeObjects();
+   ForEachClass(ClearClassInstances);
 
-   for (i=0;i<num_objects;i++)
-   {
-      if (!objects[i].deleted)
-      {
-	 c = GetClassByID(objects[i].class_id);
-	 if (c == NULL)
-	 {
-	    eprintf("ResetObject can't find class id %i\n",objects[i].class_id);
-	    return;
-	 }
-
-	 FreeMemory(MALLOC_ID_OBJECT_PROPERTIES,objects[i].p,
-		    sizeof(prop_type)*(1+c->num_properties));
-      }
-   }
    old_objects = max_objects;
    num_objects = 0;  
+   num_live_objects = 0;
    max_objects = INIT_OBJECTS;
    objects = (object_node *)
       ResizeMemory(MALLOC_ID_OBJECT,objects,old_objects*sizeof(object_node),
@@ -66,8 +130,13 @@ void ClearObject()
 {
    int old_objects;
 
+   FreePropertyPools();
+   ClearFreeObjects();
+   ForEachClass(ClearClassInstances);
+
    old_objects = max_objects;
    num_objects = 0;
+   num_live_objects = 0;
    max_objects = INIT_OBJECTS;
    objects = (object_node *)
       ResizeMemory(MALLOC_ID_OBJECT,objects,old_objects*sizeof(object_node),
@@ -79,9 +148,261 @@ int GetObjectsUsed()
    return num_objects;
 }
 
-int AllocateObject(int class_id)
+int GetObjectsLive()
 {
-   int old_objects;
+   return num_live_objects;
+}
+
+void GetObjectStats(object_statistics *ostat)
+{
+   int i;
+
+   ostat->num_slots = num_objects;
+   ostat->max_slots = max_objects;
+   ostat->num_live = num_live_objects;
+   ostat->num_free = num_free_objects;
+   ostat->num_held = num_free_objects - num_reusable_objects;
+   ostat->num_reused = num_reused_objects;
+   ostat->num_allocated = num_allocated_objects;
+   ostat->num_prop_pools = 0;
+   ostat->prop_arrays_used = 0;
+   ostat->prop_arrays_free = 0;
+   ostat->prop_bytes_free = 0;
+
+   for (i=0;i<num_prop_pools;i++)
+   {
+      if (prop_pools[i].blocks == NULL)
+	 continue;
+      ostat->num_prop_pools++;
+      ostat->prop_arrays_used += prop_pools[i].num_used;
+      ostat->prop_arrays_free += prop_pools[i].num_free;
+      ostat->prop_bytes_free += prop_pools[i].num_free*i*sizeof(prop_type);
+   }
+}
+
+prop_type * AllocateProperties(int num_props)
+{
+   prop_pool *pool;
+   prop_block *b;
+   prop_type *p;
+   int i,old_pools,num_arrays;
+
+   if (num_props >= num_prop_pools)
+   {
+      old_pools = num_prop_pools;
+      num_prop_pools = std::max(num_props + 1,2*num_prop_pools);
+      if (prop_pools == NULL)
+	 prop_pools = (prop_pool *)
+	    AllocateMemory(MALLOC_ID_OBJECT,num_prop_pools*sizeof(prop_pool));
+      else
+	 prop_pools = (prop_pool *)
+	    ResizeMemory(MALLOC_ID_OBJECT,prop_pools,old_pools*sizeof(prop_pool),
+			 num_prop_pools*sizeof(prop_pool));
+      memset(&prop_pools[old_pools],0,(num_prop_pools - old_pools)*sizeof(prop_pool));
+   }
+
+   pool = &prop_pools[num_props];
+   if (pool->free_list == NULL)
+   {
+      num_arrays = std::max(1,(int)(PROP_POOL_BLOCK_SIZE/(num_props*sizeof(prop_type))));
+
+      b = (prop_block *)AllocateMemory(MALLOC_ID_OBJECT_PROPERTIES,
+				       sizeof(prop_block) + num_arrays*num_props*sizeof(prop_type));
+      b->size = sizeof(prop_block) + num_arrays*num_props*sizeof(prop_type);
+      b->next = pool->blocks;
+      pool->blocks = b;
+
+      p = (prop_type *)(b + 1);
+      for (i=num_arrays-1;i>=0;i--)
+      {
+	 *(prop_type **)&p[i*num_props] = pool->free_list;
+	 pool->free_list = &p[i*num_props];
+      }
+      pool->num_free += num_arrays;
+   }
+
+   p = pool->free_list;
+   pool->free_list = *(prop_type **)p;
+   pool->num_free--;
+   pool->num_used++;
+
+   return p;
+}
+
+void FreeProperties(prop_type *p,int num_props)
+{
+   prop_pool *pool;
+
+   if (num_props <= 0 || num_props >= num_prop_pools)
+   {
+      eprintf("FreeProperties got array of %i properties, which has no pool\n",num_props);
+      return;
+   }
+
+   pool = &prop_pools[num_props];
+   *(prop_type **)p = pool->free_list;
+   pool->free_list = p;
+   pool->num_free++;
+   pool->num_used--;
+}
+
+void FreePropertyPools()
+{
+   prop_block *b,*temp;
+   int i;
+
+   for (i=0;i<num_prop_pools;i++)
+   {
+      b = prop_pools[i].blocks;
+      while (b != NULL)
+      {
+	 temp = b->next;
+	 FreeMemory(MALLOC_ID_OBJECT_PROPERTIES,b,b->size);
+	 b = temp;
+      }
+   }
+
+   if (prop_pools != NULL)
+      FreeMemory(MALLOC_ID_OBJECT,prop_pools,num_prop_pools*sizeof(prop_pool));
+   prop_pools = NULL;
+   num_prop_pools = 0;
+}
+
+void ClearFreeObjects()
+{
+   num_free_objects = 0;
+   num_reusable_objects = 0;
+   num_reused_objects = 0;
+}
+
+void AddFreeObject(int object_id)
+{
+   int old_free;
+
+   if (num_free_objects == max_free_objects)
+   {
+      old_free = max_free_objects;
+      max_free_objects = max_free_objects * 2;
+      free_objects = (int *)
+	 ResizeMemory(MALLOC_ID_OBJECT,free_objects,old_free*sizeof(int),
+		      max_free_objects*sizeof(int));
+   }
+   free_objects[num_free_objects++] = object_id;
+}
+
+/* ReleaseFreeObjects
+*
+* Call after NewEpoch(), during a garbage collection system event, so
+* that no client can still name the objects deleted since the last one;
+* their slots can now be reused.
+*/
+void ReleaseFreeObjects()
+{
+   num_reusable_objects = num_free_objects;
+}
+
+int GetHeldFreeObjects()
+{
+   return num_free_objects - num_reusable_objects;
+}
+
+void AddClassInstance(class_node *c,int object_id)
+{
+   int old_instances;
+
+   if (c->num_instances == c->max_instances)
+   {
+      old_instances = c->max_instances;
+      c->max_instances = std::max(2*c->max_instances,16);
+      if (c->instances == NULL)
+	 c->instances = (int *)AllocateMemory(MALLOC_ID_CLASS,c->max_instances*sizeof(int));
+      else
+	 c->instances = (int *)
+	    ResizeMemory(MALLOC_ID_CLASS,c->instances,old_instances*sizeof(int),
+			 c->max_instances*sizeof(int));
+   }
+   objects[object_id].class_index = c->num_instances;
+   c->instances[c->num_instances++] = object_id;
+}
+
+/* RemoveClassInstance
+*
+* The last id in the set takes the place of the one going away.
+*/
+void RemoveClassInstance(class_node *c,int object_id)
+{
+   int index,last_id;
+
+   index = objects[object_id].class_index;
+   if (index < 0 || index >= c->num_instances || c->instances[index] != object_id)
+   {
+      eprintf("RemoveClassInstance can't find OBJECT %i in CLASS %s (%i)\n",
+	      object_id,c->class_name,c->class_id);
+      return;
+   }
+
+   last_id = c->instances[--c->num_instances];
+   c->instances[index] = last_id;
+   objects[last_id].class_index = index;
+}
+
+void ClearClassInstances(class_node *c)
+{
+   c->num_instances = 0;
+}
+
+/* GetClassInstanceCount
+*
+* How many live objects there are of class c, and of the classes below
+* it too if with_subclasses is set.
+*/
+int GetClassInstanceCount(class_node *c,Bool with_subclasses)
+{
+   class_node *sub;
+   int count;
+
+   count = c->num_instances;
+   if (with_subclasses)
+      for (sub=c->first_subclass;sub!=NULL;sub=sub->next_subclass)
+	 count += GetClassInstanceCount(sub,True);
+   return count;
+}
+
+void CopyClassInstancesUnsorted(class_node *c,int *ids,int *num_ids)
+{
+   class_node *sub;
+
+   memcpy(ids + *num_ids,c->instances,c->num_instances*sizeof(int));
+   *num_ids += c->num_instances;
+   for (sub=c->first_subclass;sub!=NULL;sub=sub->next_subclass)
+      CopyClassInstancesUnsorted(sub,ids,num_ids);
+}
+
+int CompareObjectIDs(const void *a,const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+/* CopyClassInstances
+*
+* Fills in ids with the live objects of class c and all its subclasses,
+* lowest id first, which is the order a walk of the whole array would
+* find them in.  ids must have room for GetClassInstanceCount(c,True) of
+* them; returns how many there were.
+*/
+int CopyClassInstances(class_node *c,int *ids)
+{
+   int num_ids;
+
+   num_ids = 0;
+   CopyClassInstancesUnsorted(c,ids,&num_ids);
+   qsort(ids,num_ids,sizeof(int),CompareObjectIDs);
+   return num_ids;
+}
+
+int AllocateObject(int class_id,Bool reuse_slot)
+{
+   int old_objects,object_id;
    class_node *c;
 
    c = GetClassByID(class_id);
@@ -91,22 +412,37 @@ int AllocateObject(int class_id)
       return INVALID_OBJECT;
    }
 
-   if (num_objects == max_objects)
+   if (reuse_slot && num_reusable_objects > 0)
    {
-      old_objects = max_objects;
-      max_objects = max_objects * 2;
-      objects = (object_node *)
-	 ResizeMemory(MALLOC_ID_OBJECT,objects,old_objects*sizeof(object_node),
-		      max_objects*sizeof(object_node));
-      lprintf("AllocateObject resized to %i objects\n",max_objects);
+      object_id = free_objects[--num_reusable_objects];
+      /* fill its place with the last one, which is still held back */
+      free_objects[num_reusable_objects] = free_objects[--num_free_objects];
+      num_reused_objects++;
+   }
+   else
+   {
+      if (num_objects == max_objects)
+      {
+	 old_objects = max_objects;
+	 max_objects = max_objects * 2;
+	 objects = (object_node *)
+	    ResizeMemory(MALLOC_ID_OBJECT,objects,old_objects*sizeof(object_node),
+			 max_objects*sizeof(object_node));
+	 lprintf("AllocateObject resized to %i objects\n",max_objects);
+      }
+      object_id = num_objects++;
    }
 
-   objects[num_objects].object_id = num_objects;
-   objects[num_objects].class_id = class_id;
-   objects[num_objects].deleted = False;
-   objects[num_objects].num_props = 1 + c->num_properties;
-   objects[num_objects].p = (prop_type *)AllocateMemory(MALLOC_ID_OBJECT_PROPERTIES,
-							sizeof(prop_type)*(1+c->num_properties));
+   objects[object_id].object_id = object_id;
+   objects[object_id].class_id = class_id;
+   objects[object_id].deleted = False;
+   objects[object_id].generation = next_generation++;
+   objects[object_id].num_props = 1 + c->num_properties;
+   objects[object_id].p = AllocateProperties(1 + c->num_properties);
+   objects[object_id].alloc_site = 0;
+   num_live_objects++;
+   num_allocated_objects++;
+   AddClassInstance(c,object_id);
 
    if (ConfigBool(DEBUG_INITPROPERTIES))
    {
@@ -119,11 +455,11 @@ int AllocateObject(int class_id)
 
       for (i = 0; i < (1+c->num_properties); i++)
       {
-	 objects[num_objects].p[i] = p;
+	 objects[object_id].p[i] = p;
       }
    }
 
-   return num_objects++;
+   return object_id;
 }
 
 /* charlie:  i dont want the error logs spammed by the object search routines */
@@ -188,10 +524,12 @@ int CreateObject(int class_id,int num_parms,parm_node parms[])
    int new_object_id;
    class_node *c;
 
-   new_object_id = AllocateObject(class_id);
+   new_object_id = AllocateObject(class_id,True);
 
    if (new_object_id == INVALID_OBJECT)
       return INVALID_OBJECT;
+
+   objects[new_object_id].alloc_site = GetAllocSite(CENSUS_OBJECT);
    
    /* set self = prop 0 */
    objects[new_object_id].p[0].id = 0; 
@@ -238,7 +576,8 @@ Bool LoadObject(int object_id,char *class_name)
       return False;
    }
 
-   if (AllocateObject(c->class_id) != object_id)
+   /* saved games are compacted, so loading never reuses a slot */
+   if (AllocateObject(c->class_id,False) != object_id)
    {
       eprintf("LoadObject didn't make object id %i\n",object_id);
       return False;
@@ -346,12 +685,25 @@ void DeleteBlakodObject(int object_id)
       return;
    }
 
-   /* now remove object */
+   /* now remove object, and let its slot be used again */
 
-   FreeMemory(MALLOC_ID_OBJECT_PROPERTIES,o->p,sizeof(prop_type)*(1+c->num_properties));
+   FreeProperties(o->p,o->num_props);
+   o->p = NULL;
    o->deleted = True;
+   num_live_objects--;
+   RemoveClassInstance(c,object_id);
+
+   AddFreeObject(object_id);
 }   
 
+unsigned int GetObjectGeneration(int object_id)
+{
+   if (object_id < 0 || object_id >= num_objects || objects[object_id].deleted)
+      return 0;
+
+   return objects[object_id].generation;
+}
+
 void ForEachObject(void (*callback_func)(object_node *o))
 {
    int i;
@@ -361,11 +713,28 @@ void ForEachObject(void (*callback_func)(object_node *o))
 	 callback_func(&objects[i]);
 }
 
+/* ForEachObjectInRange
+*
+* Like ForEachObject(), for the ids from start up to but not including
+* end, so garbage.c can split the objects among its worker threads.
+*/
+void ForEachObjectInRange(int start,int end,void (*callback_func)(object_node *o))
+{
+   int i;
+
+   if (end > num_objects)
+      end = num_objects;
+   for (i=start;i<end;i++)
+      if (!objects[i].deleted)
+	 callback_func(&objects[i]);
+}
+
 /* these functions are for garbage collecting */
 
 void MoveObject(int dest_id,int source_id)
 {
    object_node *source,*dest;
+   class_node *c;
 
    source = GetObjectByID(source_id);
    if (source == NULL)
@@ -389,16 +758,27 @@ void MoveObject(int dest_id,int source_id)
    dest->class_id = source->class_id;
    dest->deleted = source->deleted;
    dest->garbage_ref = source->garbage_ref;
+   dest->generation = source->generation;
+   dest->class_index = source->class_index;
+   dest->alloc_site = source->alloc_site;
    dest->num_props = source->num_props;
    dest->p = source->p;
 
+   c = GetClassByID(source->class_id);
+   if (c != NULL && source->class_index < c->num_instances &&
+       c->instances[source->class_index] == source_id)
+      c->instances[source->class_index] = dest_id;
+
    if (source->class_id == SYSTEM_CLASS)
       SetSystemObjectID(dest_id);
 }
 
 void SetNumObjects(int new_num_objects)
 {
+   /* objects were just compacted, so there are no more holes to reuse */
    num_objects = new_num_objects;
+   num_live_objects = new_num_objects;
+   ClearFreeObjects();
 }
 
 /*
@@ -14,6 +14,7 @@
 #define _OBJECT_H
 
 #define INIT_OBJECTS 100000
+#define INIT_FREE_OBJECTS 1000
 
 typedef struct
 {
@@ -28,23 +29,49 @@ typedef struct
    Bool deleted;
    int garbage_ref;
    int num_props; /* used by garbage collect */
+   unsigned int generation; /* new every time the slot is allocated */
+   int class_index; /* where its id is in its class's instances */
+   int alloc_site; /* see census.c */
    prop_type *p;
 } object_node;
 
+typedef struct
+{
+   int num_slots;
+   int max_slots;
+   int num_live;
+   int num_free; /* deleted slots waiting to be reused */
+   int num_held; /* of those, deleted since the last epoch, so not yet */
+   int num_reused; /* allocations that reused a slot since the last compaction */
+   INT64 num_allocated; /* every object made, ever */
+   int num_prop_pools;
+   int prop_arrays_used;
+   int prop_arrays_free;
+   int prop_bytes_free;
+} object_statistics;
+
 void InitObject(void);
 void ResetObject(void);
 void ClearObject(void);
 int GetObjectsUsed(void);
+int GetObjectsLive(void);
+void GetObjectStats(object_statistics *ostat);
 int CreateObject(int class_id,int num_parms,parm_node parms[]);
 Bool LoadObject(int object_id,char *class_name);
 void DeleteBlakodObject(int object_id);
+void ReleaseFreeObjects(void);
+int GetHeldFreeObjects(void);
 object_node * GetObjectByID(int object_id);
 object_node * GetObjectByIDQuietly(int object_id);
 Bool IsObjectByID(int object_id);
+unsigned int GetObjectGeneration(int object_id);
 object_node * GetObjectByIDEvenDeleted(int object_id);
 Bool SetObjectPropertyByName(int object_id,char *prop_name,val_type val);
 
 void ForEachObject(void (*callback_func)(object_node *o));
+void ForEachObjectInRange(int start,int end,void (*callback_func)(object_node *o));
+int GetClassInstanceCount(class_node *c,Bool with_subclasses);
+int CopyClassInstances(class_node *c,int *ids);
 void MoveObject(int dest_id,int source_id);
 void SetNumObjects(int new_num_objects);
 
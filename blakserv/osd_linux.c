@@ -19,9 +19,66 @@ int sessions_logged_on = 0;
 
 int fd_epoll;
 
+/* With NetworkThreads > 0, each session's socket belongs to one of that
+   many reactor threads.  A reactor does the recv() and send() calls for
+   its sessions under their muxReceive/muxSend, and tells the main thread
+   which sessions have data waiting (or were hung up) through a single
+   producer, single consumer queue.  Going the other way, the main thread
+   queues sessions it has added buffers to the send_list of.  Each session is in a queue
+   at most once, so a queue as big as the session table never fills. */
+
+typedef struct
+{
+	int *ids;
+	unsigned int mask;
+	volatile unsigned int head; /* only the consumer writes this */
+	volatile unsigned int tail; /* only the producer writes this */
+} session_queue;
+
+typedef struct
+{
+	Thread thread;
+	int fd_epoll;
+	int fd_wake;
+	volatile LONG wake_pending;
+	session_queue received; /* reactor -> main thread */
+	session_queue to_send;  /* main thread -> reactor */
+	std::vector<epoll_event> retry;
+} reactor_node;
+
+#define MAX_NETWORK_THREADS 64
+#define REACTOR_WAKE_ID ((uint64_t) -1)
+
+static reactor_node *reactors = NULL;
+static int num_reactors = 0;
+static volatile LONG reactors_quit;
+
+static int fd_main_wake = -1;
+static volatile LONG main_wake_pending;
+
+static volatile LONG *session_signaled;
+static volatile LONG *session_send_queued;
+
+static THREAD_LOCAL reactor_node *current_reactor = NULL;
+
+static void StartNetworkThreads(void);
+static void StopNetworkThreads(void);
+static void DrainNetworkThreads(void);
+static void ClearWake(int fd, volatile LONG *pending);
+
 typedef std::pair<int, int> fd_conn_type;
 std::vector<fd_conn_type> accept_sockets;
 
+/* connections to the metrics port, waiting for their requests, and
+   when they were accepted */
+typedef std::pair<int, UINT64> metrics_conn_type;
+static std::vector<metrics_conn_type> metrics_sockets;
+
+static bool IsMetricsSocket(int sock);
+static void MetricsSocketEvent(int sock, uint32_t events);
+static void CloseMetricsSocket(int sock);
+static void CloseIdleMetricsSockets(void);
+
 bool IsAcceptingSocket(int sock)
 {
 	std::vector<fd_conn_type>::iterator it;
@@ -51,6 +108,7 @@ int GetAcceptingSocketConnectionType(int sock)
 void RunMainLoop(void)
 {
    INT64 ms;
+   UINT64 start_time;
    const uint32_t num_notify_events = 500;
    struct epoll_event notify_events[num_notify_events];
    int i;
@@ -67,13 +125,25 @@ void RunMainLoop(void)
 	   {
 		   eprintf("RunMainLoop error on epoll_wait %s\n", GetLastErrorStr());
 	   }
+	   start_time = GetMicroCount();
 	   //printf("got events %i %lu\n", val, ms);
 	   for (i=0;i<val;i++)
 	   {
 		   if (notify_events[i].events == 0)
 			   continue;
 
-		   if (IsAcceptingSocket(notify_events[i].data.fd))
+		   if (notify_events[i].data.fd == fd_main_wake)
+		   {
+			   // sessions are drained below
+			   ClearWake(fd_main_wake, &main_wake_pending);
+			   continue;
+		   }
+
+		   if (IsMetricsSocket(notify_events[i].data.fd))
+		   {
+			   MetricsSocketEvent(notify_events[i].data.fd,notify_events[i].events);
+		   }
+		   else if (IsAcceptingSocket(notify_events[i].data.fd))
 		   {
 			   if (notify_events[i].events & ~EPOLLIN)
 			   {
@@ -106,14 +176,476 @@ void RunMainLoop(void)
 
 	   }
 	   EnterServerLock();
+	   DrainNetworkThreads();
 	   PollSessions(); /* really just need to check session timers */
 	   TimerActivate();
+	   UpdateTimeWarp();
 	   LeaveServerLock();
+
+	   CloseIdleMetricsSockets();
+
+	   ObserveMetric(METRIC_MAIN_LOOP,GetMicroCount() - start_time);
    }
 
+   StopNetworkThreads();
    close(fd_epoll);
 }
 
+static bool IsMetricsSocket(int sock)
+{
+	std::vector<metrics_conn_type>::iterator it;
+	for (it=metrics_sockets.begin();it!=metrics_sockets.end();++it)
+	{
+		if ((*it).first == sock)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* MetricsAccept
+ *
+ * A scraper has connected to the metrics port; we answer once its request
+ * comes in.  There are only ever a few of these, so past that we just hang
+ * up rather than keep track of more.
+ */
+void MetricsAccept(SOCKET sock)
+{
+	epoll_event ee;
+
+	if (metrics_sockets.size() >= MAX_METRICS_SOCKETS)
+	{
+		close(sock);
+		return;
+	}
+
+	ee.events = EPOLLIN;
+	ee.data.fd = sock;
+	if (epoll_ctl(fd_epoll,EPOLL_CTL_ADD,sock,&ee) != 0)
+	{
+		eprintf("MetricsAccept error adding socket %s\n",GetLastErrorStr());
+		close(sock);
+		return;
+	}
+
+	metrics_sockets.push_back(metrics_conn_type(sock, GetMilliCount()));
+}
+
+/* MetricsSocketEvent
+ *
+ * Whatever the request was, the response is all the metrics.  It's small
+ * enough to go out in one send() on a loopback connection; if it doesn't,
+ * the scraper gets a short body and tries again next time.
+ */
+static void MetricsSocketEvent(int sock, uint32_t events)
+{
+	char request[1024];
+	char *response;
+	int len, bytes;
+
+	bytes = 0;
+	if ((events & ~EPOLLIN) == 0)
+	{
+		bytes = recv(sock, request, sizeof(request), 0);
+		if (bytes < 0 && errno == EAGAIN)
+			return;
+	}
+
+	if (bytes > 0)
+	{
+		EnterServerLock();
+		len = BuildMetricsResponse(&response);
+		if (send(sock, response, len, 0) != len)
+			eprintf("MetricsSocketEvent couldn't send all %i bytes of the response\n", len);
+		LeaveServerLock();
+	}
+
+	CloseMetricsSocket(sock);
+}
+
+static void CloseMetricsSocket(int sock)
+{
+	std::vector<metrics_conn_type>::iterator it;
+
+	epoll_ctl(fd_epoll, EPOLL_CTL_DEL, sock, NULL);
+	close(sock);
+	for (it=metrics_sockets.begin();it!=metrics_sockets.end();++it)
+	{
+		if ((*it).first == sock)
+		{
+			metrics_sockets.erase(it);
+			return;
+		}
+	}
+}
+
+/* CloseIdleMetricsSockets
+ *
+ * A connection that never sends its request would otherwise hold one of
+ * the few slots forever, so hang up on any that have waited too long.
+ */
+static void CloseIdleMetricsSockets(void)
+{
+	UINT64 now;
+	size_t i;
+
+	now = GetMilliCount();
+	i = 0;
+	while (i < metrics_sockets.size())
+	{
+		if (now - metrics_sockets[i].second > METRICS_SOCKET_TIMEOUT)
+			CloseMetricsSocket(metrics_sockets[i].first);
+		else
+			i++;
+	}
+}
+
+static void SessionQueueInit(session_queue *q, int min_size)
+{
+	unsigned int size;
+
+	size = 1;
+	while (size < (unsigned int) min_size)
+		size *= 2;
+
+	q->ids = (int *) AllocateMemory(MALLOC_ID_SESSION_MODES, size*sizeof(int));
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+}
+
+static bool SessionQueuePush(session_queue *q, int session_id)
+{
+	unsigned int tail;
+
+	tail = q->tail;
+	if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+		return false;
+
+	q->ids[tail & q->mask] = session_id;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static bool SessionQueuePop(session_queue *q, int *session_id)
+{
+	unsigned int head;
+
+	head = q->head;
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	*session_id = q->ids[head & q->mask];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* wake up a thread blocked in epoll_wait on fd, unless someone already has */
+static void WakeThread(int fd, volatile LONG *pending)
+{
+	uint64_t one = 1;
+
+	if (InterlockedCompareExchange(pending, 1, 0) != 0)
+		return;
+
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		eprintf("WakeThread error writing wake event %s\n", GetLastErrorStr());
+}
+
+/* reset the event before the pending flag, so a wake that comes in between
+   isn't lost; the caller looks at its queue after this */
+static void ClearWake(int fd, volatile LONG *pending)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		eprintf("ClearWake error reading wake event %s\n", GetLastErrorStr());
+	InterlockedCompareExchange(pending, 0, 1);
+}
+
+/* ReactorSessionEvent
+ *
+ * Does the socket i/o for epoll events on a session.  The session lock is
+ * only held long enough to check the session is still the one the event
+ * is for and take its mutexes, so that CloseSession can't close it out
+ * from under us.  If the main thread has a mutex (it's handling the
+ * session's messages), we come back to that event after the next
+ * epoll_wait rather than block.  sock of INVALID_SOCKET matches whatever
+ * socket the session has.
+ */
+static void ReactorSessionEvent(reactor_node *r, int session_id, SOCKET sock, uint32_t events)
+{
+	session_node *s;
+	bool do_read, do_write;
+	epoll_event ee;
+
+	do_read = false;
+	do_write = false;
+
+	EnterSessionLock();
+
+	s = GetSessionByID(session_id);
+	if (s == NULL || !s->connected || s->conn.type != CONN_SOCKET ||
+		 (sock != INVALID_SOCKET && s->conn.socket != sock) || s->hangup)
+	{
+		LeaveSessionLock();
+		return;
+	}
+
+	if (events & ~(EPOLLIN | EPOLLOUT))
+	{
+		HangupSession(s);
+		LeaveSessionLock();
+		return;
+	}
+
+	if (events & EPOLLIN)
+	{
+		do_read = MutexAcquireWithTimeout(s->muxReceive, 0);
+		if (do_read)
+			events &= ~EPOLLIN;
+	}
+	if (events & EPOLLOUT)
+	{
+		do_write = MutexAcquireWithTimeout(s->muxSend, 0);
+		if (do_write)
+			events &= ~EPOLLOUT;
+	}
+
+	LeaveSessionLock();
+
+	if (do_read)
+	{
+		AsyncSessionRead(s);
+		if (!MutexRelease(s->muxReceive))
+			eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+		SignalSession(session_id);
+	}
+
+	if (do_write)
+	{
+		AsyncSessionWrite(s);
+		if (!MutexRelease(s->muxSend))
+			eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+	}
+
+	if (events != 0)
+	{
+		ee.events = events;
+		ee.data.u64 = ((uint64_t) session_id << 32) | (uint32_t) s->conn.socket;
+		r->retry.push_back(ee);
+	}
+}
+
+static void ReactorThread(void *arg)
+{
+	reactor_node *r = (reactor_node *) arg;
+	const int num_notify_events = 500;
+	struct epoll_event notify_events[num_notify_events];
+	std::vector<epoll_event> retry;
+	int i, val, session_id;
+
+	current_reactor = r;
+
+	while (!reactors_quit)
+	{
+		val = epoll_wait(r->fd_epoll, notify_events, num_notify_events,
+							  r->retry.empty() ? 1000 : 1);
+		if (val == -1)
+		{
+			if (errno != EINTR)
+				eprintf("ReactorThread error on epoll_wait %s\n", GetLastErrorStr());
+			val = 0;
+		}
+
+		retry.swap(r->retry);
+
+		for (i=0;i<val;i++)
+		{
+			if (notify_events[i].data.u64 == REACTOR_WAKE_ID)
+			{
+				ClearWake(r->fd_wake, &r->wake_pending);
+				while (SessionQueuePop(&r->to_send, &session_id))
+				{
+					InterlockedCompareExchange(&session_send_queued[session_id], 0, 1);
+					ReactorSessionEvent(r, session_id, INVALID_SOCKET, EPOLLOUT);
+				}
+				continue;
+			}
+
+			ReactorSessionEvent(r, (int) (notify_events[i].data.u64 >> 32),
+									  (SOCKET) (notify_events[i].data.u64 & 0xffffffff),
+									  notify_events[i].events);
+		}
+
+		for (i=0;i<(int) retry.size();i++)
+			ReactorSessionEvent(r, (int) (retry[i].data.u64 >> 32),
+									  (SOCKET) (retry[i].data.u64 & 0xffffffff),
+									  retry[i].events);
+		retry.clear();
+	}
+
+	FlushBufferCache();
+}
+
+static void StartNetworkThreads(void)
+{
+	reactor_node *r;
+	epoll_event ee;
+	int i, max_sessions;
+
+	num_reactors = std::min(ConfigInt(SOCKET_NETWORK_THREADS), MAX_NETWORK_THREADS);
+	if (num_reactors <= 0)
+	{
+		num_reactors = 0;
+		return;
+	}
+
+	fd_main_wake = eventfd(0, EFD_NONBLOCK);
+	ee.events = EPOLLIN;
+	ee.data.fd = fd_main_wake;
+	if (fd_main_wake < 0 || epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_main_wake, &ee) != 0)
+	{
+		eprintf("StartNetworkThreads error creating wake event %s\n", GetLastErrorStr());
+		num_reactors = 0;
+		return;
+	}
+	main_wake_pending = 0;
+	reactors_quit = 0;
+
+	max_sessions = ConfigInt(SESSION_MAX_CONNECT);
+	session_signaled = (volatile LONG *)
+		AllocateMemory(MALLOC_ID_SESSION_MODES, max_sessions*sizeof(LONG));
+	session_send_queued = (volatile LONG *)
+		AllocateMemory(MALLOC_ID_SESSION_MODES, max_sessions*sizeof(LONG));
+	memset((void *) session_signaled, 0, max_sessions*sizeof(LONG));
+	memset((void *) session_send_queued, 0, max_sessions*sizeof(LONG));
+
+	reactors = new reactor_node[num_reactors];
+	for (i=0;i<num_reactors;i++)
+	{
+		r = &reactors[i];
+		r->fd_epoll = epoll_create(1);
+		r->fd_wake = eventfd(0, EFD_NONBLOCK);
+		r->wake_pending = 0;
+		SessionQueueInit(&r->received, max_sessions);
+		SessionQueueInit(&r->to_send, max_sessions);
+
+		ee.events = EPOLLIN;
+		ee.data.u64 = REACTOR_WAKE_ID;
+		if (r->fd_epoll < 0 || r->fd_wake < 0 ||
+			 epoll_ctl(r->fd_epoll, EPOLL_CTL_ADD, r->fd_wake, &ee) != 0)
+			FatalError("StartNetworkThreads couldn't set up epoll for network thread");
+
+		if (!ThreadCreate(&r->thread, ReactorThread, r))
+			FatalError("StartNetworkThreads couldn't start network thread");
+	}
+
+	lprintf("StartNetworkThreads doing socket i/o on %i threads\n", num_reactors);
+}
+
+static void StopNetworkThreads(void)
+{
+	reactor_node *r;
+	int i, count;
+
+	if (num_reactors == 0)
+		return;
+
+	reactors_quit = 1;
+	for (i=0;i<num_reactors;i++)
+	{
+		r = &reactors[i];
+		WakeThread(r->fd_wake, &r->wake_pending);
+		ThreadJoin(r->thread);
+	}
+
+	/* sessions get closed after this, so anything they send from now on
+		goes out from this thread */
+	count = num_reactors;
+	num_reactors = 0;
+
+	for (i=0;i<count;i++)
+	{
+		r = &reactors[i];
+		close(r->fd_wake);
+		close(r->fd_epoll);
+		FreeMemory(MALLOC_ID_SESSION_MODES, r->received.ids, (r->received.mask + 1)*sizeof(int));
+		FreeMemory(MALLOC_ID_SESSION_MODES, r->to_send.ids, (r->to_send.mask + 1)*sizeof(int));
+	}
+	delete [] reactors;
+	reactors = NULL;
+
+	FreeMemory(MALLOC_ID_SESSION_MODES, session_signaled, ConfigInt(SESSION_MAX_CONNECT)*sizeof(LONG));
+	FreeMemory(MALLOC_ID_SESSION_MODES, session_send_queued, ConfigInt(SESSION_MAX_CONNECT)*sizeof(LONG));
+
+	close(fd_main_wake);
+	fd_main_wake = -1;
+}
+
+/* main thread: handle the sessions the reactors have read data for */
+static void DrainNetworkThreads(void)
+{
+	int i, session_id;
+
+	for (i=0;i<num_reactors;i++)
+	{
+		while (SessionQueuePop(&reactors[i].received, &session_id))
+		{
+			InterlockedCompareExchange(&session_signaled[session_id], 0, 1);
+			PollSession(session_id);
+		}
+	}
+}
+
+bool NetworkThreadsRunning(void)
+{
+	return num_reactors > 0;
+}
+
+/* main thread: the session has something new in its send_list */
+void NetworkThreadSend(int session_id)
+{
+	reactor_node *r;
+
+	if (num_reactors == 0 || session_id < 0)
+		return;
+
+	if (InterlockedCompareExchange(&session_send_queued[session_id], 1, 0) != 0)
+		return;
+
+	r = &reactors[session_id % num_reactors];
+	if (!SessionQueuePush(&r->to_send, session_id))
+	{
+		InterlockedCompareExchange(&session_send_queued[session_id], 0, 1);
+		eprintf("NetworkThreadSend queue full for session %i\n", session_id);
+		return;
+	}
+	WakeThread(r->fd_wake, &r->wake_pending);
+}
+
+/* reactor thread: let the main thread know to look at the session */
+void NetworkThreadSignal(int session_id)
+{
+	reactor_node *r;
+
+	r = current_reactor;
+	if (r == NULL || session_id < 0)
+		return;
+
+	if (InterlockedCompareExchange(&session_signaled[session_id], 1, 0) != 0)
+		return;
+
+	if (!SessionQueuePush(&r->received, session_id))
+	{
+		/* PollSessions will get to it anyway */
+		InterlockedCompareExchange(&session_signaled[session_id], 0, 1);
+		return;
+	}
+	WakeThread(fd_main_wake, &main_wake_pending);
+}
+
 int GetLastError()
 {
    return errno;
@@ -156,6 +688,62 @@ bool BlakMoveFile(const char *source, const char *dest)
    return rename(source, dest) == 0;
 }
 
+bool MapFile(const char *fname, char **mem, int *length)
+{
+   struct stat st;
+   void *ptr;
+   int fd;
+
+   fd = open(fname, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   // mmap can't map an empty file
+   if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size >= 0x7fffffff)
+   {
+      close(fd);
+      return false;
+   }
+
+   ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (ptr == MAP_FAILED)
+      return false;
+
+   *mem = (char *) ptr;
+   *length = (int) st.st_size;
+   return true;
+}
+
+void UnmapFile(char *mem, int length)
+{
+   munmap(mem, length);
+}
+
+INT64 MappedResidentBytes(const char *mem, int length)
+{
+   unsigned char pages[4096];
+   long page_size;
+   INT64 resident;
+   int num_pages, i, j, n;
+
+   page_size = sysconf(_SC_PAGESIZE);
+   num_pages = (int) ((length + page_size - 1) / page_size);
+   resident = 0;
+
+   for (i = 0; i < num_pages; i += n)
+   {
+      n = std::min(num_pages - i, (int) sizeof(pages));
+      if (mincore((void *) (mem + i*page_size), n*page_size, pages) != 0)
+         return -1;
+      for (j = 0; j < n; j++)
+         if (pages[j] & 1)
+            resident += page_size;
+   }
+
+   return std::min(resident, (INT64) length);
+}
+
 void InitInterface(void)
 {
 }
@@ -188,6 +776,7 @@ void StartupPrintf(const char *fmt,...)
 void StartupComplete(void)
 {
 	fd_epoll = epoll_create(1);
+	StartNetworkThreads();
 }
 
 void InterfaceUpdate(void)
@@ -255,9 +844,20 @@ void StartAsyncSession(session_node *s)
 {
 	//epoll_event *ee = (epoll_event *) AllocateMemory(MALLOC_ID_NETWORK, sizeof(epoll_event));
 	epoll_event ee;
+	int fd;
+
 	ee.events = EPOLLIN | EPOLLOUT | EPOLLET;
-	ee.data.fd = s->conn.socket;
-	if (epoll_ctl(fd_epoll,EPOLL_CTL_ADD,s->conn.socket,&ee) != 0)
+	if (num_reactors > 0)
+	{
+		fd = reactors[s->session_id % num_reactors].fd_epoll;
+		ee.data.u64 = ((uint64_t) s->session_id << 32) | (uint32_t) s->conn.socket;
+	}
+	else
+	{
+		fd = fd_epoll;
+		ee.data.fd = s->conn.socket;
+	}
+	if (epoll_ctl(fd,EPOLL_CTL_ADD,s->conn.socket,&ee) != 0)
 	{
 	    eprintf("StartAsyncSession error adding socket %s\n",GetLastErrorStr());
 		return;
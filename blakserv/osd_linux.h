@@ -27,9 +27,12 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 
 #include "critical_section.h"
 #include "mutex_linux.h"
+#include "thread_linux.h"
 
 #define MAX_PATH PATH_MAX
 #define O_BINARY 0
@@ -77,6 +80,16 @@ bool FindMatchingFiles(const char *path, const char *extension, StringVector *fi
 
 bool BlakMoveFile(const char *source, const char *dest);
 
+// Map a whole file read only.  The pages are shared with anyone else
+// mapping the file and are only read in when touched.
+// Return true on success.
+bool MapFile(const char *fname, char **mem, int *length);
+void UnmapFile(char *mem, int length);
+
+// Return how many bytes of a mapping are in physical memory, or -1 if
+// the os can't tell us.
+INT64 MappedResidentBytes(const char *mem, int length);
+
 void InitInterface(void);
 
 int GetUsedSessions(void);
@@ -97,6 +110,14 @@ void InterfaceSendBytes(char *buf,int len_buf);
 void StartAsyncSocketAccept(SOCKET sock,int connection_type);
 HANDLE StartAsyncNameLookup(char *peer_addr,char *buf);
 void StartAsyncSession(void *s);
+void MetricsAccept(SOCKET sock);
+
+// With NetworkThreads set, socket reads and writes are done on their own
+// threads.  The main thread then only adds to a session's send_list and
+// calls NetworkThreadSend to have it written.
+bool NetworkThreadsRunning(void);
+void NetworkThreadSend(int session_id);
+void NetworkThreadSignal(int session_id);
 
 void FatalErrorShow(const char *filename,int line,const char *str);
 
@@ -14,6 +14,7 @@
  */
 
 #include "blakserv.h"
+#include <psapi.h>
 
 void RunMainLoop(void)
 {
@@ -73,6 +74,7 @@ void RunMainLoop(void)
 		   EnterServerLock();
 		   PollSessions(); /* really just need to check session timers */
 		   TimerActivate();
+		   UpdateTimeWarp();
 		   LeaveServerLock();
 	   }
    }
@@ -126,3 +128,83 @@ bool BlakMoveFile(const char *source, const char *dest)
    }
    return true;
 }
+
+bool MapFile(const char *fname, char **mem, int *length)
+{
+   HANDLE file, mapping;
+   LARGE_INTEGER size;
+   void *ptr;
+
+   file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL, NULL);
+   if (file == INVALID_HANDLE_VALUE)
+      return false;
+
+   // can't map an empty file
+   if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || size.QuadPart >= 0x7fffffff)
+   {
+      CloseHandle(file);
+      return false;
+   }
+
+   // the view keeps the mapping and the file open
+   mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+   CloseHandle(file);
+   if (mapping == NULL)
+      return false;
+
+   ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+   CloseHandle(mapping);
+   if (ptr == NULL)
+      return false;
+
+   *mem = (char *) ptr;
+   *length = (int) size.QuadPart;
+   return true;
+}
+
+void UnmapFile(char *mem, int length)
+{
+   UnmapViewOfFile(mem);
+}
+
+INT64 MappedResidentBytes(const char *mem, int length)
+{
+   PSAPI_WORKING_SET_EX_INFORMATION pages[256];
+   SYSTEM_INFO si;
+   INT64 resident;
+   int num_pages, i, j, n;
+
+   GetSystemInfo(&si);
+   num_pages = (int) ((length + si.dwPageSize - 1) / si.dwPageSize);
+   resident = 0;
+
+   for (i = 0; i < num_pages; i += n)
+   {
+      n = std::min(num_pages - i, (int) (sizeof(pages)/sizeof(pages[0])));
+      for (j = 0; j < n; j++)
+         pages[j].VirtualAddress = (PVOID) (mem + (INT64) (i + j)*si.dwPageSize);
+      if (!QueryWorkingSetEx(GetCurrentProcess(), pages, n*sizeof(pages[0])))
+         return -1;
+      for (j = 0; j < n; j++)
+         if (pages[j].VirtualAttributes.Valid)
+            resident += si.dwPageSize;
+   }
+
+   return std::min(resident, (INT64) length);
+}
+
+// Windows already does socket i/o on the interface thread (see
+// interface.c), so there are no separate network threads.
+bool NetworkThreadsRunning(void)
+{
+   return false;
+}
+
+void NetworkThreadSend(int session_id)
+{
+}
+
+void NetworkThreadSignal(int session_id)
+{
+}
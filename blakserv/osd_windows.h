@@ -22,6 +22,7 @@
 #include <io.h>
 #include <process.h>
 #include "mutex_windows.h"
+#include "thread_windows.h"
 
 typedef int socklen_t;
 
@@ -34,6 +35,21 @@ bool FindMatchingFiles(const char *path, const char *extension, StringVector *fi
 
 bool BlakMoveFile(const char *source, const char *dest);
 
+// Map a whole file read only.  The pages are shared with anyone else
+// mapping the file and are only read in when touched.
+// Return true on success.
+bool MapFile(const char *fname, char **mem, int *length);
+void UnmapFile(char *mem, int length);
+
+// Return how many bytes of a mapping are in physical memory, or -1 if
+// the os can't tell us.
+INT64 MappedResidentBytes(const char *mem, int length);
+
+// Socket i/o threads, which are only separate on linux.
+bool NetworkThreadsRunning(void);
+void NetworkThreadSend(int session_id);
+void NetworkThreadSignal(int session_id);
+
 // a lot of stuff that really belongs here is in interface.h instead
 
 #endif
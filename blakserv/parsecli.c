@@ -73,6 +73,8 @@ void AllocateParseClientListNodes()
 {
 	val_type list_val,temp;
 	int i;
+
+	RecordSystem(RECORD_CLIENT_LISTS,0);
 	
 	/* allocate constant list that we set the First values in for
     * client messages.
@@ -88,6 +90,16 @@ void AllocateParseClientListNodes()
 	}
 }
 
+/* GetParseClientListNodes
+*
+* Returns the head of the constant list, whose nodes nothing else refers
+* to, so ReclaimListNodes can keep them.
+*/
+val_type GetParseClientListNodes(void)
+{
+	return cli_list_nodes[0];
+}
+
 void GameMessageCount(unsigned char message_type)
 {
 	user_table[message_type].call_count++;
@@ -95,6 +107,7 @@ void GameMessageCount(unsigned char message_type)
 
 void ClientToBlakodUser(session_node *session,int msg_len,char *msg_data)
 {
+	RecordClientMessage(session,msg_len,msg_data);
 	ParseClientSendBlakod(session->session_id,msg_len,(unsigned char *) msg_data,
 		session->game->object_id,user_table);
 }
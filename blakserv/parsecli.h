@@ -49,6 +49,7 @@ typedef client_table_node client_table_type[CLIENT_COMMANDS_PER_TABLE];
 
 void InitParseClient(void);
 void AllocateParseClientListNodes(void); /* call after garbage collecting */
+val_type GetParseClientListNodes(void);
 
 void GameMessageCount(unsigned char message_type);
 
@@ -0,0 +1,309 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * preload.c
+ *
+
+ This module reads the files we need at startup (and on a system reload)
+ on worker threads, while the main thread is busy linking the ones
+ already read.  StartPreload() lists the .bof and .rsc files and the
+ string and dynamic resource files of the last save, and starts the
+ threads.  The .bof files are left out when they're mapped instead (see
+ loadkod.c), and the game file is left out because loadgame.c streams
+ it a section at a time.  The loaders then ask
+ for each file with PreloadFile(), which hands over the whole file in
+ memory, waiting for it if a worker is still reading it, or reading it
+ right there if no worker has gotten to it yet.  Files we weren't asked
+ to preload are just read in, so the loaders don't care whether a
+ preload is running.
+
+ The workers only read files; the parsing, and everything that touches
+ the class, resource, object or account tables, stays on the main
+ thread, since none of those are safe to change from two threads at
+ once.  So the startup is only faster by the time spent reading.
+
+ Each file is allocated one byte longer than its contents and null
+ terminated, so text files can be parsed in place.
+
+ */
+
+#include "blakserv.h"
+
+preload_file_node *preload_files;
+int num_preload_files,max_preload_files;
+int preload_next_file; /* where the main thread expects the next request */
+
+Thread preload_threads[PRELOAD_MAX_THREADS];
+int num_preload_threads;
+
+UINT64 preload_start_time;
+UINT64 load_phase_time;
+
+/* for the main thread to wait for a file a worker is reading */
+Bool preload_lock_ready;
+CRITICAL_SECTION csPreload;
+CONDITION_VARIABLE preload_read;
+
+/* local function prototypes */
+void AddPreloadFile(const char *path,const char *fname,int malloc_id);
+void AddPreloadFiles(const char *path,const char *extension,int malloc_id);
+void PreloadThread(void *arg);
+void PreloadReadFile(preload_file_node *pf);
+preload_file_node * GetPreloadFile(const char *fname);
+
+void StartPreload(Bool load_accounts)
+{
+	char fname[MAX_PATH+FILENAME_MAX];
+	int last_save_time,i;
+
+	preload_start_time = GetMilliCount();
+	load_phase_time = preload_start_time;
+
+	if (!preload_lock_ready)
+	{
+		InitializeCriticalSection(&csPreload);
+		InitializeConditionVariable(&preload_read);
+		preload_lock_ready = True;
+	}
+
+	num_preload_files = 0;
+	max_preload_files = 0;
+	preload_files = NULL;
+	preload_next_file = 0;
+	num_preload_threads = 0;
+
+	/* new .bof files have to be in place before we can list them */
+	MoveNewBofFiles();
+
+	/* same order the loaders ask for them */
+	if (!ConfigBool(BLAKOD_MAP_BOFS))
+		AddPreloadFiles(ConfigStr(PATH_MEMMAP),".bof",MALLOC_ID_LOADBOF);
+	AddPreloadFiles(ConfigStr(PATH_RSC),".rsc",MALLOC_ID_RESOURCE);
+
+	if (LoadControlFile(&last_save_time))
+	{
+		/* the account store is mapped instead, so this is just for
+			saves from before there was one */
+		if (load_accounts && !AccountStoreExists())
+		{
+			sprintf(fname,"%s%i",ACCOUNT_FILE_SAVE,last_save_time);
+			AddPreloadFile(ConfigStr(PATH_LOADSAVE),fname,MALLOC_ID_ACCOUNT);
+		}
+		sprintf(fname,"%s%i",STRING_FILE_SAVE,last_save_time);
+		AddPreloadFile(ConfigStr(PATH_LOADSAVE),fname,MALLOC_ID_STRING);
+		sprintf(fname,"%s%i",DYNAMIC_RSC_FILE_SAVE,last_save_time);
+		AddPreloadFile(ConfigStr(PATH_LOADSAVE),fname,MALLOC_ID_RESOURCE);
+	}
+
+	if (num_preload_files == 0)
+		return;
+
+	/* the main thread reads too, so it's fine to have fewer workers than cpus */
+	for (i=0;i<std::min(ThreadNumProcessors(),PRELOAD_MAX_THREADS);i++)
+	{
+		if (!ThreadCreate(&preload_threads[num_preload_threads],PreloadThread,NULL))
+		{
+			eprintf("StartPreload couldn't start worker thread %i\n",i);
+			break;
+		}
+		num_preload_threads++;
+	}
+}
+
+void EndPreload(void)
+{
+	INT64 bytes;
+	int i,num_unused;
+
+	for (i=0;i<num_preload_threads;i++)
+		ThreadJoin(preload_threads[i]);
+
+	bytes = 0;
+	num_unused = 0;
+	for (i=0;i<num_preload_files;i++)
+	{
+		bytes += preload_files[i].length;
+		if (preload_files[i].mem != NULL)
+		{
+			FreeFileMemory(preload_files[i].malloc_id,preload_files[i].mem,
+								preload_files[i].length);
+			num_unused++;
+		}
+	}
+
+	lprintf("EndPreload read %i files (%lli bytes) with %i threads, %i unused, startup took %u ms\n",
+			  num_preload_files,(long long)bytes,num_preload_threads,num_unused,
+			  (unsigned int)(GetMilliCount() - preload_start_time));
+
+	if (preload_files != NULL)
+		FreeMemory(MALLOC_ID_LOAD_GAME,preload_files,
+					  max_preload_files*sizeof(preload_file_node));
+	preload_files = NULL;
+	num_preload_files = 0;
+	max_preload_files = 0;
+	num_preload_threads = 0;
+}
+
+/* LoadPhaseDone
+*
+* Logs how long the startup phase that just finished took.
+*/
+void LoadPhaseDone(const char *phase)
+{
+	UINT64 now;
+
+	now = GetMilliCount();
+	lprintf("LoadPhaseDone %s took %u ms\n",phase,(unsigned int)(now - load_phase_time));
+	load_phase_time = now;
+}
+
+void AddPreloadFiles(const char *path,const char *extension,int malloc_id)
+{
+	StringVector files;
+
+	if (!FindMatchingFiles(path,extension,&files))
+		return;
+
+	for (StringVector::iterator it = files.begin(); it != files.end(); ++it)
+		AddPreloadFile(path,it->c_str(),malloc_id);
+}
+
+void AddPreloadFile(const char *path,const char *fname,int malloc_id)
+{
+	preload_file_node *pf;
+	int old_max;
+
+	if (num_preload_files == max_preload_files)
+	{
+		old_max = max_preload_files;
+		max_preload_files = (max_preload_files == 0) ? 2048 : 2*max_preload_files;
+		if (preload_files == NULL)
+			preload_files = (preload_file_node *)AllocateMemory(MALLOC_ID_LOAD_GAME,
+				max_preload_files*sizeof(preload_file_node));
+		else
+			preload_files = (preload_file_node *)ResizeMemory(MALLOC_ID_LOAD_GAME,preload_files,
+				old_max*sizeof(preload_file_node),max_preload_files*sizeof(preload_file_node));
+	}
+
+	pf = &preload_files[num_preload_files++];
+	sprintf(pf->fname,"%s%s",path,fname);
+	pf->malloc_id = malloc_id;
+	pf->mem = NULL;
+	pf->length = 0;
+	pf->ok = False;
+	pf->taken = False;
+	pf->claimed = 0;
+	pf->done = 0;
+}
+
+void PreloadThread(void *arg)
+{
+	int i;
+
+	for (i=0;i<num_preload_files;i++)
+		if (InterlockedIncrement(&preload_files[i].claimed) == 1)
+			PreloadReadFile(&preload_files[i]);
+}
+
+void PreloadReadFile(preload_file_node *pf)
+{
+	pf->ok = LoadFileMemory(pf->fname,pf->malloc_id,&pf->mem,&pf->length);
+
+	/* publishes mem and length to the main thread */
+	EnterCriticalSection(&csPreload);
+	pf->done = 1;
+	WakeAllConditionVariable(&preload_read);
+	LeaveCriticalSection(&csPreload);
+}
+
+preload_file_node * GetPreloadFile(const char *fname)
+{
+	int i;
+
+	/* the loaders go through the files in the order we listed them */
+	for (i=preload_next_file;i<num_preload_files;i++)
+		if (strcmp(preload_files[i].fname,fname) == 0)
+		{
+			preload_next_file = i + 1;
+			return &preload_files[i];
+		}
+
+	for (i=0;i<preload_next_file;i++)
+		if (strcmp(preload_files[i].fname,fname) == 0)
+			return &preload_files[i];
+
+	return NULL;
+}
+
+/* PreloadFile
+*
+* Gives the caller the contents of fname, which it owns from then on and
+* frees with FreeFileMemory.
+*/
+Bool PreloadFile(const char *fname,int malloc_id,char **mem,int *length)
+{
+	preload_file_node *pf;
+
+	pf = GetPreloadFile(fname);
+	if (pf == NULL || pf->malloc_id != malloc_id || pf->taken)
+		return LoadFileMemory(fname,malloc_id,mem,length);
+	pf->taken = True;
+
+	/* read it ourselves if no worker has started on it */
+	if (InterlockedIncrement(&pf->claimed) == 1)
+		PreloadReadFile(pf);
+
+	EnterCriticalSection(&csPreload);
+	while (!pf->done)
+		SleepConditionVariableCS(&preload_read,&csPreload,INFINITE);
+	LeaveCriticalSection(&csPreload);
+
+	if (!pf->ok)
+		return False;
+
+	*mem = pf->mem;
+	*length = pf->length;
+	pf->mem = NULL;
+	return True;
+}
+
+Bool LoadFileMemory(const char *fname,int malloc_id,char **mem,int *length)
+{
+	FILE *f;
+	struct stat st;
+	char *ptr;
+
+	f = fopen(fname,"rb");
+	if (f == NULL)
+		return False;
+
+	if (fstat(fileno(f),&st) != 0 || st.st_size < 0 || (INT64)st.st_size >= 0x7fffffff)
+	{
+		fclose(f);
+		return False;
+	}
+
+	ptr = (char *)AllocateMemory(malloc_id,(int)st.st_size+1);
+	if (st.st_size > 0 && fread(ptr,1,st.st_size,f) != (size_t)st.st_size)
+	{
+		FreeMemory(malloc_id,ptr,(int)st.st_size+1);
+		fclose(f);
+		return False;
+	}
+	fclose(f);
+
+	ptr[st.st_size] = 0;
+	*mem = ptr;
+	*length = (int)st.st_size;
+	return True;
+}
+
+void FreeFileMemory(int malloc_id,char *mem,int length)
+{
+	FreeMemory(malloc_id,mem,length+1);
+}
@@ -0,0 +1,38 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * preload.h
+ *
+ */
+
+#ifndef _PRELOAD_H
+#define _PRELOAD_H
+
+#define PRELOAD_MAX_THREADS 4
+
+typedef struct
+{
+   char fname[MAX_PATH+FILENAME_MAX];
+   int malloc_id;
+   char *mem;
+   int length;
+   Bool ok;
+   Bool taken; /* main thread only */
+   volatile LONG claimed;
+   Bool done; /* under csPreload */
+} preload_file_node;
+
+void StartPreload(Bool load_accounts);
+void EndPreload(void);
+void LoadPhaseDone(const char *phase);
+
+Bool PreloadFile(const char *fname,int malloc_id,char **mem,int *length);
+Bool LoadFileMemory(const char *fname,int malloc_id,char **mem,int *length);
+void FreeFileMemory(int malloc_id,char *mem,int length);
+
+#endif
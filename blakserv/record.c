@@ -0,0 +1,330 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * record.c
+ *
+
+ This module records what the clients in the game ask of the Blakod,
+ so kodreplay can do it all again later without any sockets.  An admin
+ saves the game and starts a recording with "record start"; from then
+ on each message a client sends its user object, each session's change
+ of state, each user entering the game and each Blakod timer going off
+ is written to the file, with the time it happened.  The sessions that
+ were already in the game when it started are written first, as if
+ they had just come in.
+
+ So are the things the server does to the whole game that change
+ object, list and string numbers or when timers go off: pausing and
+ unpausing the timers (with how far they were moved), the Blakod's
+ begin and end system events, garbage collection, reclaiming objects
+ and list nodes, making the client parser's list nodes and the new
+ hour.  kodreplay does each of them again at the same point.  Saving
+ isn't recorded, since it changes nothing in the game, but the garbage
+ collection before it is.  Reloading the system or the game stops the
+ recording, since a replay can't follow it.
+
+ The file is a header of four byte ints (RECORD_MAGIC, RECORD_VERSION
+ and the save time) and then the events, each a type byte, the
+ milliseconds of game time since the event before it (so they still
+ line up with the timers during a time warp), and the event's numbers, all
+ written as variable length unsigned numbers, seven bits to a byte
+ with the high bit set on all but the last.  A client message is then
+ its length and its bytes as the client sent them.
+
+ */
+
+#include "blakserv.h"
+
+static FILE *record_file;
+static char record_name[MAX_PATH+FILENAME_MAX];
+static UINT64 record_last_time;
+static INT64 record_events,record_bytes;
+
+static UINT64 read_time; /* of the last event read back */
+
+/* local function prototypes */
+static void RecordBytes(const void *buf,int len);
+static void RecordNumber(unsigned int num);
+static void RecordEventStart(int type,int id);
+static void RecordEachGameSession(session_node *s);
+static Bool ReadNumber(FILE *f,unsigned int *num);
+
+static void RecordBytes(const void *buf,int len)
+{
+   if (record_file == NULL)
+      return;
+
+   if (fwrite(buf,1,len,record_file) != (size_t)len)
+   {
+      eprintf("RecordBytes error writing %s, stopping the recording\n",record_name);
+      StopRecording();
+      return;
+   }
+   record_bytes += len;
+}
+
+static void RecordNumber(unsigned int num)
+{
+   unsigned char buf[5];
+   int len;
+
+   len = 0;
+   while (num >= 0x80)
+   {
+      buf[len++] = (unsigned char)(num | 0x80);
+      num >>= 7;
+   }
+   buf[len++] = (unsigned char)num;
+   RecordBytes(buf,len);
+}
+
+static void RecordEventStart(int type,int id)
+{
+   unsigned char type_byte;
+   UINT64 now;
+
+   now = GetGameMilliCount();
+
+   type_byte = (unsigned char)type;
+   RecordBytes(&type_byte,1);
+   RecordNumber((unsigned int)(now - record_last_time));
+   RecordNumber((unsigned int)id);
+   record_last_time = now;
+   record_events++;
+}
+
+/* StartRecording
+*
+* Call just after saving the game, so a replay can start from the same
+* place.
+*/
+Bool StartRecording(const char *filename,int save_time)
+{
+   int header[3];
+
+   if (record_file != NULL)
+      return False;
+
+   record_file = fopen(filename,"wb");
+   if (record_file == NULL)
+      return False;
+
+   snprintf(record_name,sizeof(record_name),"%s",filename);
+   record_events = 0;
+   record_bytes = 0;
+   record_last_time = GetGameMilliCount();
+
+   header[0] = RECORD_MAGIC;
+   header[1] = RECORD_VERSION;
+   header[2] = save_time;
+   RecordBytes(header,sizeof(header));
+
+   ForEachSession(RecordEachGameSession);
+
+   lprintf("StartRecording recording client traffic to %s\n",record_name);
+   return record_file != NULL;
+}
+
+static void RecordEachGameSession(session_node *s)
+{
+   if (s->state != STATE_GAME)
+      return;
+
+   RecordSessionState(s,STATE_GAME);
+   if (s->game->object_id != INVALID_OBJECT)
+      RecordEnterGame(s,s->game->object_id);
+}
+
+void StopRecording(void)
+{
+   FILE *f;
+
+   if (record_file == NULL)
+      return;
+
+   /* RecordBytes calls us if this fails */
+   f = record_file;
+   record_file = NULL;
+   fclose(f);
+
+   lprintf("StopRecording wrote %lli events, %lli bytes to %s\n",
+	   (long long)record_events,(long long)record_bytes,record_name);
+}
+
+Bool IsRecording(void)
+{
+   return record_file != NULL;
+}
+
+const char * GetRecordingName(void)
+{
+   return record_name;
+}
+
+INT64 GetRecordingEvents(void)
+{
+   return record_events;
+}
+
+INT64 GetRecordingBytes(void)
+{
+   return record_bytes;
+}
+
+void RecordClientMessage(session_node *s,int msg_len,char *msg_data)
+{
+   if (record_file == NULL)
+      return;
+
+   RecordEventStart(RECORD_CLIENT_MSG,s->session_id);
+   RecordNumber(msg_len);
+   RecordBytes(msg_data,msg_len);
+}
+
+void RecordSessionState(session_node *s,int state)
+{
+   if (record_file == NULL)
+      return;
+
+   RecordEventStart(RECORD_SESSION_STATE,s->session_id);
+   RecordNumber(state);
+   RecordNumber(s->account == NULL ? 0 : s->account->account_id);
+}
+
+void RecordSessionClose(session_node *s)
+{
+   if (record_file == NULL)
+      return;
+
+   RecordEventStart(RECORD_SESSION_CLOSE,s->session_id);
+}
+
+void RecordEnterGame(session_node *s,int object_id)
+{
+   if (record_file == NULL)
+      return;
+
+   RecordEventStart(RECORD_ENTER_GAME,s->session_id);
+   RecordNumber(object_id);
+}
+
+void RecordTimer(int timer_id,int object_id,int message_id)
+{
+   if (record_file == NULL)
+      return;
+
+   RecordEventStart(RECORD_TIMER,timer_id);
+   RecordNumber(object_id);
+   RecordNumber(message_id);
+}
+
+void RecordSystem(int what,int value)
+{
+   if (record_file == NULL)
+      return;
+
+   RecordEventStart(RECORD_SYSTEM,what);
+   RecordNumber((unsigned int)value);
+}
+
+/* OpenRecording
+*
+* Opens a recording to read back with ReadRecordEvent; returns NULL if
+* it isn't one.
+*/
+FILE * OpenRecording(const char *filename,record_header *header)
+{
+   FILE *f;
+   int buf[3];
+
+   f = fopen(filename,"rb");
+   if (f == NULL)
+      return NULL;
+
+   if (fread(buf,sizeof(buf),1,f) != 1 || buf[0] != RECORD_MAGIC || buf[1] != RECORD_VERSION)
+   {
+      fclose(f);
+      return NULL;
+   }
+
+   header->save_time = buf[2];
+   read_time = 0;
+   return f;
+}
+
+static Bool ReadNumber(FILE *f,unsigned int *num)
+{
+   int c,shift;
+
+   *num = 0;
+   for (shift=0;shift<35;shift+=7)
+   {
+      c = fgetc(f);
+      if (c == EOF)
+	 return False;
+      *num |= (unsigned int)(c & 0x7f) << shift;
+      if ((c & 0x80) == 0)
+	 return True;
+   }
+   return False;
+}
+
+/* ReadRecordEvent
+*
+* False at the end of the file, with e->type 0, or if the rest of it
+* is cut off or garbled.
+*/
+Bool ReadRecordEvent(FILE *f,record_event *e)
+{
+   unsigned int delta,id,value,value2,len;
+   int type;
+
+   type = fgetc(f);
+   e->type = type == EOF ? 0 : type;
+   if (type == EOF || !ReadNumber(f,&delta) || !ReadNumber(f,&id))
+      return False;
+
+   read_time += delta;
+   e->type = type;
+   e->time = read_time;
+   e->session_id = (int)id;
+   e->value = 0;
+   e->value2 = 0;
+   e->len_data = 0;
+
+   switch (type)
+   {
+   case RECORD_CLIENT_MSG :
+      if (!ReadNumber(f,&len) || len > sizeof(e->data) || fread(e->data,1,len,f) != len)
+	 return False;
+      e->len_data = (int)len;
+      break;
+
+   case RECORD_SESSION_STATE :
+   case RECORD_TIMER :
+      if (!ReadNumber(f,&value) || !ReadNumber(f,&value2))
+	 return False;
+      e->value = (int)value;
+      e->value2 = (int)value2;
+      break;
+
+   case RECORD_ENTER_GAME :
+   case RECORD_SYSTEM :
+      if (!ReadNumber(f,&value))
+	 return False;
+      e->value = (int)value;
+      break;
+
+   case RECORD_SESSION_CLOSE :
+      break;
+
+   default :
+      return False;
+   }
+   return True;
+}
@@ -0,0 +1,76 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * record.h
+ *
+ */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#define RECORD_MAGIC 0x43455242 /* "BREC" */
+#define RECORD_VERSION 2
+
+enum
+{
+   RECORD_CLIENT_MSG = 1, /* a message from a client in the game to its user object */
+   RECORD_SESSION_STATE,  /* a session went into a state, as an account */
+   RECORD_SESSION_CLOSE,
+   RECORD_ENTER_GAME,     /* a session's user object went into the game */
+   RECORD_TIMER,          /* a Blakod timer went off */
+   RECORD_SYSTEM,         /* the server did something to the whole game */
+};
+
+/* what a RECORD_SYSTEM event was, in its session_id */
+enum
+{
+   RECORD_PAUSE = 1,          /* PauseTimers() */
+   RECORD_UNPAUSE,            /* UnpauseTimers(), moving the timers value ms later */
+   RECORD_BEGIN_EVENT,        /* SendBlakodBeginSystemEvent(value) */
+   RECORD_END_EVENT,          /* SendBlakodEndSystemEvent(value) */
+   RECORD_GARBAGE,            /* GarbageCollect() */
+   RECORD_RECLAIM_OBJECTS,    /* ReclaimObjects() */
+   RECORD_RECLAIM_LIST_NODES, /* ReclaimListNodes() */
+   RECORD_CLIENT_LISTS,       /* AllocateParseClientListNodes() */
+   RECORD_NEW_HOUR,           /* the system object got NEW_HOUR_MSG */
+};
+
+typedef struct
+{
+   int type;
+   UINT64 time; /* game clock milliseconds since the recording started */
+   int session_id; /* or the timer id, for RECORD_TIMER, or what, for RECORD_SYSTEM */
+   int value; /* the state, user object, timer's object or system event's value */
+   int value2; /* the account id or timer's message id */
+   int len_data;
+   unsigned char data[LEN_MAX_CLIENT_MSG];
+} record_event;
+
+typedef struct
+{
+   int save_time; /* of the game saved just before recording started */
+} record_header;
+
+Bool StartRecording(const char *filename,int save_time);
+void StopRecording(void);
+Bool IsRecording(void);
+const char * GetRecordingName(void);
+INT64 GetRecordingEvents(void);
+INT64 GetRecordingBytes(void);
+
+void RecordClientMessage(session_node *s,int msg_len,char *msg_data);
+void RecordSessionState(session_node *s,int state);
+void RecordSessionClose(session_node *s);
+void RecordEnterGame(session_node *s,int object_id);
+void RecordTimer(int timer_id,int object_id,int message_id);
+void RecordSystem(int what,int value);
+
+FILE * OpenRecording(const char *filename,record_header *header);
+Bool ReadRecordEvent(FILE *f,record_event *e);
+
+#endif
@@ -0,0 +1,234 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * rscbench.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself,
+ though it links with the rest of the server.  It loads a made-up set
+ of resources into the resource table in blakres.c and times building
+ packets full of them the way commcli.c does for STRING_RESOURCE sends,
+ against the way the table used to work (a chained hash table on
+ resource id, with each text allocated separately and measured with
+ strlen every time it was sent).  It also checks that both ways send
+ the same bytes.  Build it with "make -f makefile.linux rscbench" and
+ run bin/rscbench [resources] [iterations].
+
+ */
+
+#include "blakserv.h"
+
+#define BENCH_DEFAULT_RESOURCES 40000
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_SENDS_PER_PACKET 40
+#define OLD_RESOURCE_HASH 99971
+
+static const char *rsc_texts[] =
+{
+   "a",
+   "the",
+   "You feel a little better.",
+   "%s%s has been slain by %s%s.",
+   "orc pit guard",
+   "A stout wooden shield, banded with iron and painted with the crest of the Duke.",
+   "You can't do that while you're moving.",
+   "Marion",
+   "The priestess of Shal'ille smiles at you and says, \"Be well, child.\"",
+   "troll",
+   "You don't have enough mana to cast that spell.",
+   "This scroll is covered in runes you cannot make out, though one of them looks like a skull.",
+};
+
+#define NUM_RSC_TEXTS ((int)(sizeof(rsc_texts)/sizeof(rsc_texts[0])))
+
+/* the table as it was, for reference */
+
+typedef struct old_resource_struct
+{
+   int resource_id;
+   char *resource_val;
+   struct old_resource_struct *next;
+} old_resource_node;
+
+static old_resource_node *old_resources[OLD_RESOURCE_HASH];
+
+static void OldAddResource(int id,const char *str_value)
+{
+   old_resource_node *r;
+
+   r = (old_resource_node *)AllocateMemory(MALLOC_ID_RESOURCE,sizeof(old_resource_node));
+   r->resource_id = id;
+   r->resource_val = (char *)AllocateMemory(MALLOC_ID_RESOURCE,strlen(str_value)+1);
+   strcpy(r->resource_val,str_value);
+   r->next = old_resources[id % OLD_RESOURCE_HASH];
+   old_resources[id % OLD_RESOURCE_HASH] = r;
+}
+
+static old_resource_node * OldGetResourceByID(int id)
+{
+   old_resource_node *r;
+
+   for (r = old_resources[id % OLD_RESOURCE_HASH]; r != NULL; r = r->next)
+      if (r->resource_id == id)
+         return r;
+   return NULL;
+}
+
+Bool InMainLoop(void)
+{
+   return False;
+}
+
+static double NowNanoseconds(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static void Report(const char *name,double old_ns,double new_ns,INT64 calls,int mismatches)
+{
+   printf("%-18s %8.1f ns/call before, %8.1f ns/call now, %5.2fx%s\n",name,
+          old_ns/calls,new_ns/calls,new_ns > 0 ? old_ns/new_ns : 0.0,
+          mismatches ? "  RESULTS DIFFER" : "");
+}
+
+/* MakeText
+*
+* Every other resource shares its text with many others, like the
+* names and messages the kod repeats; the rest are unique.
+*/
+static void MakeText(char *buf,int id)
+{
+   if (id % 2 == 0)
+      strcpy(buf,rsc_texts[id % NUM_RSC_TEXTS]);
+   else
+      sprintf(buf,"%s (%i)",rsc_texts[id % NUM_RSC_TEXTS],id);
+}
+
+int main(int argc,char **argv)
+{
+   int num_resources,iterations,i,k,id,mismatches;
+   unsigned int seed;
+   char buf[200];
+   double start,old_ns,new_ns;
+   INT64 calls;
+   old_resource_node *old_r;
+   resource_node *r;
+   resource_statistics rstat;
+   volatile int sink = 0;
+
+   num_resources = BENCH_DEFAULT_RESOURCES;
+   iterations = BENCH_DEFAULT_ITERATIONS;
+   if (argc > 1)
+      num_resources = atoi(argv[1]);
+   if (argc > 2)
+      iterations = atoi(argv[2]);
+   if (num_resources <= 0 || iterations <= 0)
+   {
+      fprintf(stderr,"usage: rscbench [resources] [iterations]\n");
+      return 1;
+   }
+
+   InitMemory();
+   InitConfig();
+   LoadConfig();
+   InitBufferPool();
+   InitCommCli();
+   InitResource();
+
+   printf("%i resources, %i iterations of sending each once in %i-string packets\n",
+          num_resources,iterations,BENCH_SENDS_PER_PACKET);
+
+   /* loading, as from the .rsc files */
+   start = NowNanoseconds();
+   for (id=1;id<=num_resources;id++)
+   {
+      MakeText(buf,id);
+      OldAddResource(id,buf);
+   }
+   old_ns = NowNanoseconds() - start;
+   start = NowNanoseconds();
+   for (id=1;id<=num_resources;id++)
+   {
+      MakeText(buf,id);
+      AddResource(id,buf);
+   }
+   new_ns = NowNanoseconds() - start;
+   Report("AddResource",old_ns,new_ns,num_resources,0);
+
+   mismatches = 0;
+   for (id=1;id<=num_resources;id++)
+   {
+      old_r = OldGetResourceByID(id);
+      r = GetResourceByID(id);
+      if (r == NULL || old_r == NULL || r->len_val != (int)strlen(old_r->resource_val) ||
+          memcmp(r->resource_val,old_r->resource_val,r->len_val) != 0)
+         mismatches++;
+   }
+
+   /* packet building, in a scattered order like objects in a room */
+   calls = (INT64)iterations*num_resources;
+   seed = 1;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<num_resources;i++)
+      {
+         seed = seed*1103515245 + 12345;
+         old_r = OldGetResourceByID(1 + (seed >> 8) % num_resources);
+         AddStringToPacket(strlen(old_r->resource_val),old_r->resource_val);
+         if (i % BENCH_SENDS_PER_PACKET == BENCH_SENDS_PER_PACKET - 1)
+            ClearPacket();
+      }
+   ClearPacket();
+   old_ns = NowNanoseconds() - start;
+
+   seed = 1;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<num_resources;i++)
+      {
+         seed = seed*1103515245 + 12345;
+         r = GetResourceByID(1 + (seed >> 8) % num_resources);
+         AddStringToPacket(r->len_val,r->resource_val);
+         if (i % BENCH_SENDS_PER_PACKET == BENCH_SENDS_PER_PACKET - 1)
+            ClearPacket();
+      }
+   ClearPacket();
+   new_ns = NowNanoseconds() - start;
+   Report("Send resource",old_ns,new_ns,calls,mismatches);
+
+   /* just the lookups, without the packet */
+   seed = 1;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<num_resources;i++)
+      {
+         seed = seed*1103515245 + 12345;
+         sink += strlen(OldGetResourceByID(1 + (seed >> 8) % num_resources)->resource_val);
+      }
+   old_ns = NowNanoseconds() - start;
+   seed = 1;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<num_resources;i++)
+      {
+         seed = seed*1103515245 + 12345;
+         sink += GetResourceByID(1 + (seed >> 8) % num_resources)->len_val;
+      }
+   new_ns = NowNanoseconds() - start;
+   Report("Lookup and length",old_ns,new_ns,calls,0);
+
+   GetResourceStats(&rstat);
+   printf("%i distinct texts for %i resources, %lli bytes of text in %lli bytes of arena\n",
+          rstat.num_texts,rstat.num_resources,(long long)rstat.text_bytes,
+          (long long)rstat.arena_bytes);
+
+   return mismatches ? 1 : 0;
+}
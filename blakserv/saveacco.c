@@ -9,14 +9,19 @@
  * saveacco.c
  *
 
- This module saves account information to a file, with the password in
- a cheesy pseudo-encoded format.  See loadacco.c for the format of the
- file.
+ This module saves account information to a text file, with the password
+ in a cheesy pseudo-encoded format.  See loadacco.c for the format of the
+ file.  The accounts are kept in the account store (accostore.c); this
+ file is only written with each save when [Save] AccountText is on, or by
+ "save accounts".
 
  */
 
 #include "blakserv.h"
 
+/* longest password we write out, more than any encrypted one */
+#define MAX_SAVE_PASSWORD 256
+
 FILE *accofile;
 
 /* local function prototypes */
@@ -39,20 +44,20 @@ Bool SaveAccounts(char *filename)
 
 void SaveEachAccount(account_node *a)
 {
+   static const char hex_digits[] = "0123456789abcdef";
+   char hex[2*MAX_SAVE_PASSWORD+1];
    unsigned char *ptr;
-   
-   fprintf(accofile,"ACCOUNT %i:%s:",a->account_id,a->name);
+   int i;
 
    ptr = (unsigned char *) a->password;
-   while (*ptr != 0)
+   for (i=0;ptr[i] != 0 && i < MAX_SAVE_PASSWORD;i++)
    {
-      fprintf(accofile,"%02x",*ptr);
-      ptr++;
+      hex[2*i] = hex_digits[ptr[i] >> 4];
+      hex[2*i+1] = hex_digits[ptr[i] & 0xf];
    }
+   hex[2*i] = 0;
 
-   if (a->password[0] == 0)
-      fprintf(accofile,"None");
-
-   fprintf(accofile,":%i:%lli:%i:%lli\n",a->type,(long long) a->last_login_time,
+   fprintf(accofile,"ACCOUNT %i:%s:%s:%i:%lli:%i:%lli\n",a->account_id,a->name,
+           i == 0 ? "None" : hex,a->type,(long long) a->last_login_time,
            a->credits,(long long) a->suspend_time);
 }
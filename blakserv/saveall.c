@@ -9,7 +9,7 @@
  * saveall.c
  *
 
- This module uses the three save modules, saveacco.c, savegame.c, and
+ This module uses the save modules, accostore.c, savegame.c, and
  savestr.c to save the entire system.  If successful, it modifies a
  control file with the current date and time so that loadall.c will
  know which game to load in.  This control file has the time (as an
@@ -25,6 +25,7 @@ INT64 SaveAll(void)
 {
    Bool save_ok;
    INT64 save_time;
+   UINT64 start_time;
    char save_name[MAX_PATH+FILENAME_MAX];
    char time_str[100];
    
@@ -45,6 +46,7 @@ INT64 SaveAll(void)
       We make our own copy since the time functions use a static
       buffer. */
    save_time = GetTime();
+   start_time = GetMicroCount();
    sprintf(time_str,"%lli",(long long) save_time);
    
    save_ok = True;
@@ -59,19 +61,31 @@ INT64 SaveAll(void)
    if (SaveStrings(save_name) == False)
       save_ok = False;
 
-   sprintf(save_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),ACCOUNT_FILE_SAVE,time_str);
-   if (SaveAccounts(save_name) == False)
+   if (SaveAccountStore(save_time) == False)
       save_ok = False;
 
+   /* the old text format, for anyone who wants to read the accounts */
+   if (ConfigBool(SAVE_ACCOUNT_TEXT))
+   {
+      sprintf(save_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),ACCOUNT_FILE_SAVE,time_str);
+      if (SaveAccounts(save_name) == False)
+	 save_ok = False;
+   }
+
    sprintf(save_name,"%s%s%s",ConfigStr(PATH_LOADSAVE),DYNAMIC_RSC_FILE_SAVE,time_str);
    if (!SaveDynamicRsc(save_name))
       save_ok = False;
 
-   if (save_ok)
-      SaveControlFile(save_time);
+   if (save_ok && !SaveControlFile(save_time))
+      save_ok = False;
+
+   /* only now can a compacted account store drop the previous save */
+   CommitAccountStore(save_ok);
    
    lprintf("Save game successful (time stamp %s).\n", time_str);
 
+   ObserveMetric(METRIC_SAVE,GetMicroCount() - start_time);
+
    if (save_ok)
       return save_time;
 
@@ -79,7 +93,7 @@ INT64 SaveAll(void)
 }
 
 
-void SaveControlFile(INT64 save_time)
+Bool SaveControlFile(INT64 save_time)
 {
    char save_name[MAX_PATH+FILENAME_MAX];
    FILE *savefile;
@@ -89,7 +103,7 @@ void SaveControlFile(INT64 save_time)
    {
       eprintf("SaveContrtolFile can't open %s to save date/time of successful save!!!\n",
 	      save_name);
-      return;
+      return False;
    }
 
    fprintf(savefile,"#\n");
@@ -97,7 +111,9 @@ void SaveControlFile(INT64 save_time)
    fprintf(savefile,"#\n");
    fprintf(savefile,"# Files written:\n");
    fprintf(savefile,"# %s%s%lli\n",ConfigStr(PATH_LOADSAVE),GAME_FILE_SAVE,(long long) save_time);
-   fprintf(savefile,"# %s%s%lli\n",ConfigStr(PATH_LOADSAVE),ACCOUNT_FILE_SAVE,(long long) save_time);
+   fprintf(savefile,"# %s%s\n",ConfigStr(PATH_LOADSAVE),ACCOUNT_STORE_FILE);
+   if (ConfigBool(SAVE_ACCOUNT_TEXT))
+      fprintf(savefile,"# %s%s%lli\n",ConfigStr(PATH_LOADSAVE),ACCOUNT_FILE_SAVE,(long long) save_time);
    fprintf(savefile,"# %s%s%lli\n",ConfigStr(PATH_LOADSAVE),STRING_FILE_SAVE,(long long) save_time);
    fprintf(savefile,"# %s%s%lli\n",ConfigStr(PATH_LOADSAVE),DYNAMIC_RSC_FILE_SAVE,(long long) save_time);
    fprintf(savefile,"#\n");
@@ -106,5 +122,10 @@ void SaveControlFile(INT64 save_time)
    fprintf(savefile,"\n");
    fprintf(savefile,"LASTSAVE %lli\n",(long long) save_time);
    
-   fclose(savefile);
+   if (fclose(savefile) != 0)
+   {
+      eprintf("SaveControlFile error writing %s\n",save_name);
+      return False;
+   }
+   return True;
 }
@@ -15,6 +15,6 @@
 
 // Returns timestamp of save
 INT64 SaveAll(void);
-void SaveControlFile(INT64 save_time);
+Bool SaveControlFile(INT64 save_time);
 
 #endif
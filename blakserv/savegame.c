@@ -11,9 +11,20 @@
 
   This module saves game information to the file, so it can be loaded
   in by loadgame.c at some future time.
+
+  Version 1 files are a stream of records, each led by a type byte.
+  Version 2 files group the same records into sections (see savegame.h);
+  each section is built in memory, checksummed, optionally compressed,
+  and written with a single fwrite.  The [Save] Version config value
+  picks which one we write, so a server can still hand its saves to an
+  older binary.  [Save] Compress is off by default: compressing makes a
+  save several times slower, and the timers are paused for all of it,
+  so it only pays where disk space matters more than that pause.
   
 */
 
+#include <zlib.h>
+
 #include "blakserv.h"
 
 typedef struct
@@ -22,36 +33,57 @@ typedef struct
 	unsigned int tag:4;
 } unsigned_type;
 
+typedef struct
+{
+	save_section_header header;
+	char *buf;
+	int max_len;
+	char *zbuf;
+	int max_zlen;
+	INT64 total_len;
+	INT64 total_stored_len;
+} save_section_type;
+
 FILE *savefile;
+int save_file_version;
+Bool save_compress;
+Bool save_error;
+save_section_type save_section;
+
+/* message ids used by timers, saved once in version 2 */
+int *save_messages;
+int num_save_messages,max_save_messages;
 
 #define SaveGameWrite(buf,len) \
 { \
-	if (fwrite(buf,len,1,savefile) != 1) \
-	eprintf("File %s Line %i error writing to file!\n",__FILE__,__LINE__); \
+	if (save_file_version >= 2) \
+		SaveSectionWrite(buf,len); \
+	else if (fwrite(buf,len,1,savefile) != 1) \
+	{ \
+		eprintf("File %s Line %i error writing to file!\n",__FILE__,__LINE__); \
+		save_error = True; \
+	} \
 } 
 
 #define SaveGameWriteByte(byte) \
 { \
 	char ch; \
 	ch = byte; \
-	if (fwrite(&ch,1,1,savefile) != 1) \
-	eprintf("File %s Line %i error writing to file!\n",__FILE__,__LINE__); \
+	SaveGameWrite(&ch,1); \
 } 
 
 #define SaveGameWriteInt(num) \
 { \
 	int temp; \
 	temp = num; \
-	if (fwrite(&temp,4,1,savefile) != 1) \
-	eprintf("File %s Line %i error writing to file!\n",__FILE__,__LINE__); \
+	SaveGameWrite(&temp,4); \
 } 
 
 #define SaveGameWriteInt64(num) \
 { \
 	INT64 temp; \
 	temp = num; \
-	if (fwrite(&temp,8,1,savefile) != 1) \
-	eprintf("File %s Line %i error writing to file!\n",__FILE__,__LINE__); \
+	SaveGameWrite(&temp,8); \
 } 
 
 #define SaveGameWriteString(s) \
@@ -74,6 +106,12 @@ FILE *savefile;
 
 /* local function prototypes */
 
+void SaveGameBeginRecord(int type);
+void SaveSectionBegin(int type);
+void SaveSectionEnd(void);
+void SaveSectionWrite(const void *buf,int len);
+void SaveSectionFree(void);
+
 void SaveClasses(void);
 void SaveEachClass(class_node *c);
 void SaveResources(void);
@@ -83,6 +121,8 @@ void SaveObjects(void);
 void SaveEachObject(object_node *o);
 void SaveListNodes(void);
 void SaveEachListNode(list_node *l,int list_id);
+void SaveMessages(void);
+void SaveAddEachTimerMessage(timer_node *t);
 void SaveTimers(void);
 void SaveEachTimer(timer_node *t);
 void SaveUsers(void);
@@ -93,6 +133,20 @@ const char *GetTagShortName(val_type val);
 
 Bool SaveGame(char *filename)
 {
+	UINT64 start_time;
+
+	start_time = GetMilliCount();
+
+	save_file_version = ConfigInt(SAVE_VERSION);
+	if (save_file_version != 1 && save_file_version != 2)
+	{
+		eprintf("SaveGame can't write unknown save game version %i, using 2\n",
+			save_file_version);
+		save_file_version = 2;
+	}
+	save_compress = ConfigBool(SAVE_COMPRESS);
+	save_error = False;
+
 	savefile = fopen(filename,"wb");
 	if (savefile == NULL)
 	{
@@ -100,21 +154,169 @@ Bool SaveGame(char *filename)
 		return False;
 	}
 
-	// Version number
-	SaveGameWriteByte('V');
-	SaveGameWriteInt(1);
+	// Version number, written straight to the file in either version
+	if (fwrite("V",1,1,savefile) != 1 || fwrite(&save_file_version,4,1,savefile) != 1)
+	{
+		eprintf("SaveGame error writing version to %s\n",filename);
+		save_error = True;
+	}
+
+	save_section.header.type = 0;
+	save_section.total_len = 0;
+	save_section.total_stored_len = 0;
 
 	SaveClasses();
 	SaveResources();
 	SaveSystem();
 	SaveObjects();
 	SaveListNodes();
+	SaveMessages();
 	SaveTimers(); 
 	SaveUsers();
+
+	if (save_file_version >= 2)
+	{
+		SaveSectionEnd();
+
+		/* the end marker tells the loader the file wasn't truncated */
+		SaveSectionBegin(SAVE_GAME_END);
+		SaveSectionEnd();
+		SaveSectionFree();
+	}
 	
-	fclose(savefile);
+	if (fclose(savefile) != 0)
+	{
+		eprintf("SaveGame error closing %s\n",filename);
+		save_error = True;
+	}
+
+	if (save_file_version >= 2)
+		lprintf("SaveGame wrote version %i, %lli bytes (%lli stored) in %u ms\n",
+			save_file_version,(long long)save_section.total_len,
+			(long long)save_section.total_stored_len,
+			(unsigned int)(GetMilliCount() - start_time));
+	else
+		lprintf("SaveGame wrote version %i in %u ms\n",save_file_version,
+			(unsigned int)(GetMilliCount() - start_time));
 	
-	return True;
+	return !save_error;
+}
+
+/* SaveGameBeginRecord
+*
+* Version 1 leads each record with its type byte.  Version 2 just counts
+* records into the open section, starting a new one when the type changes
+* or the current one has gotten big.
+*/
+void SaveGameBeginRecord(int type)
+{
+	if (save_file_version < 2)
+	{
+		SaveGameWriteByte(type);
+		return;
+	}
+
+	if (save_section.header.type != type || save_section.header.len >= SAVE_SECTION_SPLIT_LEN)
+	{
+		SaveSectionEnd();
+		SaveSectionBegin(type);
+	}
+	save_section.header.count++;
+}
+
+void SaveSectionBegin(int type)
+{
+	save_section.header.type = type;
+	save_section.header.flags = 0;
+	save_section.header.count = 0;
+	save_section.header.len = 0;
+	save_section.header.stored_len = 0;
+	save_section.header.crc = 0;
+}
+
+void SaveSectionWrite(const void *buf,int len)
+{
+	int old_len;
+
+	if (save_section.header.len + len > save_section.max_len)
+	{
+		old_len = save_section.max_len;
+		if (save_section.max_len == 0)
+			save_section.max_len = SAVE_SECTION_SPLIT_LEN + SAVE_SECTION_SPLIT_LEN/4;
+		while (save_section.header.len + len > save_section.max_len)
+			save_section.max_len *= 2;
+
+		if (save_section.buf == NULL)
+			save_section.buf = (char *)AllocateMemory(MALLOC_ID_SAVE_GAME,save_section.max_len);
+		else
+			save_section.buf = (char *)ResizeMemory(MALLOC_ID_SAVE_GAME,save_section.buf,old_len,
+														  save_section.max_len);
+	}
+
+	memcpy(save_section.buf + save_section.header.len,buf,len);
+	save_section.header.len += len;
+}
+
+void SaveSectionEnd(void)
+{
+	save_section_header *h;
+	const char *payload;
+	uLongf zlen;
+
+	h = &save_section.header;
+	if (h->type == 0)
+		return;
+
+	h->crc = CRC32(save_section.buf,h->len);
+	h->flags = 0;
+	h->stored_len = h->len;
+	payload = save_section.buf;
+
+	if (save_compress && h->len > 0)
+	{
+		zlen = compressBound(h->len);
+		if ((int)zlen > save_section.max_zlen)
+		{
+			if (save_section.zbuf != NULL)
+				FreeMemory(MALLOC_ID_SAVE_GAME,save_section.zbuf,save_section.max_zlen);
+			save_section.max_zlen = zlen;
+			save_section.zbuf = (char *)AllocateMemory(MALLOC_ID_SAVE_GAME,save_section.max_zlen);
+		}
+
+		/* store it raw if zlib doesn't help, which is common for tiny sections */
+		if (compress2((Bytef *)save_section.zbuf,&zlen,(const Bytef *)save_section.buf,h->len,
+						  Z_BEST_SPEED) == Z_OK && (int)zlen < h->len)
+		{
+			h->flags |= SAVE_SECTION_COMPRESSED;
+			h->stored_len = zlen;
+			payload = save_section.zbuf;
+		}
+	}
+
+	if (fwrite(h,sizeof(save_section_header),1,savefile) != 1 ||
+		 (h->stored_len > 0 && fwrite(payload,h->stored_len,1,savefile) != 1))
+	{
+		eprintf("SaveSectionEnd error writing section type %i to file!\n",h->type);
+		save_error = True;
+	}
+
+	save_section.total_len += sizeof(save_section_header) + h->len;
+	save_section.total_stored_len += sizeof(save_section_header) + h->stored_len;
+
+	h->type = 0;
+}
+
+void SaveSectionFree(void)
+{
+	if (save_section.buf != NULL)
+		FreeMemory(MALLOC_ID_SAVE_GAME,save_section.buf,save_section.max_len);
+	save_section.buf = NULL;
+	save_section.max_len = 0;
+
+	if (save_section.zbuf != NULL)
+		FreeMemory(MALLOC_ID_SAVE_GAME,save_section.zbuf,save_section.max_zlen);
+	save_section.zbuf = NULL;
+	save_section.max_zlen = 0;
 }
 
 void SaveClasses(void)
@@ -134,7 +336,7 @@ void SaveEachClass(class_node *c)
 		return;
 	}
 	
-	SaveGameWriteByte(SAVE_GAME_CLASS);
+	SaveGameBeginRecord(SAVE_GAME_CLASS);
 	SaveGameWriteInt(c->class_id);
 	SaveGameWriteString(c->class_name);
 	SaveGameWriteInt(c->num_properties);
@@ -164,14 +366,14 @@ void SaveEachResource(resource_node *r)
 		return;
 	}
 	
-	SaveGameWriteByte(SAVE_GAME_RESOURCE);
+	SaveGameBeginRecord(SAVE_GAME_RESOURCE);
 	SaveGameWriteInt(r->resource_id);
 	SaveGameWriteString(r->resource_name);
 }
 
 void SaveSystem(void)
 {
-	SaveGameWriteByte(SAVE_GAME_SYSTEM);
+	SaveGameBeginRecord(SAVE_GAME_SYSTEM);
 	SaveGameWriteInt(GetSystemObjectID());
 }
 
@@ -192,7 +394,7 @@ void SaveEachObject(object_node *o)
 		return;
 	}
 	
-	SaveGameWriteByte(SAVE_GAME_OBJECT);
+	SaveGameBeginRecord(SAVE_GAME_OBJECT);
 	SaveGameWriteInt(o->object_id);
 	SaveGameWriteInt(o->class_id);
 	SaveGameWriteInt(c->num_properties);
@@ -207,17 +409,79 @@ void SaveEachObject(object_node *o)
 
 void SaveListNodes(void)
 {
-	SaveGameWriteByte(SAVE_GAME_LIST_NODES);
-	SaveGameWriteInt(GetListNodesUsed());
+	/* version 2 counts the nodes per section instead */
+	if (save_file_version < 2)
+	{
+		SaveGameWriteByte(SAVE_GAME_LIST_NODES);
+		SaveGameWriteInt(GetListNodesUsed());
+	}
 	ForEachListNode(SaveEachListNode);
 }
 
 void SaveEachListNode(list_node *l,int list_id)
 {
+	if (save_file_version >= 2)
+		SaveGameBeginRecord(SAVE_GAME_LIST_NODES);
 	SaveGameWriteInt64(l->first.int_val);
 	SaveGameWriteInt64(l->rest.int_val);
 }
 
+/* SaveMessages
+*
+* Version 2 timers refer to their message by name id, and the names are
+* written here once rather than with every timer.
+*/
+void SaveMessages(void)
+{
+	int i;
+
+	if (save_file_version < 2)
+		return;
+
+	num_save_messages = 0;
+	max_save_messages = 0;
+	save_messages = NULL;
+
+	ForEachTimer(SaveAddEachTimerMessage);
+
+	for (i=0;i<num_save_messages;i++)
+	{
+		SaveGameBeginRecord(SAVE_GAME_MESSAGE);
+		SaveGameWriteInt(save_messages[i]);
+		SaveGameWriteString(GetNameByID(save_messages[i]));
+	}
+
+	if (save_messages != NULL)
+		FreeMemory(MALLOC_ID_SAVE_GAME,save_messages,max_save_messages*sizeof(int));
+	save_messages = NULL;
+}
+
+void SaveAddEachTimerMessage(timer_node *t)
+{
+	int i,old_max;
+
+	if (GetNameByID(t->message_id) == NULL)
+		return;
+
+	/* few distinct messages are used by timers, so a scan is fine */
+	for (i=0;i<num_save_messages;i++)
+		if (save_messages[i] == t->message_id)
+			return;
+
+	if (num_save_messages == max_save_messages)
+	{
+		old_max = max_save_messages;
+		max_save_messages = (max_save_messages == 0) ? 64 : 2*max_save_messages;
+		if (save_messages == NULL)
+			save_messages = (int *)AllocateMemory(MALLOC_ID_SAVE_GAME,
+															  max_save_messages*sizeof(int));
+		else
+			save_messages = (int *)ResizeMemory(MALLOC_ID_SAVE_GAME,save_messages,
+															old_max*sizeof(int),max_save_messages*sizeof(int));
+	}
+	save_messages[num_save_messages++] = t->message_id;
+}
+
 void SaveTimers(void)
 {
 	ForEachTimer(SaveEachTimer);
@@ -243,12 +507,19 @@ void SaveEachTimer(timer_node *t)
 		return;
 	}
 	
-	SaveGameWriteByte(SAVE_GAME_TIMER);
+	SaveGameBeginRecord(SAVE_GAME_TIMER);
 	SaveGameWriteInt(t->timer_id);
 	SaveGameWriteInt(t->object_id);
-	SaveGameWriteString(GetNameByID(t->message_id));
+	if (save_file_version >= 2)
+	{
+		SaveGameWriteInt(t->message_id);
+	}
+	else
+	{
+		SaveGameWriteString(GetNameByID(t->message_id));
+	}
 	
-	save_time = (INT64)(t->time - GetMilliCount());
+	save_time = (INT64)(t->time - GetGameMilliCount());
 	if (save_time < 0)
 		save_time = 0;
 	SaveGameWriteInt64(save_time);
@@ -261,7 +532,7 @@ void SaveUsers(void)
 
 void SaveEachUser(user_node *u)
 {
-	SaveGameWriteByte(SAVE_GAME_USER);
+	SaveGameBeginRecord(SAVE_GAME_USER);
 	SaveGameWriteInt(u->account_id);
 	SaveGameWriteInt(u->object_id);
 }
@@ -21,9 +21,34 @@ enum
    SAVE_GAME_OBJECT = 4,
    SAVE_GAME_LIST_NODES = 5,
    SAVE_GAME_TIMER = 6,
-   SAVE_GAME_USER = 7
+   SAVE_GAME_USER = 7,
+   SAVE_GAME_MESSAGE = 8,
+   SAVE_GAME_END = 9
 };
 
+/* Version 2 saved games are a sequence of sections, each a header followed
+ * by stored_len bytes of payload.  The payload holds count records of the
+ * section's type, zlib compressed if SAVE_SECTION_COMPRESSED is set.  crc is
+ * the CRC32 of the uncompressed payload.  Bulk sections (objects, list nodes)
+ * are split so no section is much bigger than SAVE_SECTION_SPLIT_LEN, which
+ * keeps the buffer the loader inflates them into small.
+ */
+
+#define SAVE_SECTION_COMPRESSED 0x01
+
+#define SAVE_SECTION_SPLIT_LEN (1024*1024)
+#define SAVE_SECTION_MAX_LEN (64*1024*1024)
+
+typedef struct
+{
+   int type;
+   int flags;
+   int count;
+   int len;
+   int stored_len;
+   unsigned int crc;
+} save_section_header;
+
 Bool SaveGame(char *filename);
 
 #endif
@@ -11,11 +11,19 @@
 
  This module saves the strings to a binary file.
 
+ Strings are saved in id order.  Each is its id followed by its length
+ and text, except that a string with the same text as one saved before
+ it (see string.c, which interns the text) is saved as its id followed
+ by -1 minus the id of that earlier string, and no text.  Version 1
+ files have no shared strings.
+
  */
 
 #include "blakserv.h"
 
 FILE *strfile;
+static int num_saved_shared;
+static INT64 saved_shared_bytes;
 
 /* local function prototypes */
 void SaveEachString(string_node *snod,int string_id);
@@ -32,7 +40,7 @@ Bool SaveStrings(char *filename)
       return False;
    }
 
-   write_int = 1; /* version */
+   write_int = STR_SAVE_VERSION;
    written = fwrite(&write_int, 1, LEN_STR_VERSION, strfile);
    if (written != LEN_STR_VERSION)
       eprintf("SaveStrings 1 error writing to file!\n");
@@ -42,20 +50,39 @@ Bool SaveStrings(char *filename)
    if (written != LEN_NUM_STRS)
       eprintf("SaveStrings 2 error writing to file!\n");
 
+   num_saved_shared = 0;
+   saved_shared_bytes = 0;
+   ClearStringSavedIDs();
+
    ForEachString(SaveEachString);
    fclose(strfile);
 
+   lprintf("SaveStrings saved %i strings, %i shared with an earlier one (%lli bytes not written)\n",
+           GetNumStrings(),num_saved_shared,(long long)saved_shared_bytes);
+
    return True;
 }
 
 void SaveEachString(string_node *snod,int string_id)
 {
-   int written;
+   int written,shared_id;
 
    written = fwrite(&string_id, 1, LEN_STR_ID, strfile);
    if (written != LEN_STR_ID)
       eprintf("SaveEachString 1 error writing to file!\n");
 
+   shared_id = GetSavedStringID(snod,string_id);
+   if (shared_id != INVALID_ID)
+   {
+      shared_id = -1 - shared_id;
+      written = fwrite(&shared_id, 1, LEN_STR_LEN, strfile);
+      if (written != LEN_STR_LEN)
+         eprintf("SaveEachString 2 error writing to file!\n");
+      num_saved_shared++;
+      saved_shared_bytes += snod->len_data;
+      return;
+   }
+
    written = fwrite(&snod->len_data, 1, LEN_STR_LEN, strfile);
    if (written != LEN_STR_LEN)
       eprintf("SaveEachString 2 error writing to file!\n");
@@ -13,6 +13,8 @@
 #ifndef _SAVESTR_H
 #define _SAVESTR_H
 
+#define STR_SAVE_VERSION 2
+
 #define LEN_STR_VERSION 4
 #define LEN_NUM_STRS 4
 #define LEN_STR_ID 4
@@ -10,6 +10,24 @@
  *
 
   This module interprets compiled Blakod.
+
+  Each Send() call site in the bkod gets an inline cache, kept in a
+  small open addressed table keyed by the bkod address of the call.
+  It remembers the receiver's class and message from the last send
+  there, and the handler that was found for them, so the next send
+  from that site to an object of the same class skips looking up the
+  class and walking its message tables.  Most sites only ever send to
+  one class.  The handlers point into the loaded .bof files, so the
+  caches are thrown away whenever the kod is reset.
+
+  Messages posted with PostMessage() wait in a ring of small headers
+  that doubles when it fills, and are sent in order after the top level
+  message that posted them.  Their parms are copied once, into blocks
+  handed out in order and reused when every post in them has been sent,
+  so a waiting post's parms never move and are passed straight to the
+  handler.  [Blakod] PostQueueLimit bounds how many can wait.  A message
+  named in [Blakod] CoalescePosts isn't posted to an object again while
+  the last post of it to that object, with the same parms, is waiting.
   
 */
 
@@ -32,6 +50,31 @@ int trace_session_id = INVALID_ID;
 
 post_queue_type post_q;
 
+/* post number + 1 of a recent post that can be coalesced, by object and message */
+static unsigned int post_coalesce[POST_COALESCE_HASH];
+static int post_coalesce_ids[MAX_COALESCE_MESSAGES];
+static int num_post_coalesce_ids;
+static char *post_coalesce_str; /* the [Blakod] CoalescePosts they came from */
+static Bool post_coalesce_stale = True;
+
+static int most_posts_pending;
+static INT64 num_posts_posted;
+static INT64 num_posts_coalesced;
+static INT64 num_posts_dropped;
+static INT64 num_posts_deferred;
+
+#define INIT_SEND_CACHE_SIZE 4096
+
+/* send_cache_size is a power of 2, and the table is kept at most half full */
+static send_cache_entry *send_cache;
+static int send_cache_size;
+static int send_cache_sites;
+static INT64 send_cache_hits;
+static INT64 send_cache_misses;
+
+/* [Blakod] SendCache, checked at each top level message */
+static Bool send_cache_enabled = True;
+
 
 /* return values for InterpretAtMessage */
 enum
@@ -62,6 +105,16 @@ void InterpretBinaryAssign(int object_id,local_var_type *local_vars,opcode_type
 void InterpretGoto(int object_id,local_var_type *local_vars,
 				   opcode_type opcode,char *inst_start);
 void InterpretCall(int object_id,local_var_type *local_vars,opcode_type opcode);
+send_cache_entry * GetSendCacheEntry(char *call_site);
+void GrowSendCache(void);
+blak_int SendBlakodMessageToHandler(int object_id,class_node *c,message_node *m,
+									int num_parms,parm_node parms[]);
+void SortParms(int num_parms,parm_node parms[]);
+parm_node * AllocatePostParms(int num_parms,post_block **block);
+void ReleasePostParms(post_block *b);
+void GrowPostQueue(void);
+void UpdatePostCoalescing(void);
+Bool IsSamePost(post_node *post,int object_id,int message_id,int num_parms,parm_node parms[]);
 
 void InitProfiling(void)
 {
@@ -100,8 +153,14 @@ void InitBkodInterpret(void)
 	
 	bkod = NULL;
 	
+	post_q.max_posts = INIT_POST_QUEUE;
+	post_q.data = (post_node *)AllocateMemory(MALLOC_ID_MESSAGE,post_q.max_posts*sizeof(post_node));
+	post_q.first = 0;
 	post_q.next = 0;
-	post_q.last = 0;   
+	post_q.oldest = NULL;
+	post_q.newest = NULL;
+	post_q.spare = NULL;
+	post_q.num_blocks = 0;
 	
 	for (i=0;i<MAX_C_FUNCTION;i++)
 		ccall_table[i] = C_Invalid;
@@ -196,6 +255,14 @@ Bool IsInterpreting(void)
 	return bkod != NULL;
 }
 
+/* the message whose handler is running, for census.c */
+int GetInterpretingMessage(void)
+{
+	if (message_depth == 0)
+		return INVALID_ID;
+	return stack[message_depth-1].message_id;
+}
+
 void TraceInfo(int session_id,const char *class_name,int message_id,int num_parms,
 			   parm_node parms[])
 {
@@ -217,35 +284,236 @@ void TraceInfo(int session_id,const char *class_name,int message_id,int num_parm
 	SendSessionAdminText(session_id,"\n");
 }
 
+/* AllocatePostParms
+*
+* Room for a post's parms at the end of the newest block, or in a new
+* one if they don't fit there.
+*/
+parm_node * AllocatePostParms(int num_parms,post_block **block)
+{
+	post_block *b;
+	parm_node *p;
+
+	b = post_q.newest;
+	if (b == NULL || b->used + num_parms > POST_BLOCK_PARMS)
+	{
+		if (post_q.spare != NULL)
+		{
+			b = post_q.spare;
+			post_q.spare = b->next;
+		}
+		else
+		{
+			b = (post_block *)AllocateMemory(MALLOC_ID_MESSAGE,sizeof(post_block));
+			post_q.num_blocks++;
+		}
+		b->used = 0;
+		b->pending = 0;
+		b->next = NULL;
+		if (post_q.newest == NULL)
+			post_q.oldest = b;
+		else
+			post_q.newest->next = b;
+		post_q.newest = b;
+	}
+
+	p = &b->parms[b->used];
+	b->used += num_parms;
+	b->pending++;
+	*block = b;
+	return p;
+}
+
+/* ReleasePostParms
+*
+* Called after a post with parms in block b has been sent.  Since posts
+* are sent in order, the blocks empty out oldest first.
+*/
+void ReleasePostParms(post_block *b)
+{
+	b->pending--;
+
+	while (post_q.oldest != NULL && post_q.oldest->pending == 0)
+	{
+		b = post_q.oldest;
+		if (b == post_q.newest)
+		{
+			b->used = 0;
+			break;
+		}
+		post_q.oldest = b->next;
+		b->next = post_q.spare;
+		post_q.spare = b;
+	}
+}
+
+void GrowPostQueue(void)
+{
+	post_node *new_data;
+	int new_max;
+	unsigned int n;
+
+	/* keep each post at its number mod the size */
+	new_max = 2*post_q.max_posts;
+	new_data = (post_node *)AllocateMemory(MALLOC_ID_MESSAGE,new_max*sizeof(post_node));
+	for (n=post_q.first;n!=post_q.next;n++)
+		new_data[n & (new_max-1)] = post_q.data[n & (post_q.max_posts-1)];
+	FreeMemory(MALLOC_ID_MESSAGE,post_q.data,post_q.max_posts*sizeof(post_node));
+	post_q.data = new_data;
+	post_q.max_posts = new_max;
+}
+
+/* UpdatePostCoalescing
+*
+* Looks up the messages named in [Blakod] CoalescePosts again if it has
+* changed, or the kod has been reloaded, since the last time.
+*/
+void UpdatePostCoalescing(void)
+{
+	char *str,*names,*name;
+	int message_id;
+
+	str = LockConfigStr(BLAKOD_COALESCE_POSTS);
+	if (str == NULL || (!post_coalesce_stale && post_coalesce_str != NULL &&
+							  strcmp(str,post_coalesce_str) == 0))
+	{
+		UnlockConfigStr();
+		return;
+	}
+
+	if (post_coalesce_str != NULL)
+		FreeMemory(MALLOC_ID_MESSAGE,post_coalesce_str,strlen(post_coalesce_str)+1);
+	post_coalesce_str = (char *)AllocateMemory(MALLOC_ID_MESSAGE,strlen(str)+1);
+	strcpy(post_coalesce_str,str);
+	UnlockConfigStr();
+
+	post_coalesce_stale = False;
+	num_post_coalesce_ids = 0;
+	memset(post_coalesce,0,sizeof(post_coalesce));
+
+	names = (char *)AllocateMemory(MALLOC_ID_MESSAGE,strlen(post_coalesce_str)+1);
+	strcpy(names,post_coalesce_str);
+	for (name = strtok(names," ,\t");name != NULL;name = strtok(NULL," ,\t"))
+	{
+		message_id = GetIDByName(name);
+		if (message_id == INVALID_ID)
+		{
+			eprintf("UpdatePostCoalescing can't find MESSAGE %s\n",name);
+			continue;
+		}
+		if (num_post_coalesce_ids == MAX_COALESCE_MESSAGES)
+		{
+			eprintf("UpdatePostCoalescing can only coalesce %i messages\n",MAX_COALESCE_MESSAGES);
+			break;
+		}
+		post_coalesce_ids[num_post_coalesce_ids++] = message_id;
+	}
+	FreeMemory(MALLOC_ID_MESSAGE,names,strlen(post_coalesce_str)+1);
+}
+
+/* ResetPostCoalescing
+*
+* The message ids can change when the kod is reloaded.
+*/
+void ResetPostCoalescing(void)
+{
+	post_coalesce_stale = True;
+}
+
+Bool IsSamePost(post_node *post,int object_id,int message_id,int num_parms,parm_node parms[])
+{
+	int i;
+
+	if (post->object_id != object_id || post->message_id != message_id ||
+		 post->num_parms != num_parms)
+		return False;
+
+	for (i=0;i<num_parms;i++)
+		if (post->parms[i].name_id != parms[i].name_id || post->parms[i].value != parms[i].value)
+			return False;
+
+	return True;
+}
+
 void PostBlakodMessage(int object_id,int message_id,int num_parms,parm_node parms[])
 {
-	int i,new_next;
-	
-	new_next = (post_q.next + 1) % MAX_POST_QUEUE;
-	if (new_next == post_q.last)
+	post_node *post;
+	unsigned int pending,n,*coalesce;
+	int i,limit;
+
+	pending = post_q.next - post_q.first;
+
+	coalesce = NULL;
+	for (i=0;i<num_post_coalesce_ids;i++)
+		if (post_coalesce_ids[i] == message_id)
+		{
+			coalesce = &post_coalesce[(object_id*31 + message_id) & (POST_COALESCE_HASH-1)];
+			/* the post it remembers might have been sent already */
+			n = *coalesce - 1;
+			if (*coalesce != 0 && n - post_q.first < pending &&
+				 IsSamePost(&post_q.data[n & (post_q.max_posts-1)],object_id,message_id,
+								num_parms,parms))
+			{
+				num_posts_coalesced++;
+				return;
+			}
+			break;
+		}
+
+	limit = ConfigInt(BLAKOD_POST_QUEUE_LIMIT);
+	if (limit > 0 && pending >= (unsigned int)limit)
 	{
 		bprintf("PostBlakodMessage can't post MESSAGE %s (%i) to OBJECT %i; queue filled\n",
 			GetNameByID(message_id),message_id,object_id);
+		num_posts_dropped++;
 		return;
 	}
-	post_q.data[post_q.next].object_id = object_id;
-	post_q.data[post_q.next].message_id = message_id;
-	post_q.data[post_q.next].num_parms = num_parms;
-	for (i=0;i<num_parms;i++)
+
+	if (pending == (unsigned int)post_q.max_posts)
+		GrowPostQueue();
+
+	post = &post_q.data[post_q.next & (post_q.max_posts-1)];
+	post->object_id = object_id;
+	post->message_id = message_id;
+	post->num_parms = num_parms;
+	post->parms = NULL;
+	post->block = NULL;
+	if (num_parms > 0)
 	{
-		post_q.data[post_q.next].parms[i] = parms[i];
+		post->parms = AllocatePostParms(num_parms,&post->block);
+		memcpy(post->parms,parms,num_parms*sizeof(parm_node));
 	}
-	post_q.next = new_next;
+
+	if (coalesce != NULL)
+		*coalesce = post_q.next + 1;
+	post_q.next++;
+	num_posts_posted++;
+	if ((int)pending + 1 > most_posts_pending)
+		most_posts_pending = pending + 1;
+}
+
+void GetPostQueueStats(post_queue_statistics *stat)
+{
+	stat->num_pending = post_q.next - post_q.first;
+	stat->most_pending = most_posts_pending;
+	stat->max_posts = post_q.max_posts;
+	stat->num_blocks = post_q.num_blocks;
+	stat->num_coalesce_messages = num_post_coalesce_ids;
+	stat->num_posted = num_posts_posted;
+	stat->num_coalesced = num_posts_coalesced;
+	stat->num_dropped = num_posts_dropped;
+	stat->num_deferred = num_posts_deferred;
 }
 
 /* returns the return value of the blakod */
 blak_int SendTopLevelBlakodMessage(int object_id,int message_id,int num_parms,parm_node parms[])
 {
 	blak_int ret_val = 0;
-	UINT64 start_time = 0;
+	UINT64 start_time = 0,elapsed = 0;
 	int interp_time = 0;
 	int posts = 0;
 	int accumulated_num_interpreted = 0;
+	post_node post;
 	
 	if (message_depth != 0)
 	{
@@ -253,15 +521,17 @@ blak_int SendTopLevelBlakodMessage(int object_id,int message_id,int num_parms,pa
 	}
 	
 	kod_stat.debugging = ConfigBool(DEBUG_UNINITIALIZED);
+	send_cache_enabled = ConfigBool(BLAKOD_SEND_CACHE);
+	UpdatePostCoalescing();
 	
-	start_time = GetMilliCount();
+	start_time = GetMicroCount();
 	kod_stat.num_top_level_messages++;
 	trace_session_id = INVALID_ID;
 	num_interpreted = 0;
 	
 	ret_val = SendBlakodMessage(object_id,message_id,num_parms,parms);
 	
-	while (post_q.next != post_q.last)
+	while (post_q.first != post_q.next)
 	{
 		posts++;
 		
@@ -278,17 +548,25 @@ blak_int SendTopLevelBlakodMessage(int object_id,int message_id,int num_parms,pa
 				GetClassByID(GetObjectByID(object_id)->class_id)->class_name,
 				GetNameByID(message_id), message_id);
 			
+			/* the rest wait for the next top level message */
+			num_posts_deferred++;
 			break;
 		}
 		
+		/* taken off first, so an identical post made while it runs isn't coalesced into it */
+		post = post_q.data[post_q.first & (post_q.max_posts-1)];
+		post_q.first++;
+
 		/* posted messages' return value is ignored */
-		SendBlakodMessage(post_q.data[post_q.last].object_id,post_q.data[post_q.last].message_id,
-			post_q.data[post_q.last].num_parms,post_q.data[post_q.last].parms);
+		SendBlakodMessage(post.object_id,post.message_id,post.num_parms,post.parms);
 		
-		post_q.last = (post_q.last + 1) % MAX_POST_QUEUE;
+		if (post.block != NULL)
+			ReleasePostParms(post.block);
 	}
 	
-	interp_time = (int)(GetMilliCount() - start_time);
+	elapsed = GetMicroCount() - start_time;
+	ObserveMetric(METRIC_TOP_LEVEL_MESSAGE,elapsed);
+	interp_time = (int)(elapsed/1000);
 	kod_stat.interpreting_time += interp_time;
 	if (interp_time > kod_stat.interpreting_time_highest)
 	{
@@ -323,58 +601,234 @@ blak_int SendTopLevelBlakodMessage(int object_id,int message_id,int num_parms,pa
 	return ret_val;
 }
 
-typedef struct {
-	int class_id;
-	int message_id;
-	int num_params;
-	parm_node *parm;
-} ClassMessage, *PClassMessage;
+/* SendBlakodClassMessage
+*
+* Sends the message to every object of the class or its subclasses, in
+* id order.  The instances are taken from the class index in object.c
+* before the first send, so objects the handlers create aren't sent to,
+* and ones they delete (or whose slots get reused) are skipped.  Returns
+* how many were sent to.
+*/
+int SendBlakodClassMessage(int class_id,int message_id,int num_params,parm_node parm[])
+{
+	class_node *c;
+	int *ids;
+	unsigned int *generations;
+	int i,num_ids,max_ids,num_executed;
+
+	c = GetClassByID(class_id);
+	if (c == NULL)
+		return 0;
+
+	max_ids = GetClassInstanceCount(c,True);
+	if (max_ids == 0)
+		return 0;
+
+	ids = (int *)AllocateMemory(MALLOC_ID_MESSAGE,max_ids*sizeof(int));
+	generations = (unsigned int *)AllocateMemory(MALLOC_ID_MESSAGE,max_ids*sizeof(unsigned int));
+	num_ids = CopyClassInstances(c,ids);
+	for (i=0;i<num_ids;i++)
+		generations[i] = GetObjectGeneration(ids[i]);
+
+	num_executed = 0;
+	for (i=0;i<num_ids;i++)
+	{
+		if (GetObjectGeneration(ids[i]) != generations[i])
+			continue;
+		SendBlakodMessage(ids[i],message_id,num_params,parm);
+		num_executed++;
+	}
+
+	FreeMemory(MALLOC_ID_MESSAGE,ids,max_ids*sizeof(int));
+	FreeMemory(MALLOC_ID_MESSAGE,generations,max_ids*sizeof(unsigned int));
+	return num_executed;
+}
+
+void ResetSendCache(void)
+{
+	if (send_cache != NULL)
+		FreeMemory(MALLOC_ID_MESSAGE,send_cache,send_cache_size*sizeof(send_cache_entry));
+	send_cache = NULL;
+	send_cache_size = 0;
+	send_cache_sites = 0;
+	send_cache_hits = 0;
+	send_cache_misses = 0;
+}
 
-static ClassMessage classMsg;
-static int numExecuted;
+#define SendCacheHash(p) ((unsigned int)(((UINT64)(p) >> 2) * 2654435761U))
 
-void SendClassMessage(object_node *object)
+/* GetSendCacheEntry
+*
+* Returns the cache for the call site, adding an empty one if it's new.
+* The entry is only good until the next call, which might grow the table.
+*/
+send_cache_entry * GetSendCacheEntry(char *call_site)
 {
-	class_node *c = GetClassByID(object->class_id);
-	do
+	send_cache_entry *e;
+	unsigned int i;
+
+	if (2*(send_cache_sites + 1) > send_cache_size)
+		GrowSendCache();
+
+	i = SendCacheHash(call_site) & (send_cache_size - 1);
+	for (;;)
 	{
-		if (c->class_id == classMsg.class_id)
-		{
-			SendBlakodMessage(object->object_id,classMsg.message_id,classMsg.num_params,classMsg.parm);
-			numExecuted++;
-			return;
-		}
-		c = c->super_ptr;
-	} while (c != NULL);
+		e = &send_cache[i];
+		if (e->call_site == call_site)
+			return e;
+		if (e->call_site == NULL)
+			break;
+		i = (i + 1) & (send_cache_size - 1);
+	}
+
+	e->call_site = call_site;
+	e->caller_class_id = kod_stat.interpreting_class;
+	e->class_id = INVALID_CLASS;
+	e->message_id = INVALID_ID;
+	e->handler_class = NULL;
+	e->m = NULL;
+	e->hits = 0;
+	e->misses = 0;
+	send_cache_sites++;
+
+	return e;
 }
 
-int SendBlakodClassMessage(int class_id,int message_id,int num_params,parm_node parm[])
+void GrowSendCache(void)
+{
+	send_cache_entry *old_cache;
+	int old_size,i;
+	unsigned int j;
+
+	old_cache = send_cache;
+	old_size = send_cache_size;
+
+	send_cache_size = (old_size == 0) ? INIT_SEND_CACHE_SIZE : 2*old_size;
+	send_cache = (send_cache_entry *)
+		AllocateMemory(MALLOC_ID_MESSAGE,send_cache_size*sizeof(send_cache_entry));
+	memset(send_cache,0,send_cache_size*sizeof(send_cache_entry));
+
+	for (i=0;i<old_size;i++)
+	{
+		if (old_cache[i].call_site == NULL)
+			continue;
+		j = SendCacheHash(old_cache[i].call_site) & (send_cache_size - 1);
+		while (send_cache[j].call_site != NULL)
+			j = (j + 1) & (send_cache_size - 1);
+		send_cache[j] = old_cache[i];
+	}
+
+	if (old_cache != NULL)
+		FreeMemory(MALLOC_ID_MESSAGE,old_cache,old_size*sizeof(send_cache_entry));
+}
+
+void GetSendCacheStats(send_cache_statistics *stat)
+{
+	stat->num_sites = send_cache_sites;
+	stat->table_size = send_cache_size;
+	stat->hits = send_cache_hits;
+	stat->misses = send_cache_misses;
+}
+
+void ForEachSendCacheSite(void (*callback_func)(send_cache_entry *e))
+{
+	int i;
+
+	for (i=0;i<send_cache_size;i++)
+		if (send_cache[i].call_site != NULL)
+			callback_func(&send_cache[i]);
+}
+
+/* SendBlakodMessageFromCall
+*
+* Send() from the bkod, which uses the inline cache for the call site.
+* bkod is just past the call, so it's different for each site.
+*/
+blak_int SendBlakodMessageFromCall(int object_id,int message_id,int num_parms,parm_node parms[])
+{
+	object_node *o;
+	class_node *c;
+	message_node *m;
+	send_cache_entry *e;
+
+	if (!send_cache_enabled || bkod == NULL)
+		return SendBlakodMessage(object_id,message_id,num_parms,parms);
+
+	o = GetObjectByID(object_id);
+	if (o == NULL)
+	{
+		bprintf("SendBlakodMessage can't find OBJECT %i\n",object_id);
+		return NIL;
+	}
+
+	e = GetSendCacheEntry(bkod);
+	if (e->class_id == o->class_id && e->message_id == message_id)
+	{
+		e->hits++;
+		send_cache_hits++;
+		return SendBlakodMessageToHandler(object_id,e->handler_class,e->m,num_parms,parms);
+	}
+
+	e->misses++;
+	send_cache_misses++;
+
+	c = GetClassByID(o->class_id);
+	if (c == NULL)
+	{
+		eprintf("SendBlakodMessage OBJECT %i can't find CLASS %i\n",
+			object_id,o->class_id);
+		return NIL;
+	}
+
+	m = GetMessageByID(c->class_id,message_id,&c);
+	if (m == NULL)
+	{
+		bprintf("SendBlakodMessage CLASS %s (%i) OBJECT %i can't find a handler for MESSAGE %s (%i)\n",
+			c->class_name,c->class_id,object_id,GetNameByID(message_id),message_id);
+		return NIL;
+	}
+
+	/* monomorphic, so the last class sent to here replaces the one before */
+	e->class_id = o->class_id;
+	e->message_id = message_id;
+	e->handler_class = c;
+	e->m = m;
+
+	return SendBlakodMessageToHandler(object_id,c,m,num_parms,parms);
+}
+
+/* SortParms
+*
+* Sorts parameters by id, which InterpretAtMessage depends on.  blakcomp
+* sorts the parameters of a Send() in the bkod, but the C code and the
+* admin commands don't, so sends from them are sorted here.  They're
+* short and usually sorted already.
+*/
+void SortParms(int num_parms,parm_node parms[])
 {
-	numExecuted = 0;
-	classMsg.class_id = class_id;
-	classMsg.message_id = message_id;
-	classMsg.num_params = num_params;
-	classMsg.parm = parm;
-	ForEachObject(SendClassMessage);
-	return numExecuted;
+	parm_node parm;
+	int i,j;
+
+	for (i=1;i<num_parms;i++)
+	{
+		if (parms[i-1].name_id <= parms[i].name_id)
+			continue;
+		parm = parms[i];
+		for (j=i;j>0 && parms[j-1].name_id > parm.name_id;j--)
+			parms[j] = parms[j-1];
+		parms[j] = parm;
+	}
 }
 
 /* returns the return value of the blakod */
 blak_int SendBlakodMessage(int object_id,int message_id,int num_parms,parm_node parms[])
 {
 	object_node *o;
-	class_node *c,*propagate_class;
+	class_node *c;
 	message_node *m;
-	val_type message_ret;
 	
-	int prev_interpreting_class;
-	char *prev_bkod;
-
-	int propagate_depth = 0;
+	SortParms(num_parms,parms);
 
-	prev_bkod = bkod;
-	prev_interpreting_class = kod_stat.interpreting_class;
-	
 	o = GetObjectByID(object_id);
 	if (o == NULL)
 	{
@@ -398,6 +852,29 @@ blak_int SendBlakodMessage(int object_id,int message_id,int num_parms,parm_node
 			c->class_name,c->class_id,object_id,GetNameByID(message_id),message_id);
 		return NIL;
 	}
+
+	return SendBlakodMessageToHandler(object_id,c,m,num_parms,parms);
+}
+
+/* SendBlakodMessageToHandler
+*
+* Runs handler m, found in class c, and any handlers it propagates to.
+*/
+blak_int SendBlakodMessageToHandler(int object_id,class_node *c,message_node *m,
+									int num_parms,parm_node parms[])
+{
+	class_node *propagate_class;
+	val_type message_ret;
+	int message_id;
+	
+	int prev_interpreting_class;
+	char *prev_bkod;
+
+	int propagate_depth = 0;
+
+	prev_bkod = bkod;
+	prev_interpreting_class = kod_stat.interpreting_class;
+	message_id = m->message_id;
 	
 	m->called_count++;
 	
@@ -530,19 +1007,19 @@ int InterpretAtMessage(int object_id,class_node* c,message_node* m,
 {
 	opcode_type opcode;
 	char opcode_char;
-	char num_locals,num_parms;
+	int num_parms;
 	local_var_type local_vars;
-	int parm_id;
+	message_parm_type *parms;
 	val_type parm_init_value;
 	
 	int i,j;
 	char *inst_start;
-	Bool found_parm;
 	
-	num_locals = get_byte();
-	num_parms = get_byte();
+	/* AddMessage already read the parameter table at the start of the handler */
+	num_parms = m->num_parms;
+	bkod = m->code;
 	
-	local_vars.num_locals = num_locals+num_parms;
+	local_vars.num_locals = m->num_locals+num_parms;
 	if (local_vars.num_locals > MAX_LOCALS)
 	{
 		dprintf("InterpretAtMessage found too many locals and parms for OBJECT %i CLASS %s MESSAGE %s (%s) aborting and returning NIL\n",
@@ -565,33 +1042,20 @@ int InterpretAtMessage(int object_id,class_node* c,message_node* m,
 		}
 	}
 	
-	/* both table and call parms are sorted */
+	/* both table and call parms are sorted, so one pass over each binds them */
 	
+	if (num_parms > 0)
+		memcpy(local_vars.locals,m->parm_defaults,num_parms*sizeof(val_type));
+	parms = m->parms;
 	j = 0;
-	for (i=0;i<num_parms;i++)
+	for (i=0;i<num_parms && j<num_sent_parms;i++)
 	{
-		parm_id = get_int(); /* match this with parameters */
-		parm_init_value.int_val = get_blakint();
-		
-		/* look if we have a value for this parm */
-		found_parm = False;
-		j = 0;			/* don't assume sorted for now */
-		while (j < num_sent_parms)
-		{
-			if (sent_parms[j].name_id == parm_id)
-			{
-			/* assuming no RetrieveValue needed here, since InterpretCall
-				does that for us */
-				local_vars.locals[i].int_val = sent_parms[j].value;
-				found_parm = True;
-				j++;
-				break;
-			}
+		while (j < num_sent_parms && sent_parms[j].name_id < parms[i].parm_id)
 			j++;
-		}
-		
-		if (!found_parm)
-			local_vars.locals[i].int_val = parm_init_value.int_val;
+		/* assuming no RetrieveValue needed here, since InterpretCall
+			does that for us */
+		if (j < num_sent_parms && sent_parms[j].name_id == parms[i].parm_id)
+			local_vars.locals[parms[i].slot].int_val = sent_parms[j++].value;
 	}
 	
 	for(;;)			/* returns when gets a blakod return */
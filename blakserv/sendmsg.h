@@ -64,33 +64,94 @@ typedef struct
 
 /* stuff for PostMessage queue */
 
-#define MAX_POST_QUEUE 4000
+#define INIT_POST_QUEUE 1024	/* a power of 2 */
+#define POST_BLOCK_PARMS 4096
+#define POST_COALESCE_HASH 4096	/* a power of 2 */
+#define MAX_COALESCE_MESSAGES 64
+
+/* posted messages' parms are handed out of these in order, and a block is
+   reused once every post with parms in it has been sent */
+typedef struct post_block_struct
+{
+   int used;
+   int pending;
+   struct post_block_struct *next;
+   parm_node parms[POST_BLOCK_PARMS];
+} post_block;
 
 typedef struct
 {
    int object_id;
    int message_id;
    int num_parms;
-   parm_node parms[MAX_NAME_PARMS];
+   parm_node *parms; /* in block, where it stays until the post is sent */
+   post_block *block;
 } post_node;
 
 typedef struct
 {
-   int next;
-   int last;
-   post_node data[MAX_POST_QUEUE];
+   post_node *data; /* post number n is at data[n & (max_posts-1)] */
+   int max_posts;
+   unsigned int first; /* number of the oldest waiting post */
+   unsigned int next; /* number the next post will get */
+   post_block *oldest; /* blocks with parms of waiting posts, oldest first */
+   post_block *newest;
+   post_block *spare;
+   int num_blocks;
 } post_queue_type;
 
+typedef struct
+{
+   int num_pending;
+   int most_pending;
+   int max_posts;
+   int num_blocks;
+   int num_coalesce_messages;
+   INT64 num_posted;
+   INT64 num_coalesced;
+   INT64 num_dropped;
+   INT64 num_deferred; /* times followups were left for the next top level message */
+} post_queue_statistics;
+
+/* inline cache for one Send() call site */
+
+typedef struct
+{
+   char *call_site;		/* bkod just past the call */
+   int caller_class_id;		/* class whose bkod has the call */
+   int class_id;		/* receiver's class at the last lookup */
+   int message_id;
+   class_node *handler_class;	/* class with the handler, maybe a superclass */
+   message_node *m;
+   int hits;
+   int misses;
+} send_cache_entry;
+
+typedef struct
+{
+   int num_sites;
+   int table_size;
+   INT64 hits;
+   INT64 misses;
+} send_cache_statistics;
+
 void InitProfiling(void);
 void InitBkodInterpret(void);
 kod_statistics * GetKodStats(void);
 char * GetBkodPtr(void);
 Bool IsInterpreting(void);
+int GetInterpretingMessage(void);
 
 void PostBlakodMessage(int object_id,int message_id,int num_parms,parm_node parms[]);
+void ResetPostCoalescing(void);
+void GetPostQueueStats(post_queue_statistics *stat);
 
 blak_int SendTopLevelBlakodMessage(int object_id,int message_id,int num_parms,parm_node parms[]);
 blak_int SendBlakodMessage(int object_id,int message_id,int num_parms,parm_node parms[]);
+blak_int SendBlakodMessageFromCall(int object_id,int message_id,int num_parms,parm_node parms[]);
+void ResetSendCache(void);
+void GetSendCacheStats(send_cache_statistics *stat);
+void ForEachSendCacheSite(void (*callback_func)(send_cache_entry *e));
 int SendBlakodClassMessage(int class_id,int message_id,int num_params,parm_node parm[]);
 char *BlakodDebugInfo(void);
 char *BlakodStackInfo(void);
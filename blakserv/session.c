@@ -32,7 +32,6 @@ CRITICAL_SECTION csSessions; /* need to add/remove or search through list of ses
 /* local function prototypes */
 session_node *AllocateSession(void);
 
-void CloseSession(int session_id);
 void CloseConnection(connection_node conn);
 
 void ProcessSessionTimer(session_node *s);
@@ -143,8 +142,10 @@ session_node *AllocateSession(void)
 	sessions[i].hangup = False;
 	sessions[i].account = NULL;
 	sessions[i].exiting_state = False;
-	sessions[i].receive_list = NULL;
-	sessions[i].receive_index = 0;
+	sessions[i].receive_buf = NULL;
+	sessions[i].receive_size = 0;
+	sessions[i].receive_start = 0;
+	sessions[i].receive_end = 0;
 	sessions[i].send_list = NULL;
 	sessions[i].version_major = 0;
 	sessions[i].version_minor = 0;
@@ -278,6 +279,8 @@ const char * GetStateName(session_node *s)
 
 void InitSessionState(session_node *s,int state)
 {
+	RecordSessionState(s,state);
+
 	s->state = state;
 	s->timer = 0;		/* no timer */
 
@@ -418,6 +421,8 @@ void CloseSession(int session_id)
 		return;
 	}
 
+	RecordSessionClose(s);
+
 	EnterSessionLock();
 
 	s->connected = False;
@@ -456,8 +461,12 @@ void CloseSession(int session_id)
 			eprintf("CloseSession couldn't get session %i muxReceive\n",s->session_id);
 		else
 		{
-			DeleteBufferList(s->receive_list);
-			s->receive_list = NULL;
+			if (s->receive_buf != NULL)
+				FreeMemory(MALLOC_ID_BUFFER,s->receive_buf,s->receive_size);
+			s->receive_buf = NULL;
+			s->receive_size = 0;
+			s->receive_start = 0;
+			s->receive_end = 0;
 
 			if (!MutexRelease(s->muxReceive))
 				eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
@@ -505,7 +514,7 @@ void PollSessions()
 
 	poll_time = GetTime();
 
-	ProcessSysTimer(poll_time);
+	ProcessSysTimer(GetGameTime());
 
 	for (i=0;i<num_sessions;i++)
 	{
@@ -564,7 +573,7 @@ void PollSession(int session_id)
 	}
 	*/
 
-	if (s->receive_list != NULL)
+	if (GetSessionReadBytes(s) > 0)
 		ProcessSessionBuffer(s);
 
 
@@ -668,110 +677,98 @@ void ProcessSessionTimer(session_node *s)
 
 int GetSessionReadBytes(session_node *s)
 {
-	buffer_node *bn;
-	int bytes;
-
-	bytes = 0;
-	if (s->receive_list != NULL)
-	{
-		bytes += s->receive_list->len_buf - s->receive_index;
-		bn = s->receive_list->next;
-		while (bn != NULL)
-		{
-			bytes += bn->len_buf;
-			bn = bn->next;
-		}
-	}
-	return bytes;
+	return s->receive_end - s->receive_start;
 }
 
 /* if possible, read num_bytes from session.  If not possible,
 return false and write nothing.  DO NOT pass in 0 bytes to read. */
 Bool ReadSessionBytes(session_node *s,int num_bytes,void *buf)
 {
-	buffer_node *bn,*blist;
-	int copied,copy_bytes;
-
 	if (GetSessionReadBytes(s) < num_bytes)
 		return False;
 
-	blist = s->receive_list;
-
-	if (blist->len_buf - s->receive_index > num_bytes)
-	{
-		memcpy(buf,blist->buf + s->receive_index,num_bytes);
-		s->receive_index += num_bytes;
-		return True;
-	}
-
-	/* reading at least as many bytes as there are in first buffer */
-
-	copy_bytes = blist->len_buf - s->receive_index;
-	memcpy(buf,blist->buf + s->receive_index,copy_bytes);
-	copied = copy_bytes;
-
-	bn = blist->next;
-	DeleteBuffer(blist);
-	s->receive_list = bn;
-	s->receive_index = 0;
-
-	copy_bytes = 0; /* in case exactly read message, set receive_index right */
-	while (s->receive_list != NULL && copied < num_bytes)
-	{
-	  copy_bytes = std::min(num_bytes-copied,s->receive_list->len_buf);
-	  memcpy((char *)buf+copied,s->receive_list->buf,copy_bytes);
-
-	  copied += copy_bytes;
-	  if (copy_bytes == s->receive_list->len_buf)
-	    {
-	      bn = s->receive_list->next;
-	      DeleteBuffer(s->receive_list);
-	      s->receive_list = bn;
-	      copy_bytes = 0; /* if last copy ended with this buffer,
-				 set receive_index right */
-	    }
-	}
-	s->receive_index = copy_bytes;
+	memcpy(buf,s->receive_buf + s->receive_start,num_bytes);
+	ConsumeSessionBytes(s,num_bytes);
 	return True;
 }
 
-/* if possible, peek at num_bytes from session.  If not possible,
-return false and write nothing.  DO NOT pass in 0 bytes to read. */
-Bool PeekSessionBytes(session_node *s,int num_bytes,void *buf)
+/* PeekSessionData
+*
+* Returns a pointer to the next num_bytes received from the session, or
+* NULL if there aren't that many yet.  Nothing is copied, so the pointer
+* is only good until the receive mutex is given up.
+*/
+char * PeekSessionData(session_node *s,int num_bytes)
 {
-	buffer_node *bn,*blist;
-	int copied,copy_bytes;
-
 	if (GetSessionReadBytes(s) < num_bytes)
-		return False;
-
-	blist = s->receive_list;
+		return NULL;
 
-	if (blist->len_buf - s->receive_index > num_bytes)
-	{
-		memcpy(buf,blist->buf + s->receive_index,num_bytes);
-		return True;
-	}
+	return s->receive_buf + s->receive_start;
+}
 
-	/* reading at least as many bytes as there are in first buffer */
+/* ConsumeSessionBytes
+*
+* Marks num_bytes as processed, usually after looking at them with
+* PeekSessionData.
+*/
+void ConsumeSessionBytes(session_node *s,int num_bytes)
+{
+	s->receive_start += std::min(num_bytes,GetSessionReadBytes(s));
+}
 
-	copy_bytes = blist->len_buf - s->receive_index;
-	memcpy(buf,blist->buf + s->receive_index,copy_bytes);
+/* GetSessionReceiveSpace
+*
+* Called by the socket code, holding the receive mutex, to get where to
+* recv() the next bytes into.  Slides the unprocessed bytes down to the
+* front of the buffer, or grows it, so there are at least
+* RECEIVE_BUF_MIN_SPACE bytes free.  Returns NULL if the session has
+* more unprocessed data than we're willing to hold.
+*/
+char * GetSessionReceiveSpace(session_node *s,int *len)
+{
+	int used,new_size;
 
-	bn = blist->next;
+	if (s->receive_buf == NULL)
+	{
+		s->receive_size = RECEIVE_BUF_INIT_SIZE;
+		s->receive_buf = (char *)AllocateMemory(MALLOC_ID_BUFFER,s->receive_size);
+		s->receive_start = 0;
+		s->receive_end = 0;
+	}
 
-	copied = copy_bytes;
-	while (bn != NULL && copied < num_bytes)
+	if (s->receive_start == s->receive_end)
 	{
-	  copy_bytes = std::min(num_bytes-copied,bn->len_buf);
-	  memcpy((char *)buf+copied,bn->buf,copy_bytes);
+		s->receive_start = 0;
+		s->receive_end = 0;
+	}
 
-	  copied += copy_bytes;
-	  if (copy_bytes == bn->len_buf)
-	    bn = bn->next;
+	if (s->receive_size - s->receive_end < RECEIVE_BUF_MIN_SPACE)
+	{
+		used = GetSessionReadBytes(s);
+		if (s->receive_start > 0)
+		{
+			memmove(s->receive_buf,s->receive_buf + s->receive_start,used);
+			s->receive_start = 0;
+			s->receive_end = used;
+		}
+		if (s->receive_size - used < RECEIVE_BUF_MIN_SPACE)
+		{
+			new_size = 2*s->receive_size;
+			if (new_size > RECEIVE_BUF_MAX_SIZE)
+				return NULL;
+			s->receive_buf = (char *)ResizeMemory(MALLOC_ID_BUFFER,s->receive_buf,
+															  s->receive_size,new_size);
+			s->receive_size = new_size;
+		}
 	}
 
-	return True;
+	*len = s->receive_size - s->receive_end;
+	return s->receive_buf + s->receive_end;
+}
+
+void AddSessionReceivedBytes(session_node *s,int num_bytes)
+{
+	s->receive_end += num_bytes;
 }
 
 void SendClientStr(int session_id,char *str)
@@ -847,7 +844,8 @@ void SendBytes(session_node *s,char *buf,int len_buf)
 		return;
 	}
 
-	if (s->send_list == NULL)
+	/* with network threads, they do all the sending */
+	if (s->send_list == NULL && !NetworkThreadsRunning())
 	{
 		/* if nothing in queue, try to send right now */
 
@@ -866,7 +864,8 @@ void SendBytes(session_node *s,char *buf,int len_buf)
 		}
 		else
 		{
-			transmitted_bytes += len_buf;
+			InterlockedExchangeAdd((LONG *)&transmitted_bytes,len_buf);
+			CountMetric(METRIC_BYTES_SENT,len_buf);
 		}
 	}
 	else
@@ -876,6 +875,9 @@ void SendBytes(session_node *s,char *buf,int len_buf)
 
 	if (!MutexRelease(s->muxSend))
 		eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+
+	if (NetworkThreadsRunning())
+		NetworkThreadSend(s->session_id);
 }
 
 /*------------ above here is junk-o byte buffer sending */
@@ -990,7 +992,7 @@ void SendBufferList(session_node *s,buffer_node *blist)
 		return;
 	}
 
-	if (s->send_list == NULL)
+	if (s->send_list == NULL && !NetworkThreadsRunning())
 	{
 		/* if nothing in queue, try to send right now */
 
@@ -1013,7 +1015,8 @@ void SendBufferList(session_node *s,buffer_node *blist)
 			}
 			else
 			{
-				transmitted_bytes += blist->len_buf;
+				InterlockedExchangeAdd((LONG *)&transmitted_bytes,blist->len_buf);
+				CountMetric(METRIC_BYTES_SENT,blist->len_buf);
 
 				bn = blist->next;
 				DeleteBuffer(blist);
@@ -1028,6 +1031,9 @@ void SendBufferList(session_node *s,buffer_node *blist)
 
 	if (!MutexRelease(s->muxSend))
 		eprintf("File %s line %i release of non-owned mutex\n",__FILE__,__LINE__);
+
+	if (NetworkThreadsRunning())
+		NetworkThreadSend(s->session_id);
 }
 
 void SessionAddBufferList(session_node *s,buffer_node *blist)
@@ -1047,19 +1053,20 @@ void SessionAddBufferList(session_node *s,buffer_node *blist)
 	}
 	else
 	{
-		length = 1;
+		length = s->send_list->len_buf;
 		bn = s->send_list;
 		while (bn->next != NULL)
 		{
-			length++;
 			bn = bn->next;
+			length += bn->len_buf;
 		}
 
 		/* dprintf("non-blank send list len %i\n",length); */
 
-		/* if currently backed up more than MAX_SESSION_BUFFER_LIST_LEN,
-		then don't waste any more memory on them */
-		if (length > MAX_SESSION_BUFFER_LIST_LEN)
+		/* if currently backed up more than MAX_SESSION_BUFFER_LIST_LEN
+		full buffers' worth, then don't waste any more memory on them
+		(buffers come in smaller sizes too, so count bytes) */
+		if (length > MAX_SESSION_BUFFER_LIST_LEN*BUFFER_SIZE)
 		{
 			//dprintf("SessionAddBufferList deleting because buffer list too long %i\n",s->session_id);
 			DeleteBufferList(blist);
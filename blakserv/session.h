@@ -30,6 +30,12 @@ enum
 #define CRCBYTES 2
 #define HEADERBYTES 7
 
+/* each session's received bytes sit in one contiguous buffer, which
+   grows as needed up to RECEIVE_BUF_MAX_SIZE */
+#define RECEIVE_BUF_INIT_SIZE 8192
+#define RECEIVE_BUF_MAX_SIZE (1024*1024)
+#define RECEIVE_BUF_MIN_SPACE 2048 /* least we'll recv() into at once */
+
 enum { CONN_SOCKET, CONN_CONSOLE };
 
 enum { STATE_ADMIN, STATE_GAME, STATE_TRYSYNC,
@@ -115,9 +121,12 @@ typedef struct
    const char* sliding_token;
 
    Mutex muxReceive;
-   /* this protects the list of received data: receive_list, and receive_index */
-   buffer_node *receive_list;
-   int receive_index; /* index into first buffer of receive_list, of where we are */
+   /* this protects the received data: receive_buf and the offsets into it.
+      Pointers into receive_buf are only good while you hold it. */
+   char *receive_buf;
+   int receive_size;
+   int receive_start; /* first byte we haven't processed */
+   int receive_end;   /* one past the last byte received */
 
 
    Mutex muxSend;
@@ -137,6 +146,7 @@ void MaintenanceProcessSessionTimer(session_node *s);
 void MaintenanceProcessSessionBuffer(session_node *s);
 void GameInit(session_node *s);
 void GameExit(session_node *s);
+void GameStartUser(session_node *s,user_node *u);
 void GameClientExit(session_node *s);
 void GameCleanupExit(session_node *s);
 void GameProcessSessionTimer(session_node *s);
@@ -166,7 +176,9 @@ void EnterSessionLock(void);
 void LeaveSessionLock(void);
 void SendBytes(session_node *s,char *buf,int len_buf);
 void InitSessionState(session_node *s,int state);
+void ExitSessionState(session_node *s);
 session_node * CreateSession(connection_node conn);
+void CloseSession(int session_id);
 session_node *GetSessionByAccount(account_node *a);
 session_node * GetSessionBySocket(SOCKET sock);
 void ForEachSession(void (*callback_func)(session_node *s));
@@ -178,7 +190,10 @@ void SetSessionTimer(session_node *s,int seconds);
 void ClearSessionTimer(session_node *s);
 int GetSessionReadBytes(session_node *s);
 Bool ReadSessionBytes(session_node *s,int num_bytes,void *buf);
-Bool PeekSessionBytes(session_node *s,int num_bytes,void *buf);
+char * PeekSessionData(session_node *s,int num_bytes);
+void ConsumeSessionBytes(session_node *s,int num_bytes);
+char * GetSessionReceiveSpace(session_node *s,int *len);
+void AddSessionReceivedBytes(session_node *s,int num_bytes);
 void SendClientStr(int session_id,char *str);
 void SendClient(int session_id,char *data,unsigned short len_data);
 void SendClientBufferList(int session_id,buffer_node *blist);
@@ -0,0 +1,272 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * strbench.c
+ *
+
+ This is a standalone Linux program, not part of blakserv itself.  It
+ times the string comparisons in strfold.c behind the Blakod calls
+ StringEqual, StringContain and StringSubstitute against the way those
+ calls used to work (copy each string into a scratch buffer, then
+ stricmp/strstr it), on lines like the ones players type.  It also
+ checks that both ways give the same answers.  Build it with
+ "make -f makefile.linux strbench" and run bin/strbench [iterations].
+
+ */
+
+#include "blakserv.h"
+
+#define BENCH_DEFAULT_ITERATIONS 20000
+
+static const char *chat_lines[] =
+{
+   "hi",
+   "say hello everyone",
+   "Does anyone know where to buy a Healing Potion in Marion?",
+   "  selling orc teeth, spider eggs and a SHORT SWORD, tell me   ",
+   "Frular has been killed by a troll in the Forest of Tos",
+   "wts mystic sword of the ancients, pst with offers, no lowballers please",
+   "LOL",
+   "the guild Knights of the Crimson Shield is recruiting new members tonight",
+   "can someone rez me? died near the orc pit again, items are in the corpse",
+   "brb",
+   "Meridian 59 has been running since 1996 and I still get lost in Barloque",
+   "Where is the Jasper inn? I need to drop off my Reagents before logging",
+};
+
+static const char *search_words[] =
+{
+   "hello", "HEALING", "orc teeth", "frular", "sword", "Barloque",
+   "  brb ", "guild", "xyzzy", "the", "potion in marion", "  ",
+};
+
+#define NUM_CHAT_LINES ((int)(sizeof(chat_lines)/sizeof(chat_lines[0])))
+#define NUM_SEARCH_WORDS ((int)(sizeof(search_words)/sizeof(search_words[0])))
+
+#define iswhite(c) ((c)==' ' || (c)=='\t' || (c)=='\n' || (c)=='\r')
+
+static char buf0[LEN_MAX_CLIENT_MSG+1];
+static char buf1[LEN_MAX_CLIENT_MSG+1];
+
+/* the comparisons as they were, for reference */
+
+static const char* OldStristr(const char* pSource, const char* pSearch)
+{
+   if (!pSource || !pSearch || !*pSearch)
+      return NULL;
+
+   int nSearch = strlen(pSearch);
+   const char *pEnd = pSource + strlen(pSource) - nSearch;
+   while (pSource <= pEnd)
+   {
+      if (0 == strnicmp(pSource, pSearch, nSearch))
+         return pSource;
+      pSource++;
+   }
+   return NULL;
+}
+
+static void OldFuzzyCollapseString(char* pTarget, const char* pSource, int len)
+{
+   while (len && iswhite(*pSource)) { pSource++; len--; }
+   while (len && iswhite(pSource[len-1])) { len--; }
+   while (len)
+   {
+      *pTarget++ = toupper(*pSource++);
+      len--;
+   }
+   *pTarget = '\0';
+}
+
+static bool OldFuzzyBufferEqual(const char *s1,int len1,const char *s2,int len2)
+{
+   if (!s1 || !s2 || len1 <= 0 || len2 <= 0)
+      return false;
+   while (len1 && iswhite(*s1)) { s1++; len1--; }
+   while (len2 && iswhite(*s2)) { s2++; len2--; }
+   while (len1 && iswhite(s1[len1-1])) { len1--; }
+   while (len2 && iswhite(s2[len2-1])) { len2--; }
+   if (!len1 || !len2)
+      return false;
+   while (len1 && len2 && toupper(*s1) == toupper(*s2))
+   {
+      s1++;
+      s2++;
+      len1--;
+      len2--;
+   }
+   return (len1 == 0 && len2 == 0);
+}
+
+static bool OldFuzzyBufferContain(const char *s1,int len_s1,const char *s2,int len_s2)
+{
+   if (!s1 || !s2 || len_s1 <= 0 || len_s2 <= 0)
+      return false;
+   OldFuzzyCollapseString(buf0, s1, len_s1);
+   OldFuzzyCollapseString(buf1, s2, len_s2);
+   return (NULL != strstr(buf0, buf1));
+}
+
+static int OldSubstitute(char *out,const char *s0,int len0,const char *s1,int len1,
+                         const char *s2,int len2)
+{
+   char copy0[LEN_MAX_CLIENT_MSG+1],copy1[LEN_MAX_CLIENT_MSG+1];
+   const char *subspot;
+   int pos;
+
+   memcpy(copy1,s1,len1);
+   copy1[len1] = 0;
+   memcpy(copy0,s0,len0);
+   copy0[len0] = 0;
+   subspot = OldStristr(copy0,copy1);
+   if (subspot == NULL)
+      return -1;
+   pos = subspot - copy0;
+   memcpy(out,copy0,pos);
+   memcpy(out + pos,s2,len2);
+   memcpy(out + pos + len2,subspot + len1,len0 - pos - len1);
+   return len0 - len1 + len2;
+}
+
+static int NewSubstitute(char *out,const char *s0,int len0,const char *s1,int len1,
+                         const char *s2,int len2)
+{
+   const char *subspot;
+   int pos;
+
+   subspot = FoldedFind(s0,len0,s1,len1);
+   if (subspot == NULL)
+      return -1;
+   pos = subspot - s0;
+   memcpy(out,s0,pos);
+   memcpy(out + pos,s2,len2);
+   memcpy(out + pos + len2,subspot + len1,len0 - pos - len1);
+   return len0 - len1 + len2;
+}
+
+static double NowNanoseconds(void)
+{
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC,&t);
+   return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static void Report(const char *name,double old_ns,double new_ns,int calls,int mismatches)
+{
+   printf("%-18s %8.1f ns/call before, %8.1f ns/call now, %5.2fx%s\n",name,
+          old_ns/calls,new_ns/calls,new_ns > 0 ? old_ns/new_ns : 0.0,
+          mismatches ? "  RESULTS DIFFER" : "");
+}
+
+int main(int argc,char **argv)
+{
+   int iterations,i,j,k,calls,mismatches,total_mismatches,len_old,len_new;
+   int chat_len[NUM_CHAT_LINES],word_len[NUM_SEARCH_WORDS];
+   char out_old[2*LEN_MAX_CLIENT_MSG],out_new[2*LEN_MAX_CLIENT_MSG];
+   double start,old_ns,new_ns;
+   volatile int sink = 0;
+
+   iterations = BENCH_DEFAULT_ITERATIONS;
+   if (argc > 1)
+      iterations = atoi(argv[1]);
+   if (iterations <= 0)
+   {
+      fprintf(stderr,"usage: strbench [iterations]\n");
+      return 1;
+   }
+
+   for (i=0;i<NUM_CHAT_LINES;i++)
+      chat_len[i] = strlen(chat_lines[i]);
+   for (i=0;i<NUM_SEARCH_WORDS;i++)
+      word_len[i] = strlen(search_words[i]);
+
+   printf("%i iterations over %i chat lines and %i search words\n",
+          iterations,NUM_CHAT_LINES,NUM_SEARCH_WORDS);
+   total_mismatches = 0;
+
+   /* StringEqual: every line against every line, plus a case-changed copy */
+   mismatches = 0;
+   for (i=0;i<NUM_CHAT_LINES;i++)
+   {
+      for (j=0;j<chat_len[i];j++)
+         out_new[j] = (j & 1) ? toupper(chat_lines[i][j]) : tolower(chat_lines[i][j]);
+      for (k=0;k<NUM_CHAT_LINES;k++)
+      {
+         if (OldFuzzyBufferEqual(out_new,chat_len[i],chat_lines[k],chat_len[k]) !=
+             FuzzyBufferEqual(out_new,chat_len[i],chat_lines[k],chat_len[k]))
+            mismatches++;
+      }
+   }
+   calls = iterations*NUM_CHAT_LINES*NUM_CHAT_LINES;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<NUM_CHAT_LINES;i++)
+         for (j=0;j<NUM_CHAT_LINES;j++)
+            sink += OldFuzzyBufferEqual(chat_lines[i],chat_len[i],chat_lines[j],chat_len[j]);
+   old_ns = NowNanoseconds() - start;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<NUM_CHAT_LINES;i++)
+         for (j=0;j<NUM_CHAT_LINES;j++)
+            sink += FuzzyBufferEqual(chat_lines[i],chat_len[i],chat_lines[j],chat_len[j]);
+   new_ns = NowNanoseconds() - start;
+   Report("StringEqual",old_ns,new_ns,calls,mismatches);
+   total_mismatches += mismatches;
+
+   /* StringContain: every line against every search word */
+   mismatches = 0;
+   for (i=0;i<NUM_CHAT_LINES;i++)
+      for (j=0;j<NUM_SEARCH_WORDS;j++)
+         if (OldFuzzyBufferContain(chat_lines[i],chat_len[i],search_words[j],word_len[j]) !=
+             FuzzyBufferContain(chat_lines[i],chat_len[i],search_words[j],word_len[j]))
+            mismatches++;
+   calls = iterations*NUM_CHAT_LINES*NUM_SEARCH_WORDS;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<NUM_CHAT_LINES;i++)
+         for (j=0;j<NUM_SEARCH_WORDS;j++)
+            sink += OldFuzzyBufferContain(chat_lines[i],chat_len[i],search_words[j],word_len[j]);
+   old_ns = NowNanoseconds() - start;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<NUM_CHAT_LINES;i++)
+         for (j=0;j<NUM_SEARCH_WORDS;j++)
+            sink += FuzzyBufferContain(chat_lines[i],chat_len[i],search_words[j],word_len[j]);
+   new_ns = NowNanoseconds() - start;
+   Report("StringContain",old_ns,new_ns,calls,mismatches);
+   total_mismatches += mismatches;
+
+   /* StringSubstitute: replace each search word in each line with "***" */
+   mismatches = 0;
+   for (i=0;i<NUM_CHAT_LINES;i++)
+      for (j=0;j<NUM_SEARCH_WORDS;j++)
+      {
+         len_old = OldSubstitute(out_old,chat_lines[i],chat_len[i],search_words[j],word_len[j],"***",3);
+         len_new = NewSubstitute(out_new,chat_lines[i],chat_len[i],search_words[j],word_len[j],"***",3);
+         if (len_old != len_new || (len_old > 0 && memcmp(out_old,out_new,len_old) != 0))
+            mismatches++;
+      }
+   calls = iterations*NUM_CHAT_LINES*NUM_SEARCH_WORDS;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<NUM_CHAT_LINES;i++)
+         for (j=0;j<NUM_SEARCH_WORDS;j++)
+            sink += OldSubstitute(out_old,chat_lines[i],chat_len[i],search_words[j],word_len[j],"***",3);
+   old_ns = NowNanoseconds() - start;
+   start = NowNanoseconds();
+   for (k=0;k<iterations;k++)
+      for (i=0;i<NUM_CHAT_LINES;i++)
+         for (j=0;j<NUM_SEARCH_WORDS;j++)
+            sink += NewSubstitute(out_new,chat_lines[i],chat_len[i],search_words[j],word_len[j],"***",3);
+   new_ns = NowNanoseconds() - start;
+   Report("StringSubstitute",old_ns,new_ns,calls,mismatches);
+   total_mismatches += mismatches;
+
+   return total_mismatches ? 1 : 0;
+}
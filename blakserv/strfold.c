@@ -0,0 +1,202 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * strfold.c
+ *
+
+ This module has the case-insensitive string comparisons behind the
+ Blakod string calls (StringEqual, StringContain, StringSubstitute) and
+ table string keys.
+
+ The strings are compared where they lie, folding case as the bytes are
+ read, instead of first copying each one into a null-terminated scratch
+ buffer.  Where SSE2 is available (always on x64) sixteen bytes are
+ folded and compared at a time; elsewhere it's a byte at a time.
+
+ */
+
+#include "blakserv.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FOLD_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#define iswhite(c) ((c)==' ' || (c)=='\t' || (c)=='\n' || (c)=='\r')
+
+#ifdef FOLD_SSE2
+
+/* FoldBlock
+*
+* FoldChar on sixteen bytes.  Adding 128 - 'a' maps 'a'..'z' to the
+* smallest 26 signed bytes, so one signed compare finds the lowercase
+* letters.
+*/
+static __inline __m128i FoldBlock(__m128i x)
+{
+   __m128i lower;
+
+   lower = _mm_cmplt_epi8(_mm_add_epi8(x,_mm_set1_epi8(128 - 'a')),
+                          _mm_set1_epi8(-128 + 26));
+   return _mm_sub_epi8(x,_mm_and_si128(lower,_mm_set1_epi8('a' - 'A')));
+}
+
+static __inline int LowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+   unsigned long index;
+
+   _BitScanForward(&index,mask);
+   return (int)index;
+#else
+   return __builtin_ctz(mask);
+#endif
+}
+
+#endif
+
+/* FoldedEqual
+*
+* True if the len bytes at s1 and s2 are the same, ignoring case.
+*/
+bool FoldedEqual(const char *s1,const char *s2,int len)
+{
+#ifdef FOLD_SSE2
+   __m128i a,b;
+
+   while (len >= 16)
+   {
+      a = _mm_loadu_si128((const __m128i *)s1);
+      b = _mm_loadu_si128((const __m128i *)s2);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(FoldBlock(a),FoldBlock(b))) != 0xFFFF)
+         return false;
+      s1 += 16;
+      s2 += 16;
+      len -= 16;
+   }
+#endif
+
+   while (len > 0)
+   {
+      if (FoldChar(*s1) != FoldChar(*s2))
+         return false;
+      s1++;
+      s2++;
+      len--;
+   }
+   return true;
+}
+
+/* FoldedFind
+*
+* Returns the first place in the len bytes at s where the len_pat bytes
+* at pat appear, ignoring case, or NULL if they don't.  Neither needs to
+* be null-terminated.
+*/
+const char * FoldedFind(const char *s,int len,const char *pat,int len_pat)
+{
+   char first,other;
+   int i,last;
+
+   if (!s || !pat || len_pat <= 0 || len_pat > len)
+      return NULL;
+
+   first = FoldChar(pat[0]);
+   other = (first >= 'A' && first <= 'Z') ? first + ('a' - 'A') : first;
+   last = len - len_pat;
+   i = 0;
+
+#ifdef FOLD_SSE2
+   {
+      __m128i want_first,want_other,block;
+      unsigned int mask;
+
+      /* find candidates by their first byte sixteen at a time, then check
+         the rest of the pattern at each one */
+      want_first = _mm_set1_epi8(first);
+      want_other = _mm_set1_epi8(other);
+      while (i + 16 <= len && i <= last)
+      {
+         block = _mm_loadu_si128((const __m128i *)(s + i));
+         mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block,want_first),
+                                               _mm_cmpeq_epi8(block,want_other)));
+         if (last - i < 15)
+            mask &= (1u << (last - i + 1)) - 1;
+         while (mask != 0)
+         {
+            int pos = i + LowestBit(mask);
+            if (FoldedEqual(s + pos + 1,pat + 1,len_pat - 1))
+               return s + pos;
+            mask &= mask - 1;
+         }
+         i += 16;
+      }
+   }
+#endif
+
+   for (;i<=last;i++)
+      if (FoldChar(s[i]) == first && FoldedEqual(s + i + 1,pat + 1,len_pat - 1))
+         return s + i;
+
+   return NULL;
+}
+
+/* FuzzyTrimString
+*
+* Skips leading and trailing whitespace, which fuzzy comparisons ignore.
+*/
+void FuzzyTrimString(const char **s,int *len)
+{
+   const char *p = *s;
+   int n = *len;
+
+   while (n > 0 && iswhite(*p)) { p++; n--; }
+   while (n > 0 && iswhite(p[n-1])) { n--; }
+
+   *s = p;
+   *len = n;
+}
+
+bool FuzzyBufferEqual(const char *s1,int len1,const char *s2,int len2)
+{
+   if (!s1 || !s2 || len1 <= 0 || len2 <= 0)
+      return false;
+
+   FuzzyTrimString(&s1,&len1);
+   FuzzyTrimString(&s2,&len2);
+
+   // empty strings can't match anything
+   if (!len1 || !len2 || len1 != len2)
+      return false;
+
+   // strings with the same interned text are the same bytes
+   if (s1 == s2)
+      return true;
+
+   return FoldedEqual(s1,s2,len1);
+}
+
+// return true if s1 contains s2, ignoring case and leading and trailing
+// whitespace
+bool FuzzyBufferContain(const char *s1,int len_s1,const char *s2,int len_s2)
+{
+   if (!s1 || !s2 || len_s1 <= 0 || len_s2 <= 0)
+      return false;
+
+   FuzzyTrimString(&s1,&len_s1);
+   FuzzyTrimString(&s2,&len_s2);
+
+   // an all-whitespace s2 is contained in anything
+   if (len_s2 == 0)
+      return true;
+
+   return FoldedFind(s1,len_s1,s2,len_s2) != NULL;
+}
@@ -0,0 +1,26 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * strfold.h
+ *
+ */
+
+#ifndef _STRFOLD_H
+#define _STRFOLD_H
+
+/* ASCII uppercase, which is all the case folding Blakod strings get */
+#define FoldChar(c) ((unsigned char)((c) - 'a') < 26 ? (char)((c) - ('a' - 'A')) : (char)(c))
+
+bool FoldedEqual(const char *s1,const char *s2,int len);
+const char * FoldedFind(const char *s,int len,const char *pat,int len_pat);
+
+void FuzzyTrimString(const char **s,int *len);
+bool FuzzyBufferEqual(const char *s1,int len1,const char *s2,int len2);
+bool FuzzyBufferContain(const char *s1,int len1,const char *s2,int len2);
+
+#endif
@@ -13,18 +13,70 @@
  for the Blakod.  It also has a temp string, for things from the
  client like say commands which are not stored by the Blakod.
 
+ The text of the string nodes is interned.  Each distinct text is kept
+ once in a refcounted, immutable string body found through a hash
+ table, and every string node with that text points at the same body.
+ Nothing may write through a string node's data pointer; the Blakod
+ calls that change a string (SetString, StringSubstitute) build the new
+ text elsewhere and call SetString, which drops the node's reference to
+ the old body and interns the new text.
+
+ Small bodies are carved out of large arena blocks and recycled through
+ free lists by size, so the many short strings don't each cost a heap
+ block.  Bodies too big for the arena are allocated on their own.
+
  */
 
 #include "blakserv.h"
 
+/* body sizes are rounded up to this; arena size classes are this apart */
+#define STRING_GRANULE 16
+/* bodies up to this size come from the arena */
+#define MAX_ARENA_BODY 512
+#define NUM_ARENA_CLASSES (MAX_ARENA_BODY/STRING_GRANULE)
+#define STRING_ARENA_BLOCK 65536
+
+/* must be a power of two */
+#define INIT_STRING_BUCKETS 65536
+
+typedef struct string_body_struct
+{
+   struct string_body_struct *next; /* hash chain, or arena free list */
+   unsigned int hash;
+   int refs;
+   int len;
+   int size;         /* bytes allocated for this body, header included */
+   int saved_id;     /* first string saved with this body, during a save */
+   char data[1];
+} string_body;
+
+#define STRING_BODY_HEADER ((int)offsetof(string_body,data))
+#define StringBodyOf(s) ((string_body *)((s) - STRING_BODY_HEADER))
+
 string_node *strings;
 int num_strings,max_strings;
 
 /* this is for say commands, which are not saved */
 string_node temp_str;
 
+static string_body **string_buckets;
+static int num_string_buckets;
+
+static char *string_arena_blocks; /* chained through the first pointer */
+static char *string_arena_next,*string_arena_end;
+static string_body *string_arena_free[NUM_ARENA_CLASSES];
+
+static string_statistics string_stats;
+
 /* local function prototypes */
 int AllocateString();
+static unsigned int HashStringText(const char *buf,int len);
+static void ResizeStringBuckets(int new_buckets);
+static string_body * AllocateStringBody(int size);
+static void FreeStringBody(string_body *body);
+static char * InternString(const char *buf,int len);
+static void ReleaseString(char *data);
+static void FreeAllStringBodies(void);
 
 void InitString()
 {
@@ -32,6 +84,17 @@ void InitString()
    max_strings = INIT_STRING_NODES;
    strings = (string_node *)AllocateMemory(MALLOC_ID_STRING,max_strings*sizeof(string_node));
 
+   num_string_buckets = INIT_STRING_BUCKETS;
+   string_buckets = (string_body **)
+      AllocateMemory(MALLOC_ID_STRING,num_string_buckets*sizeof(string_body *));
+   memset(string_buckets,0,num_string_buckets*sizeof(string_body *));
+
+   string_arena_blocks = NULL;
+   string_arena_next = string_arena_end = NULL;
+   memset(string_arena_free,0,sizeof(string_arena_free));
+
+   memset(&string_stats,0,sizeof(string_stats));
+
    /* allocate max client bytes for temp string because max string len is < this */
    temp_str.data = (char *)AllocateMemory(MALLOC_ID_STRING,LEN_TEMP_STRING+1);
    temp_str.len_data = 0;
@@ -40,13 +103,12 @@ void InitString()
 
 void ResetString()
 {
-   int i,old_strings;
+   int old_strings;
 
-   for (i=0;i<num_strings;i++)
-      FreeMemory(MALLOC_ID_STRING,strings[i].data,strings[i].len_data);
+   FreeAllStringBodies();
 
    old_strings = max_strings;
-   num_strings = 0;  
+   num_strings = 0;
    max_strings = INIT_STRING_NODES;
    strings = (string_node *)
       ResizeMemory(MALLOC_ID_STRING,strings,old_strings*sizeof(string_node),
@@ -58,6 +120,225 @@ int GetStringsUsed()
    return num_strings;
 }
 
+void GetStringStats(string_statistics *stats)
+{
+   int i;
+   string_body *body;
+
+   *stats = string_stats;
+   stats->num_strings = num_strings;
+   stats->num_buckets = num_string_buckets;
+
+   stats->arena_free_bytes = 0;
+   for (i=0;i<NUM_ARENA_CLASSES;i++)
+      for (body=string_arena_free[i];body!=NULL;body=body->next)
+	 stats->arena_free_bytes += body->size;
+   stats->arena_free_bytes += string_arena_end - string_arena_next;
+}
+
+/* HashStringText
+*
+* FNV-1a.  Unlike GetBufferHash this is case sensitive, since strings that
+* differ only in case must get bodies of their own.
+*/
+static unsigned int HashStringText(const char *buf,int len)
+{
+   unsigned int h;
+   int i;
+
+   h = 2166136261u;
+   for (i=0;i<len;i++)
+   {
+      h ^= (unsigned char)buf[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+static void ResizeStringBuckets(int new_buckets)
+{
+   string_body **new_table,*body,*next;
+   int i,bucket;
+
+   new_table = (string_body **)
+      AllocateMemory(MALLOC_ID_STRING,new_buckets*sizeof(string_body *));
+   memset(new_table,0,new_buckets*sizeof(string_body *));
+
+   for (i=0;i<num_string_buckets;i++)
+   {
+      for (body=string_buckets[i];body!=NULL;body=next)
+      {
+	 next = body->next;
+	 bucket = body->hash & (new_buckets - 1);
+	 body->next = new_table[bucket];
+	 new_table[bucket] = body;
+      }
+   }
+
+   FreeMemory(MALLOC_ID_STRING,string_buckets,num_string_buckets*sizeof(string_body *));
+   string_buckets = new_table;
+   num_string_buckets = new_buckets;
+   lprintf("ResizeStringBuckets resized to %i buckets\n",num_string_buckets);
+}
+
+static string_body * AllocateStringBody(int size)
+{
+   string_body *body;
+   char *block;
+   int size_class;
+
+   size = (size + STRING_GRANULE - 1) & ~(STRING_GRANULE - 1);
+
+   if (size > MAX_ARENA_BODY)
+   {
+      body = (string_body *)AllocateMemory(MALLOC_ID_STRING,size);
+      body->size = size;
+      string_stats.num_large_bodies++;
+      return body;
+   }
+
+   size_class = size/STRING_GRANULE - 1;
+   if (string_arena_free[size_class] != NULL)
+   {
+      body = string_arena_free[size_class];
+      string_arena_free[size_class] = body->next;
+      body->size = size;
+      return body;
+   }
+
+   if (string_arena_end - string_arena_next < size)
+   {
+      /* the tail of the old block is too small for this body, so it's
+         simply left unused */
+      block = (char *)AllocateMemory(MALLOC_ID_STRING,STRING_ARENA_BLOCK);
+      *(char **)block = string_arena_blocks;
+      string_arena_blocks = block;
+      string_arena_next = block + STRING_GRANULE;
+      string_arena_end = block + STRING_ARENA_BLOCK;
+      string_stats.num_arena_blocks++;
+   }
+
+   body = (string_body *)string_arena_next;
+   string_arena_next += size;
+   body->size = size;
+   return body;
+}
+
+static void FreeStringBody(string_body *body)
+{
+   int size_class;
+
+   if (body->size > MAX_ARENA_BODY)
+   {
+      string_stats.num_large_bodies--;
+      FreeMemory(MALLOC_ID_STRING,body,body->size);
+      return;
+   }
+
+   size_class = body->size/STRING_GRANULE - 1;
+   body->next = string_arena_free[size_class];
+   string_arena_free[size_class] = body;
+}
+
+/* InternString
+*
+* Returns the data of the body holding this text, creating the body if
+* there isn't one yet, and counts one more reference to it.
+*/
+static char * InternString(const char *buf,int len)
+{
+   string_body *body;
+   unsigned int hash;
+   int bucket;
+
+   hash = HashStringText(buf,len);
+   bucket = hash & (num_string_buckets - 1);
+
+   for (body=string_buckets[bucket];body!=NULL;body=body->next)
+   {
+      if (body->hash == hash && body->len == len && memcmp(body->data,buf,len) == 0)
+      {
+	 body->refs++;
+	 string_stats.num_shared++;
+	 string_stats.text_bytes += len;
+	 return body->data;
+      }
+   }
+
+   body = AllocateStringBody(STRING_BODY_HEADER + len + 1);
+   body->hash = hash;
+   body->refs = 1;
+   body->len = len;
+   body->saved_id = INVALID_ID;
+   memcpy(body->data,buf,len);
+   body->data[len] = '\0';
+
+   body->next = string_buckets[bucket];
+   string_buckets[bucket] = body;
+
+   string_stats.num_bodies++;
+   string_stats.body_bytes += len;
+   string_stats.text_bytes += len;
+
+   if (string_stats.num_bodies > num_string_buckets)
+      ResizeStringBuckets(num_string_buckets*2);
+
+   return body->data;
+}
+
+static void ReleaseString(char *data)
+{
+   string_body *body,**link;
+
+   body = StringBodyOf(data);
+   string_stats.text_bytes -= body->len;
+   if (--body->refs > 0)
+      return;
+
+   for (link=&string_buckets[body->hash & (num_string_buckets - 1)];*link!=NULL;
+	link=&(*link)->next)
+   {
+      if (*link == body)
+      {
+	 *link = body->next;
+	 break;
+      }
+   }
+
+   string_stats.num_bodies--;
+   string_stats.body_bytes -= body->len;
+   FreeStringBody(body);
+}
+
+static void FreeAllStringBodies(void)
+{
+   string_body *body,*next;
+   char *block;
+   int i;
+
+   for (i=0;i<num_string_buckets;i++)
+   {
+      for (body=string_buckets[i];body!=NULL;body=next)
+      {
+	 next = body->next;
+	 if (body->size > MAX_ARENA_BODY)
+	    FreeMemory(MALLOC_ID_STRING,body,body->size);
+      }
+   }
+   memset(string_buckets,0,num_string_buckets*sizeof(string_body *));
+
+   while (string_arena_blocks != NULL)
+   {
+      block = string_arena_blocks;
+      string_arena_blocks = *(char **)block;
+      FreeMemory(MALLOC_ID_STRING,block,STRING_ARENA_BLOCK);
+   }
+   string_arena_next = string_arena_end = NULL;
+   memset(string_arena_free,0,sizeof(string_arena_free));
+
+   memset(&string_stats,0,sizeof(string_stats));
+}
+
 int AllocateString()
 {
    int old_strings;
@@ -68,13 +349,14 @@ int AllocateString()
       max_strings = max_strings * 2;
       strings = (string_node *)
 	 ResizeMemory(MALLOC_ID_STRING,strings,old_strings*sizeof(string_node),
-		      max_strings*sizeof(string_node));      
+		      max_strings*sizeof(string_node));
       lprintf("AllocateStringNode resized to %i string nodes\n",max_strings);
    }
 
    strings[num_strings].data = NULL;
    strings[num_strings].len_data = 0;
-   
+   strings[num_strings].alloc_site = 0;
+
    return num_strings++;
 }
 
@@ -105,20 +387,19 @@ int CreateStringWithLen(const char *buf,int len)
 {
    int string_id;
    string_node *snod;
-   
+
    /* note:  new_str is NOT null-terminated */
    string_id = AllocateString();
    snod = GetStringByID(string_id);
 
-   snod->data = (char *)AllocateMemory(MALLOC_ID_STRING,len+1);
-   memcpy(snod->data,buf,len);
+   snod->data = InternString(buf,len);
    snod->len_data = len;
-   snod->data[snod->len_data] = '\0';
-   
+   snod->alloc_site = GetAllocSite(CENSUS_STRING);
+
    return string_id;
 }
 
-Bool LoadBlakodString(FILE *f,int len_str,int string_id)
+Bool LoadBlakodString(const char *data,int len_str,int string_id)
 {
    string_node *snod;
 
@@ -130,23 +411,74 @@ Bool LoadBlakodString(FILE *f,int len_str,int string_id)
    }
    snod = GetStringByID(string_id);
 
-   if (len_str != 0)
+   snod->data = InternString(data,len_str);
+   snod->len_data = len_str;
+
+   return True;
+}
+
+/* LoadSharedBlakodString
+*
+* Loads a string saved as a reference to an earlier string with the same
+* text.
+*/
+Bool LoadSharedBlakodString(int string_id,int shared_id)
+{
+   string_node *snod;
+
+   if (shared_id < 0 || shared_id >= string_id || strings[shared_id].data == NULL)
    {
-      snod->data = (char *)AllocateMemory(MALLOC_ID_STRING,len_str+1);
-      if (!fread(snod->data, 1, len_str, f))
-         return False;
-      snod->data[len_str] = '\0';
+      eprintf("LoadString can't share string id %i with %i\n",string_id,shared_id);
+      return False;
    }
-   else
+
+   if (AllocateString() != string_id)
    {
-      snod->data = NULL;
+      eprintf("LoadString didn't make string id %i\n",string_id);
+      return False;
    }
+   snod = GetStringByID(string_id);
+
+   snod->data = strings[shared_id].data;
+   snod->len_data = strings[shared_id].len_data;
+   StringBodyOf(snod->data)->refs++;
+   string_stats.num_shared++;
+   string_stats.text_bytes += snod->len_data;
 
-   snod->len_data = len_str;
-   
    return True;
 }
 
+void ClearStringSavedIDs(void)
+{
+   string_body *body;
+   int i;
+
+   for (i=0;i<num_string_buckets;i++)
+      for (body=string_buckets[i];body!=NULL;body=body->next)
+	 body->saved_id = INVALID_ID;
+}
+
+/* GetSavedStringID
+*
+* While saving, returns the id of a string already saved with the same
+* text as this one, or INVALID_ID if this is the first, in which case
+* this string is remembered for the ones that follow.
+*/
+int GetSavedStringID(string_node *snod,int string_id)
+{
+   string_body *body;
+
+   if (snod->data == NULL)
+      return INVALID_ID;
+
+   body = StringBodyOf(snod->data);
+   if (body->saved_id != INVALID_ID)
+      return body->saved_id;
+
+   body->saved_id = string_id;
+   return INVALID_ID;
+}
+
 void ForEachString(void (*callback_func)(string_node *snod,int string_id))
 {
    int i;
@@ -155,6 +487,20 @@ void ForEachString(void (*callback_func)(string_node *snod,int string_id))
       callback_func(&strings[i],i);
 }
 
+/* ForEachStringInRange
+*
+* ForEachString() for just the ids start <= id < end.
+*/
+void ForEachStringInRange(int start,int end,void (*callback_func)(string_node *snod,int string_id))
+{
+   int i;
+
+   if (end > num_strings)
+      end = num_strings;
+   for (i=start;i<end;i++)
+      callback_func(&strings[i],i);
+}
+
 void FreeString(int string_id) /* for garbage collection */
 {
    string_node *snod;
@@ -168,12 +514,7 @@ void FreeString(int string_id) /* for garbage collection */
 
    if (snod->data != NULL)
    {
-      FreeMemory(MALLOC_ID_STRING,snod->data,snod->len_data+1);
-   }
-   else
-   {
-      /* happens when blank string saved, loaded, then garbage collected */
-      /* eprintf("FreeString can't free NULL string %i\n",string_id); */
+      ReleaseString(snod->data);
    }
 
    snod->data = NULL;
@@ -183,7 +524,7 @@ void FreeString(int string_id) /* for garbage collection */
 void MoveStringNode(int dest_id,int source_id) /* for garbage collection */
 {
    string_node *source,*dest;
-   
+
    source = GetStringByID(source_id);
    if (source == NULL)
    {
@@ -210,10 +551,11 @@ void MoveStringNode(int dest_id,int source_id) /* for garbage collection */
       return;
 
    if (dest->data != NULL)
-      FreeMemory(MALLOC_ID_STRING,dest->data,dest->len_data+1);
+      ReleaseString(dest->data);
 
    dest->data = source->data;
    dest->len_data = source->len_data;
+   dest->alloc_site = source->alloc_site;
 
    source->data = NULL;
    source->len_data = 0;
@@ -231,16 +573,20 @@ int GetNumStrings() /* for saving */
 
 void SetString(string_node *snod,char *buf,int len)
 {
+   char *old_data;
+
    if (snod == &temp_str)
    {
       SetTempString(buf,len);
       return;
    }
-   FreeMemory(MALLOC_ID_STRING,snod->data,snod->len_data+1);
-   snod->data = (char *)AllocateMemory(MALLOC_ID_STRING,len+1);
-   memcpy(snod->data,buf,len);
+
+   /* intern before releasing, since buf may be the old body itself */
+   old_data = snod->data;
+   snod->data = InternString(buf,len);
    snod->len_data = len;
-   snod->data[snod->len_data] = '\0';
+   if (old_data != NULL)
+      ReleaseString(old_data);
 }
 
 void SetTempString(char *buf,int len)
@@ -66,17 +66,19 @@ void SynchedProcessSessionTimer(session_node *s)
 
 void SynchedProcessSessionBuffer(session_node *s)
 {
-   client_msg msg;
+   client_msg msg,*header;
    
    SetSessionTimer(s,60*ConfigInt(INACTIVE_SYNCHED));
 
    /* need to copy only as many bytes as we can hold */
-   while (s->receive_list != NULL)
+   while (GetSessionReadBytes(s) > 0)
    {
-      if (PeekSessionBytes(s,HEADERBYTES,&msg) == False)
+      /* look at the header where it sits in the receive buffer */
+      header = (client_msg *)PeekSessionData(s,HEADERBYTES);
+      if (header == NULL)
 	 return;
 
-      if (msg.len != msg.len_verify || msg.seqno != 0)
+      if (header->len != header->len_verify || header->seqno != 0)
       {
 	 AddByteToPacket(AP_RESYNC);
 	 SendPacket(s->session_id);
@@ -84,9 +86,9 @@ void SynchedProcessSessionBuffer(session_node *s)
 	 return;
       }
 
-      if (msg.len > LEN_MAX_CLIENT_MSG)
+      if (header->len > LEN_MAX_CLIENT_MSG)
       {
-	 eprintf("SynchedProcessSessionBuffer got message too long %i\n",msg.len);
+	 eprintf("SynchedProcessSessionBuffer got message too long %i\n",header->len);
 	 AddByteToPacket(AP_RESYNC);
 	 SendPacket(s->session_id);
 	 SetSessionState(s,STATE_RESYNC);
@@ -95,7 +97,7 @@ void SynchedProcessSessionBuffer(session_node *s)
       }
       
       /* now read the header for real, plus the actual data */
-      if (ReadSessionBytes(s,msg.len+HEADERBYTES,&msg) == False)
+      if (ReadSessionBytes(s,header->len+HEADERBYTES,&msg) == False)
 	 return;
 
 #if 0
@@ -444,6 +446,7 @@ void SynchedAcceptLogin(session_node *s,char *name,char *password)
 
    s->account = a;
    s->account->last_login_time = now;
+   MarkAccountDirty(s->account);
 
    InterfaceUpdateSession(s);
 
@@ -22,15 +22,26 @@
  Garbage collecting, saving, sending a "time has passed" message to
  Blakod, and updating our window interface are currently what we do.
 
+ In a time warp (timer.c) the game hours go by a few a second, so the
+ game isn't saved, and the garbage collections that saving does are
+ held to one a real minute, WARP_GARBAGE_MS.  A long soak still
+ collects, just not as often in game time as a live server.
+
  */
 
 #include "blakserv.h"
 
+#define WARP_GARBAGE_MS 60000 /* real time between collections in a time warp */
+
 systimer_node *systimers;
 
+static UINT64 warp_garbage_ms; /* GetMilliCount() of the last one, 0 for none */
+
 /* local function prototypes */
 void CreateInitialSysTimers();
 void ProcessOneSysTimer(systimer_node *st);
+Bool WarpGarbageDue(void);
+void SysTimerGarbage(void);
 
 void InitSysTimer()
 {
@@ -71,7 +82,7 @@ void CreateSysTimer(int type,int time,int period)
    st->enabled = True;
    st->next = NULL;
 
-   now = GetTime();
+   now = GetGameTime();
    next_time = now - (now % period) + time;
    if (now > next_time)
       next_time += period;
@@ -95,6 +106,8 @@ void CreateInitialSysTimers()
    CreateSysTimer(SYST_SAVE,60*ConfigInt(AUTO_SAVE_TIME),
 		  60*ConfigInt(AUTO_SAVE_PERIOD));
    CreateSysTimer(SYST_REOPEN_CHANNELS,ConfigInt(AUTO_REOPEN_CHANNELS_TIME), ConfigInt(AUTO_REOPEN_CHANNELS_PERIOD));
+   CreateSysTimer(SYST_RECLAIM,60*ConfigInt(AUTO_RECLAIM_TIME),
+		  60*ConfigInt(AUTO_RECLAIM_PERIOD));
 	/*
 	  no garbage collection now
    CreateSysTimer(SYST_GARBAGE,60*ConfigInt(AUTO_GARBAGE_TIME),
@@ -102,6 +115,32 @@ void CreateInitialSysTimers()
 	*/
 }
 
+/* WarpGarbageDue
+*
+* Whether it's been WARP_GARBAGE_MS of real time since the last garbage
+* collection a system timer did in a time warp.
+*/
+Bool WarpGarbageDue(void)
+{
+   UINT64 now = GetMilliCount();
+
+   if (warp_garbage_ms != 0 && now - warp_garbage_ms < WARP_GARBAGE_MS)
+      return False;
+   warp_garbage_ms = now;
+   return True;
+}
+
+void SysTimerGarbage(void)
+{
+   PauseTimers();
+   lprintf("ProcessOneSysTimer garbage collecting\n");
+   SendBlakodBeginSystemEvent(SYSEVENT_GARBAGE);
+   GarbageCollect();
+   AllocateParseClientListNodes();
+   SendBlakodEndSystemEvent(SYSEVENT_GARBAGE);
+   UnpauseTimers();
+}
+
 void ProcessSysTimer(INT64 time)
 {
    systimer_node *st;
@@ -125,20 +164,24 @@ void ProcessOneSysTimer(systimer_node *st)
    switch (st->systimer_type)
    {
    case SYST_BLAKOD_HOUR :
+      RecordSystem(RECORD_NEW_HOUR,0);
       SendTopLevelBlakodMessage(GetSystemObjectID(),NEW_HOUR_MSG,0,NULL);
       break;
 
    case SYST_GARBAGE :
-      PauseTimers();
-      lprintf("ProcessOneSysTimer garbage collecting\n");
-      SendBlakodBeginSystemEvent(SYSEVENT_GARBAGE);
-      GarbageCollect();
-      AllocateParseClientListNodes();
-      SendBlakodEndSystemEvent(SYSEVENT_GARBAGE);
-      UnpauseTimers();
+      if (IsTimeWarping() && !WarpGarbageDue())
+	 break;
+      SysTimerGarbage();
       break;
 
    case SYST_SAVE :
+      if (IsTimeWarping())
+      {
+	 /* it would save every game hour, a few times a second */
+	 if (WarpGarbageDue())
+	    SysTimerGarbage();
+	 break;
+      }
       PauseTimers();
       lprintf("ProcessOneSysTimer saving\n");
       SendBlakodBeginSystemEvent(SYSEVENT_SAVE);
@@ -163,12 +206,20 @@ void ProcessOneSysTimer(systimer_node *st)
       break;
 
    case SYST_RESET_POOL :
-      ResetBufferPool();
+      TrimBufferPool();
+      break;
+
+   case SYST_RECLAIM :
+      PauseTimers();
+      SendBlakodBeginSystemEvent(SYSEVENT_GARBAGE);
+      lprintf("ProcessOneSysTimer reclaimed %i unreferenced objects\n",ReclaimObjects());
+      lprintf("ProcessOneSysTimer reclaimed %i unreferenced list nodes\n",ReclaimListNodes());
+      SendBlakodEndSystemEvent(SYSEVENT_GARBAGE);
+      UnpauseTimers();
       break;
 
    case SYST_REOPEN_CHANNELS :
-      CloseDefaultChannels();
-      OpenDefaultChannels();
+      ReopenDefaultChannels();
       break;
 
    }
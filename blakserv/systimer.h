@@ -17,6 +17,7 @@ enum
 {
    SYST_GARBAGE, SYST_SAVE, SYST_BLAKOD_HOUR, SYST_INTERFACE_UPDATE,
    SYST_RESET_TRANSMITTED, SYST_RESET_POOL, SYST_REOPEN_CHANNELS,
+   SYST_RECLAIM,
 };
 
 typedef struct systimer_struct
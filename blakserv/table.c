@@ -21,8 +21,6 @@
 table_node *tables;
 int next_table_id;
 
-static char buf0[LEN_MAX_CLIENT_MSG+1];
-
 /* local function prototypes */
 
 void FreeTable(table_node *tn);
@@ -180,6 +178,21 @@ table_node * GetTableByID(int table_id)
    return NULL;
 }
 
+void ForEachTableValue(void (*callback_func)(val_type *val))
+{
+   table_node *tn;
+   hash_node *hn;
+   int i;
+
+   for (tn = tables; tn != NULL; tn = tn->next)
+      for (i=0;i<tn->size;i++)
+	 for (hn = tn->table[i]; hn != NULL; hn = hn->next)
+	 {
+	    callback_func(&hn->key_val);
+	    callback_func(&hn->data_val);
+	 }
+}
+
 hash_node * AllocateTableEntry(val_type key_val,val_type data_val)
 {
    hash_node *hn;
@@ -312,7 +325,7 @@ Bool EqualTableEntry(val_type s1_val,val_type s2_val)
 	 return False;
       }
       s1 = r->resource_val;
-      len1 = strlen(r->resource_val);
+      len1 = r->len_val;
       break;
 
    case TAG_STRING :
@@ -348,7 +361,7 @@ Bool EqualTableEntry(val_type s1_val,val_type s2_val)
 	 return False;
       }
       s2 = r->resource_val;
-      len2 = strlen(r->resource_val);
+      len2 = r->len_val;
       break;
 
    case TAG_STRING :
@@ -391,7 +404,7 @@ unsigned int GetTableHash(val_type val)
 {
    resource_node *r;
    string_node *snod;
-   char* s = NULL;
+   const char* s = NULL;
    int len = 0;
 
    switch (val.v.tag)
@@ -405,7 +418,7 @@ unsigned int GetTableHash(val_type val)
 	 return 0;
       }
       s = r->resource_val;
-      len = strlen(r->resource_val);
+      len = r->len_val;
       break;
 
    case TAG_STRING :
@@ -438,9 +451,11 @@ unsigned int GetTableHash(val_type val)
    if (!s || len <= 0)
       return 0;
 
-   FuzzyCollapseString(buf0,s,len);
+   /* GetBufferHash ignores case itself, so only the whitespace that
+      FuzzyBufferEqual ignores needs skipping */
+   FuzzyTrimString(&s,&len);
 
-   return GetBufferHash(buf0,strlen(buf0));
+   return GetBufferHash(s,len);
 }
 
 unsigned int GetBufferHash(const char *buf,unsigned int len_buf)
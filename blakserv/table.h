@@ -36,6 +36,7 @@ void DeleteTable(int table_id);
 void InsertTable(int table_id,val_type key_val,val_type data_val);
 blak_int GetTableEntry(int table_id,val_type key_val);
 void DeleteTableEntry(int table_id,val_type key_val);
+void ForEachTableValue(void (*callback_func)(val_type *val));
 
 unsigned int GetBufferHash(const char *buf,unsigned int len_buf);
 
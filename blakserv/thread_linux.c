@@ -0,0 +1,50 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+/*
+ * thread_linux.c
+ */
+
+#include "blakserv.h"
+
+struct ThreadStart {
+   ThreadProc thread_proc;
+   void *arg;
+};
+
+static void * ThreadStartProc(void *arg) {
+   ThreadStart start = *(ThreadStart *) arg;
+   delete (ThreadStart *) arg;
+
+   start.thread_proc(start.arg);
+   return NULL;
+}
+
+bool ThreadCreate(Thread *thread, ThreadProc thread_proc, void *arg) {
+   ThreadStart *start = new ThreadStart();
+   start->thread_proc = thread_proc;
+   start->arg = arg;
+
+   if (pthread_create(thread, NULL, ThreadStartProc, start) != 0) {
+      delete start;
+      return false;
+   }
+   return true;
+}
+
+bool ThreadJoin(Thread thread) {
+   return pthread_join(thread, NULL) == 0;
+}
+
+int ThreadNumProcessors() {
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count < 1 ? 1 : (int) count;
+}
+
+void Sleep(int milliseconds) {
+   usleep(milliseconds * 1000);
+}
@@ -0,0 +1,35 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+
+#ifndef _THREAD_LINUX_H
+#define _THREAD_LINUX_H
+
+typedef pthread_t Thread;
+typedef void (*ThreadProc)(void *arg);
+
+bool ThreadCreate(Thread *thread, ThreadProc thread_proc, void *arg);
+bool ThreadJoin(Thread thread);
+int ThreadNumProcessors();
+
+// Linux versions of the Windows calls we use alongside threads.
+
+typedef int LONG;
+
+#define InterlockedIncrement(p) __sync_add_and_fetch((p),1)
+#define InterlockedDecrement(p) __sync_sub_and_fetch((p),1)
+#define InterlockedExchangeAdd(p,v) __sync_fetch_and_add((p),(v))
+#define InterlockedExchangeAdd64(p,v) __sync_fetch_and_add((p),(v))
+#define InterlockedCompareExchange(p,x,c) __sync_val_compare_and_swap((p),(c),(x))
+#define InterlockedCompareExchangePointer(p,x,c) __sync_val_compare_and_swap((p),(c),(void *)(x))
+#define InterlockedExchangePointer(p,x) __atomic_exchange_n((p),(void *)(x),__ATOMIC_SEQ_CST)
+
+#define THREAD_LOCAL __thread
+
+void Sleep(int milliseconds);
+
+#endif
@@ -0,0 +1,47 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+
+#include "blakserv.h"
+
+struct ThreadStart {
+   ThreadProc thread_proc;
+   void *arg;
+};
+
+static unsigned __stdcall ThreadStartProc(void *arg) {
+   ThreadStart start = *(ThreadStart *) arg;
+   delete (ThreadStart *) arg;
+
+   start.thread_proc(start.arg);
+   return 0;
+}
+
+bool ThreadCreate(Thread *thread, ThreadProc thread_proc, void *arg) {
+   ThreadStart *start = new ThreadStart();
+   start->thread_proc = thread_proc;
+   start->arg = arg;
+
+   *thread = (HANDLE) _beginthreadex(NULL, 0, ThreadStartProc, start, 0, NULL);
+   if (*thread == NULL) {
+      delete start;
+      return false;
+   }
+   return true;
+}
+
+bool ThreadJoin(Thread thread) {
+   bool ok = WaitForSingleObject(thread, INFINITE) == WAIT_OBJECT_0;
+   CloseHandle(thread);
+   return ok;
+}
+
+int ThreadNumProcessors() {
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors < 1 ? 1 : (int) info.dwNumberOfProcessors;
+}
@@ -0,0 +1,21 @@
+// Meridian 59, Copyright 1994-2012 Andrew Kirmse and Chris Kirmse.
+// All rights reserved.
+//
+// This software is distributed under a license that is described in
+// the LICENSE file that accompanies it.
+//
+// Meridian is a registered trademark.
+
+#ifndef _THREAD_WINDOWS_H
+#define _THREAD_WINDOWS_H
+
+typedef HANDLE Thread;
+typedef void (*ThreadProc)(void *arg);
+
+bool ThreadCreate(Thread *thread, ThreadProc thread_proc, void *arg);
+bool ThreadJoin(Thread thread);
+int ThreadNumProcessors();
+
+#define THREAD_LOCAL __declspec(thread)
+
+#endif
@@ -14,11 +14,28 @@
   same.  The only use of milliseconds is for relative times.  The seconds
   time (GetTime()) is good for recording when things happen, and there 
   are functions convert it to a string for you.
+
+  The game runs on its own clock, which is the real one until someone
+  stops it.  Blakod timers, system timers and the Blakod's idea of the
+  time all read it, through GetGameMilliCount() and GetGameTime().
+  Session timeouts and inactive times stay on the real clock, since a
+  player who goes quiet during a time warp hasn't really been idle.
+  Once stopped, the game clock only moves when SetGameClock() says to;
+  that's how kodbench and kodreplay run the same way every time, and
+  how the main loop skips ahead in a time warp (timer.c).
+  Started again, it runs at real speed from wherever it got to.
   
 */
 
 #include "blakserv.h"
 
+static Bool game_clock_stopped;
+static UINT64 game_clock; /* while stopped */
+static UINT64 game_clock_stop_ms; /* game_clock when it stopped */
+static time_t game_clock_stop_time; /* and GetGameTime() then */
+static INT64 game_clock_offset; /* from GetMilliCount(), while running */
+static time_t game_time_offset; /* from time(), while running */
+
 void InitTime()
 {
 }
@@ -28,6 +45,64 @@ time_t GetTime()
 	return time(NULL);
 }
 
+UINT64 GetGameMilliCount(void)
+{
+	if (game_clock_stopped)
+		return game_clock;
+	return GetMilliCount() + game_clock_offset;
+}
+
+time_t GetGameTime(void)
+{
+	if (game_clock_stopped)
+		return game_clock_stop_time + (time_t)((game_clock - game_clock_stop_ms)/1000);
+	return time(NULL) + game_time_offset;
+}
+
+/* StopGameClock
+*
+* Stops the game clock at now milliseconds, which is now_time in seconds.
+*/
+void StopGameClock(UINT64 now,time_t now_time)
+{
+	game_clock_stopped = True;
+	game_clock = now;
+	game_clock_stop_ms = now;
+	game_clock_stop_time = now_time;
+}
+
+/* SetGameClock
+*
+* Moves a stopped game clock.  It should only go forward.
+*/
+void SetGameClock(UINT64 now)
+{
+	if (!game_clock_stopped)
+	{
+		eprintf("SetGameClock called when the game clock is running\n");
+		return;
+	}
+	game_clock = now;
+}
+
+void StartGameClock(void)
+{
+	time_t now_time;
+
+	if (!game_clock_stopped)
+		return;
+
+	now_time = GetGameTime();
+	game_clock_offset = (INT64)(game_clock - GetMilliCount());
+	game_time_offset = now_time - time(NULL);
+	game_clock_stopped = False;
+}
+
+Bool IsGameClockStopped(void)
+{
+	return game_clock_stopped;
+}
+
 const char * TimeStr(time_t time)
 {
 	struct tm *tm_time;
@@ -150,3 +225,34 @@ UINT64 GetMilliCount()
 #endif
 }
 
+UINT64 GetMicroCount(void)
+{
+#ifdef BLAK_PLATFORM_WINDOWS
+   
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER now;
+
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+
+	if (frequency.QuadPart == 0)
+	{
+		eprintf("GetMicroCount can't get frequency\n");
+		return 0;
+	}
+
+	QueryPerformanceCounter(&now);
+	/* split up so it doesn't overflow after a few days up */
+	return (now.QuadPart/frequency.QuadPart)*1000000 +
+		((now.QuadPart%frequency.QuadPart)*1000000)/frequency.QuadPart;
+
+#else
+
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   
+   return (UINT64) tv.tv_sec * 1000000 + tv.tv_usec;
+   
+#endif
+}
+
@@ -12,6 +12,18 @@
  This module maintains a linked list of timers for the Blakod.  It
  also contains the main loop of the program.
 
+ Timer times are in milliseconds on the game clock,
+ GetGameMilliCount() (time.c).
+
+ With [Debug] TimeWarp on, the main loop stops the game clock and
+ moves it straight to each timer as it comes due, a second at most at
+ a time, so a server with nobody to wait for can get through hours of
+ its Blakod's timers in minutes.  Turning it off again starts the
+ clock from where the warp got to.  Session timers stay on the real
+ clock, so nobody's connection times out, and the system timer doesn't
+ save the game while warping, only collects garbage now and then
+ (systimer.c).
+
  */
 
 #include "blakserv.h"
@@ -25,16 +37,49 @@ timer_node *deleted_timers;
 
 INT64 pause_time;
 
+static int num_timers_fired;
+
+static Bool time_warping;
+static UINT64 warp_start_real; /* GetMilliCount() when the warp started */
+static UINT64 warp_start_game; /* and GetGameMilliCount() */
+static int warp_start_fired;
+static INT64 warp_start_instructions;
+
 /* local function prototypes */
 void AddTimerNode(timer_node *t);
 void StoreDeletedTimer(timer_node *t);
 void ResetLastMessageTimes(session_node *s);
+static INT64 GetInstructionCount(void);
+static void StartTimeWarp(void);
+static void StopTimeWarp(void);
 
 int  GetNumActiveTimers(void)
 {
    return numActiveTimers;
 }
 
+/* GetNextTimerTime
+*
+* When the first timer is due; returns False if there are no timers.
+*/
+Bool GetNextTimerTime(UINT64 *next_time)
+{
+   if (timers == NULL)
+      return False;
+   *next_time = timers->time;
+   return True;
+}
+
+/* GetNextTimer
+*
+* The first timer to come due, the one TimerActivate() would fire, or
+* NULL.
+*/
+timer_node * GetNextTimer(void)
+{
+   return timers;
+}
+
 void InitTimer(void)
 {
    timers = NULL;
@@ -82,20 +127,18 @@ void PauseTimers(void)
       eprintf("PauseTimers called when they were already paused at %s\n",TimeStr(pause_time));
       return;
    }
-   pause_time = GetTime();
+   pause_time = GetGameTime();
+   RecordSystem(RECORD_PAUSE,0);
 }
 
-void UnpauseTimers(void)
+/* ShiftTimers
+*
+* Moves every timer add_time milliseconds later, as UnpauseTimers() does
+* for the time they were paused.
+*/
+void ShiftTimers(INT64 add_time)
 {
-   INT64 add_time;
    timer_node *t;
-   
-   if (pause_time == 0)
-   {
-      eprintf("UnpauseTimers called when they were not paused\n");
-      return;
-   }
-   add_time = 1000*(GetTime() - pause_time);
 
    t = timers;
    while (t != NULL)
@@ -103,6 +146,20 @@ void UnpauseTimers(void)
       t->time += add_time;
       t = t->next;
    }
+}
+
+void UnpauseTimers(void)
+{
+   INT64 add_time;
+   
+   if (pause_time == 0)
+   {
+      eprintf("UnpauseTimers called when they were not paused\n");
+      return;
+   }
+   add_time = 1000*(GetGameTime() - pause_time);
+   ShiftTimers(add_time);
+   RecordSystem(RECORD_UNPAUSE,(int)add_time);
 
    pause_time = 0;
    
@@ -167,8 +224,10 @@ int CreateTimer(int object_id,int message_id,int milliseconds)
       
    t->timer_id = next_timer_num++;
    t->object_id = object_id;
+   t->object_generation = GetObjectGeneration(object_id);
    t->message_id = message_id;
-   t->time = GetMilliCount() + milliseconds;
+   t->time = GetGameMilliCount() + milliseconds;
+   t->alloc_site = GetAllocSite(CENSUS_TIMER);
 
    AddTimerNode(t);
    numActiveTimers++;
@@ -199,8 +258,10 @@ Bool LoadTimer(int timer_id,int object_id,char *message_name,INT64 milliseconds)
    t = (timer_node *)AllocateMemory(MALLOC_ID_TIMER,sizeof(timer_node));
    t->timer_id = timer_id;
    t->object_id = object_id;
+   t->object_generation = o->generation;
    t->message_id = m->message_id;
-   t->time = GetMilliCount() + milliseconds;
+   t->time = GetGameMilliCount() + milliseconds;
+   t->alloc_site = 0;
 
    AddTimerNode(t);
    numActiveTimers++;
@@ -272,11 +333,41 @@ Bool DeleteTimer(int timer_id)
    return False;
 }
 
+/* DeleteTimersOfDeletedObjects
+*
+* For garbage collection, which deletes objects without their Blakod
+* getting a chance to delete their timers.  One pass over the timers,
+* rather than a search for each deleted object.
+*/
+void DeleteTimersOfDeletedObjects(void)
+{
+   timer_node *t,*prev,*next;
+
+   prev = NULL;
+   t = timers;
+   while (t != NULL)
+   {
+      next = t->next;
+      if (GetObjectByIDQuietly(t->object_id) == NULL)
+      {
+	 if (prev == NULL)
+	    timers = next;
+	 else
+	    prev->next = next;
+	 StoreDeletedTimer(t);
+      }
+      else
+	 prev = t;
+      t = next;
+   }
+}
+
 /* activate the 1st timer, if it is time */
 void TimerActivate()
 {
    timer_node *temp;
    int object_id,message_id;
+   unsigned int object_generation;
    UINT64 now;
    val_type timer_val;
    parm_node p[1];
@@ -284,7 +375,7 @@ void TimerActivate()
    if (timers == NULL)
       return;
    
-   now = GetMilliCount();
+   now = GetGameMilliCount();
    if (now > timers->time)
    {
 	/*
@@ -294,6 +385,7 @@ void TimerActivate()
 	*/
 
       object_id = timers->object_id;
+      object_generation = timers->object_generation;
       message_id = timers->message_id;
       
       timer_val.v.tag = TAG_TIMER;
@@ -308,6 +400,17 @@ void TimerActivate()
       
       /* put deleted timer on deleted_timer list */
       StoreDeletedTimer(temp);
+
+      /* the object slot may have been freed and given to a new object */
+      if (GetObjectGeneration(object_id) != object_generation)
+      {
+	 eprintf("TimerActivate timer %i MESSAGE %s outlived its OBJECT %i\n",
+		 (int) timer_val.v.data,GetNameByID(message_id),object_id);
+	 return;
+      }
+
+      RecordTimer(timer_val.v.data,object_id,message_id);
+      num_timers_fired++;
       
       SendTopLevelBlakodMessage(object_id,message_id,1,p);
    }
@@ -316,11 +419,13 @@ void TimerActivate()
 INT64 GetMainLoopWaitTime()
 {
 	INT64 ms;
-	if (timers == NULL)
+	if (time_warping)
+		ms = 0;
+	else if (timers == NULL)
 		ms = 500;
 	else
 	{
-		ms = timers->time - GetMilliCount();
+		ms = timers->time - GetGameMilliCount();
 		if (ms <= 0)
 			ms = 0;
 		
@@ -329,6 +434,95 @@ INT64 GetMainLoopWaitTime()
 	}	 
 	return ms;
 }
+
+static INT64 GetInstructionCount(void)
+{
+   kod_statistics *kstat;
+
+   kstat = GetKodStats();
+   return (INT64)kstat->billions_interpreted*1000000000 + kstat->num_interpreted;
+}
+
+static void StartTimeWarp(void)
+{
+   StopGameClock(GetGameMilliCount(),GetGameTime());
+
+   time_warping = True;
+   warp_start_real = GetMilliCount();
+   warp_start_game = GetGameMilliCount();
+   warp_start_fired = num_timers_fired;
+   warp_start_instructions = GetInstructionCount();
+
+   lprintf("StartTimeWarp skipping the game clock ahead to each timer\n");
+}
+
+static void StopTimeWarp(void)
+{
+   timer_statistics stats;
+
+   GetTimerStats(&stats);
+   lprintf("StopTimeWarp covered %lli.%03lli game seconds in %lli.%03lli real, %i timers, %lli instructions\n",
+	   (long long)(stats.warp_game_ms/1000),(long long)(stats.warp_game_ms%1000),
+	   (long long)(stats.warp_real_ms/1000),(long long)(stats.warp_real_ms%1000),
+	   stats.warp_timers_fired,(long long)stats.warp_instructions);
+
+   time_warping = False;
+   StartGameClock();
+}
+
+/* UpdateTimeWarp
+*
+* Called by the main loop after each TimerActivate().  Starts or stops
+* a time warp to match [Debug] TimeWarp, and while in one moves the game
+* clock just past the next timer, or on a second if none are due
+* before then, so periodic work like the system timers still happens.
+*/
+void UpdateTimeWarp(void)
+{
+   UINT64 now,next;
+
+   if (ConfigBool(DEBUG_TIME_WARP) != time_warping)
+   {
+      if (time_warping)
+	 StopTimeWarp();
+      else
+	 StartTimeWarp();
+   }
+
+   if (!time_warping)
+      return;
+
+   now = GetGameMilliCount();
+   if (timers != NULL && timers->time < now)
+      return; /* TimerActivate() will get it next time around */
+
+   next = now + 1000 - (now - warp_start_game) % 1000;
+   if (timers != NULL && timers->time < next)
+      next = timers->time + 1;
+   SetGameClock(next);
+}
+
+Bool IsTimeWarping(void)
+{
+   return time_warping;
+}
+
+void GetTimerStats(timer_statistics *stats)
+{
+   stats->num_fired = num_timers_fired;
+   stats->warping = time_warping;
+   stats->warp_real_ms = 0;
+   stats->warp_game_ms = 0;
+   stats->warp_timers_fired = 0;
+   stats->warp_instructions = 0;
+   if (!time_warping)
+      return;
+
+   stats->warp_real_ms = (INT64)(GetMilliCount() - warp_start_real);
+   stats->warp_game_ms = (INT64)(GetGameMilliCount() - warp_start_game);
+   stats->warp_timers_fired = num_timers_fired - warp_start_fired;
+   stats->warp_instructions = GetInstructionCount() - warp_start_instructions;
+}
 	
 timer_node * GetTimerByID(int timer_id)
 {
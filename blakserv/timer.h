@@ -17,22 +17,42 @@ typedef struct timer_struct
 {
    int timer_id;
    int object_id;
+   unsigned int object_generation; /* to notice if object_id gets reused */
    int message_id;
    UINT64 time;
    int garbage_ref;
+   int alloc_site; /* see census.c */
    struct timer_struct *next;
 } timer_node;
 
+typedef struct
+{
+   int num_fired;
+   Bool warping;
+   /* since the time warp started, if in one */
+   INT64 warp_real_ms;
+   INT64 warp_game_ms;
+   int warp_timers_fired;
+   INT64 warp_instructions;
+} timer_statistics;
+
 void InitTimer(void);
 void ResetTimer(void);
 void ClearTimer(void);
 void PauseTimers(void);
 void UnpauseTimers(void);
+void ShiftTimers(INT64 add_time);
 int CreateTimer(int object_id,int message_id,int milliseconds);
 Bool LoadTimer(int timer_id,int object_id,char *message_name,INT64 milliseconds);
 Bool DeleteTimer(int timer_id);
+void DeleteTimersOfDeletedObjects(void);
 void TimerActivate();
+Bool GetNextTimerTime(UINT64 *next_time);
+timer_node * GetNextTimer(void);
 INT64 GetMainLoopWaitTime();
+void UpdateTimeWarp(void);
+Bool IsTimeWarping(void);
+void GetTimerStats(timer_statistics *stats);
 timer_node * GetTimerByID(int timer_id);
 void ForEachTimer(void (*callback_func)(timer_node *t));
 void SetNumTimers(int new_next_timer_num);
@@ -20,6 +20,7 @@
 typedef bool (*RscCallbackProc)(char *filename, int resource_num, char *string);
 
 bool RscFileLoad(char *fname, RscCallbackProc callback);
+bool RscMemoryLoad(char *fname, char *mem, int length, RscCallbackProc callback);
 
 
 #endif /* #ifndef _RSCLOAD_H */
@@ -3,6 +3,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "rscload.h"
 
@@ -33,6 +34,56 @@ bool RscFileLoad(char *fname, RscCallbackProc callback)
    return retval; 
 }
 /***************************************************************************/
+/*
+ * RscMemoryLoad:  Same as RscFileLoad, for a rsc file that has already been
+ *   read into memory.  The strings passed to the callback point into mem.
+ */
+bool RscMemoryLoad(char *fname, char *mem, int length, RscCallbackProc callback)
+{
+   int i, num_resources, version, rsc_num;
+   char *ptr, *end, *str_end;
+
+   if (callback == NULL || length < 12)
+      return false;
+
+   ptr = mem;
+   end = mem + length;
+
+   // Check magic number and version
+   if (memcmp(ptr, rsc_magic, 4) != 0)
+      return false;
+   ptr += 4;
+
+   memcpy(&version, ptr, 4);
+   ptr += 4;
+   if (version != RSC_VERSION)
+      return false;
+
+   memcpy(&num_resources, ptr, 4);
+   ptr += 4;
+   if (num_resources < 0)
+      return false;
+
+   // Read each resource
+   for (i=0; i < num_resources; i++)
+   {
+      if (end - ptr < 4)
+         return false;
+      memcpy(&rsc_num, ptr, 4);
+      ptr += 4;
+
+      str_end = (char *) memchr(ptr, 0, end - ptr);
+      if (str_end == NULL || str_end - ptr >= MAX_RSC_LEN)
+         return false;
+
+      if (!(*callback)(fname, rsc_num, ptr))
+         return false;
+      ptr = str_end + 1;
+   }
+
+   return true;
+}
+/***************************************************************************/
 /*
  * RscFileRead:  Do real work of RscFileLoad.
  */